@@ -0,0 +1,132 @@
+/**
+ * @file    epoch.h
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Interface for grace-period based memory reclamation
+ *
+ * Two schemes are provided. Epoch-based reclamation (EBR) has each thread
+ * announce the global epoch when it enters a critical section, and frees
+ * retired memory two epochs later. Quiescent-state-based reclamation (QSBR)
+ * has threads report, outside of any operation, that they hold no references
+ * at all; retired memory is freed once every online thread has done so.
+ *
+ * Unlike hazard pointers, neither scheme costs anything per pointer
+ * dereferenced, but a single stalled thread can hold up all reclamation.
+ */
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+/**
+ * @defgroup EPOCH
+ * @{
+ */
+
+/* --- PUBLIC DEPENDENCIES -------------------------------------------------- */
+
+// Standard
+#include <stdint.h>
+#include <stdlib.h>
+
+/* --- PUBLIC DATA TYPES ---------------------------------------------------- */
+
+/**
+ * @brief   Function signature of a free function
+ *
+ * A free function takes a generic pointer, and
+ * frees the memory referenced
+ */
+typedef void (*free_f_t)(void *);
+
+/* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+
+/**
+ * @brief   Enters an EBR critical section
+ *
+ * Memory retired with epoch_retire after this call won't be freed
+ * until the matching epoch_exit. Critical sections may be nested
+ */
+void epoch_enter(void);
+
+/**
+ * @brief   Leaves an EBR critical section
+ */
+void epoch_exit(void);
+
+/**
+ * @brief   Schedules ptr to be freed once no EBR critical section can refer to it
+ *
+ * ptr must already be unreachable for any thread entering a critical section
+ *
+ * @param[in] ptr:      The pointer to retire
+ * @param[in] free_f:   The function which frees ptr. May NOT be NULL
+ *
+ * @return      An error code
+ * @retval      0:  Success
+ * @retval      >0: Memory allocation failed. ptr has not been retired
+ */
+uint32_t epoch_retire(void * ptr, free_f_t free_f);
+
+/**
+ * @brief   Tries to advance the epoch, and frees what the calling thread can
+ */
+void epoch_collect(void);
+
+/**
+ * @brief   Gets the number of pointers retired through EBR by the calling thread and not yet freed
+ *
+ * @return      The number of pointers waiting to be freed
+ */
+size_t epoch_retired(void);
+
+/**
+ * @brief   Reports that the calling thread holds no QSBR-protected references
+ *
+ * Also brings the thread online, if it wasn't already
+ */
+void epoch_qsbr_quiescent(void);
+
+/**
+ * @brief   Brings the calling thread online, if it isn't already
+ *
+ * Must be called before taking QSBR-protected references. Does nothing
+ * for a thread which is already online
+ */
+void epoch_qsbr_online(void);
+
+/**
+ * @brief   Takes the calling thread offline
+ *
+ * An offline thread holds no references and doesn't hold up reclamation,
+ * which makes this the right thing to call before blocking for a long time.
+ * Threads are taken offline automatically when they exit
+ */
+void epoch_qsbr_offline(void);
+
+/**
+ * @brief   Schedules ptr to be freed once every online thread has been quiescent
+ *
+ * @param[in] ptr:      The pointer to retire
+ * @param[in] free_f:   The function which frees ptr. May NOT be NULL
+ *
+ * @return      An error code
+ * @retval      0:  Success
+ * @retval      >0: Memory allocation failed. ptr has not been retired
+ */
+uint32_t epoch_qsbr_retire(void * ptr, free_f_t free_f);
+
+/**
+ * @brief   Frees what the calling thread can of its QSBR retired pointers
+ */
+void epoch_qsbr_collect(void);
+
+/**
+ * @brief   Gets the number of pointers retired through QSBR by the calling thread and not yet freed
+ *
+ * @return      The number of pointers waiting to be freed
+ */
+size_t epoch_qsbr_retired(void);
+
+/** @} defgroup EPOCH */
+
+#endif //#ifndef EPOCH_H_
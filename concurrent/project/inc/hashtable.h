@@ -22,6 +22,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+#ifndef HASHTABLE_STATS
+#define HASHTABLE_STATS     (1)     /**< Set to 0 to compile out the counters behind hashtable_get_stats */
+#endif
+
 /* --- PUBLIC DATA TYPES ---------------------------------------------------- */
 
 /**
@@ -29,6 +35,11 @@
  */
 typedef struct hashtable_t_ * hashtable_t;
 
+/**
+ * @brief   A position in a walk over a table
+ */
+typedef struct hashtable_iter_t_ * hashtable_iter_t;
+
 /**
  * @brief   Data used as keys are generic pointers
  */
@@ -39,11 +50,29 @@ typedef void * hashtable_key_t;
  */
 typedef void * hashtable_elem_t;
 
+/**
+ * @brief   A key and its element, for building a table in one go
+ */
+typedef struct hashtable_pair_t_ {
+    hashtable_key_t     key;        /**< The key */
+    hashtable_elem_t    elem;       /**< The element stored under it */
+} hashtable_pair_t;
+
 /**
  * @brief   Function signature for hashing key objects
  */
 typedef uint32_t (*hash_f_t)(hashtable_key_t);
 
+/**
+ * @brief   Function signature for hashing key objects to 64 bits
+ */
+typedef uint64_t (*hash64_f_t)(hashtable_key_t);
+
+/**
+ * @brief   Function signature for comparing keys. Returns true if they are the same key
+ */
+typedef bool (*eq_f_t)(hashtable_key_t, hashtable_key_t);
+
 /**
  * @brief   Function signature for printing elements
  */
@@ -54,12 +83,89 @@ typedef void (*print_f_t)(hashtable_elem_t);
  */
 typedef void (*free_f_t)(hashtable_elem_t);
 
+/**
+ * @brief   Function signature for making the element for a missing key
+ */
+typedef hashtable_elem_t (*compute_f_t)(hashtable_key_t);
+
+/**
+ * @brief   Function signature for visiting each element of a table
+ */
+typedef void (*for_each_f_t)(hashtable_key_t, hashtable_elem_t, void *);
+
+/**
+ * @brief   Ways of reclaiming the memory of removed nodes
+ */
+typedef enum {
+    HASHTABLE_RECLAIM_HAZARD = 0,   /**< Hazard pointers. Bounded memory, but every node traversed costs a fence */
+    HASHTABLE_RECLAIM_EPOCH,        /**< Epoch-based. One announcement per operation; a stalled thread holds up reclamation */
+    HASHTABLE_RECLAIM_QSBR,         /**< Quiescent-state-based. Free to read, but threads must call hashtable_quiescent */
+    HASHTABLE_RECLAIM_NONE,         /**< Removed nodes are kept until the table is freed */
+} hashtable_reclaim_t;
+
+/**
+ * @brief   Ways of laying out a table
+ */
+typedef enum {
+    HASHTABLE_ENGINE_LIST = 0,      /**< Split-ordered list. Resizes without moving anything, but each element is a node of its own */
+    HASHTABLE_ENGINE_PROBE,         /**< Open addressing with linear probing. Keys and elements sit inline in one array, which is migrated cooperatively to resize */
+    HASHTABLE_ENGINE_CUCKOO,        /**< Bucketized cuckoo hashing. Lookups read two buckets without locking; writers lock them. Fills up densely, but resizing stops the table */
+    HASHTABLE_ENGINE_MUTEX,         /**< Chained buckets behind one mutex. A baseline, which ignores the reclamation scheme */
+    HASHTABLE_ENGINE_RWLOCK,        /**< Chained buckets behind one reader-writer lock. A baseline, which ignores the reclamation scheme */
+    HASHTABLE_ENGINE_STRIPED,       /**< Chained buckets behind a fixed set of MCS locks, striped across them. A baseline, which ignores the reclamation scheme */
+} hashtable_engine_t;
+
+/**
+ * @brief   What a thread does when one of its CASes on the split-ordered list fails
+ */
+typedef enum {
+    HASHTABLE_BACKOFF_NONE = 0,     /**< Retry straight away */
+    HASHTABLE_BACKOFF_EXPONENTIAL,  /**< Pause before retrying, twice as long after each failure in a row */
+    HASHTABLE_BACKOFF_ADAPTIVE,     /**< Pause for as long as recent operations on the thread's stripe have needed, adjusted with each one */
+} hashtable_backoff_t;
+
+/**
+ * @brief   Options fixed at creation time
+ *
+ * Always initialize with hashtable_config_init before changing fields, so
+ * that options added later get their defaults
+ */
+typedef struct hashtable_config_t_ {
+    hashtable_reclaim_t reclaim;    /**< How removed nodes are reclaimed */
+    hash64_f_t          hash64_f;   /**< Used in place of hash_f if not NULL */
+    eq_f_t              eq_f;       /**< Tells colliding keys apart. If NULL, keys with the same hash (ignoring its top bit) are the same key */
+    size_t              capacity;   /**< Elements the table is sized for up front. It won't grow until it holds more, or shrink below this size */
+    hashtable_engine_t  engine;     /**< How the table is laid out */
+    bool                combine;    /**< Hand single insertions and removals to a flat combiner, which applies everyone's at once. Pays off when many threads write a few hot keys */
+    hashtable_backoff_t backoff;    /**< What to do after a failed CAS. Only the split-ordered list uses it */
+} hashtable_config_t;
+
+/**
+ * @brief   What a table has been doing, as reported by hashtable_get_stats
+ *
+ * Operations are counted for every engine. The rest only describe the
+ * split-ordered list, and are 0 for other engines
+ */
+typedef struct hashtable_stats_t_ {
+    uint64_t            inserts;        /**< Keys passed to hashtable_insert, hashtable_insert_many, hashtable_put and hashtable_compute_if_absent */
+    uint64_t            gets;           /**< Keys passed to hashtable_get (and so hashtable_contains) and hashtable_get_many */
+    uint64_t            removes;        /**< Keys passed to hashtable_remove and hashtable_remove_many */
+    uint64_t            cas_failures;   /**< As for hashtable_cas_failures */
+    uint64_t            resizes;        /**< Times the table has doubled or halved */
+    uint64_t            resize_ns;      /**< Time spent resizing. Splitting buckets happens lazily, and isn't included */
+    uint64_t            sentinels;      /**< Bucket sentinels in the list */
+    uint64_t            retired_bytes;  /**< Memory held by removed nodes not yet freed. See hashtable_get_stats */
+    uint64_t            searches;       /**< Searches of the list, including the ones made to place sentinels */
+    double              search_avg;     /**< Nodes a search stepped past, on average */
+    uint64_t            search_max;     /**< Most nodes any one search stepped past */
+} hashtable_stats_t;
+
 /* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
 
 /**
  * @brief   Allocates and returns a new hashtable object
  *
- * Takes no size parameter; the returned hashtable is of
+ * Takes no size parameter (see hashtable_create_with_capacity); the returned hashtable is of
  * (algorithmically) unlimited size, but may be resized at
  * runtime for performance purposes. 
  *
@@ -80,9 +186,86 @@ hashtable_t hashtable_create(hash_f_t hash_f,
                              print_f_t print_f,
                              free_f_t free_f);
 
+/**
+ * @brief   Fills config with the options hashtable_create uses
+ *
+ * @param[out] config:  The configuration to initialize
+ */
+void hashtable_config_init(hashtable_config_t * config);
+
+/**
+ * @brief   Allocates and returns a new hashtable object, with non-default options
+ *
+ * With an eq_f, the table stores each key alongside its element, and keys are
+ * only considered the same if eq_f says so. Stored keys aren't copied, so
+ * whatever they point to must stay valid for as long as they're in the table
+ * (pointing into the element is the usual way to arrange that)
+ *
+ * @see hashtable_create
+ *
+ * @param[in] hash_f:   As for hashtable_create. May be NULL if config has a hash64_f
+ * @param[in] config:   The options to use, or NULL for the defaults
+ *
+ * @return              A new hashtable object, or NULL if memory allocation fails
+ *                      or config is invalid
+ */
+hashtable_t hashtable_create_with_config(hash_f_t hash_f,
+                                         print_f_t print_f,
+                                         free_f_t free_f,
+                                         const hashtable_config_t * config);
+
+/**
+ * @brief   Allocates and returns a new hashtable object, sized for capacity elements
+ *
+ * The directory for enough buckets to hold capacity elements is built up front, so
+ * filling the table to that size never resizes it. The table can still grow
+ * past capacity, but won't shrink below it
+ *
+ * @see hashtable_create
+ *
+ * @param[in] capacity: The number of elements expected
+ *
+ * @return              A new hashtable object, or NULL if memory allocation fails
+ */
+hashtable_t hashtable_create_with_capacity(hash_f_t hash_f,
+                                           print_f_t print_f,
+                                           free_f_t free_f,
+                                           size_t capacity);
+
+/**
+ * @brief   Allocates and returns a new hashtable object, holding every pair given
+ *
+ * Much faster than inserting the pairs one at a time. They're sorted into list
+ * order, and then every node, along with every bucket's sentinel, is carved out
+ * of one block of memory and linked in a single pass, with no atomic
+ * read-modify-writes. Walking the table walks that block in order.
+ *
+ * The table is sized for at least n elements. As when inserting them in
+ * order, only the first pair with any given key goes in; the elements of the
+ * rest are left to the caller
+ *
+ * @see hashtable_create_with_config
+ *
+ * @param[in] pairs:    The keys and elements to fill the table with
+ * @param[in] n:        The number of pairs
+ * @param[in] config:   The options to use, or NULL for the defaults
+ *
+ * @return              A new hashtable object, or NULL if memory allocation fails
+ *                      or config is invalid. The elements aren't freed on failure
+ */
+hashtable_t hashtable_create_from(const hashtable_pair_t * pairs,
+                                  size_t n,
+                                  hash_f_t hash_f,
+                                  print_f_t print_f,
+                                  free_f_t free_f,
+                                  const hashtable_config_t * config);
+
 /**
  * @brief   Deletes the hashtable, de-allocating all memory used
  *
+ * Its nodes go back to the node pool shared by every table, which gives a slab
+ * back to the system once all of its nodes are free
+ *
  * @warming     This function is not thread safe. It must only be called once
  *              per object instance
  *
@@ -114,6 +297,78 @@ bool hashtable_insert(hashtable_t h,
                       hashtable_key_t key,
                       hashtable_elem_t val);
 
+/**
+ * @brief   Inserts a batch of elements
+ *
+ * Equivalent to calling hashtable_insert on each pair, but the keys are sorted
+ * into the order the table keeps them in first, so the whole batch takes about
+ * one pass over the part of the table it touches. Each insertion is atomic on
+ * its own; the batch as a whole isn't
+ *
+ * @param[in,out] h:    The hashtable to modify
+ * @param[in] keys:     The keys to insert under
+ * @param[in] elems:    The data to store, one per key
+ * @param[in] n:        The number of keys
+ *
+ * @return              The number of elements inserted. Keys which were already
+ *                      present are skipped
+ */
+size_t hashtable_insert_many(hashtable_t h,
+                             const hashtable_key_t * keys,
+                             const hashtable_elem_t * elems,
+                             size_t n);
+
+/**
+ * @brief   Sets h[key] to elem, whether or not key was already present
+ *
+ * Replacing is done in place, so readers see either the old element or the
+ * new one, never a missing key
+ *
+ * @param[in,out] h:    The hashtable to modify
+ * @param[in] key:      A piece of data, hashable with the hash function provide for h
+ * @param[in] elem:     The data to store
+ *
+ * @return              The object which was replaced, or NULL if key was inserted. The
+ *                      caller takes ownership of it, as with hashtable_remove
+ */
+hashtable_elem_t hashtable_put(hashtable_t h,
+                               hashtable_key_t key,
+                               hashtable_elem_t elem);
+
+/**
+ * @brief   Sets h[key] to new_elem, but only if it is currently expected
+ *
+ * @param[in,out] h:        The hashtable to modify
+ * @param[in] key:          A piece of data, hashable with the hash function provide for h
+ * @param[in] expected:     The object h[key] must hold
+ * @param[in] new_elem:     The data to store in its place
+ *
+ * @return                  true if expected was replaced, false if key held something
+ *                          else or wasn't present
+ */
+bool hashtable_replace_if(hashtable_t h,
+                          hashtable_key_t key,
+                          hashtable_elem_t expected,
+                          hashtable_elem_t new_elem);
+
+/**
+ * @brief   Gets the value at h[key], inserting one made by compute_f if there is none
+ *
+ * compute_f is only called if key looks absent. If another thread inserts key
+ * before the new element is linked in, that thread's element wins, and the new
+ * one is freed with the table's free function
+ *
+ * @param[in,out] h:        The hashtable to modify
+ * @param[in] key:          A piece of data, hashable with the hash function provide for h
+ * @param[in] compute_f:    Makes the element for key. If it returns NULL, nothing is inserted
+ *
+ * @return                  The object residing at h[key] once done, or NULL if compute_f
+ *                          did, or memory allocation failed
+ */
+hashtable_elem_t hashtable_compute_if_absent(hashtable_t h,
+                                             hashtable_key_t key,
+                                             compute_f_t compute_f);
+
 /**
  * @brief   Gets the value at h[key], leaving that object in the table
  *
@@ -125,9 +380,32 @@ bool hashtable_insert(hashtable_t h,
 hashtable_elem_t hashtable_get(hashtable_t h,
                                hashtable_key_t key);
 
+/**
+ * @brief   Gets the values for a batch of keys
+ *
+ * Equivalent to calling hashtable_get on each key, but several lookups are
+ * interleaved, with each one's next memory access prefetched while the others
+ * proceed. Much faster than separate calls when the table doesn't fit in cache
+ *
+ * @param[in] h:        The hashtable to search
+ * @param[in] keys:     The keys to look up
+ * @param[out] elems:   Gets the object residing at h[key] for each key, or NULL if none exists
+ * @param[in] n:        The number of keys
+ *
+ * @return              The number of keys found
+ */
+size_t hashtable_get_many(hashtable_t h,
+                          const hashtable_key_t * keys,
+                          hashtable_elem_t * elems,
+                          size_t n);
+
 /**
  * @brief   Removes the value at h[key], and returns it
  *
+ * The table shrinks as it empties. The directory segments of the buckets
+ * dropped are retired like nodes, and the nodes of removed keys and dropped
+ * buckets go back to the node pool, which frees them a slab at a time
+ *
  * @param[in] h:        The hashtable to search
  * @param[in] key:      A piece of data, hashable with the hash function provide for h
  * 
@@ -136,6 +414,153 @@ hashtable_elem_t hashtable_get(hashtable_t h,
 hashtable_elem_t hashtable_remove(hashtable_t h,
                                   hashtable_key_t key);
 
+/**
+ * @brief   Removes a batch of elements
+ *
+ * Equivalent to calling hashtable_remove on each key, but makes about one pass
+ * over the table, like hashtable_insert_many
+ *
+ * @param[in,out] h:    The hashtable to modify
+ * @param[in] keys:     The keys to remove
+ * @param[out] elems:   Gets the removed object for each key, or NULL if it wasn't
+ *                      present. May be NULL, if they aren't needed
+ * @param[in] n:        The number of keys
+ *
+ * @return              The number of elements removed
+ */
+size_t hashtable_remove_many(hashtable_t h,
+                             const hashtable_key_t * keys,
+                             hashtable_elem_t * elems,
+                             size_t n);
+
+/**
+ * @brief   Starts a walk over every element in a table
+ *
+ * The walk is weakly consistent: it runs concurrently with other operations,
+ * and sees each element present for its whole duration once. Elements inserted
+ * or removed while it runs may or may not be seen. Should the element the
+ * iterator is on be removed, other keys with exactly the same hash which
+ * come after it may be missed. In a HASHTABLE_ENGINE_PROBE or
+ * HASHTABLE_ENGINE_CUCKOO table with an eq_f, a key removed and inserted again
+ * mid-walk may be seen twice.
+ *
+ * The calling thread holds up reclamation until hashtable_iter_free, and for
+ * HASHTABLE_RECLAIM_QSBR tables mustn't call hashtable_quiescent or
+ * hashtable_thread_offline in between. Under HASHTABLE_RECLAIM_HAZARD a thread
+ * can only have one iterator open at a time. Other operations on the table are
+ * fine in between steps
+ *
+ * @param[in] h:        The hashtable to walk
+ *
+ * @return              The new iterator, or NULL if memory allocation failed
+ */
+hashtable_iter_t hashtable_iter_create(hashtable_t h);
+
+/**
+ * @brief   Steps to the next element
+ *
+ * @param[in,out] it:   The iterator
+ * @param[out] key:     Gets the element's key
+ * @param[out] elem:    Gets the element
+ *
+ * @return              true if there was another element, false if the walk is over
+ */
+bool hashtable_iter_next(hashtable_iter_t it,
+                         hashtable_key_t * key,
+                         hashtable_elem_t * elem);
+
+/**
+ * @brief   Ends a walk started with hashtable_iter_create
+ *
+ * @param[in] it:       The iterator to free
+ */
+void hashtable_iter_free(hashtable_iter_t it);
+
+/**
+ * @brief   Calls fn on every element of a table, from several threads at once
+ *
+ * The table is split into ranges, each starting at a bucket, and the
+ * threads take ranges until there are none left. Each range is walked with
+ * the same guarantees as hashtable_iter_next. fn must be safe to call
+ * concurrently, and may operate on the table
+ *
+ * @param[in] h:            The hashtable to walk
+ * @param[in] n_threads:    The number of threads to use, including the caller
+ * @param[in] fn:           Called with each element's key and value, and arg
+ * @param[in] arg:          Passed through to fn
+ *
+ * @return                  The number of elements visited
+ */
+size_t hashtable_parallel_for_each(hashtable_t h,
+                                   uint32_t n_threads,
+                                   for_each_f_t fn,
+                                   void * arg);
+
+/**
+ * @brief   Gets roughly the number of elements in the table
+ *
+ * Cheap enough for monitoring, but only exact when no other thread is
+ * modifying the table
+ *
+ * @param[in] h:        The hashtable to check
+ *
+ * @return              The approximate number of elements
+ */
+size_t hashtable_size_approx(hashtable_t h);
+
+/**
+ * @brief   Gets the number of CASes on the split-ordered list which have failed
+ *
+ * Counted on every failure, whatever the table's backoff, so it shows how much
+ * contention there is to back off from. Each failure is one retry (or one
+ * restarted search). Other engines don't count theirs, and always report 0
+ *
+ * @param[in] h:        The hashtable to check
+ *
+ * @return              The number of failed CASes since the table was created
+ */
+uint64_t hashtable_cas_failures(hashtable_t h);
+
+/**
+ * @brief   Gets what a table has been doing since it was created
+ *
+ * Each thread counts on its stripe, with relaxed atomics, and the stripes
+ * are added up here, so reading is the only expensive part. Counts may be off
+ * by whatever is in flight. With HASHTABLE_STATS set to 0, nothing is counted
+ * on the way, so the operation, search, resize and retired byte counts stay 0.
+ *
+ * retired_bytes covers this table's nodes only: bytes are added as a node is
+ * retired and taken off when it's freed, whichever threads do either. Under
+ * HASHTABLE_RECLAIM_NONE that's every node the table has removed, since none
+ * are freed until the table is
+ *
+ * @param[in] h:        The hashtable to check
+ * @param[out] stats:   Gets the statistics
+ */
+void hashtable_get_stats(hashtable_t h,
+                         hashtable_stats_t * stats);
+
+/**
+ * @brief   Reports that the calling thread holds no references into any table
+ *
+ * Only needed for tables using HASHTABLE_RECLAIM_QSBR, and a no-op otherwise. A
+ * thread which has used such a table must call this (or hashtable_thread_offline)
+ * regularly between operations, or removed nodes will never be freed
+ *
+ * @param[in] h:        A table the calling thread uses
+ */
+void hashtable_quiescent(hashtable_t h);
+
+/**
+ * @brief   Tells the table the calling thread won't touch it for a while
+ *
+ * For HASHTABLE_RECLAIM_QSBR tables, stops the thread holding up reclamation
+ * until its next operation. A no-op otherwise
+ *
+ * @param[in] h:        A table the calling thread uses
+ */
+void hashtable_thread_offline(hashtable_t h);
+
 /**
  * @brief   Prints a hashtable
  *
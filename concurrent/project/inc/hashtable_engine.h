@@ -0,0 +1,182 @@
+/**
+ * @file    hashtable_engine.h
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Interface between the hashtable front end and its alternative engines
+ *
+ * The front end (hashtable.c) owns argument checking, hashing, entering and
+ * leaving the table's reclamation scheme around each operation, and making
+ * elements for hashtable_compute_if_absent. It
+ * implements the split-ordered list itself; any other engine is a set of
+ * operations on an opaque table, called with the key's hash already worked out.
+ *
+ * Engines may use hazard slots below HASHTABLE_ENGINE_HAZARD_SLOTS freely during
+ * an operation; the front end clears them when it ends. Iterators and scans
+ * keep whatever they need protected in HASHTABLE_ENGINE_HAZARD_ITER, which the
+ * front end clears when the walk ends
+ */
+
+#ifndef HASHTABLE_ENGINE_H_
+#define HASHTABLE_ENGINE_H_
+
+ /**
+ * @addtogroup HASHTABLE
+ * @{
+ * @defgroup HASHTABLE_ENGINE
+ * @{
+ */
+
+/* --- PUBLIC DEPENDENCIES -------------------------------------------------- */
+
+// Modules
+#include "hashtable.h"
+#include "hazard_pointer.h"
+#include "epoch.h"
+
+// Standard
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+#define HASHTABLE_ENGINE_HAZARD_SLOTS   (5)                         /**< Hazard slots an operation may use, and the front end clears after it */
+#define HASHTABLE_ENGINE_HAZARD_ITER    (HAZARD_POINTER_SLOTS - 1)  /**< Hazard slot holding a walk's position between steps */
+
+/* --- PUBLIC DATA TYPES ---------------------------------------------------- */
+
+/**
+ * @brief   The operations an engine provides
+ *
+ * Every operation but create and free is called between the front end's
+ * reclamation enter and exit. Keys follow the front end's rules: with an eq_f
+ * they're compared with it, and otherwise keys with the same hash (ignoring
+ * its top bit) are the same key
+ */
+typedef struct hashtable_engine_ops_t_ {
+    /**
+     * @brief   Allocates an empty table, sized for config->capacity elements
+     *
+     * @return  The table, or NULL if memory allocation failed
+     */
+    void *              (*create)(const hashtable_config_t * config);
+
+    /**
+     * @brief   Frees a table, and every element still in it with free_f, unless it's NULL
+     */
+    void                (*free)(void * table, free_f_t free_f);
+
+    /**
+     * @brief   Gets the element at key, or NULL if it's absent
+     */
+    hashtable_elem_t    (*get)(void * table, hashtable_key_t key, uint64_t hash);
+
+    /**
+     * @brief   Inserts elem at key, unless key is present
+     *
+     * @param[out] present:     If not NULL, gets the element at key afterwards,
+     *                          or NULL if memory allocation failed
+     *
+     * @return  true if inserted, false if key was present or memory allocation failed
+     */
+    bool                (*insert)(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present);
+
+    /**
+     * @brief   Sets key's element to elem, inserting it if necessary
+     *
+     * @return  The element replaced, or NULL if key was inserted
+     */
+    hashtable_elem_t    (*put)(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem);
+
+    /**
+     * @brief   Sets key's element to new_elem if it's currently expected
+     */
+    bool                (*replace_if)(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem);
+
+    /**
+     * @brief   Removes key
+     *
+     * @return  The element removed, or NULL if key was absent
+     */
+    hashtable_elem_t    (*remove)(void * table, hashtable_key_t key, uint64_t hash);
+
+    /**
+     * @brief   Gets roughly the number of elements, as for hashtable_size_approx
+     */
+    size_t              (*size)(void * table);
+
+    /**
+     * @brief   Starts a walk, with the guarantees of hashtable_iter_create
+     *
+     * @return  The engine's iterator, or NULL if memory allocation failed
+     */
+    void *              (*iter_create)(void * table);
+
+    /**
+     * @brief   Steps a walk to its next element
+     */
+    bool                (*iter_next)(void * it, hashtable_key_t * key, hashtable_elem_t * elem);
+
+    /**
+     * @brief   Frees an iterator. The front end clears its hazard slot afterwards
+     */
+    void                (*iter_free)(void * it);
+
+    /**
+     * @brief   Pins down whatever a parallel scan walks, on the thread starting it
+     *
+     * @return  Passed to scan_range on every thread of the scan
+     */
+    void *              (*scan_begin)(void * table);
+
+    /**
+     * @brief   Lets go of what scan_begin pinned down, once every thread is done. May be NULL
+     */
+    void                (*scan_end)(void * table, void * snapshot);
+
+    /**
+     * @brief   Walks one of n_ranges parts of a table, calling fn on each element
+     *
+     * @return  The number of elements visited
+     */
+    size_t              (*scan_range)(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg);
+
+    /**
+     * @brief   Set if the engine guards everything with locks, and frees removed
+     *          memory straight away. Its tables then run as HASHTABLE_RECLAIM_NONE
+     */
+    bool                locked;
+} hashtable_engine_ops_t;
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+extern const hashtable_engine_ops_t hashtable_probe_ops;    /**< HASHTABLE_ENGINE_PROBE */
+extern const hashtable_engine_ops_t hashtable_cuckoo_ops;   /**< HASHTABLE_ENGINE_CUCKOO */
+extern const hashtable_engine_ops_t hashtable_mutex_ops;    /**< HASHTABLE_ENGINE_MUTEX */
+extern const hashtable_engine_ops_t hashtable_rwlock_ops;   /**< HASHTABLE_ENGINE_RWLOCK */
+extern const hashtable_engine_ops_t hashtable_striped_ops;  /**< HASHTABLE_ENGINE_STRIPED */
+
+/* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+
+/**
+ * @brief   Hands memory over to be freed once no thread can be looking at it
+ *
+ * @param[in] reclaim:  The table's reclamation scheme. Must not be
+ *                      HASHTABLE_RECLAIM_NONE, which engines handle themselves
+ * @param[in] ptr:      The memory to free
+ * @param[in] free_f:   Frees it
+ */
+static inline void hashtable_engine_retire(hashtable_reclaim_t reclaim, void * ptr, void (*free_f)(void *))
+{
+    switch (reclaim) {
+    case HASHTABLE_RECLAIM_HAZARD:  hazard_pointer_retire(ptr, free_f);     break;
+    case HASHTABLE_RECLAIM_EPOCH:   epoch_retire(ptr, free_f);              break;
+    case HASHTABLE_RECLAIM_QSBR:    epoch_qsbr_retire(ptr, free_f);         break;
+    case HASHTABLE_RECLAIM_NONE:                                            break;
+    }
+}
+
+/** @} defgroup HASHTABLE_ENGINE */
+/** @} addtogroup HASHTABLE */
+
+#endif //#ifndef HASHTABLE_ENGINE_H_
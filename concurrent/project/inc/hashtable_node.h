@@ -3,6 +3,10 @@
  * @author  Ausitin Glaser <austin.glaser@colorado.edu>
  *
  * @brief   Implements the hashtable_node_t class, used by the hashtable library
+ *
+ * Accessors are defined inline here, since they sit on the hashtable's
+ * traversal path. Allocation and freeing, which go through the node pool,
+ * live in hashtable_node.c
  */
 
 #ifndef HASHTABLE_NODE_H_
@@ -25,6 +29,14 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+#define HASHTABLE_NODE_MARK         ((uintptr_t) 0x01)  /**< Bit in next denoting a logically deleted node */
+#define HASHTABLE_NODE_SENTINEL     ((uintptr_t) 0x02)  /**< Bit in next denoting a bucket sentinel */
+#define HASHTABLE_NODE_FLAGS        (HASHTABLE_NODE_MARK | HASHTABLE_NODE_SENTINEL)
+
+#define HASHTABLE_NODE_ALIGN        (32)    /**< Node stride. Two nodes per line, none straddling */
+
 /* --- PUBLIC DATA TYPES ---------------------------------------------------- */
 
 /**
@@ -32,111 +44,296 @@
  */
 typedef struct hashtable_node_t_ * hashtable_node_t;
 
+/**
+ * @brief   Internal node structure
+ *
+ * Only visible so the accessors below can be inlined. Don't touch the
+ * fields directly.
+ *
+ * The fields a traversal looks at come first. Nodes are aligned to
+ * HASHTABLE_NODE_ALIGN, which leaves the low bits of next free for flags
+ */
+struct hashtable_node_t_ {
+    _Alignas(HASHTABLE_NODE_ALIGN)
+    uint64_t            so_key;         /**< The node's position in the list. Never changes */
+    atomic_uintptr_t    next;           /**< The next node, plus flags. Links the free list while pooled */
+    atomic_uintptr_t    elem;           /**< The element the node references */
+    hashtable_key_t     key;            /**< The key the element was inserted under. Never changes */
+};
+
 /* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
 
 /**
  * @brief   Allocates and returns a new hashtable node structure
  *
- * The new node's sentinel and next values will be false and NULL respectively --
- * to set them, call the appropriate hashtable_node_set functions
+ * The new node's next value will be NULL -- to set it, call
+ * hashtable_node_set_next
+ *
+ * The key is stored as is; whatever it points to must outlive the node
+ *
+ * Nodes come from a per-thread pool rather than straight from malloc(): each
+ * thread keeps a magazine of free nodes and a slab to carve new ones from, and
+ * only goes to shared state when both are exhausted. A slab is freed once all
+ * of its nodes have made their way back to the shared depot; nodes parked in
+ * a thread's magazine keep theirs until the thread spills them, or exits
  *
+ * @param[in] key:              The key for the structure
  * @param[in] elem:             The element for the structure
- * @param[in] hash:             The associated key hash
+ * @param[in] hash:             The key's hash
  *
  * @return:     An allocated hashtable node, or NULL if memory allocation failed
  */
-hashtable_node_t hashtable_node_create(hashtable_elem_t elem, uint32_t hash);
+hashtable_node_t hashtable_node_create(hashtable_key_t key, hashtable_elem_t elem, uint64_t hash);
+
+/**
+ * @brief   Allocates and returns a new bucket sentinel
+ *
+ * A sentinel has no key or element, and sorts immediately before any regular node
+ * with the same hash. Whether a node is a sentinel never changes
+ *
+ * @param[in] bucket:           The bucket the sentinel heads
+ *
+ * @return:     An allocated hashtable node, or NULL if memory allocation failed
+ */
+hashtable_node_t hashtable_node_create_sentinel(uint32_t bucket);
+
+/**
+ * @brief   Allocates n nodes, contiguous in memory
+ *
+ * Meant for building a whole list in one go, in list order, so that walking it
+ * walks memory in order. The nodes are uninitialized; set each up with
+ * hashtable_node_init or hashtable_node_init_sentinel. Once they are, they're
+ * like any other node, and are freed one at a time with hashtable_node_free
+ *
+ * @param[in] n:                The number of nodes. Must not be 0
+ *
+ * @return:     The first of n nodes, or NULL if memory allocation failed
+ */
+hashtable_node_t hashtable_node_create_block(size_t n);
+
+/**
+ * @brief   Initializes a node from hashtable_node_create_block
+ *
+ * @see hashtable_node_create
+ */
+void hashtable_node_init(hashtable_node_t node, hashtable_key_t key, hashtable_elem_t elem, uint64_t hash);
+
+/**
+ * @brief   Initializes a node from hashtable_node_create_block as a sentinel
+ *
+ * @see hashtable_node_create_sentinel
+ */
+void hashtable_node_init_sentinel(hashtable_node_t node, uint32_t bucket);
 
 /**
  * @brief   De-allocates memory associated with a hashtable node
  *
+ * The node is returned to the calling thread's magazine, so it may be handed
+ * straight back out by the next hashtable_node_create on the same thread
+ *
  * @param[in] node:             The node to be freed
  */
 void hashtable_node_free(hashtable_node_t node);
 
 /**
- * @brief   Gets the hash value from a hashtable node
+ * @brief   Gets the memory the node pool holds, in use or not
+ *
+ * @return      The size of every slab and block not yet given back, in bytes
+ */
+size_t hashtable_node_pool_bytes(void);
+
+/**
+ * @brief   Bit reverses <val>
+ *
+ * @note    from <https://graphics.stanford.edu/~seander/bithacks.html#ReverseParallel>
+ *
+ * @param[in] val:      The value to be bit-reversed
+ *
+ * @return:         <val>, bit-reversed
+ */
+static inline uint64_t hashtable_node_uint64_bit_reverse(uint64_t val)
+{
+    // Swap successively larger halves
+    val = ((val >> 1)  & UINT64_C(0x5555555555555555)) | ((val & UINT64_C(0x5555555555555555)) << 1);
+    val = ((val >> 2)  & UINT64_C(0x3333333333333333)) | ((val & UINT64_C(0x3333333333333333)) << 2);
+    val = ((val >> 4)  & UINT64_C(0x0F0F0F0F0F0F0F0F)) | ((val & UINT64_C(0x0F0F0F0F0F0F0F0F)) << 4);
+    val = ((val >> 8)  & UINT64_C(0x00FF00FF00FF00FF)) | ((val & UINT64_C(0x00FF00FF00FF00FF)) << 8);
+    val = ((val >> 16) & UINT64_C(0x0000FFFF0000FFFF)) | ((val & UINT64_C(0x0000FFFF0000FFFF)) << 16);
+    return (val >> 32) | (val << 32);
+}
+
+/**
+ * @brief   Computes the position of a node in the list
+ *
+ * Nodes are ordered by bit-reversed hash. A bucket's sentinel sorts immediately
+ * before any regular node with the same hash
+ *
+ * The lowest bit of the key says which kind of node it is, so the top bit of
+ * the hash is dropped. Keys which differ only there share a position, and are
+ * told apart like any other collision
+ *
+ * @param[in] hash:         The node's hash
+ * @param[in] sentinel:     Whether the node is a sentinel
+ *
+ * @return      The node's split-order key
+ */
+static inline uint64_t hashtable_node_split_order_key(uint64_t hash, bool sentinel)
+{
+    return (hashtable_node_uint64_bit_reverse(hash) & ~UINT64_C(1)) | (sentinel ? 0 : 1);
+}
+
+/**
+ * @brief   Gets the key stored in a hashtable node
  *
  * @param[in] node:             The node to extract information from
  *
- * @return      The 32 bit hash, or 0 if getting failed
+ * @return      The node's key, or NULL if retrieval failed
  */
-uint32_t hashtable_node_get_hash(hashtable_node_t node);
+static inline hashtable_key_t hashtable_node_get_key(hashtable_node_t node)
+{
+    // Verify that the node is non-NULL
+    if (node)   return node->key;
+    else        return NULL;
+}
+
+/**
+ * @brief   Gets the split-order key of a hashtable node
+ *
+ * @see hashtable_node_split_order_key
+ *
+ * @param[in] node:             The node to extract information from
+ *
+ * @return      The node's split-order key, or 0 if getting failed
+ */
+static inline uint64_t hashtable_node_get_so_key(hashtable_node_t node)
+{
+    // Precomputed at creation
+    if (node)   return node->so_key;
+    else        return UINT64_C(0);
+}
 
 /**
  * @brief   Gets the element stored in a hashtable node
  *
  * @param[in] node:             The node to extract information from
- * 
+ *
  * @return      The element stored in the node, or NULL if retrieval failed
  */
-hashtable_elem_t hashtable_node_get_elem(hashtable_node_t node);
+static inline hashtable_elem_t hashtable_node_get_elem(hashtable_node_t node)
+{
+    // Load the elem pointer
+    if (node)   return (hashtable_elem_t) atomic_load(&(node->elem));
+    else        return NULL;
+}
 
 /**
  * @brief   Gets the next node in the node list, or NULL if there is no next
  *
+ * @note    The flags are stripped; use hashtable_node_is_marked to check for deletion
+ *
  * @param[in] node:             The node to extract the predecessor from
  *
  * @return      The node's predecessor, or NULL if there is none
  */
-hashtable_node_t hashtable_node_get_next(hashtable_node_t node);
+static inline hashtable_node_t hashtable_node_get_next(hashtable_node_t node)
+{
+    // Load the next node pointer, without the flags
+    if (node)   return (hashtable_node_t) (atomic_load(&(node->next)) & ~HASHTABLE_NODE_FLAGS);
+    else        return NULL;
+}
 
 /**
- * @brief   Determines whether node is a sentinel or not
+ * @brief   Gets the next node and the deletion mark with a single atomic load
  *
  * @param[in] node:             The node to extract information from
+ * @param[out] marked:          Set to whether node is marked
  *
- * @return      true if the node is a sentinel, false otherwise
+ * @return      The node's predecessor, or NULL if there is none
  */
-bool hashtable_node_is_sentinel(hashtable_node_t node);
+static inline hashtable_node_t hashtable_node_get_next_mark(hashtable_node_t node, bool * marked)
+{
+    // Load once, so the two always agree
+    uintptr_t next = node ? atomic_load(&(node->next)) : (uintptr_t) NULL;
+
+    *marked = (next & HASHTABLE_NODE_MARK) != 0;
+    return (hashtable_node_t) (next & ~HASHTABLE_NODE_FLAGS);
+}
 
 /**
- * @brief   Sets node's element to elem
+ * @brief   Determines whether node has been marked as logically deleted
  *
- * @note    If node was a sentinel, it will not be considered so after a call
- *          to this function
+ * @param[in] node:             The node to extract information from
  *
- * @param[in] node:             The node to modify
- * @param[in] elem:             The element to insert
+ * @return      true if the node is marked, false otherwise
  */
-void hashtable_node_set_elem(hashtable_node_t node, hashtable_elem_t elem);
+static inline bool hashtable_node_is_marked(hashtable_node_t node)
+{
+    // Retrieve the mark from the next field
+    if (node)   return (atomic_load(&(node->next)) & HASHTABLE_NODE_MARK) != 0;
+    else        return false;
+}
 
 /**
- * @brief   Sets the predecessor of node to next
+ * @brief   Determines whether node is a sentinel or not
  *
- * @param[in,out] node:         The node to modify
- * @param[in] next:             node's new predecessor
+ * @param[in] node:             The node to extract information from
+ *
+ * @return      true if the node is a sentinel, false otherwise
  */
-void hashtable_node_set_next(hashtable_node_t node, hashtable_node_t next);
+static inline bool hashtable_node_is_sentinel(hashtable_node_t node)
+{
+    // Never changes, so there's nothing to order against
+    if (node)   return (atomic_load_explicit(&(node->next), memory_order_relaxed) & HASHTABLE_NODE_SENTINEL) != 0;
+    else        return false;
+}
 
 /**
- * @brief   Makes node into a sentinel
- *
- * @note    node's elem will read as NULL after a call to this function
+ * @brief   Sets node's element to elem
  *
- * @param[in, out] node:        The node to modify
+ * @param[in] node:             The node to modify
+ * @param[in] elem:             The element to insert
  */
-void hashtable_node_set_sentinel(hashtable_node_t node);
+static inline void hashtable_node_set_elem(hashtable_node_t node, hashtable_elem_t elem)
+{
+    // Atomically set the elem field
+    if (node) atomic_store(&(node->elem), (uintptr_t) elem);
+}
 
 /**
- * @brief   Sets the node as a sentinel if node->elem == expected_elem
+ * @brief   Sets the predecessor of node to next
  *
- * @param[in,out] node:         The node to modify
- * @param[in] expected_elem:    The expected element
+ * @note    Clears the deletion mark. Only meant for nodes which haven't been
+ *          published yet
  *
- * @return      true if node was made into a sentinel, false otherwise
+ * @param[in,out] node:         The node to modify
+ * @param[in] next:             node's new predecessor
  */
-bool hashtable_node_set_sentinel_if_elem(hashtable_node_t node, hashtable_elem_t expected_elem);
+static inline void hashtable_node_set_next(hashtable_node_t node, hashtable_node_t next)
+{
+    // Atomically set the next field, keeping the sentinel flag
+    if (node) {
+        uintptr_t sentinel = atomic_load_explicit(&(node->next), memory_order_relaxed) & HASHTABLE_NODE_SENTINEL;
+        atomic_store(&(node->next), ((uintptr_t) next) | sentinel);
+    }
+}
 
 /**
- * @brief   Atomically checks whether node is a sentinel, and if so sets the elem to new_elem
+ * @brief   Atomically marks node as logically deleted
+ *
+ * Once marked, node's next field can no longer be changed with
+ * hashtable_node_cas_next, so nothing can be linked in after it
+ * while it is being unlinked
  *
  * @param[in,out] node:         The node to modify
- * @param[in] new_elem:         The element to try to set
  *
- * @return      true if node was a sentinel and new_elem was successfully set, false otherwise
+ * @return      true if this call marked the node, false if it was already marked
  */
-bool hashtable_node_if_sentinel_set_elem(hashtable_node_t node, hashtable_elem_t new_elem);
+static inline bool hashtable_node_mark(hashtable_node_t node)
+{
+    // Set the mark, and see whether we were the ones to set it
+    if (node)   return (atomic_fetch_or(&(node->next), HASHTABLE_NODE_MARK) & HASHTABLE_NODE_MARK) == 0;
+    else        return false;
+}
 
 /**
  * @brief   Atomicall checks whether the node's elem has the expected value, and if so sets the new element
@@ -147,18 +344,37 @@ bool hashtable_node_if_sentinel_set_elem(hashtable_node_t node, hashtable_elem_t
  *
  * @return      true if the CAS succeeded, false otherwise
  */
-bool hashtable_node_cas_elem(hashtable_node_t node, hashtable_elem_t expected_elem, hashtable_elem_t new_elem);
+static inline bool hashtable_node_cas_elem(hashtable_node_t node, hashtable_elem_t expected_elem, hashtable_elem_t new_elem)
+{
+    // CAS the elem field
+    if (node)   return atomic_compare_exchange_strong(&(node->elem), (uintptr_t *) &expected_elem, (uintptr_t) new_elem);
+    else        return false;
+}
 
 /**
  * @brief   Atomically compares node's next value to expected next, sets it to new_hash if they are equal
  *
+ * @note    Always fails if node has been marked
+ *
  * @paran[in,out] node:         The node to modify
  * @param[in] expected_next:    The node we expect to be the predecessor
  * @param[in] new_next:         The predecessor we're attempting to set
  *
  * @return      true if the CAS succeeded, false if node remains unchanged
  */
-bool hashtable_node_cas_next(hashtable_node_t node, hashtable_node_t expected_next, hashtable_node_t new_next);
+static inline bool hashtable_node_cas_next(hashtable_node_t node, hashtable_node_t expected_next, hashtable_node_t new_next)
+{
+    // CAS the next field, checking whether it's still expected_next. The
+    // sentinel flag never changes, so it's carried through as is
+    if (node) {
+        uintptr_t sentinel = atomic_load_explicit(&(node->next), memory_order_relaxed) & HASHTABLE_NODE_SENTINEL;
+        uintptr_t expected = ((uintptr_t) expected_next) | sentinel;
+        return atomic_compare_exchange_strong(&(node->next), &expected, ((uintptr_t) new_next) | sentinel);
+    }
+    else {
+        return false;
+    }
+}
 
 /**
  * @} defgroup HASHTABLE_NODE
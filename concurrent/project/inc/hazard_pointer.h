@@ -0,0 +1,99 @@
+/**
+ * @file    hazard_pointer.h
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Interface for hazard pointer based memory reclamation
+ *
+ * Each thread owns a small, fixed number of hazard slots. A thread publishes
+ * a pointer in one of its slots before dereferencing it, and retires memory
+ * it has unlinked instead of freeing it. Retired memory is freed once no slot
+ * in any thread refers to it, so the amount of memory waiting to be freed is
+ * bounded by O(threads * slots) instead of growing with every retirement.
+ */
+
+#ifndef HAZARD_POINTER_H_
+#define HAZARD_POINTER_H_
+
+/**
+ * @defgroup HAZARD_POINTER
+ * @{
+ */
+
+/* --- PUBLIC DEPENDENCIES -------------------------------------------------- */
+
+// Standard
+#include <stdint.h>
+#include <stdlib.h>
+
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+#define HAZARD_POINTER_SLOTS        (22)    /**< The number of hazard slots each thread owns. Enough for hashtable_get_many to protect a pair per lookup in a group of 8 */
+
+/* --- PUBLIC DATA TYPES ---------------------------------------------------- */
+
+/**
+ * @brief   Function signature of a free function
+ *
+ * A free function takes a generic pointer, and
+ * frees the memory referenced
+ */
+typedef void (*free_f_t)(void *);
+
+/* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+
+/**
+ * @brief   Publishes ptr in one of the calling thread's hazard slots
+ *
+ * Once this returns, no thread will free ptr through hazard_pointer_retire.
+ * The caller must still check that ptr was reachable after publishing it,
+ * since it may have been retired in between
+ *
+ * @param[in] slot:     The slot to use, less than HAZARD_POINTER_SLOTS
+ * @param[in] ptr:      The pointer to protect
+ */
+void hazard_pointer_set(uint32_t slot, void * ptr);
+
+/**
+ * @brief   Clears every hazard slot owned by the calling thread
+ */
+void hazard_pointer_clear(void);
+
+/**
+ * @brief   Clears some of the calling thread's hazard slots, leaving the rest published
+ *
+ * @param[in] first:    The first slot to clear
+ * @param[in] n:        The number of slots to clear. Slots past HAZARD_POINTER_SLOTS are ignored
+ */
+void hazard_pointer_clear_range(uint32_t first, uint32_t n);
+
+/**
+ * @brief   Schedules ptr to be freed once no thread has it published
+ *
+ * ptr must already be unreachable for any thread that doesn't hold it
+ * in a hazard slot. Retiring will periodically scan all hazard slots
+ * and free whatever is no longer protected
+ *
+ * @param[in] ptr:      The pointer to retire
+ * @param[in] free_f:   The function which frees ptr. May NOT be NULL
+ *
+ * @return      An error code
+ * @retval      0:  Success
+ * @retval      >0: Memory allocation failed. ptr has not been retired
+ */
+uint32_t hazard_pointer_retire(void * ptr, free_f_t free_f);
+
+/**
+ * @brief   Frees every pointer retired by the calling thread which is no longer protected
+ */
+void hazard_pointer_scan(void);
+
+/**
+ * @brief   Gets the number of pointers retired by the calling thread and not yet freed
+ *
+ * @return      The number of pointers waiting to be freed
+ */
+size_t hazard_pointer_retired(void);
+
+/** @} defgroup HAZARD_POINTER */
+
+#endif //#ifndef HAZARD_POINTER_H_
@@ -3,6 +3,9 @@
  * @author  Austin Glaser <austin.glaser@colorado.edu>
  *
  * @brief   Intefrace for a node type for reference lists
+ *
+ * Each node is a block holding up to REFERENCE_LIST_NODE_REFS references,
+ * so that saving a reference rarely needs an allocation of its own
  */
 
 #ifndef REFERENCE_LIST_NODE_H_
@@ -18,6 +21,11 @@
 // Standard
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+#define REFERENCE_LIST_NODE_REFS    (254)   /**< References per node. Makes a node exactly 2KiB */
 
 /* --- PUBLIC DATA TYPES ---------------------------------------------------- */
 
@@ -31,7 +39,7 @@ typedef struct reference_list_node_t_* reference_list_node_t;
 /**
  * @brief       Creates a new reference list node
  *
- * @param[in] ref:      The reference to store
+ * @param[in] ref:      The first reference to store
  *
  * @return      A reference to the new node, or NULL if memory allocation failed
  */
@@ -47,7 +55,7 @@ reference_list_node_t reference_list_node_create(void* ref);
 void reference_list_node_free(reference_list_node_t node);
 
 /**
- * @brief       Retrieves the stored reference from a node
+ * @brief       Retrieves the first stored reference from a node
  *
  * @param[in] node:     The node to retrieve information from
  *
@@ -55,6 +63,46 @@ void reference_list_node_free(reference_list_node_t node);
  */
 void* reference_list_node_get_ref(reference_list_node_t node);
 
+/**
+ * @brief       Retrieves a stored reference from a node
+ *
+ * @param[in] node:     The node to retrieve information from
+ * @param[in] i:        The index of the reference, less than reference_list_node_count(node)
+ *
+ * @return      The reference value, or NULL if retrieval failed
+ */
+void* reference_list_node_get_ref_at(reference_list_node_t node, uint32_t i);
+
+/**
+ * @brief       Gets the number of references stored in a node
+ *
+ * @param[in] node:     The node to check
+ *
+ * @return      The number of references stored
+ */
+uint32_t reference_list_node_count(reference_list_node_t node);
+
+/**
+ * @brief       Stores another reference in a node
+ *
+ * @warning     Not thread safe. The caller must have exclusive access to node
+ *
+ * @param[in,out] node: The node to add to
+ * @param[in] ref:      The reference to store
+ *
+ * @return      true if successful, false if the node is full
+ */
+bool reference_list_node_add_ref(reference_list_node_t node, void* ref);
+
+/**
+ * @brief       Checks whether a node has room for more references
+ *
+ * @param[in] node:     The node to check
+ *
+ * @return      true if no more references can be added
+ */
+bool reference_list_node_is_full(reference_list_node_t node);
+
 /**
  * @brief       Gets the next node referenced
  *
@@ -77,6 +125,27 @@ reference_list_node_t reference_list_node_get_next(reference_list_node_t node);
  */
 bool reference_list_node_set_next(reference_list_node_t node, reference_list_node_t next);
 
+/**
+ * @brief       Sets the next field of a node which isn't in a list yet
+ *
+ * Unconditional, so only safe before node has been published to other threads
+ *
+ * @param[in,out] node: The node to modify
+ * @param[in] next:     The desired next node, or NULL
+ */
+void reference_list_node_init_next(reference_list_node_t node, reference_list_node_t next);
+
+/**
+ * @brief       Atomically sets the next field of node to next, if it's currently expected
+ *
+ * @param[in,out] node: The node we're trying to modify
+ * @param[in] expected: The next node we think node currently has, or NULL
+ * @param[in] next:     The desired next node in the list
+ *
+ * @return      true if the assignment was successful, false otherwise
+ */
+bool reference_list_node_cas_next(reference_list_node_t node, reference_list_node_t expected, reference_list_node_t next);
+
 /** @} defgroup REFERENCE_LIST_NODE */
 
 #endif //#ifndef REFERENCE_LIST_NODE_H_
@@ -0,0 +1,271 @@
+/**
+ * @file    spinlock.h
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Interface for spinning mutual exclusion locks
+ *
+ * Five locks, from simplest to most scalable. A test-and-set (TAS) lock has
+ * every waiter hammer one flag with atomic swaps. A test-and-test-and-set
+ * (TTAS) lock waits with plain loads, which hit in cache until the lock is
+ * released, and backs off exponentially after losing a race for it. A ticket
+ * lock hands out places in line, so it's fair, but every waiter still watches
+ * one word. MCS and CLH locks queue waiters, each spinning on its own cache
+ * line, so a release only disturbs the next in line.
+ *
+ * An MCS waiter spins on a node it provides, which can live on its stack, and
+ * must be passed to the matching unlock. A CLH waiter spins on its
+ * predecessor's node, and takes that node over on unlocking, so CLH nodes are
+ * allocated, and held in a handle which stays with the thread.
+ *
+ * No lock is reentrant. Waiters pause between checks, and after
+ * SPINLOCK_SPINS_MAX checks start yielding the processor, so that holders
+ * which are preempted (with more threads than cores) get to run
+ */
+
+#ifndef SPINLOCK_H_
+#define SPINLOCK_H_
+
+/**
+ * @defgroup SPINLOCK
+ * @{
+ */
+
+/* --- PUBLIC DEPENDENCIES -------------------------------------------------- */
+
+// Standard
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+#define SPINLOCK_CACHE_LINE     (64)            /**< Queue nodes are aligned to this many bytes */
+#define SPINLOCK_SPINS_MAX      (1024)          /**< Pauses a waiter spins through before it starts yielding */
+#define SPINLOCK_BACKOFF_MIN    (4)             /**< Pauses a TTAS lock backs off for after its first lost race */
+#define SPINLOCK_BACKOFF_MAX    (1024)          /**< Most pauses a TTAS lock backs off for */
+
+/* --- PUBLIC DATA TYPES ---------------------------------------------------- */
+
+/**
+ * @brief   A test-and-set lock
+ */
+typedef struct spinlock_tas_t_ {
+    atomic_bool                         held;       /**< Whether the lock is held */
+} spinlock_tas_t;
+
+/**
+ * @brief   A test-and-test-and-set lock, with exponential backoff
+ */
+typedef struct spinlock_ttas_t_ {
+    atomic_bool                         held;       /**< Whether the lock is held */
+} spinlock_ttas_t;
+
+/**
+ * @brief   A ticket lock
+ */
+typedef struct spinlock_ticket_t_ {
+    atomic_uint_fast32_t                next;       /**< The next ticket to hand out */
+    atomic_uint_fast32_t                serving;    /**< The ticket allowed in */
+} spinlock_ticket_t;
+
+/**
+ * @brief   A waiter's place in an MCS lock's queue
+ */
+typedef struct spinlock_mcs_node_t_ {
+    _Alignas(SPINLOCK_CACHE_LINE)
+    _Atomic(struct spinlock_mcs_node_t_ *) next;   /**< The waiter behind this one, once it's linked itself in */
+    atomic_bool                         waiting;    /**< Cleared by the waiter ahead, to let this one in */
+} spinlock_mcs_node_t;
+
+/**
+ * @brief   An MCS queue lock
+ */
+typedef struct spinlock_mcs_t_ {
+    _Atomic(spinlock_mcs_node_t *)      tail;       /**< The last waiter in line (or the holder), or NULL if it's free */
+} spinlock_mcs_t;
+
+/**
+ * @brief   A place in a CLH lock's queue
+ */
+typedef struct spinlock_clh_node_t_ {
+    _Alignas(SPINLOCK_CACHE_LINE)
+    atomic_bool                         waiting;    /**< Set while its owner holds, or waits for, the lock */
+} spinlock_clh_node_t;
+
+/**
+ * @brief   A CLH queue lock
+ */
+typedef struct spinlock_clh_t_ {
+    _Atomic(spinlock_clh_node_t *)      tail;       /**< The last waiter's node, or a released one if it's free */
+} spinlock_clh_t;
+
+/**
+ * @brief   A thread's way into CLH locks. Good for one lock at a time, but any of them
+ */
+typedef struct spinlock_clh_handle_t_ {
+    spinlock_clh_node_t *               mine;       /**< The node queued on the next lock */
+    spinlock_clh_node_t *               pred;       /**< The node ahead of it, taken over on unlocking */
+} spinlock_clh_handle_t;
+
+/* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+
+/**
+ * @brief   Waits a moment before a waiter checks again
+ *
+ * Pauses for the first SPINLOCK_SPINS_MAX calls, then yields the processor.
+ * For anything else which spins waiting on another thread
+ *
+ * @param[in,out] spins:    The checks made so far. Start it at 0
+ */
+void spinlock_relax(uint32_t * spins);
+
+/**
+ * @brief   Tells the processor we're spinning, so it can ease off
+ */
+void spinlock_pause(void);
+
+/**
+ * @brief   Initializes a TAS lock, unheld
+ */
+void spinlock_tas_init(spinlock_tas_t * lock);
+
+/**
+ * @brief   Takes a TAS lock, spinning until it's free
+ */
+void spinlock_tas_lock(spinlock_tas_t * lock);
+
+/**
+ * @brief   Takes a TAS lock if it's free
+ *
+ * @return      true if the lock was taken
+ */
+bool spinlock_tas_trylock(spinlock_tas_t * lock);
+
+/**
+ * @brief   Releases a TAS lock
+ */
+void spinlock_tas_unlock(spinlock_tas_t * lock);
+
+/**
+ * @brief   Initializes a TTAS lock, unheld
+ */
+void spinlock_ttas_init(spinlock_ttas_t * lock);
+
+/**
+ * @brief   Takes a TTAS lock, spinning until it's free
+ */
+void spinlock_ttas_lock(spinlock_ttas_t * lock);
+
+/**
+ * @brief   Takes a TTAS lock if it's free
+ *
+ * @return      true if the lock was taken
+ */
+bool spinlock_ttas_trylock(spinlock_ttas_t * lock);
+
+/**
+ * @brief   Releases a TTAS lock
+ */
+void spinlock_ttas_unlock(spinlock_ttas_t * lock);
+
+/**
+ * @brief   Initializes a ticket lock, unheld
+ */
+void spinlock_ticket_init(spinlock_ticket_t * lock);
+
+/**
+ * @brief   Takes a ticket lock, waiting for everyone who asked first
+ */
+void spinlock_ticket_lock(spinlock_ticket_t * lock);
+
+/**
+ * @brief   Takes a ticket lock if it's free and nobody's waiting
+ *
+ * @return      true if the lock was taken
+ */
+bool spinlock_ticket_trylock(spinlock_ticket_t * lock);
+
+/**
+ * @brief   Releases a ticket lock, to the next in line
+ */
+void spinlock_ticket_unlock(spinlock_ticket_t * lock);
+
+/**
+ * @brief   Initializes an MCS lock, unheld
+ */
+void spinlock_mcs_init(spinlock_mcs_t * lock);
+
+/**
+ * @brief   Takes an MCS lock, waiting for everyone queued first
+ *
+ * @param[in] lock:     The lock
+ * @param[in] node:     The caller's place in line. Must stay valid until the
+ *                      matching spinlock_mcs_unlock
+ */
+void spinlock_mcs_lock(spinlock_mcs_t * lock, spinlock_mcs_node_t * node);
+
+/**
+ * @brief   Takes an MCS lock if it's free
+ *
+ * @param[in] lock:     The lock
+ * @param[in] node:     As for spinlock_mcs_lock
+ *
+ * @return      true if the lock was taken
+ */
+bool spinlock_mcs_trylock(spinlock_mcs_t * lock, spinlock_mcs_node_t * node);
+
+/**
+ * @brief   Releases an MCS lock, to the next in line
+ *
+ * @param[in] lock:     The lock
+ * @param[in] node:     The node it was taken with
+ */
+void spinlock_mcs_unlock(spinlock_mcs_t * lock, spinlock_mcs_node_t * node);
+
+/**
+ * @brief   Initializes a CLH lock, unheld
+ *
+ * @return      An error code
+ * @retval      0:  Success
+ * @retval      >0: Memory allocation failed
+ */
+uint32_t spinlock_clh_init(spinlock_clh_t * lock);
+
+/**
+ * @brief   Frees what a CLH lock holds. It mustn't be held, or waited on
+ */
+void spinlock_clh_destroy(spinlock_clh_t * lock);
+
+/**
+ * @brief   Initializes a thread's handle for taking CLH locks
+ *
+ * @return      An error code
+ * @retval      0:  Success
+ * @retval      >0: Memory allocation failed
+ */
+uint32_t spinlock_clh_handle_init(spinlock_clh_handle_t * handle);
+
+/**
+ * @brief   Frees what a CLH handle holds. It mustn't hold a lock
+ */
+void spinlock_clh_handle_destroy(spinlock_clh_handle_t * handle);
+
+/**
+ * @brief   Takes a CLH lock, waiting for everyone queued first
+ *
+ * @param[in] lock:     The lock
+ * @param[in] handle:   The calling thread's handle, which mustn't hold another lock
+ */
+void spinlock_clh_lock(spinlock_clh_t * lock, spinlock_clh_handle_t * handle);
+
+/**
+ * @brief   Releases a CLH lock, to the next in line
+ *
+ * @param[in] lock:     The lock
+ * @param[in] handle:   The handle it was taken with
+ */
+void spinlock_clh_unlock(spinlock_clh_t * lock, spinlock_clh_handle_t * handle);
+
+/** @} defgroup SPINLOCK */
+
+#endif //#ifndef SPINLOCK_H_
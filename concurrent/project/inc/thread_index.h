@@ -0,0 +1,49 @@
+/**
+ * @file    thread_index.h
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Interface for small, dense per-thread indices
+ *
+ * Each thread is handed an index the first time it asks for one, in the
+ * order threads show up. Indices are never reused, so they're mostly useful
+ * for spreading threads across a fixed number of stripes of shared state
+ */
+
+#ifndef THREAD_INDEX_H_
+#define THREAD_INDEX_H_
+
+/**
+ * @defgroup THREAD_INDEX
+ * @{
+ */
+
+/* --- PUBLIC DEPENDENCIES -------------------------------------------------- */
+
+// Standard
+#include <stdint.h>
+
+/* --- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+
+/**
+ * @brief   Gets the calling thread's index
+ *
+ * @return      The same value every time it's called from a given thread, and
+ *              a different value from every other thread
+ */
+uint32_t thread_index(void);
+
+/**
+ * @brief   Gets the calling thread's stripe, out of a power-of-two number of them
+ *
+ * @param[in] n_stripes:    The number of stripes. Must be a power of two
+ *
+ * @return      An index less than n_stripes
+ */
+static inline uint32_t thread_index_stripe(uint32_t n_stripes)
+{
+    return thread_index() & (n_stripes - 1);
+}
+
+/** @} defgroup THREAD_INDEX */
+
+#endif //#ifndef THREAD_INDEX_H_
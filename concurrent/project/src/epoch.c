@@ -0,0 +1,395 @@
+/**
+ * @file    epoch.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implementation of grace-period based memory reclamation
+ *
+ * Every thread which touches the module is given a record, holding its
+ * announced epoch, its last quiescent state, and a list of retired pointers
+ * for each scheme. As with hazard pointers, records are kept in a global
+ * list which only ever grows, and are reused after their thread exits.
+ *
+ * @addtogroup EPOCH
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// This module
+#include "epoch.h"
+
+// Standard
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define EPOCH_CACHE_LINE        (64)    /**< Records are aligned to this many bytes */
+#define EPOCH_COLLECT_PERIOD    (64)    /**< Try to collect every time this many pointers are retired */
+#define EPOCH_LIMBO_INIT        (64)    /**< The initial size of a retired list */
+
+#define EPOCH_ACTIVE            ((uint_fast64_t) 0x01)  /**< Announcement bit for a thread in a critical section */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   A pointer waiting to be freed
+ */
+typedef struct epoch_retired_t_ {
+    void *              ptr;            /**< The retired pointer */
+    free_f_t            free_f;         /**< The function which frees it */
+    uint_fast64_t       tag;            /**< The epoch or counter value it was retired at */
+} epoch_retired_t;
+
+/**
+ * @brief   A list of retired pointers, in the order they were retired
+ */
+typedef struct epoch_limbo_t_ {
+    epoch_retired_t *   entries;        /**< The retired pointers */
+    size_t              count;          /**< The number of retired pointers */
+    size_t              size;           /**< The number of slots allocated */
+} epoch_limbo_t;
+
+/**
+ * @brief   Per-thread reclamation state
+ */
+typedef struct epoch_record_t_ {
+    _Alignas(EPOCH_CACHE_LINE)
+    atomic_uint_fast64_t        announce;       /**< (epoch << 1) | EPOCH_ACTIVE while in a critical section, 0 otherwise */
+    atomic_uint_fast64_t        quiescent;      /**< The last QSBR counter value observed while quiescent, or 0 if offline */
+    atomic_bool                 in_use;         /**< Whether a live thread owns this record */
+    struct epoch_record_t_ *    next;           /**< The next record. Never changes once published */
+    uint32_t                    nesting;        /**< EBR critical section depth */
+    epoch_limbo_t               limbo;          /**< Pointers retired through EBR */
+    epoch_limbo_t               qsbr_limbo;     /**< Pointers retired through QSBR */
+} epoch_record_t;
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static _Atomic(epoch_record_t *) epoch_records = NULL;
+
+static atomic_uint_fast64_t epoch_global = 1;
+
+static atomic_uint_fast64_t epoch_qsbr_counter = 1;
+
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t epoch_key;
+
+static _Thread_local epoch_record_t * epoch_record = NULL;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Gets the calling thread's record, acquiring one if necessary
+ *
+ * @return      The record, or NULL if memory allocation failed
+ */
+static inline epoch_record_t * epoch_record_get(void);
+
+/**
+ * @brief   Takes an unused record, or allocates and publishes a new one
+ *
+ * @return      The record, or NULL if memory allocation failed
+ */
+static epoch_record_t * epoch_record_acquire(void);
+
+/**
+ * @brief   Creates the key used to release records on thread exit
+ */
+static void epoch_key_create(void);
+
+/**
+ * @brief   Thread exit hook. Leaves any critical section, goes offline, and gives up the record
+ *
+ * @param[in] p_record:     The exiting thread's record
+ */
+static void epoch_record_release(void * p_record);
+
+/**
+ * @brief   Appends a pointer to a retired list
+ *
+ * @return      true if successful, false if memory allocation failed
+ */
+static bool epoch_limbo_push(epoch_limbo_t * limbo, void * ptr, free_f_t free_f, uint_fast64_t tag);
+
+/**
+ * @brief   Frees every entry of a retired list with a tag of at most safe_tag
+ */
+static void epoch_limbo_free(epoch_limbo_t * limbo, uint_fast64_t safe_tag);
+
+/**
+ * @brief   Advances the global epoch if every thread in a critical section has seen the current one
+ */
+static void epoch_try_advance(void);
+
+/**
+ * @brief   Finds the oldest counter value any online thread has been quiescent at
+ *
+ * @return      The minimum quiescent value, or the current counter if no thread is online
+ */
+static uint_fast64_t epoch_qsbr_min_quiescent(void);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+void epoch_enter(void)
+{
+    epoch_record_t * record = epoch_record_get();
+
+    if (!record) return;
+
+    // Announce the epoch we're running in. Sequentially consistent, so
+    // no loads in the critical section can be moved ahead of it
+    if ((record->nesting)++ == 0) {
+        uint_fast64_t epoch = atomic_load(&epoch_global);
+        atomic_store(&(record->announce), (epoch << 1) | EPOCH_ACTIVE);
+    }
+}
+
+void epoch_exit(void)
+{
+    epoch_record_t * record = epoch_record;
+
+    if (!record || !record->nesting) return;
+
+    if (--(record->nesting) == 0) atomic_store_explicit(&(record->announce), 0, memory_order_release);
+}
+
+uint32_t epoch_retire(void * ptr, free_f_t free_f)
+{
+    epoch_record_t * record = epoch_record_get();
+
+    // Check input
+    if (!record || !free_f) return 1;
+
+    // Tag it with the epoch it became unreachable in
+    if (!epoch_limbo_push(&(record->limbo), ptr, free_f, atomic_load(&epoch_global))) return 1;
+
+    // Periodically try to move things along
+    if (record->limbo.count % EPOCH_COLLECT_PERIOD == 0) epoch_collect();
+
+    // Success
+    return 0;
+}
+
+void epoch_collect(void)
+{
+    epoch_record_t * record = epoch_record;
+
+    if (!record) return;
+
+    epoch_try_advance();
+
+    // Anything retired two epochs ago can't be referenced by any critical section
+    uint_fast64_t epoch = atomic_load(&epoch_global);
+    epoch_limbo_free(&(record->limbo), epoch - 2);
+}
+
+size_t epoch_retired(void)
+{
+    epoch_record_t * record = epoch_record;
+
+    return record ? record->limbo.count : 0;
+}
+
+void epoch_qsbr_quiescent(void)
+{
+    epoch_record_t * record = epoch_record_get();
+
+    if (record) atomic_store(&(record->quiescent), atomic_load(&epoch_qsbr_counter));
+}
+
+void epoch_qsbr_online(void)
+{
+    epoch_record_t * record = epoch_record_get();
+
+    if (record && !atomic_load_explicit(&(record->quiescent), memory_order_relaxed)) {
+        atomic_store(&(record->quiescent), atomic_load(&epoch_qsbr_counter));
+    }
+}
+
+void epoch_qsbr_offline(void)
+{
+    epoch_record_t * record = epoch_record;
+
+    if (record) atomic_store_explicit(&(record->quiescent), 0, memory_order_release);
+}
+
+uint32_t epoch_qsbr_retire(void * ptr, free_f_t free_f)
+{
+    epoch_record_t * record = epoch_record_get();
+
+    // Check input
+    if (!record || !free_f) return 1;
+
+    // Every thread must observe a counter value newer than the current one
+    if (!epoch_limbo_push(&(record->qsbr_limbo), ptr, free_f, atomic_load(&epoch_qsbr_counter) + 1)) return 1;
+
+    // Periodically try to move things along
+    if (record->qsbr_limbo.count % EPOCH_COLLECT_PERIOD == 0) epoch_qsbr_collect();
+
+    // Success
+    return 0;
+}
+
+void epoch_qsbr_collect(void)
+{
+    epoch_record_t * record = epoch_record;
+
+    if (!record) return;
+
+    // Start a new grace period, so our retired pointers have something to wait for
+    atomic_fetch_add(&epoch_qsbr_counter, 1);
+
+    epoch_limbo_free(&(record->qsbr_limbo), epoch_qsbr_min_quiescent());
+}
+
+size_t epoch_qsbr_retired(void)
+{
+    epoch_record_t * record = epoch_record;
+
+    return record ? record->qsbr_limbo.count : 0;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static inline epoch_record_t * epoch_record_get(void)
+{
+    if (!epoch_record) epoch_record = epoch_record_acquire();
+
+    return epoch_record;
+}
+
+static epoch_record_t * epoch_record_acquire(void)
+{
+    epoch_record_t * record;
+
+    // Make sure we give the record back when this thread exits
+    pthread_once(&epoch_key_once, epoch_key_create);
+
+    // Try to reuse a record from a thread which has exited
+    for (record = atomic_load(&epoch_records); record; record = record->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&(record->in_use), &expected, true)) {
+            record->nesting = 0;
+            pthread_setspecific(epoch_key, record);
+            return record;
+        }
+    }
+
+    // Allocate a new one
+    record = (epoch_record_t *) aligned_alloc(EPOCH_CACHE_LINE, sizeof(epoch_record_t));
+    if (!record) return NULL;
+
+    // Initialize fields
+    atomic_init(&(record->announce), 0);
+    atomic_init(&(record->quiescent), 0);
+    atomic_init(&(record->in_use), true);
+    record->nesting = 0;
+    record->limbo.entries = NULL;
+    record->limbo.count = 0;
+    record->limbo.size = 0;
+    record->qsbr_limbo.entries = NULL;
+    record->qsbr_limbo.count = 0;
+    record->qsbr_limbo.size = 0;
+
+    // Push it onto the list. Records are never removed, so there is no ABA
+    record->next = atomic_load(&epoch_records);
+    while (!atomic_compare_exchange_weak(&epoch_records, &(record->next), record));
+
+    pthread_setspecific(epoch_key, record);
+
+    return record;
+}
+
+static void epoch_key_create(void)
+{
+    pthread_key_create(&epoch_key, epoch_record_release);
+}
+
+static void epoch_record_release(void * p_record)
+{
+    epoch_record_t * record = (epoch_record_t *) p_record;
+
+    // Stop holding anything up
+    record->nesting = 0;
+    atomic_store(&(record->announce), 0);
+    atomic_store(&(record->quiescent), 0);
+
+    // Free what we can. The rest is inherited by the next thread to take this record
+    epoch_record = record;
+    epoch_collect();
+    epoch_qsbr_collect();
+    epoch_record = NULL;
+
+    atomic_store(&(record->in_use), false);
+}
+
+static bool epoch_limbo_push(epoch_limbo_t * limbo, void * ptr, free_f_t free_f, uint_fast64_t tag)
+{
+    // Grow if necessary
+    if (limbo->count == limbo->size) {
+        size_t new_size = limbo->size ? limbo->size*2 : EPOCH_LIMBO_INIT;
+        epoch_retired_t * new_entries = (epoch_retired_t *) realloc(limbo->entries, new_size * sizeof(epoch_retired_t));
+        if (!new_entries) return false;
+
+        limbo->entries = new_entries;
+        limbo->size = new_size;
+    }
+
+    // Save it
+    limbo->entries[limbo->count].ptr = ptr;
+    limbo->entries[limbo->count].free_f = free_f;
+    limbo->entries[limbo->count].tag = tag;
+    (limbo->count)++;
+
+    return true;
+}
+
+static void epoch_limbo_free(epoch_limbo_t * limbo, uint_fast64_t safe_tag)
+{
+    size_t i;
+
+    // Tags never decrease, so everything safe is at the front
+    for (i = 0; i < limbo->count && limbo->entries[i].tag <= safe_tag; i++) {
+        limbo->entries[i].free_f(limbo->entries[i].ptr);
+    }
+
+    // Shift the rest down
+    size_t j;
+    for (j = 0; i < limbo->count; i++, j++) limbo->entries[j] = limbo->entries[i];
+    limbo->count = j;
+}
+
+static void epoch_try_advance(void)
+{
+    epoch_record_t * curr;
+    uint_fast64_t epoch = atomic_load(&epoch_global);
+
+    // Everyone in a critical section has to have seen this epoch
+    for (curr = atomic_load(&epoch_records); curr; curr = curr->next) {
+        uint_fast64_t announce = atomic_load(&(curr->announce));
+        if ((announce & EPOCH_ACTIVE) && (announce >> 1) != epoch) return;
+    }
+
+    // Fine if someone else beat us to it
+    atomic_compare_exchange_strong(&epoch_global, &epoch, epoch + 1);
+}
+
+static uint_fast64_t epoch_qsbr_min_quiescent(void)
+{
+    epoch_record_t * curr;
+    uint_fast64_t min = atomic_load(&epoch_qsbr_counter);
+
+    for (curr = atomic_load(&epoch_records); curr; curr = curr->next) {
+        uint_fast64_t quiescent = atomic_load(&(curr->quiescent));
+        if (quiescent && quiescent < min) min = quiescent;
+    }
+
+    return min;
+}
+
+/** @} addtogroup EPOCH */
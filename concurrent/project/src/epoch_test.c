@@ -0,0 +1,594 @@
+/**
+ * @file    epoch_test.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Unit test for grace-period based reclamation
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Module under test
+#include "epoch.h"
+
+// Standard Libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Modules
+#include "unit_test.h"
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define N_STRESS_RETIRES        (10000)
+#define N_THREADS               (8)
+#define N_SWAPS                 (20000)
+#define N_COLLECTS              (4)         // Enough to get through a grace period with nobody in the way
+
+#define MAX_RETIRED             (1024)
+#define CANARY                  (0xC0FFEE)
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static atomic_uint_fast32_t n_freed;
+
+static atomic_uintptr_t shared;
+
+static atomic_bool writers_done;
+
+static atomic_bool helper_ready;
+
+static atomic_bool helper_release;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Resets the counters
+ */
+static bool test_epoch_standard_pre(void** p_context, char** err_str);
+
+/**
+ * @brief   Frees anything left behind by the test
+ */
+static void test_epoch_standard_post(void* p_context);
+
+/**
+ * @brief   Free function which counts calls, and poisons the memory first
+ */
+static void counting_free(void* ptr);
+
+/**
+ * @brief   Allocates a canary for retiring
+ */
+static uint32_t* canary_create(void);
+
+/**
+ * @brief   Tests that a pointer isn't freed while another thread is in a critical section
+ */
+static bool test_epoch_protection(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that nested critical sections only end at the outermost exit
+ */
+static bool test_epoch_nesting(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that the number of retired pointers stays bounded
+ */
+static bool test_epoch_bounded(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that QSBR waits on every online thread to be quiescent
+ */
+static bool test_epoch_qsbr_protection(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests EBR readers against writers retiring what the readers are looking at
+ */
+static bool test_epoch_threading(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests QSBR readers against writers retiring what the readers are looking at
+ */
+static bool test_epoch_qsbr_threading(void* p_context, char** err_str);
+
+/**
+ * @brief   Runs readers and writers to completion
+ *
+ * @return  true if no reader saw freed memory
+ */
+static bool run_readers_writers(void* (*reader_f)(void*), void* (*writer_f)(void*));
+
+/**
+ * @brief   Sits in a critical section until told to leave
+ */
+static void* test_epoch_helper_thread_f(void* p_context);
+
+/**
+ * @brief   Stays online without being quiescent until told otherwise
+ */
+static void* test_epoch_qsbr_helper_thread_f(void* p_context);
+
+/**
+ * @brief   Repeatedly replaces the shared object, retiring the old one through EBR
+ */
+static void* test_epoch_writer_thread_f(void* p_context);
+
+/**
+ * @brief   Repeatedly replaces the shared object, retiring the old one through QSBR
+ */
+static void* test_epoch_qsbr_writer_thread_f(void* p_context);
+
+/**
+ * @brief   Repeatedly checks the shared object inside a critical section
+ */
+static void* test_epoch_reader_thread_f(void* p_context);
+
+/**
+ * @brief   Repeatedly checks the shared object, reporting quiescent states in between
+ */
+static void* test_epoch_qsbr_reader_thread_f(void* p_context);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+/**
+ * @brief   Test entry point
+ *
+ * @return  1 if one or more tests failed, 0 otherwise
+ */
+int main(void)
+{
+    uint32_t err;
+    unit_test_t epoch_tests;
+
+    // Allocate test structure
+    epoch_tests = unit_test_create("epoch");
+
+    // Register tests
+    unit_test_register(epoch_tests,
+                       "protection",
+                       test_epoch_standard_pre,
+                       test_epoch_protection,
+                       test_epoch_standard_post);
+    unit_test_register(epoch_tests,
+                       "nesting",
+                       test_epoch_standard_pre,
+                       test_epoch_nesting,
+                       test_epoch_standard_post);
+    unit_test_register(epoch_tests,
+                       "bounded",
+                       test_epoch_standard_pre,
+                       test_epoch_bounded,
+                       test_epoch_standard_post);
+    unit_test_register(epoch_tests,
+                       "quiescent protection",
+                       test_epoch_standard_pre,
+                       test_epoch_qsbr_protection,
+                       test_epoch_standard_post);
+    unit_test_register(epoch_tests,
+                       "threading",
+                       test_epoch_standard_pre,
+                       test_epoch_threading,
+                       test_epoch_standard_post);
+    unit_test_register(epoch_tests,
+                       "quiescent threading",
+                       test_epoch_standard_pre,
+                       test_epoch_qsbr_threading,
+                       test_epoch_standard_post);
+
+    // Run tests
+    if (unit_test_run(epoch_tests)) err = 1;
+    else                            err = 0;
+
+    // Free test structure
+    unit_test_free(epoch_tests);
+
+    return err;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static bool test_epoch_standard_pre(void** p_context, char** err_str)
+{
+    // Ensure params are good
+    if (!err_str) {
+        return false;
+    }
+    if (!p_context) {
+        *err_str = "!!! bad params !!!";
+        return false;
+    }
+
+    // No context needed
+    *p_context = NULL;
+    atomic_store(&n_freed, 0);
+    atomic_store(&shared, (uintptr_t) NULL);
+    atomic_store(&writers_done, false);
+    atomic_store(&helper_ready, false);
+    atomic_store(&helper_release, false);
+
+    *err_str = NULL;
+    return true;
+}
+
+static void test_epoch_standard_post(void* p_context)
+{
+    (void) p_context;
+    uint32_t i;
+
+    // Nobody else is running, so a few collections free everything
+    epoch_qsbr_offline();
+    for (i = 0; i < N_COLLECTS; i++) {
+        epoch_collect();
+        epoch_qsbr_collect();
+    }
+
+    // Free the shared object, if there is one
+    void* last = (void*) atomic_exchange(&shared, (uintptr_t) NULL);
+    if (last) free(last);
+}
+
+static void counting_free(void* ptr)
+{
+    *((uint32_t*) ptr) = 0;
+    free(ptr);
+    atomic_fetch_add(&n_freed, 1);
+}
+
+static uint32_t* canary_create(void)
+{
+    uint32_t* reference = (uint32_t*) malloc(sizeof(uint32_t));
+    if (reference) *reference = CANARY;
+
+    return reference;
+}
+
+static bool test_epoch_protection(void* p_context, char** err_str)
+{
+    uint32_t i;
+
+    uint32_t* reference = canary_create();
+    if (!reference) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+
+    // Get another thread into a critical section
+    pthread_t helper;
+    pthread_create(&helper, NULL, test_epoch_helper_thread_f, p_context);
+    while (!atomic_load(&helper_ready));
+
+    // Retire while it's in there
+    if (epoch_retire(reference, counting_free)) {
+        free(reference);
+        atomic_store(&helper_release, true);
+        pthread_join(helper, NULL);
+        *err_str = "retire failed";
+        return false;
+    }
+
+    // Collecting must leave it alone
+    for (i = 0; i < N_COLLECTS; i++) epoch_collect();
+    bool protected = (atomic_load(&n_freed) == 0 && epoch_retired() == 1 && *reference == CANARY);
+
+    // Let the helper leave
+    atomic_store(&helper_release, true);
+    pthread_join(helper, NULL);
+
+    if (!protected) {
+        *err_str = "pointer freed during critical section";
+        return false;
+    }
+
+    // Once it's gone, the pointer goes
+    for (i = 0; i < N_COLLECTS; i++) epoch_collect();
+    if (atomic_load(&n_freed) != 1 || epoch_retired() != 0) {
+        *err_str = "pointer not freed after critical section";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_epoch_nesting(void* p_context, char** err_str)
+{
+    (void) p_context;
+    uint32_t i;
+
+    uint32_t* reference = canary_create();
+    if (!reference) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+
+    // Retire from inside a nested critical section
+    epoch_enter();
+    epoch_enter();
+    if (epoch_retire(reference, counting_free)) {
+        free(reference);
+        epoch_exit();
+        epoch_exit();
+        *err_str = "retire failed";
+        return false;
+    }
+
+    // Leaving the inner section doesn't end the outer one
+    epoch_exit();
+    for (i = 0; i < N_COLLECTS; i++) epoch_collect();
+    if (atomic_load(&n_freed) != 0 || *reference != CANARY) {
+        epoch_exit();
+        *err_str = "pointer freed inside outer critical section";
+        return false;
+    }
+
+    // Leaving the outer one does
+    epoch_exit();
+    for (i = 0; i < N_COLLECTS; i++) epoch_collect();
+    if (atomic_load(&n_freed) != 1) {
+        *err_str = "pointer not freed after critical section";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_epoch_bounded(void* p_context, char** err_str)
+{
+    (void) p_context;
+    uint32_t i;
+
+    // Retire a lot of things through both schemes, without ever collecting explicitly
+    for (i = 0; i < N_STRESS_RETIRES; i++) {
+        uint32_t* reference = canary_create();
+        if (!reference || epoch_retire(reference, counting_free)) {
+            free(reference);
+            *err_str = "retire failed";
+            return false;
+        }
+
+        reference = canary_create();
+        if (!reference || epoch_qsbr_retire(reference, counting_free)) {
+            free(reference);
+            *err_str = "retire failed";
+            return false;
+        }
+
+        if (epoch_retired() > MAX_RETIRED || epoch_qsbr_retired() > MAX_RETIRED) {
+            *err_str = "retired list grew without bound";
+            return false;
+        }
+    }
+
+    // Everything that's gone was freed exactly once
+    if (atomic_load(&n_freed) + epoch_retired() + epoch_qsbr_retired() != 2*N_STRESS_RETIRES) {
+        *err_str = "retired pointer lost";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_epoch_qsbr_protection(void* p_context, char** err_str)
+{
+    uint32_t i;
+
+    uint32_t* reference = canary_create();
+    if (!reference) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+
+    // Bring another thread online
+    pthread_t helper;
+    pthread_create(&helper, NULL, test_epoch_qsbr_helper_thread_f, p_context);
+    while (!atomic_load(&helper_ready));
+
+    // Retire while it might be looking at it
+    if (epoch_qsbr_retire(reference, counting_free)) {
+        free(reference);
+        atomic_store(&helper_release, true);
+        pthread_join(helper, NULL);
+        *err_str = "retire failed";
+        return false;
+    }
+
+    // Collecting must leave it alone
+    for (i = 0; i < N_COLLECTS; i++) epoch_qsbr_collect();
+    bool protected = (atomic_load(&n_freed) == 0 && epoch_qsbr_retired() == 1 && *reference == CANARY);
+
+    // Let the helper go quiescent and exit
+    atomic_store(&helper_release, true);
+    pthread_join(helper, NULL);
+
+    if (!protected) {
+        *err_str = "pointer freed before a quiescent state";
+        return false;
+    }
+
+    // Now it goes
+    epoch_qsbr_collect();
+    if (atomic_load(&n_freed) != 1 || epoch_qsbr_retired() != 0) {
+        *err_str = "pointer not freed after a quiescent state";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_epoch_threading(void* p_context, char** err_str)
+{
+    (void) p_context;
+
+    if (!run_readers_writers(test_epoch_reader_thread_f, test_epoch_writer_thread_f)) {
+        *err_str = "reader saw freed memory";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_epoch_qsbr_threading(void* p_context, char** err_str)
+{
+    (void) p_context;
+
+    if (!run_readers_writers(test_epoch_qsbr_reader_thread_f, test_epoch_qsbr_writer_thread_f)) {
+        *err_str = "reader saw freed memory";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool run_readers_writers(void* (*reader_f)(void*), void* (*writer_f)(void*))
+{
+    uint32_t i;
+
+    // Start with something to look at
+    uint32_t* first = canary_create();
+    if (!first) return false;
+    atomic_store(&shared, (uintptr_t) first);
+
+    // Start readers and writers
+    pthread_t readers[N_THREADS];
+    pthread_t writers[N_THREADS];
+    for (i = 0; i < N_THREADS; i++) {
+        pthread_create(&(readers[i]), NULL, reader_f, NULL);
+        pthread_create(&(writers[i]), NULL, writer_f, NULL);
+    }
+
+    // Wait on writers, then tell readers to stop
+    bool success = true;
+    for (i = 0; i < N_THREADS; i++) {
+        void* err_val;
+        pthread_join(writers[i], &err_val);
+        if (err_val) success = false;
+    }
+    atomic_store(&writers_done, true);
+    for (i = 0; i < N_THREADS; i++) {
+        void* err_val;
+        pthread_join(readers[i], &err_val);
+        if (err_val) success = false;
+    }
+
+    return success;
+}
+
+static void* test_epoch_helper_thread_f(void* p_context)
+{
+    (void) p_context;
+
+    epoch_enter();
+    atomic_store(&helper_ready, true);
+    while (!atomic_load(&helper_release));
+    epoch_exit();
+
+    return (void*) 0;
+}
+
+static void* test_epoch_qsbr_helper_thread_f(void* p_context)
+{
+    (void) p_context;
+
+    epoch_qsbr_online();
+    atomic_store(&helper_ready, true);
+    while (!atomic_load(&helper_release));
+    epoch_qsbr_quiescent();
+
+    // Stays quiescent from here on, since exiting takes it offline
+    return (void*) 0;
+}
+
+static void* test_epoch_writer_thread_f(void* p_context)
+{
+    (void) p_context;
+    uint32_t i;
+
+    for (i = 0; i < N_SWAPS; i++) {
+        uint32_t* reference = canary_create();
+        if (!reference) return (void*) 1;
+
+        // Swap it in. The old one is now unreachable, so retire it
+        void* old = (void*) atomic_exchange(&shared, (uintptr_t) reference);
+        if (epoch_retire(old, counting_free)) {
+            free(old);
+            return (void*) 1;
+        }
+    }
+
+    return (void*) 0;
+}
+
+static void* test_epoch_qsbr_writer_thread_f(void* p_context)
+{
+    (void) p_context;
+    uint32_t i;
+
+    for (i = 0; i < N_SWAPS; i++) {
+        uint32_t* reference = canary_create();
+        if (!reference) return (void*) 1;
+
+        // Swap it in. The old one is now unreachable, so retire it
+        void* old = (void*) atomic_exchange(&shared, (uintptr_t) reference);
+        if (epoch_qsbr_retire(old, counting_free)) {
+            free(old);
+            return (void*) 1;
+        }
+    }
+
+    return (void*) 0;
+}
+
+static void* test_epoch_reader_thread_f(void* p_context)
+{
+    (void) p_context;
+
+    while (!atomic_load(&writers_done)) {
+        epoch_enter();
+
+        // Poisoned means it was freed while we held it
+        uint32_t* reference = (uint32_t*) atomic_load(&shared);
+        if (*reference != CANARY) {
+            epoch_exit();
+            return (void*) 1;
+        }
+
+        epoch_exit();
+    }
+
+    return (void*) 0;
+}
+
+static void* test_epoch_qsbr_reader_thread_f(void* p_context)
+{
+    (void) p_context;
+
+    epoch_qsbr_online();
+    while (!atomic_load(&writers_done)) {
+        // Poisoned means it was freed while we held it
+        uint32_t* reference = (uint32_t*) atomic_load(&shared);
+        if (*reference != CANARY) {
+            epoch_qsbr_offline();
+            return (void*) 1;
+        }
+
+        epoch_qsbr_quiescent();
+    }
+    epoch_qsbr_offline();
+
+    return (void*) 0;
+}
@@ -4,501 +4,2908 @@
  *
  * @brief   Implements a concurrent hashtable
  *
- * <Add more details>
+ * A lock-free split-ordered list: every element sits in one linked list,
+ * sorted by its hash bit-reversed, so each bucket is a contiguous run headed
+ * by a sentinel node, and doubling the table splits every run in place.
+ *
+ * A key is removed by claiming its node's element (swapping in ELEM_REMOVED),
+ * marking the node, which freezes its next field, and unlinking it. Claiming
+ * the element is the removal, so a replacement in place can't race past it.
+ * Anyone who runs into a claimed or marked node helps finish the job, and
+ * whoever unlinks it retires it through the table's reclamation scheme.
+ *
+ * Sentinels are found through a directory of segments, each as big as all the
+ * ones before it, so growing only allocates a segment and bumps the width.
+ * Buckets other than 0 are initialized lazily, by searching from their parent
+ * bucket. Shrinking lowers the width and marks, unlinks and retires the
+ * sentinels of the buckets dropped; a search from one of those fails, and is
+ * retried from the bucket the new width gives. Their segment is then retired
+ * too, and a bucket whose segment is gone is searched from its parent. Under
+ * hazard pointers, a sentinel is protected as it's loaded, and rechecked
+ * against its slot, whose segment is protected the same way.
+ *
+ * Iterators and parallel scans walk the list in split order, searching again
+ * from the bucket if their position has been removed between steps.
+ *
+ * The element count, failed CASes (with the adaptive backoff level) and, unless
+ * HASHTABLE_STATS is 0, operation and search statistics are striped across
+ * cache lines by thread. Every GROW_CHECK_PERIOD elements a stripe gains or
+ * loses, its thread adds up the stripes and resizes the table if it needs to.
+ * Retired node bytes are striped apart from the table, since nodes can be freed
+ * after it is.
+ *
+ * A table created with combining puts a flat combiner in front of single
+ * insertions and removals: threads publish their operation in a slot, and
+ * whichever takes the lock applies every pending one in a sorted pass.
+ * Tables created with another engine (see hashtable_engine.h) have no list:
+ * this file checks arguments, hashes keys and enters the reclamation scheme,
+ * and the engine does the rest, one key at a time for batches and walks.
  *
  * @addtogroup HASHTABLE
  * @{
  */
 
-/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Module
+#include "hashtable.h"
+
+// Standard Libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+// Other modules
+#include "hashtable_node.h"
+#include "hashtable_engine.h"
+#include "reference_list.h"
+#include "hazard_pointer.h"
+#include "epoch.h"
+#include "thread_index.h"
+#include "spinlock.h"
+ 
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define HASH_WIDTH_INIT         (2)             /**< The initial hash size */
+#define HASH_WIDTH_MAX          (32)            /**< Bucket indices are 32 bits, so there can't be more buckets than this allows */
+#define HASH_SEGMENTS           (HASH_WIDTH_MAX - HASH_WIDTH_INIT + 1)  /**< The number of directory segments */
+
+#define CACHE_LINE              (64)            /**< Counter stripes are aligned to this many bytes */
+#define COUNTER_STRIPES         (16)            /**< The number of element count stripes. Must be a power of two */
+#define GROW_LOAD               (2)             /**< The table doubles once it has more than this many elements per bucket */
+#define GROW_CHECK_PERIOD       (64)            /**< Insertions (or removals) on a stripe between checks for growth (or shrinking). Must be a power of two */
+#define SHRINK_LOAD_INV         (4)             /**< The table halves once it has this many buckets per element */
+
+#define BATCH_RADIX_BITS        (8)             /**< Bits of split-order key sorted on per pass over a batch */
+#define BATCH_RADIX             (1 << BATCH_RADIX_BITS)
+#define BATCH_RADIX_PASSES      (64 / BATCH_RADIX_BITS)
+
+#define GET_MANY_GROUP          (16)            /**< Lookups hashtable_get_many keeps in flight at once */
+#define GET_MANY_HAZARD_GROUP   ((HAZARD_ITER - HAZARD_GROUP) / 2)  /**< The same, under hazard pointers, where each takes a pair of slots */
+
+#define ELEM_REMOVED(h)         ((hashtable_elem_t) (h)->retired) /**< Element of a node of h's whose key has been removed */
+
+#define HAZARD_CURR             (0)             /**< Hazard slot protecting the node being examined */
+#define HAZARD_PREV             (1)             /**< Hazard slot protecting its predecessor */
+#define HAZARD_START            (2)             /**< Hazard slot protecting the node a search starts from: a sentinel, or where a batch resumes */
+#define HAZARD_NEW              (3)             /**< Hazard slot protecting a sentinel being inserted */
+#define HAZARD_SEGMENT          (4)             /**< Hazard slot protecting the directory segment of the bucket last looked up */
+#define HAZARD_GROUP            (HASHTABLE_ENGINE_HAZARD_SLOTS) /**< First of the pairs of hazard slots hashtable_get_many gives the lookups in a group */
+#define HAZARD_ITER             (HASHTABLE_ENGINE_HAZARD_ITER)  /**< Hazard slot protecting an iterator's position between steps. Not cleared by other operations */
+
+#define SCAN_RANGES_PER_THREAD  (4)             /**< Ranges per thread in a parallel scan, so uneven ranges even out */
+
+#define COMBINE_SLOTS           (64)            /**< Publication slots in a flat combiner. Must be a power of two */
+
+#define BACKOFF_MIN             (1)             /**< Pauses after the first failed CAS in a row */
+#define BACKOFF_MAX             (1024)          /**< Most pauses after any failed CAS */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   A directory slot, pointing to a bucket's sentinel
+ */
+typedef _Atomic(hashtable_node_t) hashtable_bucket_t;
+
+/**
+ * @brief   One stripe of the element count and statistics, alone on its cache lines
+ */
+typedef struct hashtable_counter_t_ {
+    _Alignas(CACHE_LINE)
+    atomic_int_fast64_t         count;                      /**< Insertions minus removals by the threads on this stripe */
+    atomic_uint_fast64_t        cas_failures;               /**< Failed CASes by the threads on this stripe */
+    atomic_uint_fast32_t        backoff;                    /**< Pauses an adaptive backoff starts from on this stripe */
+    atomic_uint_fast64_t        inserts;                    /**< Keys inserted (or put) by the threads on this stripe */
+    atomic_uint_fast64_t        gets;                       /**< Keys looked up by the threads on this stripe */
+    atomic_uint_fast64_t        removes;                    /**< Keys removed by the threads on this stripe */
+    atomic_uint_fast64_t        searches;                   /**< List searches by the threads on this stripe */
+    atomic_uint_fast64_t        search_steps;               /**< Nodes those searches stepped past */
+    atomic_uint_fast64_t        search_max;                 /**< Most nodes any one of them stepped past */
+} hashtable_counter_t;
+
+/**
+ * @brief   One stripe of a table's retired node bytes, alone on its cache line
+ */
+typedef struct hashtable_retired_stripe_t_ {
+    _Alignas(CACHE_LINE)
+    atomic_int_fast64_t         bytes;                      /**< Bytes retired minus bytes freed by the threads on this stripe */
+} hashtable_retired_stripe_t;
+
+/**
+ * @brief   A table's retired node bytes
+ *
+ * Allocated apart from the table, since nodes retired under hazard pointers or
+ * epochs can be freed after the table is. Each retired node's element points
+ * here, so the free callback can find it. Once the table is freed only
+ * subtractions remain, so when the stripes add up to zero nothing will touch
+ * it again
+ */
+typedef struct hashtable_retired_t_ {
+    hashtable_retired_stripe_t  stripes[COUNTER_STRIPES];   /**< Retired minus freed bytes, striped by thread */
+    struct hashtable_retired_t_ * next;                     /**< The next orphan, once its table has been freed */
+} hashtable_retired_t;
+
+/**
+ * @brief   The operations counted for hashtable_get_stats
+ */
+typedef enum {
+    STATS_INSERT = 0,                                       /**< Counted in inserts */
+    STATS_GET,                                              /**< Counted in gets */
+    STATS_REMOVE,                                           /**< Counted in removes */
+} hashtable_stats_op_t;
+
+/**
+ * @brief   How far a lookup in a hashtable_get_many group has got
+ */
+typedef enum {
+    LOOKUP_WALKING = 0,                                     /**< Still stepping through its bucket */
+    LOOKUP_DONE,                                            /**< Found its key, or where it would be */
+    LOOKUP_RETRY,                                           /**< Ran into a removal or a shrink, and has to search the usual way */
+} hashtable_lookup_state_t;
+
+/**
+ * @brief   One lookup of a hashtable_get_many group, walked a node at a time
+ */
+typedef struct hashtable_lookup_t_ {
+    uint64_t                    hash;                       /**< The key's hash */
+    uint64_t                    so_key;                     /**< The key's split-order key */
+    hashtable_node_t            prev;                       /**< The last node stepped past, or the bucket's sentinel */
+    hashtable_node_t            curr;                       /**< The node after prev, fetched and waiting to be looked at */
+    hashtable_elem_t            elem;                       /**< Gets the element, once done */
+    uint32_t                    slot;                       /**< The hazard slot holding the node protected last. The other of its pair holds the one before */
+    uint32_t                    steps;                      /**< Nodes stepped past */
+    hashtable_lookup_state_t    state;                      /**< How far it has got */
+} hashtable_lookup_t;
+
+/**
+ * @brief   One key of a batched operation
+ */
+typedef struct hashtable_batch_entry_t_ {
+    uint64_t                    so_key;                     /**< The key's split-order key, which the batch is sorted by */
+    uint64_t                    hash;                       /**< The key's hash */
+    size_t                      index;                      /**< The key's position in the caller's arrays */
+} hashtable_batch_entry_t;
+
+/**
+ * @brief   The states of a flat combining slot
+ */
+typedef enum {
+    COMBINE_FREE = 0,                                       /**< Nobody's using it */
+    COMBINE_CLAIMED,                                        /**< Its thread is filling in an operation */
+    COMBINE_PENDING,                                        /**< The operation is waiting for a combiner */
+    COMBINE_DONE,                                           /**< The operation has been applied, and its result filled in */
+} hashtable_combine_state_t;
+
+/**
+ * @brief   An operation published for a combiner, alone on its cache line
+ */
+typedef struct hashtable_combine_slot_t_ {
+    _Alignas(CACHE_LINE)
+    atomic_uint                 state;                      /**< A hashtable_combine_state_t */
+    bool                        remove;                     /**< Whether it's a removal, rather than an insertion */
+    hashtable_key_t             key;                        /**< The key */
+    uint64_t                    hash;                       /**< The key's hash */
+    hashtable_elem_t            elem;                       /**< The element to insert. Gets the removed element, for removals */
+    bool                        success;                    /**< Gets whether an insertion succeeded */
+} hashtable_combine_slot_t;
+
+/**
+ * @brief   Flat combining state
+ */
+typedef struct hashtable_combiner_t_ {
+    spinlock_ttas_t             lock;                       /**< Held by the thread applying everyone's operations */
+    atomic_uint                 n_used;                     /**< Slots below this have been used. Thread indices are dense, so it stays small */
+    hashtable_combine_slot_t    slots[COMBINE_SLOTS];       /**< Published operations, by thread stripe */
+} hashtable_combiner_t;
+
+/**
+ * @brief   A position in a walk over a table
+ */
+struct hashtable_iter_t_ {
+    hashtable_t                 h;                          /**< The table being walked */
+    hashtable_node_t            curr;                       /**< The last node visited, or the sentinel the walk started from */
+    uint64_t                    first;                      /**< The walk skips nodes before this split-order key, if it started from an ancestor's sentinel */
+    uint64_t                    last;                       /**< The walk ends after this split-order key */
+    bool                        done;                       /**< Whether the walk has ended */
+    void *                      state;                      /**< The engine's iterator, for tables with an engine */
+};
+
+/**
+ * @brief   Shared state for a parallel scan
+ */
+typedef struct hashtable_scan_t_ {
+    hashtable_t                 h;                          /**< The table being scanned */
+    for_each_f_t                fn;                         /**< Called on each element */
+    void *                      arg;                        /**< Passed through to fn */
+    uint32_t                    range_bits;                 /**< The split-order key space is split into 2^range_bits ranges */
+    atomic_uint_fast32_t        next_range;                 /**< The next range to be claimed */
+    atomic_size_t               visited;                    /**< The number of elements visited so far */
+    void *                      snapshot;                   /**< What the engine's scan walks, for tables with an engine */
+} hashtable_scan_t;
+
+/**
+ * @brief   The basic data structure for a hash table
+ */
+struct hashtable_t_ {
+    hashtable_counter_t         counters[COUNTER_STRIPES];  /**< The number of elements stored in the table, striped by thread */
+    atomic_uint_fast32_t        hash_width;                 /**< The number of bits in the hash actually used for binning */
+    uint32_t                    min_width;                  /**< The table never shrinks below this width */
+    _Atomic(hashtable_bucket_t *) segments[HASH_SEGMENTS];  /**< The bucket directory. Segments are never moved, but those above the minimum width are retired by shrinks */
+    hash_f_t                    hash_f;                     /**< The function used to hash keys */
+    hash64_f_t                  hash64_f;                   /**< The function used to hash keys, if it isn't NULL */
+    eq_f_t                      eq_f;                       /**< The function used to compare keys with the same hash, or NULL */
+    print_f_t                   print_f;                    /**< The function used to print elements */
+    free_f_t                    free_f;                     /**< The function used to free elements */
+    hashtable_reclaim_t         reclaim;                    /**< How removed nodes are reclaimed */
+    reference_list_t            saved_nodes;                /**< Removed nodes, when they aren't reclaimed until the table is freed */
+    const hashtable_engine_ops_t * engine;                  /**< The engine, or NULL for the split-ordered list */
+    void *                      table;                      /**< The engine's table */
+    hashtable_combiner_t *      combiner;                   /**< Flat combining state, or NULL if operations go straight to the table */
+    hashtable_retired_t *       retired;                    /**< Bytes of the table's retired nodes. Its address is ELEM_REMOVED */
+    hashtable_backoff_t         backoff;                    /**< What to do after a failed CAS */
+    atomic_uint_fast64_t        sentinels;                  /**< Sentinels linked into the list */
+    atomic_uint_fast64_t        resizes;                    /**< Times the width has changed */
+    atomic_uint_fast64_t        resize_ns;                  /**< Time spent changing it */
+};
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static pthread_mutex_t hashtable_orphans_lock = PTHREAD_MUTEX_INITIALIZER;   /**< Protects hashtable_orphans */
+static hashtable_retired_t * hashtable_orphans = NULL;                          /**< Retired byte counts of freed tables whose nodes aren't all freed */
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Looks for a node with a given key
+ *
+ * Starts from the hash's bucket, initializing it if necessary, and
+ * searches with hashtable_list_find
+ *
+ * Batched operations pass the prev from their last search as resume. If it
+ * still sorts between the bucket's sentinel and key, and hasn't been removed,
+ * the search starts there instead, so a sorted batch makes one pass over the list
+ *
+ * @param[in] h:            The hashtable to search
+ * @param[in] hash:         The key's hash
+ * @param[in] key:          The key to search for
+ * @param[in] resume:       A protected node to try starting from, or NULL
+ * @param[out] curr:        Will point to a node with the given key, or the one after its spot
+ * @param[out] prev:        Points to the node before curr
+ */
+static inline void hashtable_find_location(hashtable_t h, uint64_t hash, hashtable_key_t key, hashtable_node_t resume, hashtable_node_t * curr, hashtable_node_t * prev);
+
+/**
+ * @brief   Inserts a single element
+ *
+ * Must be called between hashtable_reclaim_enter and hashtable_reclaim_exit. Doesn't
+ * adjust the element count
+ *
+ * @param[in,out] h:        The hashtable to modify
+ * @param[in] hash:         The key's hash
+ * @param[in] key:          The key to insert under
+ * @param[in] elem:         The element to insert
+ * @param[in] compute_f:    If not NULL, makes the element to insert instead, only once
+ *                          key has been found absent
+ * @param[in,out] resume:   Where to start searching, as for hashtable_find_location. Set
+ *                          to where the next key in split order can start
+ * @param[out] present:     If not NULL, gets the element at key afterwards, whether
+ *                          inserted or already there
+ *
+ * @return      true if elem was inserted, false if key was present or memory allocation failed
+ */
+static inline bool hashtable_insert_at(hashtable_t h, uint64_t hash, hashtable_key_t key, hashtable_elem_t elem, compute_f_t compute_f, hashtable_node_t * resume, hashtable_elem_t * present);
+
+/**
+ * @brief   Removes a single element
+ *
+ * Must be called between hashtable_reclaim_enter and hashtable_reclaim_exit. Doesn't
+ * adjust the element count
+ *
+ * @param[in,out] h:        The hashtable to modify
+ * @param[in] hash:         The key's hash
+ * @param[in] key:          The key to remove
+ * @param[in,out] resume:   Where to start searching, as for hashtable_find_location. Set
+ *                          to where the next key in split order can start
+ *
+ * @return      The removed element, or NULL if key wasn't present
+ */
+static inline hashtable_elem_t hashtable_remove_at(hashtable_t h, uint64_t hash, hashtable_key_t key, hashtable_node_t * resume);
+
+/**
+ * @brief   Reads a node's element, unless its key has been removed
+ *
+ * A node whose element has been claimed by a remover is marked, so the
+ * caller's next search helps unlink it
+ *
+ * @param[in] node:         The node to read. Must be protected
+ * @param[out] elem:        Gets the node's element, if it's live
+ *
+ * @return      true if the node is live, false if it has been removed
+ */
+static inline bool hashtable_live_elem(hashtable_t h, hashtable_node_t node, hashtable_elem_t * elem);
+
+/**
+ * @brief   Starts a walk over part of the table
+ *
+ * Must be called after hashtable_reclaim_enter, which stays in effect until
+ * hashtable_iter_end
+ *
+ * @param[out] it:          The iterator to set up
+ * @param[in] h:            The table to walk
+ * @param[in] bucket:       The walk starts at this bucket's sentinel
+ * @param[in] last:         The walk ends after this split-order key
+ */
+static void hashtable_iter_init(hashtable_iter_t it, hashtable_t h, uint32_t bucket, uint64_t last);
+
+/**
+ * @brief   Steps an iterator to the next live element
+ *
+ * @param[in,out] it:       The iterator
+ * @param[out] key:         Gets the element's key
+ * @param[out] elem:        Gets the element
+ *
+ * @return      true if there was one, false if the walk is over
+ */
+static bool hashtable_iter_step(hashtable_iter_t it, hashtable_key_t * key, hashtable_elem_t * elem);
+
+/**
+ * @brief   Finds the first node after a split-order key, searching from its bucket
+ *
+ * @param[in] h:            The table to search
+ * @param[in] so_key:       The split-order key of a node which has been removed
+ *
+ * @return      The first node past so_key, protected, or NULL if there is none
+ */
+static hashtable_node_t hashtable_iter_resume(hashtable_t h, uint64_t so_key);
+
+/**
+ * @brief   Ends a walk, and the reclamation section it was in
+ *
+ * @param[in,out] it:       The iterator
+ */
+static void hashtable_iter_end(hashtable_iter_t it);
+
+/**
+ * @brief   Claims and walks ranges of a parallel scan until there are none left
+ *
+ * @param[in,out] scan:     The scan
+ */
+static void hashtable_scan_ranges(hashtable_scan_t * scan);
+
+/**
+ * @brief   A parallel scan's helper thread. Pitches in, then goes offline
+ *
+ * Only for threads the scan started: the caller may have references of its
+ * own, which going offline would stop protecting under QSBR
+ *
+ * @param[in,out] p_scan:   The hashtable_scan_t
+ */
+static void * hashtable_scan_thread_f(void * p_scan);
+
+/**
+ * @brief   Claims ranges of a parallel scan over an engine's table, and has the engine walk them
+ *
+ * Must be called between hashtable_reclaim_enter and hashtable_reclaim_exit
+ *
+ * @param[in,out] scan:     The scan
+ */
+static void hashtable_scan_engine(hashtable_scan_t * scan);
+
+/**
+ * @brief   Hashes a batch of keys, and sorts them into split order
+ *
+ * Sorted with an LSD radix sort, skipping digits every key shares. Those are
+ * common, since 32 bit hashes leave half the split-order key empty
+ *
+ * @param[in] h:            The hashtable the keys are for
+ * @param[in] keys:         The first key
+ * @param[in] stride:       The distance between keys, in bytes
+ * @param[in] n:            The number of keys
+ *
+ * @return      n sorted batch entries, or NULL if memory allocation failed. Free with free()
+ */
+static hashtable_batch_entry_t * hashtable_batch_sort(hashtable_t h, const hashtable_key_t * keys, size_t stride, size_t n);
+
+/**
+ * @brief   Links every pair into a new table's list, in one pass
+ *
+ * The nodes, and the sentinels of every bucket but 0 (which must already be in
+ * place), come out of a single block, laid out in list order
+ *
+ * @param[in,out] h:        The table, which no other thread can see yet. Its
+ *                          width must already be what it will start with
+ * @param[in] pairs:        The pairs to link in
+ * @param[in] n:            The number of pairs
+ *
+ * @return      true if successful, false if memory allocation failed, in
+ *              which case the table is unchanged
+ */
+static bool hashtable_build(hashtable_t h, const hashtable_pair_t * pairs, size_t n);
+
+/**
+ * @brief   Checks whether a sorted batch entry's key is the same as an earlier one's
+ *
+ * @param[in] h:            The hashtable the keys are for
+ * @param[in] batch:        The sorted batch entries
+ * @param[in] i:            The entry to check
+ * @param[in] keys:         The first key, as for hashtable_batch_sort
+ * @param[in] stride:       The distance between keys, as for hashtable_batch_sort
+ *
+ * @return      true if an earlier entry has the same key
+ */
+static inline bool hashtable_batch_duplicate(hashtable_t h, const hashtable_batch_entry_t * batch, size_t i, const hashtable_key_t * keys, size_t stride);
+
+/**
+ * @brief   Looks for a position in the list, starting from a sentinel
+ *
+ * Steps through the hashtable list until it finds a node at so_key with a matching key. If that
+ * node is in the table, curr will point to it at return. If it isn't, curr will point to the node
+ * after where it should go, and prev the one before it
+ *
+ * Regular nodes sharing a split-order key aren't in any particular order, so they're all checked
+ * with the table's eq_f. A new node goes after all of them, which keeps two insertions of the same
+ * key racing for the same link
+ *
+ * Marked nodes met along the way are unlinked and retired. If that fails, the list changed
+ * under us, and the search starts over. If start itself has been marked, the search gives up
+ *
+ * Must be called between hashtable_reclaim_enter and hashtable_reclaim_exit, which keep curr
+ * and prev from being freed. With hazard pointers, prev was unmarked and linked to curr at
+ * some point during the search; other schemes skip that check, and prev may be marked.
+ * curr was unmarked when it was passed, but may have been marked since
+ *
+ * @param[in] h:            The hashtable to search
+ * @param[in] start:        A sentinel, or a protected node, sorting before so_key
+ * @param[in] so_key:       The split-order key to search for
+ * @param[in] key:          The key to search for. Ignored when searching for a sentinel
+ * @param[out] curr:        Will point to a node at so_key, or the one after its spot
+ * @param[out] prev:        Points to the node before curr
+ *
+ * @return      true if the search finished, false if start was removed
+ */
+static inline bool hashtable_list_find(hashtable_t h, hashtable_node_t start, uint64_t so_key, hashtable_key_t key, hashtable_node_t * curr, hashtable_node_t * prev);
+
+/**
+ * @brief   Hashes a key with whichever hash function the table was given
+ *
+ * @param[in] h:            The hashtable
+ * @param[in] key:          The key to hash
+ *
+ * @return      The key's hash
+ */
+static inline uint64_t hashtable_hash(hashtable_t h, hashtable_key_t key);
+
+/**
+ * @brief   Gets a bucket's sentinel, initializing the bucket if nobody has yet
+ *
+ * Must be called between hashtable_reclaim_enter and hashtable_reclaim_exit. Under
+ * hazard pointers, the sentinel is protected in HAZARD_START
+ *
+ * @param[in] h:            The hashtable
+ * @param[in] bucket:       The bucket. If the table has shrunk below it since,
+ *                          it is initialized again, as long as its segment
+ *                          hasn't been retired
+ *
+ * @return      The bucket's sentinel. If memory for it couldn't be allocated, or
+ *              its segment is gone, the sentinel of the closest initialized
+ *              ancestor, which is just as valid a place to start searching
+ */
+static inline hashtable_node_t hashtable_bucket_sentinel(hashtable_t h, uint32_t bucket);
+
+/**
+ * @brief   Gets a bucket's sentinel, if it has one
+ *
+ * @param[in] h:            The hashtable
+ * @param[in] bucket:       The bucket
+ *
+ * @return      The bucket's sentinel, protected as for hashtable_bucket_sentinel,
+ *              or NULL if the bucket isn't initialized, or its sentinel is being taken down
+ */
+static inline hashtable_node_t hashtable_bucket_load(hashtable_t h, uint32_t bucket);
+
+/**
+ * @brief   Gets whatever is in a bucket's directory slot, protected
+ *
+ * Whoever unlinks a sentinel clears its slot before retiring it, so once the
+ * sentinel is protected, finding it still in the slot means it can be read.
+ * It may be marked, and on its way out, so this doesn't read it at all
+ *
+ * @param[in] h:            The hashtable
+ * @param[in] bucket:       The bucket
+ * @param[in] slot:         The hazard slot to protect it in, under hazard pointers
+ *
+ * @return      The sentinel, or NULL if the bucket isn't initialized or its
+ *              segment is gone
+ */
+static inline hashtable_node_t hashtable_bucket_protect(hashtable_t h, uint32_t bucket, uint32_t slot);
+
+/**
+ * @brief   Inserts a bucket's sentinel, starting from its parent's
+ *
+ * @see hashtable_bucket_sentinel
+ */
+static hashtable_node_t hashtable_bucket_init(hashtable_t h, uint32_t bucket);
+
+/**
+ * @brief   Bookkeeping for a sentinel that has just been unlinked, before it's retired
+ *
+ * Clears its directory slot, if a shrink hasn't yet, so no sentinel that can
+ * be freed is ever found there, and stops counting it
+ *
+ * @param[in] h:            The hashtable
+ * @param[in] sentinel:     The sentinel
+ */
+static inline void hashtable_sentinel_unlinked(hashtable_t h, hashtable_node_t sentinel);
+
+/**
+ * @brief   Starts an operation which dereferences nodes
+ *
+ * @param[in] h:        The hashtable being operated on
+ */
+static inline void hashtable_reclaim_enter(hashtable_t h);
+
+/**
+ * @brief   Ends an operation started with hashtable_reclaim_enter
+ *
+ * Leaves an open iterator's hazard slot alone
+ *
+ * @param[in] h:        The hashtable being operated on
+ */
+static inline void hashtable_reclaim_exit(hashtable_t h);
+
+/**
+ * @brief   Hands an unlinked node over to be freed once no thread can be looking at it
+ *
+ * @param[in] h:        The hashtable node was removed from
+ * @param[in] node:     The node to retire
+ */
+static inline void hashtable_reclaim_retire(hashtable_t h, hashtable_node_t node);
+
+/**
+ * @brief   Finds a bucket's directory slot
+ *
+ * A shrink can retire the segments above the minimum width, so under hazard
+ * pointers the slot's segment is protected in HAZARD_SEGMENT, until the next
+ * call. Otherwise, it stays valid until hashtable_reclaim_exit
+ *
+ * @param[in] h:        The hashtable
+ * @param[in] bucket:   The bucket index
+ *
+ * @return      The slot holding the bucket's sentinel, or NULL if its segment
+ *              hasn't been allocated, or has been retired
+ */
+static inline hashtable_bucket_t * hashtable_bucket(hashtable_t h, uint32_t bucket);
+
+/**
+ * @brief   Checks a slot from hashtable_bucket is still in the directory
+ *
+ * @param[in] h:        The hashtable
+ * @param[in] bucket:   The bucket index
+ * @param[in] b:        The slot hashtable_bucket gave for it
+ *
+ * @return      true if the slot's segment hasn't been retired
+ */
+static inline bool hashtable_bucket_linked(hashtable_t h, uint32_t bucket, hashtable_bucket_t * b);
+
+/**
+ * @brief   Prefetches a bucket's directory slot, without protecting its segment
+ *
+ * @param[in] h:        The hashtable
+ * @param[in] bucket:   The bucket index
+ */
+static inline void hashtable_bucket_prefetch(hashtable_t h, uint32_t bucket);
+
+/**
+ * @brief   Makes sure the segment holding buckets [2^width, 2^(width+1)) is allocated
+ *
+ * @param[in,out] h:    The hashtable
+ * @param[in] width:    The current hash width
+ *
+ * @return      true if the segment exists, false if memory allocation failed
+ */
+static bool hashtable_segment_alloc(hashtable_t h, uint32_t width);
+
+/**
+ * @brief   Retires the segment holding buckets [2^width, 2^(width+1)), once a shrink has emptied it
+ *
+ * Does nothing without reclamation, where segments are kept until the table is
+ * freed. If the table has grown back over it, a fresh one takes its place
+ *
+ * @param[in,out] h:    The hashtable
+ * @param[in] width:    The width the table shrank to
+ */
+static void hashtable_segment_retire(hashtable_t h, uint32_t width);
+
+/**
+ * @brief   Adjusts the element count, growing or shrinking the table if its load is out of bounds
+ *
+ * @param[in,out] h:    The hashtable
+ * @param[in] delta:    The number of insertions, or minus the number of removals
+ */
+static inline void hashtable_count(hashtable_t h, int_fast64_t delta);
+
+/**
+ * @brief   Doubles the number of buckets until there are at least half as many as elements
+ *
+ * @param[in,out] h:    The hashtable
+ */
+static void hashtable_grow(hashtable_t h);
+
+/**
+ * @brief   Halves the number of buckets, if there are SHRINK_LOAD_INV times as many as elements
+ *
+ * Takes down the sentinels of the buckets no longer in use
+ *
+ * @param[in,out] h:    The hashtable
+ */
+static void hashtable_shrink(hashtable_t h);
+
+/**
+ * @brief   Counts a failed CAS, then waits as long as the table's backoff says to
+ *
+ * @param[in,out] h:        The hashtable
+ * @param[in,out] pauses:   The pauses waited after the operation's last failure.
+ *                          Start it at 0
+ */
+static inline void hashtable_backoff(hashtable_t h, uint32_t * pauses);
+
+/**
+ * @brief   Tells an adaptive backoff an operation is done, so it can adjust its stripe's level
+ *
+ * @param[in,out] h:        The hashtable
+ * @param[in] pauses:       The pauses waited after the operation's last failure, or
+ *                          0 if none failed
+ */
+static inline void hashtable_backoff_done(hashtable_t h, uint32_t pauses);
+
+/**
+ * @brief   Counts keys passed to an operation, on the calling thread's stripe
+ *
+ * @param[in,out] h:        The hashtable
+ * @param[in] op:           The operation
+ * @param[in] n:            The number of keys
+ */
+static inline void hashtable_stats_op(hashtable_t h, hashtable_stats_op_t op, size_t n);
+
+/**
+ * @brief   Records the length of a list search, on the calling thread's stripe
+ *
+ * @param[in,out] h:        The hashtable
+ * @param[in] steps:        The nodes it stepped past
+ */
+static inline void hashtable_stats_search(hashtable_t h, uint64_t steps);
+
+/**
+ * @brief   Gets a timestamp for timing resizes
+ *
+ * @return      The time in ns, from some arbitrary point
+ */
+static inline uint64_t hashtable_stats_now(void);
+
+/**
+ * @brief   Records a resize
+ *
+ * @param[in,out] h:        The hashtable
+ * @param[in] start:        When it started, from hashtable_stats_now
+ */
+static inline void hashtable_stats_resize(hashtable_t h, uint64_t start);
+
+/**
+ * @brief   Gets the mask selecting a hash's bucket
+ *
+ * @param[in] width:    The hash width
+ *
+ * @return      A mask of the low width bits
+ */
+static inline uint32_t hashtable_width_mask(uint32_t width);
+
+/**
+ * @brief   Finds the width a table needs to hold capacity elements without growing
+ *
+ * @param[in] capacity:     The number of elements expected
+ *
+ * @return      The width, never less than HASH_WIDTH_INIT
+ */
+static uint32_t hashtable_capacity_width(size_t capacity);
+
+/**
+ * @brief   Allocates every directory segment a new table needs, out to width
+ *
+ * @param[in,out] h:        The table, which no other thread can see yet
+ * @param[in] width:        The width the table will start with
+ *
+ * @return      true if successful, false if memory allocation failed. Anything
+ *              allocated before a failure is still freed by hashtable_free
+ */
+static bool hashtable_prebuild(hashtable_t h, uint32_t width);
+
+/**
+ * @brief   Gets the operations of a table engine
+ *
+ * @param[in] engine:   The engine
+ *
+ * @return      Its operations, or NULL for the split-ordered list, which is built in
+ */
+static const hashtable_engine_ops_t * hashtable_engine_ops(hashtable_engine_t engine);
+
+/**
+ * @brief   Inserts every pair into a new engine table, in order
+ *
+ * @param[in,out] h:        The table, which no other thread can see yet
+ * @param[in] pairs:        The pairs to insert
+ * @param[in] n:            The number of pairs
+ *
+ * @return      true if successful, false if memory allocation failed. Pairs
+ *              already inserted stay in the table
+ */
+static bool hashtable_engine_build(hashtable_t h, const hashtable_pair_t * pairs, size_t n);
+
+/**
+ * @brief   Gets the value at h[key] in an engine table, inserting one made by compute_f if there is none
+ *
+ * @see hashtable_compute_if_absent
+ */
+static hashtable_elem_t hashtable_engine_compute(hashtable_t h, uint64_t hash, hashtable_key_t key, compute_f_t compute_f);
+
+/**
+ * @brief   Allocates flat combining state, with every slot free
+ *
+ * @return      The combiner, or NULL if memory allocation failed
+ */
+static hashtable_combiner_t * hashtable_combiner_create(void);
+
+/**
+ * @brief   Hands an insertion or removal to the table's combiner, and waits for it
+ *
+ * Publishes the operation in the calling thread's slot, then waits for it to
+ * be applied, taking the combiner's role whenever it's free. The element
+ * count is adjusted for it
+ *
+ * @param[in,out] h:        The hashtable, which must have a combiner
+ * @param[in] remove:       Whether to remove key, rather than insert it
+ * @param[in] hash:         The key's hash
+ * @param[in] key:          The key
+ * @param[in,out] elem:     The element to insert. Gets the removed element, or
+ *                          NULL, for removals
+ * @param[out] success:     Gets whether an insertion succeeded
+ *
+ * @return      true if the operation was applied, false if another thread
+ *              sharing the slot had it, in which case nothing was done
+ */
+static bool hashtable_combine(hashtable_t h, bool remove, uint64_t hash, hashtable_key_t key, hashtable_elem_t * elem, bool * success);
+
+/**
+ * @brief   Applies every pending operation in the table's combiner
+ *
+ * The operations are sorted into list order, and each search picks up where
+ * the last left off, as for hashtable_insert_many. Must hold the combiner's lock
+ *
+ * @param[in,out] h:        The hashtable
+ */
+static void hashtable_combine_apply(hashtable_t h);
+
+/**
+ * @brief   Allocates a table's retired byte count, with every stripe at zero
+ *
+ * @return      The count, or NULL if it couldn't be allocated
+ */
+static hashtable_retired_t * hashtable_retired_create(void);
+
+/**
+ * @brief   Adds up a table's retired byte count
+ *
+ * @param[in] r:            The count
+ *
+ * @return      Bytes retired but not yet freed
+ */
+static int_fast64_t hashtable_retired_bytes(hashtable_retired_t * r);
+
+/**
+ * @brief   Hands over a freed table's retired byte count
+ *
+ * It joins the orphans, and every orphan whose nodes have all been freed is
+ * freed in turn
+ *
+ * @param[in] r:            The count, or NULL
+ */
+static void hashtable_retired_release(hashtable_retired_t * r);
+
+/**
+ * @brief   Steps a hashtable_get_many lookup from prev to its successor, and fetches it
+ *
+ * Under hazard pointers the successor is protected in the other slot of the
+ * lookup's pair, so prev stays protected until it has been checked against
+ *
+ * @param[in,out] l:        The lookup, with prev protected
+ * @param[in] hazard:       Whether the table uses hazard pointers
+ */
+static inline void hashtable_lookup_advance(hashtable_lookup_t * l, bool hazard);
+
+/**
+ * @brief   Looks at the node a hashtable_get_many lookup fetched last
+ *
+ * Finishes the lookup if it's the key, or past where the key would be, and
+ * steps past it otherwise
+ *
+ * @param[in] h:            The hashtable
+ * @param[in,out] l:        The lookup, with curr protected and fetched
+ * @param[in] key:          The key being looked up
+ * @param[in] hazard:       Whether the table uses hazard pointers
+ */
+static inline void hashtable_lookup_examine(hashtable_t h, hashtable_lookup_t * l, hashtable_key_t key, bool hazard);
+
+/**
+ * @brief   Wrapper for hashtable_node_free, matching the generic free_f_t signature
+ *
+ * Takes the node off its table's retired bytes first
+ *
+ * @see hashtable_node_free
+ */
+static void hashtable_node_generic_free(void* elem);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+hashtable_t hashtable_create(hash_f_t hash_f, print_f_t print_f, free_f_t free_f)
+{
+    return hashtable_create_with_config(hash_f, print_f, free_f, NULL);
+}
+
+hashtable_t hashtable_create_with_capacity(hash_f_t hash_f, print_f_t print_f, free_f_t free_f, size_t capacity)
+{
+    hashtable_config_t config;
+
+    hashtable_config_init(&config);
+    config.capacity = capacity;
+
+    return hashtable_create_with_config(hash_f, print_f, free_f, &config);
+}
+
+hashtable_t hashtable_create_from(const hashtable_pair_t * pairs, size_t n, hash_f_t hash_f, print_f_t print_f, free_f_t free_f, const hashtable_config_t * config)
+{
+    hashtable_config_t sized;
+
+    // Check input
+    if (n && !pairs) return NULL;
+
+    // Sized to hold every pair
+    if (config)     sized = *config;
+    else            hashtable_config_init(&sized);
+    if (sized.capacity < n) sized.capacity = n;
+
+    hashtable_t h = hashtable_create_with_config(hash_f, print_f, free_f, &sized);
+    if (!h) return NULL;
+
+    // Fill it. The elements are still the caller's if that fails
+    if (!(h->engine ? hashtable_engine_build(h, pairs, n) : hashtable_build(h, pairs, n))) {
+        h->free_f = NULL;
+        hashtable_free(h);
+        return NULL;
+    }
+
+    return h;
+}
+
+void hashtable_config_init(hashtable_config_t * config)
+{
+    if (!config) return;
+
+    config->reclaim = HASHTABLE_RECLAIM_HAZARD;
+    config->hash64_f = NULL;
+    config->eq_f = NULL;
+    config->capacity = 0;
+    config->engine = HASHTABLE_ENGINE_LIST;
+    config->combine = false;
+    config->backoff = HASHTABLE_BACKOFF_NONE;
+}
+
+hashtable_t hashtable_create_with_config(hash_f_t hash_f, print_f_t print_f, free_f_t free_f, const hashtable_config_t * config)
+{
+    uint_fast32_t i;
+    hashtable_config_t defaults;
+
+    // Fill in missing config
+    if (!config) {
+        hashtable_config_init(&defaults);
+        config = &defaults;
+    }
+
+    // Check config
+    if (config->reclaim > HASHTABLE_RECLAIM_NONE) return NULL;
+    if (config->engine > HASHTABLE_ENGINE_STRIPED) return NULL;
+    if (config->backoff > HASHTABLE_BACKOFF_ADAPTIVE) return NULL;
+    if (!hash_f && !config->hash64_f) return NULL;
+
+    // Allocate memory. Aligned, so the counter stripes don't share cache lines
+    hashtable_t h = (hashtable_t) aligned_alloc(CACHE_LINE, sizeof(struct hashtable_t_));
+    if (!h) return NULL;
+
+    // Initialize pointer fields
+    for (i = 0; i < HASH_SEGMENTS; i++) atomic_init(&(h->segments[i]), NULL);
+    h->saved_nodes = NULL;
+    h->free_f = NULL;
+    h->engine = hashtable_engine_ops(config->engine);
+    h->reclaim = (h->engine && h->engine->locked) ? HASHTABLE_RECLAIM_NONE : config->reclaim;
+    h->table = NULL;
+    h->combiner = NULL;
+    h->retired = NULL;
+    h->backoff = config->backoff;
+    atomic_init(&(h->sentinels), 0);
+    atomic_init(&(h->resizes), 0);
+    atomic_init(&(h->resize_ns), 0);
+
+    // Every engine counts its operations on the stripes
+    for (i = 0; i < COUNTER_STRIPES; i++) {
+        atomic_init(&(h->counters[i].count), 0);
+        atomic_init(&(h->counters[i].cas_failures), 0);
+        atomic_init(&(h->counters[i].backoff), 0);
+        atomic_init(&(h->counters[i].inserts), 0);
+        atomic_init(&(h->counters[i].gets), 0);
+        atomic_init(&(h->counters[i].removes), 0);
+        atomic_init(&(h->counters[i].searches), 0);
+        atomic_init(&(h->counters[i].search_steps), 0);
+        atomic_init(&(h->counters[i].search_max), 0);
+    }
+    h->hash_f = hash_f;
+    h->hash64_f = config->hash64_f;
+    h->eq_f = config->eq_f;
+    h->print_f = print_f;
+
+    // Writers can take turns through a combiner, whatever the engine
+    if (config->combine) {
+        h->combiner = hashtable_combiner_create();
+        if (!h->combiner) {
+            // Clean up struct
+            hashtable_free(h);
+
+            // Failure
+            return NULL;
+        }
+    }
+
+    // Other engines keep everything else to themselves
+    if (h->engine) {
+        h->table = h->engine->create(config);
+        if (!h->table) {
+            // Clean up struct
+            hashtable_free(h);
+
+            // Failure
+            return NULL;
+        }
+
+        h->free_f = free_f;
+        return h;
+    }
+
+    // Allocate the first segment of the directory
+    hashtable_bucket_t * first_segment = (hashtable_bucket_t *) calloc(1 << HASH_WIDTH_INIT, sizeof(hashtable_bucket_t));
+    if (!first_segment) {
+        // Clean up struct
+        hashtable_free(h);
+
+        // Failure
+        return NULL;
+    }
+    atomic_init(&(h->segments[0]), first_segment);
+
+    // Removed nodes are counted, and told apart, by this
+    h->retired = hashtable_retired_create();
+    if (!h->retired) {
+        // Clean up struct
+        hashtable_free(h);
+
+        // Failure
+        return NULL;
+    }
+
+    // Removed nodes are kept around, if they won't be reclaimed
+    if (h->reclaim == HASHTABLE_RECLAIM_NONE) {
+        h->saved_nodes = reference_list_create(hashtable_node_generic_free);
+        if (!h->saved_nodes) {
+            // Clean up struct
+            hashtable_free(h);
+
+            // Failure
+            return NULL;
+        }
+    }
+
+    // Allocate the first bucket's sentinel. The rest are created when they're first used
+    hashtable_node_t sentinel = hashtable_node_create_sentinel(0);
+    if (!sentinel) {
+        // Clean up struct
+        hashtable_free(h);
+
+        // Failure
+        return NULL;
+    }
+    atomic_init(&(first_segment[0]), sentinel);
+    atomic_init(&(h->sentinels), 1);
+
+    // Start out big enough for the capacity asked for
+    uint32_t width = hashtable_capacity_width(config->capacity);
+    if (!hashtable_prebuild(h, width)) {
+        // Clean up struct
+        hashtable_free(h);
+
+        // Failure
+        return NULL;
+    }
+
+    // Initialize remaining fields
+    atomic_init(&(h->hash_width), width);
+    h->min_width    = width;
+    h->free_f       = free_f;
+
+    // Success
+    return h;
+}
+
+void hashtable_free(hashtable_t h)
+{
+    hashtable_node_t curr;
+    hashtable_node_t next;
+
+    if (h) {
+        // Free element list
+        curr = atomic_load(&(h->segments[0])) ? atomic_load(hashtable_bucket(h, 0)) : NULL;
+        while (curr) {
+            next = hashtable_node_get_next(curr);
+            hashtable_elem_t elem = hashtable_node_get_elem(curr);
+            if (h->free_f && !hashtable_node_is_sentinel(curr) && elem != ELEM_REMOVED(h)) h->free_f(elem);
+            hashtable_node_free(curr);
+            curr = next;
+        }
+
+        // Free the directory
+        uint32_t i;
+        for (i = 0; i < HASH_SEGMENTS; i++) free(atomic_load(&(h->segments[i])));
+
+        // Free all saved references
+        if (h->saved_nodes) reference_list_free(h->saved_nodes);
+
+        // Or the engine's table, elements and all
+        if (h->table) h->engine->free(h->table, h->free_f);
+        free(h->combiner);
+
+        // Free whatever this thread retired that nobody is still looking at
+        switch (h->reclaim) {
+        case HASHTABLE_RECLAIM_HAZARD:  hazard_pointer_scan();   break;
+        case HASHTABLE_RECLAIM_EPOCH:   epoch_collect();         break;
+        case HASHTABLE_RECLAIM_QSBR:    epoch_qsbr_collect();    break;
+        case HASHTABLE_RECLAIM_NONE:                             break;
+        }
+
+        // Nodes still waiting to be freed count themselves out, so this outlives the table
+        hashtable_retired_release(h->retired);
+
+        // Free table
+        free(h);
+    }
+}
+
+bool hashtable_contains(hashtable_t h, hashtable_key_t key)
+{
+    // Get the element
+    hashtable_elem_t dummy = hashtable_get(h, key);
+
+    // If it's not null, it's in the table
+    return dummy != NULL;
+}
+
+bool hashtable_insert(hashtable_t h, hashtable_key_t key, hashtable_elem_t elem)
+{
+    hashtable_node_t resume = NULL;
+
+    // Check input
+    if (!h) return false;
+
+    // Get the key's hash
+    uint64_t hash;
+    hash = hashtable_hash(h, key);
+
+    hashtable_stats_op(h, STATS_INSERT, 1);
+
+    // Have the combiner insert it, if there is one
+    bool success;
+    if (h->combiner && hashtable_combine(h, false, hash, key, &elem, &success)) return success;
+
+    // Insert it
+    hashtable_reclaim_enter(h);
+    success = h->engine ? h->engine->insert(h->table, key, hash, elem, NULL) : hashtable_insert_at(h, hash, key, elem, NULL, &resume, NULL);
+    hashtable_reclaim_exit(h);
+
+    // Increase element count. Engines count for themselves
+    if (success && !h->engine) hashtable_count(h, 1);
+
+    return success;
+}
+
+size_t hashtable_insert_many(hashtable_t h, const hashtable_key_t * keys, const hashtable_elem_t * elems, size_t n)
+{
+    hashtable_node_t resume = NULL;
+    size_t inserted = 0;
+    size_t i;
+
+    // Check input
+    if (!h || !keys || !elems) return 0;
+
+    // Sort into list order. If we can't, or there's no list, do them one at a time
+    hashtable_batch_entry_t * batch = h->engine ? NULL : hashtable_batch_sort(h, keys, sizeof(hashtable_key_t), n);
+    if (!batch) {
+        for (i = 0; i < n; i++) inserted += hashtable_insert(h, keys[i], elems[i]) ? 1 : 0;
+        return inserted;
+    }
+    hashtable_stats_op(h, STATS_INSERT, n);
+
+    // Each search picks up where the last left off
+    hashtable_reclaim_enter(h);
+    for (i = 0; i < n; i++) {
+        size_t index = batch[i].index;
+        if (hashtable_insert_at(h, batch[i].hash, keys[index], elems[index], NULL, &resume, NULL)) inserted++;
+    }
+    hashtable_reclaim_exit(h);
+    free(batch);
+
+    // Increase element count, all at once
+    if (inserted) hashtable_count(h, (int_fast64_t) inserted);
+
+    return inserted;
+}
+
+hashtable_elem_t hashtable_put(hashtable_t h, hashtable_key_t key, hashtable_elem_t elem)
+{
+    hashtable_node_t resume = NULL;
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    hashtable_node_t node = NULL;
+    hashtable_elem_t old = NULL;
+    uint32_t pauses = 0;
+    bool replaced = false;
+    bool inserted = false;
+
+    // Check input
+    if (!h) return NULL;
+
+    // Get the key's hash
+    uint64_t hash = hashtable_hash(h, key);
+    uint64_t so_key = hashtable_node_split_order_key(hash, false);
+    hashtable_stats_op(h, STATS_INSERT, 1);
+
+    if (h->engine) {
+        hashtable_reclaim_enter(h);
+        old = h->engine->put(h->table, key, hash, elem);
+        hashtable_reclaim_exit(h);
+        return old;
+    }
+
+    hashtable_reclaim_enter(h);
+    while (!replaced && !inserted) {
+        // Find the appropriate place in the table
+        hashtable_find_location(h, hash, key, resume, &curr, &prev);
+        resume = prev;
+
+        // Present, so swap the element in place. If the key is removed first,
+        // searching again unlinks it, and we insert instead
+        if (curr && hashtable_node_get_so_key(curr) == so_key) {
+            while (!replaced && hashtable_live_elem(h, curr, &old)) {
+                replaced = hashtable_node_cas_elem(curr, old, elem);
+                if (!replaced) hashtable_backoff(h, &pauses);
+            }
+            continue;
+        }
+
+        // Absent. A node is only created once, and is reused across failed CAS attempts
+        if (!node) {
+            node = hashtable_node_create(key, elem, hash);
+            if (!node) break;
+        }
+        hashtable_node_set_next(node, curr);
+        inserted = hashtable_node_cas_next(prev, curr, node);
+        if (!inserted) hashtable_backoff(h, &pauses);
+    }
+    hashtable_reclaim_exit(h);
+    hashtable_backoff_done(h, pauses);
+
+    // Tidy up
+    if (inserted)   hashtable_count(h, 1);
+    else            hashtable_node_free(node);
+
+    return replaced ? old : NULL;
+}
+
+bool hashtable_replace_if(hashtable_t h, hashtable_key_t key, hashtable_elem_t expected, hashtable_elem_t new_elem)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    hashtable_elem_t elem;
+    uint32_t pauses = 0;
+    bool replaced = false;
+
+    // Check input
+    if (!h) return false;
+
+    // Get the key's hash
+    uint64_t hash = hashtable_hash(h, key);
+
+    if (h->engine) {
+        hashtable_reclaim_enter(h);
+        replaced = h->engine->replace_if(h->table, key, hash, expected, new_elem);
+        hashtable_reclaim_exit(h);
+        return replaced;
+    }
+
+    // Search table
+    hashtable_reclaim_enter(h);
+    hashtable_find_location(h, hash, key, NULL, &curr, &prev);
+
+    // Swap, as long as it's present and still holds what we expect
+    if (curr && hashtable_node_get_so_key(curr) == hashtable_node_split_order_key(hash, false)) {
+        while (!replaced && hashtable_live_elem(h, curr, &elem) && elem == expected) {
+            replaced = hashtable_node_cas_elem(curr, expected, new_elem);
+            if (!replaced) hashtable_backoff(h, &pauses);
+        }
+    }
+    hashtable_reclaim_exit(h);
+
+    return replaced;
+}
+
+hashtable_elem_t hashtable_compute_if_absent(hashtable_t h, hashtable_key_t key, compute_f_t compute_f)
+{
+    hashtable_node_t resume = NULL;
+    hashtable_elem_t present;
+
+    // Check input
+    if (!h || !compute_f) return NULL;
+
+    // Get the key's hash
+    uint64_t hash = hashtable_hash(h, key);
+    hashtable_stats_op(h, STATS_INSERT, 1);
+
+    if (h->engine) return hashtable_engine_compute(h, hash, key, compute_f);
+
+    // Insert, computing the element only if we get that far
+    hashtable_reclaim_enter(h);
+    bool inserted = hashtable_insert_at(h, hash, key, NULL, compute_f, &resume, &present);
+    hashtable_reclaim_exit(h);
+
+    // Increase element count
+    if (inserted) hashtable_count(h, 1);
+
+    return present;
+}
+
+hashtable_elem_t hashtable_get(hashtable_t h, hashtable_key_t key)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    hashtable_elem_t elem;
+    uint64_t hash;
+
+    // Generate hash
+    hash = hashtable_hash(h, key);
+    hashtable_stats_op(h, STATS_GET, 1);
+
+    // Search table
+    hashtable_reclaim_enter(h);
+    if (h->engine) {
+        elem = h->engine->get(h->table, key, hash);
+    }
+    else {
+        hashtable_find_location(h, hash, key, NULL, &curr, &prev);
+
+        // Check if key is present. Read the element while curr is still protected
+        if (!curr || hashtable_node_get_so_key(curr) != hashtable_node_split_order_key(hash, false) || !hashtable_live_elem(h, curr, &elem)) {
+            elem = NULL;
+        }
+    }
+    hashtable_reclaim_exit(h);
+
+    return elem;
+}
+
+size_t hashtable_get_many(hashtable_t h, const hashtable_key_t * keys, hashtable_elem_t * elems, size_t n)
+{
+    hashtable_lookup_t lookups[GET_MANY_GROUP];
+    bool hazard;
+    bool walking;
+    size_t found = 0;
+    size_t base;
+    size_t group;
+    size_t max_group;
+    size_t i;
+
+    // Check input
+    if (!h || !keys || !elems) return 0;
+    hazard = (h->reclaim == HASHTABLE_RECLAIM_HAZARD);
+    hashtable_stats_op(h, STATS_GET, n);
+
+    // Engines have no chain of misses to overlap
+    if (h->engine) {
+        hashtable_reclaim_enter(h);
+        for (i = 0; i < n; i++) {
+            elems[i] = h->engine->get(h->table, keys[i], hashtable_hash(h, keys[i]));
+            if (elems[i]) found++;
+        }
+        hashtable_reclaim_exit(h);
+        return found;
+    }
+
+    // Each lookup is a chain of dependent misses: directory slot, sentinel, then
+    // nodes. Take a group of lookups through the chain together, a link at a
+    // time, prefetching the next link for all of them before waiting on any.
+    // Under hazard pointers each lookup keeps its own pair of slots, so fewer fit
+    max_group = hazard ? GET_MANY_HAZARD_GROUP : GET_MANY_GROUP;
+    hashtable_reclaim_enter(h);
+    for (base = 0; base < n; base += group) {
+        group = (n - base < max_group) ? n - base : max_group;
+
+        // Every bucket below 2^width has its segment allocated
+        uint32_t width = atomic_load_explicit(&(h->hash_width), memory_order_acquire);
+        uint32_t mask = hashtable_width_mask(width);
+
+        // Hash, and fetch the directory slots
+        for (i = 0; i < group; i++) {
+            hashtable_lookup_t * l = &(lookups[i]);
+            l->hash = hashtable_hash(h, keys[base + i]);
+            l->so_key = hashtable_node_split_order_key(l->hash, false);
+            l->elem = NULL;
+            l->slot = HAZARD_GROUP + 2*i;
+            l->steps = 0;
+            hashtable_bucket_prefetch(h, ((uint32_t) l->hash) & mask);
+        }
+
+        // Protect the sentinels, and fetch them. An uninitialized bucket is
+        // left to the usual search, which initializes it
+        for (i = 0; i < group; i++) {
+            hashtable_lookup_t * l = &(lookups[i]);
+            l->prev = hashtable_bucket_protect(h, ((uint32_t) l->hash) & mask, l->slot);
+            l->state = l->prev ? LOOKUP_WALKING : LOOKUP_RETRY;
+            if (l->prev) __builtin_prefetch(l->prev);
+        }
+
+        // Step to the first node in each bucket, and fetch it
+        for (i = 0; i < group; i++) {
+            if (lookups[i].state == LOOKUP_WALKING) hashtable_lookup_advance(&(lookups[i]), hazard);
+        }
+
+        // Look at each lookup's node while everyone else's next one is on its
+        // way in, until they've all found their key or where it would be
+        do {
+            walking = false;
+            for (i = 0; i < group; i++) {
+                if (lookups[i].state != LOOKUP_WALKING) continue;
+                hashtable_lookup_examine(h, &(lookups[i]), keys[base + i], hazard);
+                if (lookups[i].state == LOOKUP_WALKING) walking = true;
+            }
+        } while (walking);
+
+        // Any which ran into a removal or a shrink start over the usual way
+        for (i = 0; i < group; i++) {
+            hashtable_lookup_t * l = &(lookups[i]);
+            if (l->state == LOOKUP_RETRY) {
+                hashtable_key_t key = keys[base + i];
+                hashtable_node_t prev;
+                hashtable_node_t curr;
+
+                hashtable_find_location(h, l->hash, key, NULL, &curr, &prev);
+                if (!curr || hashtable_node_get_so_key(curr) != l->so_key || !hashtable_live_elem(h, curr, &(l->elem))) l->elem = NULL;
+            }
+
+            elems[base + i] = l->elem;
+            if (l->elem) found++;
+        }
+    }
+    if (hazard) hazard_pointer_clear_range(HAZARD_GROUP, 2 * GET_MANY_HAZARD_GROUP);
+    hashtable_reclaim_exit(h);
+
+    return found;
+}
+
+hashtable_elem_t hashtable_remove(hashtable_t h, hashtable_key_t key)
+{
+    hashtable_node_t resume = NULL;
+    uint64_t hash;
+
+    // Generate hash
+    hash = hashtable_hash(h, key);
+    hashtable_stats_op(h, STATS_REMOVE, 1);
+
+    // Have the combiner remove it, if there is one
+    hashtable_elem_t elem = NULL;
+    bool success;
+    if (h->combiner && hashtable_combine(h, true, hash, key, &elem, &success)) return elem;
+
+    // Remove it
+    hashtable_reclaim_enter(h);
+    elem = h->engine ? h->engine->remove(h->table, key, hash) : hashtable_remove_at(h, hash, key, &resume);
+    hashtable_reclaim_exit(h);
+
+    // Decrement the number of elements. Engines count for themselves
+    if (elem && !h->engine) hashtable_count(h, -1);
+
+    // Pass back the element
+    return elem;
+}
+
+size_t hashtable_remove_many(hashtable_t h, const hashtable_key_t * keys, hashtable_elem_t * elems, size_t n)
+{
+    hashtable_node_t resume = NULL;
+    size_t removed = 0;
+    size_t i;
+
+    // Check input
+    if (!h || !keys) return 0;
+
+    // Sort into list order. If we can't, or there's no list, do them one at a time
+    hashtable_batch_entry_t * batch = h->engine ? NULL : hashtable_batch_sort(h, keys, sizeof(hashtable_key_t), n);
+    if (!batch) {
+        for (i = 0; i < n; i++) {
+            hashtable_elem_t elem = hashtable_remove(h, keys[i]);
+            if (elems) elems[i] = elem;
+            if (elem) removed++;
+        }
+        return removed;
+    }
+    hashtable_stats_op(h, STATS_REMOVE, n);
+
+    // Each search picks up where the last left off
+    hashtable_reclaim_enter(h);
+    for (i = 0; i < n; i++) {
+        size_t index = batch[i].index;
+        hashtable_elem_t elem = hashtable_remove_at(h, batch[i].hash, keys[index], &resume);
+        if (elems) elems[index] = elem;
+        if (elem) removed++;
+    }
+    hashtable_reclaim_exit(h);
+    free(batch);
+
+    // Decrement the number of elements, all at once
+    if (removed) hashtable_count(h, -(int_fast64_t) removed);
+
+    return removed;
+}
+
+hashtable_iter_t hashtable_iter_create(hashtable_t h)
+{
+    // Check input
+    if (!h) return NULL;
+
+    // Allocate iterator
+    hashtable_iter_t it = (hashtable_iter_t) malloc(sizeof(struct hashtable_iter_t_));
+    if (!it) return NULL;
+
+    hashtable_reclaim_enter(h);
+
+    // Walk the whole list, or have the engine walk its table
+    if (!h->engine) {
+        hashtable_iter_init(it, h, 0, UINT64_MAX);
+        return it;
+    }
+
+    it->h = h;
+    it->done = false;
+    it->state = h->engine->iter_create(h->table);
+    if (!it->state) {
+        hashtable_iter_end(it);
+        free(it);
+        return NULL;
+    }
+
+    return it;
+}
+
+bool hashtable_iter_next(hashtable_iter_t it, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    hashtable_key_t dummy_key;
+    hashtable_elem_t dummy_elem;
+
+    // Check input
+    if (!it) return false;
+
+    if (it->state) return it->h->engine->iter_next(it->state, key ? key : &dummy_key, elem ? elem : &dummy_elem);
+    return hashtable_iter_step(it, key ? key : &dummy_key, elem ? elem : &dummy_elem);
+}
+
+void hashtable_iter_free(hashtable_iter_t it)
+{
+    if (it) {
+        if (it->state) it->h->engine->iter_free(it->state);
+        hashtable_iter_end(it);
+        free(it);
+    }
+}
+
+size_t hashtable_parallel_for_each(hashtable_t h, uint32_t n_threads, for_each_f_t fn, void * arg)
+{
+    hashtable_scan_t scan;
+    uint32_t n_spawned = 0;
+    uint32_t i;
+
+    // Check input
+    if (!h || !fn) return 0;
+    if (n_threads == 0) n_threads = 1;
+
+    // A few ranges per thread, but in the list every range has to start at a bucket
+    uint32_t width = h->engine ? HASH_WIDTH_MAX - 1 : atomic_load_explicit(&(h->hash_width), memory_order_acquire);
+    scan.h = h;
+    scan.fn = fn;
+    scan.arg = arg;
+    scan.range_bits = 0;
+    while (scan.range_bits < width && (UINT64_C(1) << scan.range_bits) < (uint64_t) n_threads * SCAN_RANGES_PER_THREAD) scan.range_bits++;
+    atomic_init(&(scan.next_range), 0);
+    atomic_init(&(scan.visited), 0);
+    scan.snapshot = NULL;
+
+    // An engine's scan walks whatever it pins down here, so it stays pinned until everyone's done
+    if (h->engine) {
+        hashtable_reclaim_enter(h);
+        scan.snapshot = h->engine->scan_begin(h->table);
+    }
+
+    // Start helpers. If some can't be started, the rest take up the slack
+    pthread_t * threads = (n_threads > 1) ? (pthread_t *) malloc((n_threads - 1) * sizeof(pthread_t)) : NULL;
+    if (threads) {
+        for (i = 0; i < n_threads - 1; i++) {
+            if (pthread_create(&(threads[n_spawned]), NULL, hashtable_scan_thread_f, &scan) == 0) n_spawned++;
+        }
+    }
+
+    // Pitch in, then wait for everyone else
+    if (h->engine)  hashtable_scan_engine(&scan);
+    else            hashtable_scan_ranges(&scan);
+    for (i = 0; i < n_spawned; i++) pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (h->engine) {
+        if (h->engine->scan_end) h->engine->scan_end(h->table, scan.snapshot);
+        if (h->reclaim == HASHTABLE_RECLAIM_HAZARD) hazard_pointer_clear_range(HAZARD_ITER, 1);
+        hashtable_reclaim_exit(h);
+    }
+
+    return atomic_load(&(scan.visited));
+}
+
+size_t hashtable_size_approx(hashtable_t h)
+{
+    int_fast64_t total = 0;
+    uint32_t i;
+
+    if (!h) return 0;
+    if (h->engine) return h->engine->size(h->table);
+
+    // Stripes are read at slightly different times, so this can be off
+    // by however many operations are in flight
+    for (i = 0; i < COUNTER_STRIPES; i++) total += atomic_load_explicit(&(h->counters[i].count), memory_order_relaxed);
+
+    return total > 0 ? (size_t) total : 0;
+}
+
+uint64_t hashtable_cas_failures(hashtable_t h)
+{
+    uint64_t total = 0;
+    uint32_t i;
+
+    if (!h || h->engine) return 0;
+
+    for (i = 0; i < COUNTER_STRIPES; i++) total += atomic_load_explicit(&(h->counters[i].cas_failures), memory_order_relaxed);
+
+    return total;
+}
+
+void hashtable_get_stats(hashtable_t h, hashtable_stats_t * stats)
+{
+    uint64_t steps = 0;
+    uint32_t i;
+
+    // Check input
+    if (!h || !stats) return;
+    memset(stats, 0, sizeof(hashtable_stats_t));
+
+    // Add up the stripes. Engines never touch any but the operation counts
+    for (i = 0; i < COUNTER_STRIPES; i++) {
+        hashtable_counter_t * stripe = &(h->counters[i]);
+        stats->inserts      += atomic_load_explicit(&(stripe->inserts), memory_order_relaxed);
+        stats->gets         += atomic_load_explicit(&(stripe->gets), memory_order_relaxed);
+        stats->removes      += atomic_load_explicit(&(stripe->removes), memory_order_relaxed);
+        if (h->engine) continue;
+
+        stats->searches     += atomic_load_explicit(&(stripe->searches), memory_order_relaxed);
+        steps               += atomic_load_explicit(&(stripe->search_steps), memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&(stripe->search_max), memory_order_relaxed);
+        if (max > stats->search_max) stats->search_max = max;
+    }
+    if (h->engine) return;
+
+    stats->cas_failures = hashtable_cas_failures(h);
+    stats->resizes = atomic_load_explicit(&(h->resizes), memory_order_relaxed);
+    stats->resize_ns = atomic_load_explicit(&(h->resize_ns), memory_order_relaxed);
+    stats->sentinels = atomic_load_explicit(&(h->sentinels), memory_order_relaxed);
+    stats->search_avg = stats->searches ? (double) steps / (double) stats->searches : 0.0;
+
+    // A free can be counted before its retirement, so a snapshot can dip below zero
+    int_fast64_t retired = hashtable_retired_bytes(h->retired);
+    stats->retired_bytes = (retired > 0) ? (uint64_t) retired : 0;
+}
+
+void hashtable_quiescent(hashtable_t h)
+{
+    if (h && h->reclaim == HASHTABLE_RECLAIM_QSBR) epoch_qsbr_quiescent();
+}
+
+void hashtable_thread_offline(hashtable_t h)
+{
+    if (h && h->reclaim == HASHTABLE_RECLAIM_QSBR) epoch_qsbr_offline();
+}
+
+void hashtable_print(hashtable_t h)
+{
+    hashtable_node_t curr;
+    hashtable_key_t key;
+    hashtable_elem_t elem;
+
+    // Engines are printed in whatever order they walk, by hash
+    if (h->engine) {
+        hashtable_iter_t it = hashtable_iter_create(h);
+        while (hashtable_iter_next(it, &key, &elem)) {
+            printf("[    0x%016" PRIx64 " ]: ", hashtable_hash(h, key));
+            h->print_f(elem);
+            printf("\n");
+        }
+        hashtable_iter_free(it);
+        return;
+    }
+
+    for (curr = atomic_load(hashtable_bucket(h, 0)); curr; curr = hashtable_node_get_next(curr)) {
+        uint64_t so_key = hashtable_node_get_so_key(curr);
+        if (hashtable_node_is_sentinel(curr)) {
+            printf("[ ...0x%016" PRIx64 " ]\n", so_key);
+        }
+        else {
+            printf("[    0x%016" PRIx64 " ]: ", so_key);
+            h->print_f(hashtable_node_get_elem(curr));
+            printf("\n");
+        }
+    }
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static inline void hashtable_find_location(hashtable_t h, uint64_t hash, hashtable_key_t key, hashtable_node_t resume, hashtable_node_t * curr, hashtable_node_t * prev)
+{
+    uint64_t so_key = hashtable_node_split_order_key(hash, false);
+
+    // Find the bucket. If the width grows after this, the old bucket still comes first
+    uint32_t width = atomic_load_explicit(&(h->hash_width), memory_order_acquire);
+    uint32_t bucket = ((uint32_t) hash) & hashtable_width_mask(width);
+
+    // Skip ahead, if we were told where to. It has to be past the bucket's sentinel,
+    // or we'd be better off starting there, and strictly before so_key, so it can't
+    // be a collision we'd need to check. The bucket may not even be initialized yet,
+    // but a sentinel is only a shortcut, so it doesn't matter
+    if (resume) {
+        uint64_t resume_so_key = hashtable_node_get_so_key(resume);
+        if (resume_so_key > hashtable_node_split_order_key(bucket, true) && resume_so_key < so_key) {
+            if (h->reclaim == HASHTABLE_RECLAIM_HAZARD) hazard_pointer_set(HAZARD_START, resume);
+            if (hashtable_list_find(h, resume, so_key, key, curr, prev)) return;
+        }
+    }
+
+    // Only fails if a shrink took down the sentinel, and then the width has
+    // dropped, so the next try uses a bucket that's still in use
+    while (!hashtable_list_find(h, hashtable_bucket_sentinel(h, bucket), so_key, key, curr, prev)) {
+        width = atomic_load_explicit(&(h->hash_width), memory_order_acquire);
+        bucket = ((uint32_t) hash) & hashtable_width_mask(width);
+    }
+}
+
+static inline bool hashtable_insert_at(hashtable_t h, uint64_t hash, hashtable_key_t key, hashtable_elem_t elem, compute_f_t compute_f, hashtable_node_t * resume, hashtable_elem_t * present)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    hashtable_node_t node;
+    hashtable_elem_t curr_elem;
+    uint32_t pauses = 0;
+
+    uint64_t so_key = hashtable_node_split_order_key(hash, false);
+    if (present) *present = NULL;
+
+    // Loop until success. A node is only created once, and is reused
+    // across failed CAS attempts
+    bool insert_success = false;
+    node = NULL;
+    do {
+        // Find the appropriate place in the table
+        hashtable_find_location(h, hash, key, *resume, &curr, &prev);
+        *resume = prev;
+
+        // Check if key is already present
+        if (curr && hashtable_node_get_so_key(curr) == so_key) {
+            // Present and live. A computed element never made it in, so it's ours to free
+            if (hashtable_live_elem(h, curr, &curr_elem)) {
+                if (node && compute_f && h->free_f) h->free_f(elem);
+                hashtable_node_free(node);
+                if (present) *present = curr_elem;
+                hashtable_backoff_done(h, pauses);
+                return false;
+            }
+
+            // Removed since we passed it. Searching again unlinks it, so
+            // there is never more than one node with the same key
+            continue;
+        }
+
+        // Create a new node
+        if (!node) {
+            if (compute_f) {
+                elem = compute_f(key);
+                if (!elem) return false;
+            }
+
+            node = hashtable_node_create(key, elem, hash);
+            if (!node) {
+                if (compute_f && h->free_f) h->free_f(elem);
+                return false;
+            }
+        }
+
+        // Insert it
+        hashtable_node_set_next(node, curr);
+        insert_success = hashtable_node_cas_next(prev, curr, node);
+        if (!insert_success) hashtable_backoff(h, &pauses);
+    } while (!insert_success);
+
+    // Success
+    hashtable_backoff_done(h, pauses);
+    if (present) *present = elem;
+    return true;
+}
+
+static inline hashtable_elem_t hashtable_remove_at(hashtable_t h, uint64_t hash, hashtable_key_t key, hashtable_node_t * resume)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    hashtable_node_t node;
+    uint32_t pauses = 0;
+
+    uint64_t so_key = hashtable_node_split_order_key(hash, false);
+
+    // Search table
+    hashtable_find_location(h, hash, key, *resume, &curr, &prev);
+    *resume = prev;
+
+    // Check it's actually in the table
+    if (!curr || hashtable_node_get_so_key(curr) != so_key) return NULL;
+
+    // Claim the element, which is what removes the key. If another thread
+    // claimed it first, its removal takes precedence
+    hashtable_elem_t elem;
+    while (true) {
+        if (!hashtable_live_elem(h, curr, &elem)) {
+            hashtable_backoff_done(h, pauses);
+            return NULL;
+        }
+        if (hashtable_node_cas_elem(curr, elem, ELEM_REMOVED(h))) break;
+        hashtable_backoff(h, &pauses);
+    }
+
+    // Freeze the node, so its successor can't change. Someone who found it
+    // claimed may already have done this for us
+    node = curr;
+    hashtable_node_mark(node);
+    hashtable_node_t next = hashtable_node_get_next(node);
+
+    // Unlink it. If prev changed, a traversal will do it for us, and once we've
+    // searched past its spot it's certainly gone
+    if (hashtable_node_cas_next(prev, node, next)) {
+        hashtable_reclaim_retire(h, node);
+    }
+    else {
+        hashtable_backoff(h, &pauses);
+        hashtable_find_location(h, hash, key, NULL, &curr, &prev);
+        *resume = prev;
+    }
+
+    // Pass back the element
+    hashtable_backoff_done(h, pauses);
+    return elem;
+}
+
+static inline bool hashtable_live_elem(hashtable_t h, hashtable_node_t node, hashtable_elem_t * elem)
+{
+    if (hashtable_node_is_marked(node)) return false;
+
+    *elem = hashtable_node_get_elem(node);
+    if (*elem != ELEM_REMOVED(h)) return true;
+
+    hashtable_node_mark(node);
+    return false;
+}
+
+static void hashtable_iter_init(hashtable_iter_t it, hashtable_t h, uint32_t bucket, uint64_t last)
+{
+    it->h = h;
+    it->curr = hashtable_bucket_sentinel(h, bucket);
+    it->first = hashtable_node_split_order_key(bucket, true);
+    it->last = last;
+    it->done = false;
+    it->state = NULL;
+
+    // The sentinel could be taken down by a shrink, so hold on to it like any other position
+    if (h->reclaim == HASHTABLE_RECLAIM_HAZARD) hazard_pointer_set(HAZARD_ITER, it->curr);
+}
+
+static bool hashtable_iter_step(hashtable_iter_t it, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    hashtable_t h = it->h;
+    bool hazard = (h->reclaim == HASHTABLE_RECLAIM_HAZARD);
+    hashtable_node_t prev = it->curr;
+    hashtable_node_t curr;
+    bool marked;
+
+    while (!it->done) {
+        // If prev has been removed, its successor can't be trusted, so search
+        // from its bucket instead. Otherwise protect curr, and make sure prev
+        // still pointed at it afterwards, as in hashtable_list_find
+        curr = hashtable_node_get_next_mark(prev, &marked);
+        if (marked) {
+            curr = hashtable_iter_resume(h, hashtable_node_get_so_key(prev));
+        }
+        else if (hazard && curr) {
+            hazard_pointer_set(HAZARD_CURR, curr);
+            if (hashtable_node_get_next_mark(prev, &marked) != curr || marked) continue;
+        }
+
+        // Past the end of the walk
+        if (!curr || hashtable_node_get_so_key(curr) > it->last) {
+            it->done = true;
+            break;
+        }
+
+        // Move on, keeping the new position protected between steps
+        if (hazard) hazard_pointer_set(HAZARD_ITER, curr);
+        it->curr = prev = curr;
+
+        // Only stop at live elements, within the walk
+        if (!hashtable_node_is_sentinel(curr) && hashtable_node_get_so_key(curr) >= it->first && hashtable_live_elem(h, curr, elem)) {
+            *key = hashtable_node_get_key(curr);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static hashtable_node_t hashtable_iter_resume(hashtable_t h, uint64_t so_key)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+
+    // Nothing sorts after the last possible key but collisions with it, which
+    // we'd miss anyway
+    if (so_key == UINT64_MAX) return NULL;
+
+    // After a regular node, so_key + 1 is a sentinel's position, so it never
+    // needs a key comparison, and the search stops at the first node past
+    // so_key. A sentinel's own position works the same way, once it's been
+    // unlinked. Start from the bucket so_key's hash falls in, trying again if
+    // a shrink takes its sentinel down
+    uint64_t target = (so_key & 1) ? so_key + 1 : so_key;
+    uint64_t hash = hashtable_node_uint64_bit_reverse(so_key);
+    uint32_t width;
+    do {
+        width = atomic_load_explicit(&(h->hash_width), memory_order_acquire);
+    } while (!hashtable_list_find(h, hashtable_bucket_sentinel(h, ((uint32_t) hash) & hashtable_width_mask(width)), target, NULL, &curr, &prev));
+
+    return curr;
+}
+
+static void hashtable_iter_end(hashtable_iter_t it)
+{
+    if (it->h->reclaim == HASHTABLE_RECLAIM_HAZARD) hazard_pointer_clear_range(HAZARD_ITER, 1);
+    hashtable_reclaim_exit(it->h);
+}
+
+static void * hashtable_scan_thread_f(void * p_scan)
+{
+    hashtable_scan_t * scan = (hashtable_scan_t *) p_scan;
+    hashtable_t h = scan->h;
+
+    if (h->engine) {
+        hashtable_reclaim_enter(h);
+        hashtable_scan_engine(scan);
+        hashtable_reclaim_exit(h);
+    }
+    else {
+        hashtable_scan_ranges(scan);
+    }
+    hashtable_thread_offline(h);
+
+    return NULL;
+}
+
+static void hashtable_scan_ranges(hashtable_scan_t * scan)
+{
+    hashtable_t h = scan->h;
+    uint32_t n_ranges = UINT32_C(1) << scan->range_bits;
+    uint32_t shift = 64 - scan->range_bits;
+    size_t visited = 0;
+    uint_fast32_t range;
+
+    while ((range = atomic_fetch_add(&(scan->next_range), 1)) < n_ranges) {
+        struct hashtable_iter_t_ it;
+        hashtable_key_t key;
+        hashtable_elem_t elem;
+
+        // Range r covers split-order keys from r << shift, which is where the
+        // sentinel of the bucket with r's bits reversed sits, up to the next range
+        uint32_t bucket = 0;
+        uint64_t last = UINT64_MAX;
+        if (scan->range_bits) {
+            bucket = (uint32_t) (hashtable_node_uint64_bit_reverse(range) >> shift);
+            if (range + 1 < n_ranges) last = (((uint64_t) range + 1) << shift) - 1;
+        }
+
+        hashtable_reclaim_enter(h);
+        hashtable_iter_init(&it, h, bucket, last);
+        while (hashtable_iter_step(&it, &key, &elem)) {
+            scan->fn(key, elem, scan->arg);
+            visited++;
+        }
+        hashtable_iter_end(&it);
+    }
+
+    atomic_fetch_add(&(scan->visited), visited);
+}
+
+static void hashtable_scan_engine(hashtable_scan_t * scan)
+{
+    hashtable_t h = scan->h;
+    uint32_t n_ranges = UINT32_C(1) << scan->range_bits;
+    size_t visited = 0;
+    uint_fast32_t range;
+
+    while ((range = atomic_fetch_add(&(scan->next_range), 1)) < n_ranges) {
+        visited += h->engine->scan_range(h->table, scan->snapshot, range, n_ranges, scan->fn, scan->arg);
+    }
+
+    atomic_fetch_add(&(scan->visited), visited);
+}
+
+static hashtable_batch_entry_t * hashtable_batch_sort(hashtable_t h, const hashtable_key_t * keys, size_t stride, size_t n)
+{
+    size_t counts[BATCH_RADIX_PASSES][BATCH_RADIX] = { { 0 } };
+    size_t i;
+    uint32_t pass;
+
+    // One array to sort into, and one to sort out of
+    hashtable_batch_entry_t * batch = (hashtable_batch_entry_t *) malloc((n ? 2*n : 1) * sizeof(hashtable_batch_entry_t));
+    if (!batch) return NULL;
+    hashtable_batch_entry_t * from = batch;
+    hashtable_batch_entry_t * to = batch + n;
+
+    // Hash everything up front, counting every digit as we go
+    for (i = 0; i < n; i++) {
+        from[i].hash = hashtable_hash(h, *(const hashtable_key_t *) ((const char *) keys + i*stride));
+        from[i].so_key = hashtable_node_split_order_key(from[i].hash, false);
+        from[i].index = i;
+        for (pass = 0; pass < BATCH_RADIX_PASSES; pass++) counts[pass][(from[i].so_key >> (pass*BATCH_RADIX_BITS)) & (BATCH_RADIX - 1)]++;
+    }
+
+    // Sort by each digit in turn, least significant first
+    for (pass = 0; n && pass < BATCH_RADIX_PASSES; pass++) {
+        uint32_t shift = pass*BATCH_RADIX_BITS;
+        size_t offset = 0;
+        uint32_t digit;
+
+        // Nothing to do if every key has the same digit here
+        if (counts[pass][(from[0].so_key >> shift) & (BATCH_RADIX - 1)] == n) continue;
+
+        // Turn counts into starting positions, then scatter. Stable, so earlier passes hold
+        for (digit = 0; digit < BATCH_RADIX; digit++) {
+            size_t count = counts[pass][digit];
+            counts[pass][digit] = offset;
+            offset += count;
+        }
+        for (i = 0; i < n; i++) to[counts[pass][(from[i].so_key >> shift) & (BATCH_RADIX - 1)]++] = from[i];
+
+        hashtable_batch_entry_t * temp = from;
+        from = to;
+        to = temp;
+    }
+
+    // The sorted copy has to be at the start of the allocation, where free() expects it
+    if (from != batch) memcpy(batch, from, n * sizeof(hashtable_batch_entry_t));
+
+    return batch;
+}
+
+static inline bool hashtable_list_find(hashtable_t h, hashtable_node_t start, uint64_t so_key, hashtable_key_t key, hashtable_node_t * curr, hashtable_node_t * prev)
+{
+    bool hazard = (h->reclaim == HASHTABLE_RECLAIM_HAZARD);
+    uint32_t pauses = 0;
+    uint64_t steps = 0;
+
+    // Restart whenever the list changes under us
+    while (true) {
+        bool marked;
+
+        // Callers protect start. If it has been removed, nothing can be
+        // linked after it any more, so there's no point going on
+        *prev = start;
+        *curr = hashtable_node_get_next_mark(*prev, &marked);
+        if (marked) return false;
+
+        // Step through the list
+        while (*curr) {
+            // Protect curr, then make sure prev still pointed at it afterwards. If
+            // so, curr hadn't been unlinked, so it can't have been retired yet. The
+            // other schemes don't free anything until the whole operation is done
+            if (hazard) {
+                hazard_pointer_set(HAZARD_CURR, *curr);
+                if (hashtable_node_get_next_mark(*prev, &marked) != *curr || marked) break;
+            }
+
+            // Help unlink deleted nodes. Whoever does is responsible for retiring them
+            hashtable_node_t next = hashtable_node_get_next_mark(*curr, &marked);
+            if (marked) {
+                if (!hashtable_node_cas_next(*prev, *curr, next)) {
+                    hashtable_backoff(h, &pauses);
+                    break;
+                }
+                if (hashtable_node_is_sentinel(*curr)) hashtable_sentinel_unlinked(h, *curr);
+                hashtable_reclaim_retire(h, *curr);
+                *curr = next;
+                steps++;
+                continue;
+            }
+
+            // Found our spot. Sentinel positions are unique, and without an eq_f
+            // so are regular ones. Otherwise keep looking through the collisions
+            uint64_t curr_so_key = hashtable_node_get_so_key(*curr);
+            if (curr_so_key > so_key || (curr_so_key == so_key && (!h->eq_f || !(so_key & 1) || h->eq_f(hashtable_node_get_key(*curr), key)))) {
+                hashtable_stats_search(h, steps);
+                return true;
+            }
+
+            *prev = *curr;
+            if (hazard) hazard_pointer_set(HAZARD_PREV, *prev);
+            *curr = next;
+            steps++;
+        }
+
+        // Reached the end of the list
+        if (!*curr) {
+            hashtable_stats_search(h, steps);
+            return true;
+        }
+    }
+}
+
+static inline uint64_t hashtable_hash(hashtable_t h, hashtable_key_t key)
+{
+    if (h->hash64_f)    return h->hash64_f(key);
+    else                return h->hash_f(key);
+}
+
+static inline hashtable_node_t hashtable_bucket_sentinel(hashtable_t h, uint32_t bucket)
+{
+    hashtable_node_t sentinel = hashtable_bucket_load(h, bucket);
+
+    return sentinel ? sentinel : hashtable_bucket_init(h, bucket);
+}
+
+static inline hashtable_node_t hashtable_bucket_load(hashtable_t h, uint32_t bucket)
+{
+    hashtable_node_t sentinel = hashtable_bucket_protect(h, bucket, HAZARD_START);
+
+    // A marked one is on its way out, and is as good as no sentinel at all
+    if (sentinel && hashtable_node_is_marked(sentinel)) return NULL;
+
+    return sentinel;
+}
+
+static inline hashtable_node_t hashtable_bucket_protect(hashtable_t h, uint32_t bucket, uint32_t slot)
+{
+    hashtable_bucket_t * b = hashtable_bucket(h, bucket);
+    if (!b) return NULL;
+    hashtable_node_t sentinel = atomic_load_explicit(b, memory_order_acquire);
+
+    // A sentinel still in its slot hasn't been retired, or is held by whoever
+    // put it back there to take it down again (see hashtable_bucket_init).
+    // That only holds for a segment still in the directory: one a shrink has
+    // retired isn't cleared when its sentinels are unlinked
+    if (h->reclaim == HASHTABLE_RECLAIM_HAZARD) {
+        while (sentinel) {
+            hazard_pointer_set(slot, sentinel);
+            hashtable_node_t again = atomic_load(b);
+            if (again == sentinel && hashtable_bucket_linked(h, bucket, b)) break;
+
+            // Start over from the directory if the segment went
+            if (again == sentinel) {
+                b = hashtable_bucket(h, bucket);
+                if (!b) return NULL;
+                again = atomic_load(b);
+            }
+            sentinel = again;
+        }
+    }
+
+    return sentinel;
+}
 
-// Module
-#include "hashtable.h"
+static hashtable_node_t hashtable_bucket_init(hashtable_t h, uint32_t bucket)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    hashtable_node_t start;
+    hashtable_node_t sentinel;
+    hashtable_node_t node = NULL;
+    uint32_t pauses = 0;
+    bool hazard = (h->reclaim == HASHTABLE_RECLAIM_HAZARD);
+
+    // Bucket 0 always exists, so the recursion through parents ends
+    uint32_t parent = bucket & ~(1U << (31 - __builtin_clz(bucket)));
+    uint64_t so_key = hashtable_node_split_order_key(bucket, true);
+
+    // Other threads may be doing the same thing. Whoever links a sentinel first wins
+    while (true) {
+        // If a shrink takes down the parent under us, get it again. If it has
+        // retired the bucket's segment, there's nowhere to publish a sentinel,
+        // so the parent's will do
+        start = hashtable_bucket_sentinel(h, parent);
+        if (!hashtable_bucket(h, bucket)) {
+            sentinel = start;
+            break;
+        }
+        if (!hashtable_list_find(h, start, so_key, NULL, &curr, &prev)) continue;
 
-// Standard Libraries
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdatomic.h>
-#include <assert.h>
-#include <string.h>
+        // Already there
+        if (curr && hashtable_node_get_so_key(curr) == so_key) {
+            sentinel = curr;
+        }
+        else {
+            // Create a sentinel node, unless a failed attempt left us one. If we
+            // can't, the parent will do as a place to start
+            if (!node) {
+                node = hashtable_node_create_sentinel(bucket);
+                if (!node) return start;
+            }
 
-// Other modules
-#include "hashtable_node.h"
-#include "reference_list.h"
- 
-/* --- PRIVATE MACROS ------------------------------------------------------- */
+            // Insert it. Once linked, it could be published and taken down by
+            // a shrink at any moment, so protect it first
+            if (hazard) hazard_pointer_set(HAZARD_NEW, node);
+            hashtable_node_set_next(node, curr);
+            if (!hashtable_node_cas_next(prev, curr, node)) {
+                hashtable_backoff(h, &pauses);
+                continue;
+            }
+            atomic_fetch_add_explicit(&(h->sentinels), 1, memory_order_relaxed);
+            sentinel = node;
+            node = NULL;
+        }
 
-#define HASH_WIDTH_INIT         (2)             /**< The initial hash size */
-#define SAVE_SLOTS_INIT         (256)           /**< The initial number of pointer/node saving slots */
+        // Publish it, unless someone else has. A shrink marks a sentinel before
+        // clearing its slot, so if it isn't marked after this, any shrink still
+        // to come will clear the slot. If it is, take it back down and start
+        // over, which unlinks it. If a shrink has retired the segment, the
+        // sentinel stays in the list unpublished, for a later grow to find
+        hashtable_bucket_t * slot = hashtable_bucket(h, bucket);
+        hashtable_node_t expected = NULL;
+        if (slot) atomic_compare_exchange_strong(slot, &expected, sentinel);
+        if (!hashtable_node_is_marked(sentinel)) break;
+
+        expected = sentinel;
+        if (slot) atomic_compare_exchange_strong(slot, &expected, NULL);
+    }
 
-/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+    // Never published, so nobody else can have seen it
+    if (node) hashtable_node_free(node);
 
-/**
- * @brief   The basic data structure for a hash table
- */
-struct hashtable_t_ {
-    atomic_uint_fast32_t        n_elements;                 /**< The total number of elements stored in the table */
-    uint32_t                    hash_width;                 /**< The number of bits in the hash actually used for binning */
-    uint32_t                    hash_mask;                  /**< The mask used to determine the significant bits in a hash value */
-    hashtable_node_t *          hash_list;                  /**< An array of hash bins, of length 2^<hash_width> */
-    atomic_flag                 table_resizing;             /**< A thread must acquire this flag to resize the hashtable */
-    hash_f_t                    hash_f;                     /**< The function used to hash keys */
-    print_f_t                   print_f;                    /**< The function used to print elements */
-    free_f_t                    free_f;                     /**< The function used to free elements */
-    reference_list_t            saved_nodes;                /**< A list of saved hashtable nodes */
-    reference_list_t            saved_pointers;             /**< A list of pointers which can be deallocated with free() alone */
-};
+    if (hazard) hazard_pointer_set(HAZARD_START, sentinel);
+    return sentinel;
+}
 
-/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+static inline void hashtable_sentinel_unlinked(hashtable_t h, hashtable_node_t sentinel)
+{
+    // Its split-order key is its bucket, reversed
+    uint32_t bucket = (uint32_t) hashtable_node_uint64_bit_reverse(hashtable_node_get_so_key(sentinel));
+    hashtable_bucket_t * slot = hashtable_bucket(h, bucket);
+    hashtable_node_t expected = sentinel;
 
-/**
- * @brief   Looks for a node with a given hash
- *
- * Steps through the hashtable list until it finds a node with hash. If that node is in the table, curr
- * will point to it at return. If it isn't, curr will point to the node after where it should go,
- * and prev the one before it
- *
- * @param[in] h:            The hashtable to search
- * @param[in] hash:         The hash to search for
- * @param[out] curr:        Will point to a node with the given hash, or the one after its spot
- * @param[out] prev:        Points to the node before curr
- */
-static inline void hashtable_find_location(hashtable_t h, uint32_t hash, hashtable_node_t * curr, hashtable_node_t * prev);
+    if (slot) atomic_compare_exchange_strong(slot, &expected, NULL);
+    atomic_fetch_sub_explicit(&(h->sentinels), 1, memory_order_relaxed);
+}
 
-/**
- * @brief   Saves a node for later deallocation
- *
- * @param[in,out] h:    The corresponding hashtable object
- * @param[in] node:     The node to save
- */
-static inline void hashtable_save_node(hashtable_t h, hashtable_node_t node);
+static inline void hashtable_reclaim_enter(hashtable_t h)
+{
+    switch (h->reclaim) {
+    case HASHTABLE_RECLAIM_EPOCH:   epoch_enter();          break;
+    case HASHTABLE_RECLAIM_QSBR:    epoch_qsbr_online();    break;
+    default:                                                break;
+    }
+}
 
-/**
- * @brief   Saves a pointer for later deallocdation
- *
- * @note    This function should only be used to save data which can be
- *          deallocated with a single call to free()
- *
- * @param[in,out] h:    The corresponding hashtabble object
- * @param[in] ptr:      The pointer to save
- */
-static inline void hashtable_save_pointer(hashtable_t h, void * ptr);
+static inline void hashtable_reclaim_exit(hashtable_t h)
+{
+    switch (h->reclaim) {
+    case HASHTABLE_RECLAIM_HAZARD:  hazard_pointer_clear_range(0, HAZARD_GROUP);    break;
+    case HASHTABLE_RECLAIM_EPOCH:   epoch_exit();                                   break;
+    default:                                                                        break;
+    }
+}
 
-/**
- * @brief   Resizes the array pointed to by array_ptr from old_size to new_size
- *
- * @param[in, out] h:               The corresponding hashtable object
- * @param[in,out] array:            The array to be modified
- * @param[in] old_size:             The current number of elements in the array
- * @param[in] new_size:             The desired number of elements in the array
- * @param[in] elem_size:            The size (in bytes) of a single array element
- *
- * @return      true if successful, false otherwise
- */
-static inline bool hashtable_resize_array(hashtable_t h, void ** array_ptr, uint32_t old_size, uint32_t new_size, uint32_t elem_size);
+static inline void hashtable_reclaim_retire(hashtable_t h, hashtable_node_t node)
+{
+#if HASHTABLE_STATS
+    atomic_fetch_add_explicit(&(h->retired->stripes[thread_index_stripe(COUNTER_STRIPES)].bytes), sizeof(struct hashtable_node_t_), memory_order_relaxed);
+#endif
+
+    // If it can't be recorded, leaking it is the only safe option
+    switch (h->reclaim) {
+    case HASHTABLE_RECLAIM_HAZARD:  hazard_pointer_retire(node, hashtable_node_generic_free);    break;
+    case HASHTABLE_RECLAIM_EPOCH:   epoch_retire(node, hashtable_node_generic_free);             break;
+    case HASHTABLE_RECLAIM_QSBR:    epoch_qsbr_retire(node, hashtable_node_generic_free);        break;
+    case HASHTABLE_RECLAIM_NONE:    reference_list_insert(h->saved_nodes, node);                 break;
+    }
+}
 
-/**
- * @brief   Wrapper for hashtable_node_free
- *
- * @see hashtable_node_free
- */
-static void hashtable_node_reference_list_free(void* elem);
+static inline hashtable_bucket_t * hashtable_bucket(hashtable_t h, uint32_t bucket)
+{
+    // The first segment is special, holding every bucket below 2^HASH_WIDTH_INIT
+    if (bucket < (1U << HASH_WIDTH_INIT)) return &(atomic_load_explicit(&(h->segments[0]), memory_order_acquire)[bucket]);
+
+    // Every other segment starts at a power of two
+    uint32_t msb = 31 - __builtin_clz(bucket);
+    _Atomic(hashtable_bucket_t *) * link = &(h->segments[msb - HASH_WIDTH_INIT + 1]);
+    hashtable_bucket_t * segment = atomic_load_explicit(link, memory_order_acquire);
+
+    // A shrink clears a segment's link before retiring it, so once it's
+    // protected, finding it still linked means it can be used. Those below the
+    // minimum width are never retired
+    if (h->reclaim == HASHTABLE_RECLAIM_HAZARD && msb >= h->min_width) {
+        while (segment) {
+            hazard_pointer_set(HAZARD_SEGMENT, segment);
+            hashtable_bucket_t * again = atomic_load(link);
+            if (again == segment) break;
+            segment = again;
+        }
+    }
 
-/**
- * @brief   Bit reverses <val>
- *
- * @note    from <https://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable>
- *
- * @param[in] val:      The value to be bit-reversed
- *
- * @return:         <val>, bit-reversed
- */
-static inline uint32_t hashtable_uint32_bit_reverse(uint32_t val);
+    return segment ? &(segment[bucket - (1U << msb)]) : NULL;
+}
 
-/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+static inline bool hashtable_bucket_linked(hashtable_t h, uint32_t bucket, hashtable_bucket_t * b)
+{
+    if (bucket < (1U << HASH_WIDTH_INIT)) return true;
 
-hashtable_t hashtable_create(hash_f_t hash_f, print_f_t print_f, free_f_t free_f)
+    uint32_t msb = 31 - __builtin_clz(bucket);
+    return atomic_load(&(h->segments[msb - HASH_WIDTH_INIT + 1])) == b - (bucket - (1U << msb));
+}
+
+static inline void hashtable_bucket_prefetch(hashtable_t h, uint32_t bucket)
 {
-    uint_fast32_t i;
+    if (bucket < (1U << HASH_WIDTH_INIT)) {
+        __builtin_prefetch(&(atomic_load_explicit(&(h->segments[0]), memory_order_relaxed)[bucket]));
+        return;
+    }
 
-    // Allocate memory
-    hashtable_t h = (hashtable_t) malloc(sizeof(struct hashtable_t_));
-    if (!h) return NULL;
+    // Only the address is worked out, so the segment needn't be protected
+    uint32_t msb = 31 - __builtin_clz(bucket);
+    hashtable_bucket_t * segment = atomic_load_explicit(&(h->segments[msb - HASH_WIDTH_INIT + 1]), memory_order_relaxed);
+    if (segment) __builtin_prefetch(&(segment[bucket - (1U << msb)]));
+}
 
-    // Initialize pointer fields
-    h->hash_list = NULL;
-    h->saved_nodes = NULL;
-    h->saved_pointers = NULL;
+static bool hashtable_segment_alloc(hashtable_t h, uint32_t width)
+{
+    _Atomic(hashtable_bucket_t *) * slot = &(h->segments[width - HASH_WIDTH_INIT + 1]);
 
-    // Allcoate hash list
-    h->hash_list = (hashtable_node_t*) malloc((1 << HASH_WIDTH_INIT) * sizeof(hashtable_node_t));
-    if (!h->hash_list) {
-        // Clean up struct
-        hashtable_free(h);
+    // Another thread, or a previous attempt, may have gotten this far
+    if (atomic_load_explicit(slot, memory_order_acquire)) return true;
 
-        // Failure
-        return NULL;
-    }
-    // Fill with zeros
-    memset(h->hash_list, 0, (1 << HASH_WIDTH_INIT) * sizeof(hashtable_node_t));
-    
-    // Create reference saving arrays
-    h->saved_nodes      = reference_list_create(hashtable_node_reference_list_free);
-    h->saved_pointers   = reference_list_create(free);
-    if (!h->saved_nodes || !h->saved_pointers) {
-        if (h->saved_nodes)    reference_list_free(h->saved_nodes);
-        if (h->saved_pointers) reference_list_free(h->saved_pointers);
+    // Same number of buckets as all the previous segments together
+    hashtable_bucket_t * segment = (hashtable_bucket_t *) calloc((size_t) 1 << width, sizeof(hashtable_bucket_t));
+    if (!segment) return false;
 
-        // Clean up struct
-        hashtable_free(h);
+    // If someone beat us to it, theirs is just as good
+    hashtable_bucket_t * expected = NULL;
+    if (!atomic_compare_exchange_strong(slot, &expected, segment)) free(segment);
 
-        // Failure
-        return NULL;
+    return true;
+}
+
+static void hashtable_segment_retire(hashtable_t h, uint32_t width)
+{
+    _Atomic(hashtable_bucket_t *) * slot = &(h->segments[width - HASH_WIDTH_INIT + 1]);
+
+    if (h->reclaim == HASHTABLE_RECLAIM_NONE) return;
+
+    // Sentinels published into it since the shrink took them down stay in the
+    // list, and simply aren't found from here
+    hashtable_bucket_t * segment = atomic_load(slot);
+    if (!segment || !atomic_compare_exchange_strong(slot, &segment, NULL)) return;
+
+    // Once unlinked, it's never put back: a sentinel unlinked in the meantime
+    // couldn't clear its slot, and may already be retired. If the table has
+    // grown back over it, it gets a fresh one instead. A grower makes sure of
+    // the segment after raising the width, so one of us sees the other
+    if (atomic_load(&(h->hash_width)) > width) hashtable_segment_alloc(h, width);
+
+    // If it can't be recorded, leaking it is the only safe option
+    switch (h->reclaim) {
+    case HASHTABLE_RECLAIM_HAZARD:  hazard_pointer_retire(segment, free);   break;
+    case HASHTABLE_RECLAIM_EPOCH:   epoch_retire(segment, free);            break;
+    case HASHTABLE_RECLAIM_QSBR:    epoch_qsbr_retire(segment, free);       break;
+    default:                                                                break;
     }
+}
 
-    // Allocate sentinel nodes
-    hashtable_node_t tmp_node[(1 << HASH_WIDTH_INIT)];
-    for (i = 0; i < (1 << HASH_WIDTH_INIT); i++) {
-        tmp_node[i] = hashtable_node_create(NULL, i);
-        if (!(tmp_node[i])) {
-            // Free all memory allocated to this point
-            uint_fast32_t j;
-            for (j = 0; j < i; j++) hashtable_node_free(tmp_node[j]);
+static inline void hashtable_count(hashtable_t h, int_fast64_t delta)
+{
+    atomic_int_fast64_t * count = &(h->counters[thread_index_stripe(COUNTER_STRIPES)].count);
+    int_fast64_t old = atomic_fetch_add_explicit(count, delta, memory_order_relaxed);
 
-            // Clean up struct
-            hashtable_free(h);
+    // Only look at the whole table once in a while: whenever the stripe crosses a multiple of the period
+    if ((old & ~(GROW_CHECK_PERIOD - 1)) != ((old + delta) & ~(GROW_CHECK_PERIOD - 1))) {
+        if (delta > 0)  hashtable_grow(h);
+        else            hashtable_shrink(h);
+    }
+}
 
-            // Failure
-            return NULL;
+static void hashtable_grow(hashtable_t h)
+{
+    uint_fast32_t width = atomic_load(&(h->hash_width));
+    size_t size = hashtable_size_approx(h);
+    uint64_t start = 0;
+
+    while (width < HASH_WIDTH_MAX && size > ((UINT64_C(1) << width)*GROW_LOAD)) {
+        if (!start) start = hashtable_stats_now();
+
+        // Out of memory; try again next time
+        if (!hashtable_segment_alloc(h, width)) return;
+
+        // Releases the new segment to anyone who sees the new width. On
+        // failure, another thread grew it, and width is updated for us
+        if (atomic_compare_exchange_strong_explicit(&(h->hash_width), &width, width + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            // A shrink may have retired the segment since. Without it, its
+            // buckets are searched from their parents' sentinels instead
+            hashtable_segment_alloc(h, width);
+            hashtable_stats_resize(h, start);
+            start = hashtable_stats_now();
+            width++;
         }
+    }
+}
 
-        hashtable_node_set_sentinel(tmp_node[i]);
-        h->hash_list[i] = tmp_node[i];
+static void hashtable_shrink(hashtable_t h)
+{
+    hashtable_node_t prev;
+    hashtable_node_t curr;
+    uint32_t bucket;
+
+    uint_fast32_t width = atomic_load(&(h->hash_width));
+    size_t size = hashtable_size_approx(h);
+
+    // One step at a time. If it's still too empty, the next removals will notice
+    if (width <= h->min_width || size * SHRINK_LOAD_INV >= (UINT64_C(1) << width)) return;
+    uint64_t start = hashtable_stats_now();
+    if (!atomic_compare_exchange_strong(&(h->hash_width), &width, width - 1)) return;
+
+    // Take down the sentinels of the top half of the buckets. Each is marked
+    // before its slot is cleared; see hashtable_bucket_init for why
+    uint32_t half = UINT32_C(1) << (width - 1);
+    hashtable_reclaim_enter(h);
+    for (bucket = half; bucket < 2*half; bucket++) {
+        // If the table has grown back, these are in use again
+        if (atomic_load_explicit(&(h->hash_width), memory_order_relaxed) >= width) break;
+
+        hashtable_node_t sentinel = hashtable_bucket_load(h, bucket);
+        if (!sentinel) continue;
+
+        // Once it's retired, its element has to lead back to the table's retired bytes
+        hashtable_node_set_elem(sentinel, ELEM_REMOVED(h));
+        hashtable_node_mark(sentinel);
+        hashtable_bucket_t * slot = hashtable_bucket(h, bucket);
+        if (slot) atomic_compare_exchange_strong(slot, &sentinel, NULL);
+
+        // Search past it from its parent, which is still in use, so it's
+        // unlinked. Whoever unlinks it retires it
+        uint64_t so_key = hashtable_node_split_order_key(bucket, true);
+        while (!hashtable_list_find(h, hashtable_bucket_sentinel(h, bucket - half), so_key, NULL, &curr, &prev));
     }
 
-    // Initialize remaining fields
-    h->hash_width   = HASH_WIDTH_INIT;
-    h->hash_f       = hash_f;
-    h->print_f      = print_f;
-    h->free_f       = free_f;
-    atomic_flag_clear(&(h->table_resizing));
-    atomic_init(&(h->n_elements), 0);
-    h->hash_mask    = 0x00000000;
-    for (i = 0; i < h->hash_width; i++) h->hash_mask |= 0x01 << i;
-
-    // Build initial element list
-    // TODO: make this flexible for different initial widths
-    assert(HASH_WIDTH_INIT == 2);
-    hashtable_node_set_next(h->hash_list[0], h->hash_list[2]);
-    hashtable_node_set_next(h->hash_list[2], h->hash_list[1]);
-    hashtable_node_set_next(h->hash_list[1], h->hash_list[3]);
+    // With its sentinels down, nothing needs the top half's segment, unless the table grew back
+    if (bucket == 2*half) hashtable_segment_retire(h, width - 1);
+    hashtable_reclaim_exit(h);
 
-    // Success
-    return h;
+    hashtable_stats_resize(h, start);
 }
 
-void hashtable_free(hashtable_t h)
+static inline void hashtable_backoff(hashtable_t h, uint32_t * pauses)
 {
-    hashtable_node_t curr;
-    hashtable_node_t next;
+    hashtable_counter_t * stripe = &(h->counters[thread_index_stripe(COUNTER_STRIPES)]);
+    uint32_t i;
 
-    if (h) {
-        // Free element list
-        curr = h->hash_list[0];
-        while (curr) {
-            next = hashtable_node_get_next(curr);
-            if (h->free_f) h->free_f(hashtable_node_get_elem(curr));
-            hashtable_node_free(curr);
-            curr = next;
-        }
+    atomic_fetch_add_explicit(&(stripe->cas_failures), 1, memory_order_relaxed);
 
-        // Free hash list
-        if (h->hash_list) free(h->hash_list);
+    // Doubling with each failure in a row, starting small or wherever this stripe's level is
+    switch (h->backoff) {
+    case HASHTABLE_BACKOFF_NONE:        return;
+    case HASHTABLE_BACKOFF_EXPONENTIAL: *pauses = *pauses ? 2*(*pauses) : BACKOFF_MIN;                                                     break;
+    case HASHTABLE_BACKOFF_ADAPTIVE:    *pauses = *pauses ? 2*(*pauses) : atomic_load_explicit(&(stripe->backoff), memory_order_relaxed);   break;
+    }
+    if (*pauses < BACKOFF_MIN) *pauses = BACKOFF_MIN;
+    if (*pauses > BACKOFF_MAX) *pauses = BACKOFF_MAX;
 
-        // Free all saved references
-        if (h->saved_nodes)    reference_list_free(h->saved_nodes);
-        if (h->saved_pointers) reference_list_free(h->saved_pointers);
+    for (i = 0; i < *pauses; i++) spinlock_pause();
+}
 
-        // Free table
-        free(h);
-    }
+static inline void hashtable_backoff_done(hashtable_t h, uint32_t pauses)
+{
+    if (h->backoff != HASHTABLE_BACKOFF_ADAPTIVE) return;
+
+    // Move halfway to what this operation needed, or decay a little if it
+    // needed nothing. Racing threads on the stripe may lose an update, which
+    // only makes it adapt a little slower
+    atomic_uint_fast32_t * level = &(h->counters[thread_index_stripe(COUNTER_STRIPES)].backoff);
+    uint32_t old = (uint32_t) atomic_load_explicit(level, memory_order_relaxed);
+    uint32_t new = pauses ? (old + pauses + 1) / 2 : old - (old + 7) / 8;
+    if (new != old) atomic_store_explicit(level, new, memory_order_relaxed);
 }
 
-bool hashtable_contains(hashtable_t h, hashtable_key_t key)
+static inline void hashtable_stats_op(hashtable_t h, hashtable_stats_op_t op, size_t n)
 {
-    // Get the element
-    hashtable_elem_t dummy = hashtable_get(h, key);
+#if HASHTABLE_STATS
+    hashtable_counter_t * stripe = &(h->counters[thread_index_stripe(COUNTER_STRIPES)]);
 
-    // If it's not null, it's in the table
-    return dummy != NULL;
+    switch (op) {
+    case STATS_INSERT:  atomic_fetch_add_explicit(&(stripe->inserts), n, memory_order_relaxed);    break;
+    case STATS_GET:     atomic_fetch_add_explicit(&(stripe->gets), n, memory_order_relaxed);       break;
+    case STATS_REMOVE:  atomic_fetch_add_explicit(&(stripe->removes), n, memory_order_relaxed);    break;
+    }
+#else
+    (void) h;
+    (void) op;
+    (void) n;
+#endif
 }
 
-bool hashtable_insert(hashtable_t h, hashtable_key_t key, hashtable_elem_t elem)
+static inline void hashtable_stats_search(hashtable_t h, uint64_t steps)
 {
-    hashtable_node_t prev;
-    hashtable_node_t curr;
-    hashtable_node_t node;
+#if HASHTABLE_STATS
+    hashtable_counter_t * stripe = &(h->counters[thread_index_stripe(COUNTER_STRIPES)]);
+
+    atomic_fetch_add_explicit(&(stripe->searches), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(stripe->search_steps), steps, memory_order_relaxed);
+
+    // Rarely a new maximum, so usually just a load
+    uint64_t max = atomic_load_explicit(&(stripe->search_max), memory_order_relaxed);
+    while (steps > max && !atomic_compare_exchange_weak_explicit(&(stripe->search_max), &max, steps, memory_order_relaxed, memory_order_relaxed));
+#else
+    (void) h;
+    (void) steps;
+#endif
+}
 
-    // Check input
-    if (!h) return false;
+static inline uint64_t hashtable_stats_now(void)
+{
+#if HASHTABLE_STATS
+    struct timespec now;
+
+    // C11 only promises a realtime clock. Resizes are short enough that it hardly matters
+    if (!timespec_get(&now, TIME_UTC)) return 0;
+    return (uint64_t) now.tv_sec * UINT64_C(1000000000) + (uint64_t) now.tv_nsec;
+#else
+    return 0;
+#endif
+}
 
-    // If some other thread isn't already resizing, we'll do it
-    bool already_resizing = atomic_flag_test_and_set(&(h->table_resizing));
-    if (!already_resizing) {
-        if ((atomic_load(&(h->n_elements)) + 1) > ((1U << h->hash_width)*2)) {
-            // Resize
-            if (hashtable_resize_array(h, (void **) &(h->hash_list), (1 << h->hash_width), (1 << h->hash_width)*2, sizeof(hashtable_node_t*))) {
-                // Create references to the new list locations
-                uint_fast32_t i;
-                for (i = (1U << h->hash_width); i < (1U << h->hash_width)*2; i++) {
-                    while (true) {
-                        hashtable_find_location(h, i, &curr, &prev);
-
-                        // Check if we should create a new node
-                        if (curr && i == hashtable_node_get_hash(curr)) {
-                            // Just set our reference
-                            h->hash_list[i] = curr;
-
-                            // Done with this sentinel
-                            break;
-                        }
-                        else {
-                            // Create a sentinel node
-                            node = hashtable_node_create(NULL, i);
-                            hashtable_node_set_sentinel(node);
-
-                            // Insert it
-                            hashtable_node_set_next(node, curr);
-                            if (hashtable_node_cas_next(prev, curr, node)) {
-                                // Set the reference
-                                h->hash_list[i] = node;
-
-                                // Done with this sentinel
-                                break;
-                            }
-                            else {
-                                hashtable_node_free(node);
-                            }
-                        }
-                    }
-                }
+static inline void hashtable_stats_resize(hashtable_t h, uint64_t start)
+{
+#if HASHTABLE_STATS
+    uint64_t stop = hashtable_stats_now();
+
+    atomic_fetch_add_explicit(&(h->resizes), 1, memory_order_relaxed);
+    if (stop > start) atomic_fetch_add_explicit(&(h->resize_ns), stop - start, memory_order_relaxed);
+#else
+    (void) h;
+    (void) start;
+#endif
+}
 
-                // Increase hash width
-                h->hash_mask |= (1 << h->hash_width);
-                (h->hash_width)++;
-            }
+static bool hashtable_build(hashtable_t h, const hashtable_pair_t * pairs, size_t n)
+{
+    size_t used = 0;
+    size_t i;
+
+    if (!n) return true;
+
+    // Everything in list order. Stable, so the first of each key comes first
+    const hashtable_key_t * keys = &(pairs[0].key);
+    hashtable_batch_entry_t * batch = hashtable_batch_sort(h, keys, sizeof(hashtable_pair_t), n);
+    if (!batch) return false;
+
+    // One node for each pair, and one sentinel for every bucket but 0
+    uint32_t width = atomic_load_explicit(&(h->hash_width), memory_order_relaxed);
+    uint64_t n_buckets = UINT64_C(1) << width;
+    size_t n_nodes = n + (size_t) (n_buckets - 1);
+    hashtable_node_t block = hashtable_node_create_block(n_nodes);
+    if (!block) {
+        free(batch);
+        return false;
+    }
+
+    // Merge the pairs with the sentinels. Visiting bucket indices in
+    // bit-reversed order visits the sentinels in split order, and a sentinel
+    // never shares a split-order key with a regular node
+    hashtable_node_t prev = atomic_load_explicit(hashtable_bucket(h, 0), memory_order_relaxed);
+    uint64_t rank = 1;
+    for (i = 0; i <= n; i++) {
+        // Every sentinel before this pair, or every one left after the last
+        while (rank < n_buckets) {
+            uint32_t bucket = (uint32_t) (hashtable_node_uint64_bit_reverse(rank) >> (64 - width));
+            if (i < n && hashtable_node_split_order_key(bucket, true) > batch[i].so_key) break;
+
+            hashtable_node_t sentinel = block + used++;
+            hashtable_node_init_sentinel(sentinel, bucket);
+            atomic_init(hashtable_bucket(h, bucket), sentinel);
+            hashtable_node_set_next(prev, sentinel);
+            prev = sentinel;
+            rank++;
         }
+        if (i == n) break;
+
+        // Later pairs with the same key are dropped, as if inserted in order
+        if (hashtable_batch_duplicate(h, batch, i, keys, sizeof(hashtable_pair_t))) continue;
+
+        const hashtable_pair_t * pair = &(pairs[batch[i].index]);
+        hashtable_node_t node = block + used++;
+        hashtable_node_init(node, pair->key, pair->elem, batch[i].hash);
+        hashtable_node_set_next(prev, node);
+        prev = node;
     }
-    atomic_flag_clear(&(h->table_resizing));
+    free(batch);
 
-    // Get the key's hash
-    uint32_t hash;
-    hash = h->hash_f(key);
+    // Nodes left over from dropped pairs go back to the pool
+    for (i = used; i < n_nodes; i++) hashtable_node_free(block + i);
 
-    // Loop until success
-    bool insert_success = false;
-    do {
-        // Find the appropriate place in the table
-        hashtable_find_location(h, hash, &curr, &prev);
+    // Nobody else can see the table yet, so there's no need to spread the count out
+    atomic_store_explicit(&(h->counters[0].count), (int_fast64_t) (used - (n_buckets - 1)), memory_order_relaxed);
+    atomic_store_explicit(&(h->sentinels), n_buckets, memory_order_relaxed);
 
-        // Check if hash is already present
-        if (curr && hashtable_node_get_hash(curr) == hash) {
-            // See if it's a sentinel
-            if (!hashtable_node_is_sentinel(curr)) return false;
+    return true;
+}
 
-            // If it's still a sentinel, set the element
-            insert_success = hashtable_node_if_sentinel_set_elem(curr, elem);
-        }
-        else {
-            // Create a new node
-            node = hashtable_node_create(elem, hash);
+static inline bool hashtable_batch_duplicate(hashtable_t h, const hashtable_batch_entry_t * batch, size_t i, const hashtable_key_t * keys, size_t stride)
+{
+    size_t j;
 
-            // Insert it
-            hashtable_node_set_next(node, curr);
-            insert_success = hashtable_node_cas_next(prev, curr, node);
+    // Without an eq_f, a split-order key is a key
+    if (!h->eq_f) return i > 0 && batch[i - 1].so_key == batch[i].so_key;
 
-            // Clean up after ourselves
-            if (!insert_success) free(elem);
-        }
-    } while (!insert_success);
+    // Otherwise check every earlier key that collides with it
+    hashtable_key_t key = *(const hashtable_key_t *) ((const char *) keys + batch[i].index*stride);
+    for (j = i; j > 0 && batch[j - 1].so_key == batch[i].so_key; j--) {
+        if (h->eq_f(*(const hashtable_key_t *) ((const char *) keys + batch[j - 1].index*stride), key)) return true;
+    }
 
-    // Increase element count
-    atomic_fetch_add(&(h->n_elements), 1);
+    return false;
+}
 
-    // Success
-    return true;
+static inline uint32_t hashtable_width_mask(uint32_t width)
+{
+    return (uint32_t) ((UINT64_C(1) << width) - 1);
 }
 
-hashtable_elem_t hashtable_get(hashtable_t h, hashtable_key_t key)
+static uint32_t hashtable_capacity_width(size_t capacity)
 {
-    hashtable_node_t prev;
-    hashtable_node_t curr;
-    uint32_t hash;
+    uint32_t width = HASH_WIDTH_INIT;
 
-    // Generate hash
-    hash = h->hash_f(key);
+    // The same load hashtable_grow allows
+    while (width < HASH_WIDTH_MAX && capacity > ((UINT64_C(1) << width)*GROW_LOAD)) width++;
 
-    // Search table
-    hashtable_find_location(h, hash, &curr, &prev);
+    return width;
+}
+
+static bool hashtable_prebuild(hashtable_t h, uint32_t width)
+{
+    uint32_t w;
 
-    // Check if hash is already present
-    if (curr && hashtable_node_get_hash(curr) == hash && !hashtable_node_is_sentinel(curr)) {
-        return hashtable_node_get_elem(curr);
+    // Only the directory. Sentinels are still created as their buckets are
+    // first used, so each tends to share a slab with its bucket's first nodes
+    for (w = HASH_WIDTH_INIT; w < width; w++) {
+        if (!hashtable_segment_alloc(h, w)) return false;
     }
-    else {
-        return NULL;
+
+    return true;
+}
+
+static const hashtable_engine_ops_t * hashtable_engine_ops(hashtable_engine_t engine)
+{
+    switch (engine) {
+    case HASHTABLE_ENGINE_PROBE:    return &hashtable_probe_ops;
+    case HASHTABLE_ENGINE_CUCKOO:   return &hashtable_cuckoo_ops;
+    case HASHTABLE_ENGINE_MUTEX:    return &hashtable_mutex_ops;
+    case HASHTABLE_ENGINE_RWLOCK:   return &hashtable_rwlock_ops;
+    case HASHTABLE_ENGINE_STRIPED:  return &hashtable_striped_ops;
+    default:                        return NULL;
     }
 }
 
-hashtable_elem_t hashtable_remove(hashtable_t h, hashtable_key_t key)
+static bool hashtable_engine_build(hashtable_t h, const hashtable_pair_t * pairs, size_t n)
 {
-    hashtable_node_t prev;
-    hashtable_node_t curr;
-    uint32_t hash;
+    hashtable_elem_t present;
+    bool success = true;
+    size_t i;
+
+    // In order, so the first pair with each key wins. A key that's already
+    // there leaves present set; a failure doesn't
+    hashtable_reclaim_enter(h);
+    for (i = 0; success && i < n; i++) {
+        uint64_t hash = hashtable_hash(h, pairs[i].key);
+        if (!h->engine->insert(h->table, pairs[i].key, hash, pairs[i].elem, &present) && !present) success = false;
+    }
+    hashtable_reclaim_exit(h);
 
-    // Generate hash
-    hash = h->hash_f(key);
+    return success;
+}
 
-    // Loop until successful removal
-    hashtable_elem_t elem;
-    bool remove_success = false;
-    do {
-        // Search table
-        hashtable_find_location(h, hash, &curr, &prev);
-
-        // Check if it's actually in the table
-        uint32_t node_hash = hashtable_node_get_hash(curr);
-        if (curr && node_hash == hash && !hashtable_node_is_sentinel(curr)) {
-            // Determine if it should be left in as a sentinel
-            if (node_hash == (node_hash & h->hash_mask)) {
-                // Save the element
-                elem = hashtable_node_get_elem(curr);
-
-                // Try to set as sentinel
-                remove_success = hashtable_node_set_sentinel_if_elem(curr, elem);
-            }
-            else {
-                // Save the element
-                elem = hashtable_node_get_elem(curr);
+static hashtable_elem_t hashtable_engine_compute(hashtable_t h, uint64_t hash, hashtable_key_t key, compute_f_t compute_f)
+{
+    hashtable_elem_t present;
+
+    // Only make the element if the key looks absent. If another thread
+    // inserts it first, its element wins, and ours is freed
+    hashtable_reclaim_enter(h);
+    present = h->engine->get(h->table, key, hash);
+    if (!present) {
+        hashtable_elem_t elem = compute_f(key);
+        if (elem && !h->engine->insert(h->table, key, hash, elem, &present) && h->free_f) h->free_f(elem);
+    }
+    hashtable_reclaim_exit(h);
+
+    return present;
+}
+
+static hashtable_combiner_t * hashtable_combiner_create(void)
+{
+    uint32_t i;
 
-                // Try to remove from the list
-                remove_success = hashtable_node_cas_next(prev, curr, hashtable_node_get_next(curr));
+    // Aligned, so no two slots share a cache line
+    hashtable_combiner_t * c = (hashtable_combiner_t *) aligned_alloc(CACHE_LINE, sizeof(hashtable_combiner_t));
+    if (!c) return NULL;
 
-                // Save the node for later deallocation
-                if (remove_success) hashtable_save_node(h, curr);
-            }
+    spinlock_ttas_init(&(c->lock));
+    atomic_init(&(c->n_used), 0);
+    for (i = 0; i < COMBINE_SLOTS; i++) atomic_init(&(c->slots[i].state), COMBINE_FREE);
+
+    return c;
+}
+
+static bool hashtable_combine(hashtable_t h, bool remove, uint64_t hash, hashtable_key_t key, hashtable_elem_t * elem, bool * success)
+{
+    hashtable_combiner_t * c = h->combiner;
+    uint32_t index = thread_index_stripe(COMBINE_SLOTS);
+    hashtable_combine_slot_t * slot = &(c->slots[index]);
+    unsigned int state = COMBINE_FREE;
+    uint32_t spins = 0;
+
+    // Another thread on our stripe is using the slot. Rather than wait, go straight to the table
+    if (!atomic_compare_exchange_strong_explicit(&(slot->state), &state, COMBINE_CLAIMED, memory_order_acquire, memory_order_relaxed)) return false;
+
+    // Make sure combiners look this far
+    unsigned int n_used = atomic_load_explicit(&(c->n_used), memory_order_relaxed);
+    while (n_used <= index && !atomic_compare_exchange_weak_explicit(&(c->n_used), &n_used, index + 1, memory_order_relaxed, memory_order_relaxed));
+
+    // Publish the operation
+    slot->remove = remove;
+    slot->key = key;
+    slot->hash = hash;
+    slot->elem = *elem;
+    atomic_store_explicit(&(slot->state), COMBINE_PENDING, memory_order_release);
+
+    // Wait for it to be done, doing it (and everyone else's) ourselves whenever we can
+    while (atomic_load_explicit(&(slot->state), memory_order_acquire) != COMBINE_DONE) {
+        if (spinlock_ttas_trylock(&(c->lock))) {
+            hashtable_combine_apply(h);
+            spinlock_ttas_unlock(&(c->lock));
         }
         else {
-            // Not present
-            return NULL;
+            spinlock_relax(&spins);
         }
-    } while (!remove_success);
+    }
 
-    // Decrement the number of elements
-    atomic_fetch_sub(&(h->n_elements), 1);
+    // Collect the result, and hand the slot back
+    *elem = slot->elem;
+    *success = slot->success;
+    atomic_store_explicit(&(slot->state), COMBINE_FREE, memory_order_release);
 
-    // Pass back the element
-    return elem;
+    return true;
 }
 
-void hashtable_print(hashtable_t h)
+static void hashtable_combine_apply(hashtable_t h)
 {
-    hashtable_node_t curr;
+    hashtable_combiner_t * c = h->combiner;
+    hashtable_batch_entry_t batch[COMBINE_SLOTS];
+    hashtable_node_t resume = NULL;
+    int_fast64_t delta = 0;
+    size_t n_used = atomic_load_explicit(&(c->n_used), memory_order_relaxed);
+    size_t n = 0;
+    size_t i;
+    size_t j;
+
+    // Gather what's pending, insertion sorted into list order. There are never
+    // many, and operations on the same key stay in slot order
+    for (i = 0; i < n_used; i++) {
+        hashtable_combine_slot_t * slot = &(c->slots[i]);
+        if (atomic_load_explicit(&(slot->state), memory_order_acquire) != COMBINE_PENDING) continue;
+
+        uint64_t so_key = hashtable_node_split_order_key(slot->hash, false);
+        for (j = n; j > 0 && batch[j - 1].so_key > so_key; j--) batch[j] = batch[j - 1];
+        batch[j].so_key = so_key;
+        batch[j].hash = slot->hash;
+        batch[j].index = i;
+        n++;
+    }
 
-    for (curr = h->hash_list[0]; curr; curr = hashtable_node_get_next(curr)) {
-        uint32_t hash = hashtable_node_get_hash(curr);
-        if (hashtable_node_is_sentinel(curr)) {
-            printf("[ ...0x%08x (0x%08x) ]\n", hash, hashtable_uint32_bit_reverse(hash));
+    // Apply them all, each search picking up where the last left off
+    hashtable_reclaim_enter(h);
+    for (i = 0; i < n; i++) {
+        hashtable_combine_slot_t * slot = &(c->slots[batch[i].index]);
+        if (slot->remove) {
+            slot->elem = h->engine ? h->engine->remove(h->table, slot->key, slot->hash) : hashtable_remove_at(h, slot->hash, slot->key, &resume);
+            slot->success = (slot->elem != NULL);
+            if (slot->success) delta--;
         }
         else {
-            printf("[    0x%08x (0x%08x) ]: ", hash, hashtable_uint32_bit_reverse(hash));
-            h->print_f(hashtable_node_get_elem(curr));
-            printf("\n");
+            slot->success = h->engine ? h->engine->insert(h->table, slot->key, slot->hash, slot->elem, NULL) : hashtable_insert_at(h, slot->hash, slot->key, slot->elem, NULL, &resume, NULL);
+            if (slot->success) delta++;
         }
     }
-}
+    hashtable_reclaim_exit(h);
 
-/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+    // Let everyone go before counting, which may resize. Engines count for themselves
+    for (i = 0; i < n; i++) atomic_store_explicit(&(c->slots[batch[i].index].state), COMBINE_DONE, memory_order_release);
+    if (delta && !h->engine) hashtable_count(h, delta);
+}
 
-static inline void hashtable_find_location(hashtable_t h, uint32_t hash, hashtable_node_t * curr, hashtable_node_t * prev)
+static inline void hashtable_lookup_advance(hashtable_lookup_t * l, bool hazard)
 {
-    // Get reversed hash
-    uint32_t reversed = hashtable_uint32_bit_reverse(hash);
-    
-    // Find start node
-    *curr = h->hash_list[hash & h->hash_mask];
+    bool marked;
+    hashtable_node_t next = hashtable_node_get_next_mark(l->prev, &marked);
 
-    // Step through the list
-    while (*curr && hashtable_uint32_bit_reverse(hashtable_node_get_hash(*curr)) < reversed) {
-        *prev = *curr;
-        *curr = hashtable_node_get_next(*prev);
+    // A removed node's successor can't be trusted. The usual search helps unlink it
+    if (marked) {
+        l->state = LOOKUP_RETRY;
+        return;
     }
-}
 
-static inline void hashtable_save_node(hashtable_t h, hashtable_node_t node)
-{
-    // Shove it in the list
-    reference_list_insert(h->saved_nodes, node);
+    // Off the end of the list
+    if (!next) {
+        l->state = LOOKUP_DONE;
+        return;
+    }
+
+    // Protect it, then make sure prev still pointed at it afterwards
+    if (hazard) {
+        l->slot ^= 1;
+        hazard_pointer_set(l->slot, next);
+        if (hashtable_node_get_next_mark(l->prev, &marked) != next || marked) {
+            l->state = LOOKUP_RETRY;
+            return;
+        }
+    }
+
+    l->curr = next;
+    __builtin_prefetch(next);
 }
 
-static inline void hashtable_save_pointer(hashtable_t h, void * pointer)
+static inline void hashtable_lookup_examine(hashtable_t h, hashtable_lookup_t * l, hashtable_key_t key, bool hazard)
 {
-    // Shove it in the list
-    reference_list_insert(h->saved_pointers, pointer);
+    uint64_t so_key = hashtable_node_get_so_key(l->curr);
+
+    // Found it, as hashtable_list_find would, or where it would be
+    if (so_key > l->so_key || (so_key == l->so_key && (!h->eq_f || h->eq_f(hashtable_node_get_key(l->curr), key)))) {
+        if (so_key != l->so_key || !hashtable_live_elem(h, l->curr, &(l->elem))) l->elem = NULL;
+        hashtable_stats_search(h, l->steps);
+        l->state = LOOKUP_DONE;
+        return;
+    }
+
+    // Step past it. It stays protected in its slot
+    l->prev = l->curr;
+    l->steps++;
+    hashtable_lookup_advance(l, hazard);
 }
 
-static inline bool hashtable_resize_array(hashtable_t h, void ** array, uint32_t old_size, uint32_t new_size, uint32_t elem_size)
+static hashtable_retired_t * hashtable_retired_create(void)
 {
-    // Check inputs
-    if (!array || !*array) return false;
+    uint32_t i;
+
+    // Aligned, so no two stripes share a cache line
+    hashtable_retired_t * r = (hashtable_retired_t *) aligned_alloc(CACHE_LINE, sizeof(hashtable_retired_t));
+    if (!r) return NULL;
 
-    // Allocate new memory
-    void * new_array = (void *) malloc(new_size*elem_size);
-    if (!new_array) return false;
+    for (i = 0; i < COUNTER_STRIPES; i++) atomic_init(&(r->stripes[i].bytes), 0);
+    r->next = NULL;
 
-    // Copy data
-    memcpy(new_array, *array, old_size*elem_size);
+    return r;
+}
 
-    // Swap over reference
-    void * old_array = *array;
-    *array = new_array;
+static int_fast64_t hashtable_retired_bytes(hashtable_retired_t * r)
+{
+    int_fast64_t total = 0;
+    uint32_t i;
 
-    // Save old array
-    hashtable_save_pointer(h, old_array);
+    for (i = 0; i < COUNTER_STRIPES; i++) total += atomic_load_explicit(&(r->stripes[i].bytes), memory_order_acquire);
 
-    // Success
-    return true;
+    return total;
 }
 
-static void hashtable_node_reference_list_free(void* elem)
+static void hashtable_retired_release(hashtable_retired_t * r)
 {
-    hashtable_node_free((hashtable_node_t) elem);
+    hashtable_retired_t ** link;
+
+    pthread_mutex_lock(&hashtable_orphans_lock);
+    if (r) {
+        r->next = hashtable_orphans;
+        hashtable_orphans = r;
+    }
+
+    // With no more additions, no stripe grows, so reading zero means nobody's left to subtract
+    link = &hashtable_orphans;
+    while (*link) {
+        hashtable_retired_t * orphan = *link;
+        if (hashtable_retired_bytes(orphan) == 0) {
+            *link = orphan->next;
+            free(orphan);
+        }
+        else {
+            link = &(orphan->next);
+        }
+    }
+    pthread_mutex_unlock(&hashtable_orphans_lock);
 }
 
-static inline uint32_t hashtable_uint32_bit_reverse(uint32_t val)
+static void hashtable_node_generic_free(void* elem)
 {
-    // Lookup table per byte
-    #define R2(n)     (n),   ((n) | (2 << 6)),   ((n) | (1 << 6)),   ((n) | (3 << 6))
-    #define R4(n)   R2(n), R2((n) | (2 << 4)), R2((n) | (1 << 4)), R2((n) | (3 << 4))
-    #define R6(n)   R4(n), R4((n) | (2 << 2)), R4((n) | (1 << 2)), R4((n) | (3 << 2))
-    static const uint8_t reversed_uint8[256] = {
-        R6(0), R6(2), R6(1), R6(3)
-    };
-
-    uint32_t reversed;
-    uint8_t * reversed_p    = (uint8_t*) &reversed;
-    uint8_t * val_p         = (uint8_t*) &val;
+    hashtable_node_t node = (hashtable_node_t) elem;
 
-    // Reverse each byte, and its position
-    reversed_p[3] = reversed_uint8[val_p[0]];
-    reversed_p[2] = reversed_uint8[val_p[1]];
-    reversed_p[1] = reversed_uint8[val_p[2]];
-    reversed_p[0] = reversed_uint8[val_p[3]];
+#if HASHTABLE_STATS
+    // The last this node's table hears of it
+    hashtable_retired_t * r = (hashtable_retired_t *) hashtable_node_get_elem(node);
+    atomic_fetch_sub_explicit(&(r->stripes[thread_index_stripe(COUNTER_STRIPES)].bytes), sizeof(struct hashtable_node_t_), memory_order_release);
+#endif
 
-    // Return reversed value
-    return reversed;
+    hashtable_node_free(node);
 }
 
 /** @} addtogroup HASHTABLE */
@@ -3,6 +3,21 @@
  * @author  Austin Glaser <austin.glaser@colorado.edu>
  *
  * @brief   Benchmarking code for hashtable parallelism speedup
+ *
+ * Run with no arguments (or "scaling") to time insertion across thread counts.
+ * Run with "reclaim" to compare the reclamation schemes on a read-heavy mix,
+ * reporting throughput and peak resident memory. Run with "lookup" to compare
+ * hashtable_get against hashtable_get_many on a table much larger than cache.
+ * Run with "load" to compare the ways of filling a table from scratch, and how
+ * fast each result can be walked. Run with "skewed" to time insertions and
+ * removals concentrated on a few hot keys, straight on the table with each CAS
+ * backoff policy, and through a combiner, counting the CASes that failed. Name
+ * an engine ("list", "probe", "cuckoo", "mutex", "rwlock" or "striped") after
+ * the benchmark to run it against that engine instead of the default, or "all"
+ * to run it against each in turn, on the same workload and thread counts. Every
+ * row starts with the engine it was run against. The lock-based engines ignore
+ * the reclamation scheme, so in the reclaim benchmark their rows only differ by
+ * noise
  */
 
 /* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
@@ -14,11 +29,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <string.h>
 #include <assert.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <pthread.h>
 
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -29,6 +48,64 @@
 
 #define MAX_N_THREADS       (16)
 
+#define N_RECLAIM_KEYS      (20000)         /**< Size of the key space for the reclaim benchmark */
+#define N_RECLAIM_OPS       (200000)        /**< Operations per thread in the reclaim benchmark */
+#define QUIESCENT_PERIOD    (64)            /**< Operations between quiescent states under QSBR */
+#define GET_PERCENT         (90)            /**< The rest is split evenly between insertion and removal */
+
+#define N_LOOKUP_KEYS       (1 << 22)       /**< Table size for the lookup benchmark. Should dwarf the LLC */
+#define N_LOOKUP_OPS        (1 << 22)       /**< Random lookups per method in the lookup benchmark */
+#define LOOKUP_BATCH        (1024)          /**< Keys per hashtable_get_many call */
+
+#define N_HOT_KEYS          (8)             /**< Keys most operations in the skewed benchmark go to */
+#define N_COLD_KEYS         (4096)          /**< Keys the rest go to */
+#define HOT_PERCENT         (90)            /**< Share of skewed operations on a hot key */
+#define N_SKEWED_OPS        (100000)        /**< Operations per thread in the skewed benchmark */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   A reclamation scheme to benchmark
+ */
+typedef struct reclaim_scheme_t_ {
+    hashtable_reclaim_t reclaim;    /**< The scheme */
+    const char *        name;       /**< What to call it in the output */
+} reclaim_scheme_t;
+
+/**
+ * @brief   A way of handling contention to benchmark
+ */
+typedef struct skewed_mode_t_ {
+    bool                combine;    /**< Whether to put a combiner in front of the table */
+    hashtable_backoff_t backoff;    /**< What to do after a failed CAS */
+    const char *        name;       /**< What to call it in the output */
+} skewed_mode_t;
+
+/**
+ * @brief   A table engine to benchmark
+ */
+typedef struct engine_choice_t_ {
+    hashtable_engine_t  engine;     /**< The engine */
+    const char *        name;       /**< What it's called on the command line */
+} engine_choice_t;
+
+/**
+ * @brief   A benchmark to run
+ */
+typedef struct benchmark_choice_t_ {
+    const char *        name;       /**< What it's called on the command line */
+    const char *        header;     /**< The columns it prints, after the engine */
+    void                (*run)(void);   /**< Runs it against the engine being benchmarked */
+} benchmark_choice_t;
+
+/**
+ * @brief   Per-thread arguments for the reclaim and skewed benchmarks
+ */
+typedef struct reclaim_thread_arg_t_ {
+    hashtable_t         h;          /**< The table to work on */
+    uint32_t            seed;       /**< Random number generator state */
+} reclaim_thread_arg_t;
+
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
 static pthread_t threads[MAX_N_THREADS];
@@ -39,6 +116,31 @@ static uint32_t keys[N_KEYS];
 
 static atomic_uint_fast32_t key_index;
 
+static const reclaim_scheme_t reclaim_schemes[] = {
+    { HASHTABLE_RECLAIM_HAZARD, "hazard" },
+    { HASHTABLE_RECLAIM_EPOCH,  "epoch"  },
+    { HASHTABLE_RECLAIM_QSBR,   "qsbr"   },
+    { HASHTABLE_RECLAIM_NONE,   "none"   },
+};
+
+static const skewed_mode_t skewed_modes[] = {
+    { false,    HASHTABLE_BACKOFF_NONE,         "none" },
+    { false,    HASHTABLE_BACKOFF_EXPONENTIAL,  "exponential" },
+    { false,    HASHTABLE_BACKOFF_ADAPTIVE,     "adaptive" },
+    { true,     HASHTABLE_BACKOFF_NONE,         "combining" },
+};
+
+static const engine_choice_t engines[] = {
+    { HASHTABLE_ENGINE_LIST,    "list"  },
+    { HASHTABLE_ENGINE_PROBE,   "probe" },
+    { HASHTABLE_ENGINE_CUCKOO,  "cuckoo" },
+    { HASHTABLE_ENGINE_MUTEX,   "mutex" },
+    { HASHTABLE_ENGINE_RWLOCK,  "rwlock" },
+    { HASHTABLE_ENGINE_STRIPED, "striped" },
+};
+
+static const engine_choice_t * engine = &(engines[0]);   /**< Every table benchmarked uses this engine */
+
 /* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
 
 /**
@@ -51,6 +153,17 @@ static uint32_t hash_int(hashtable_key_t k);
  */
 static void print_elem(hashtable_elem_t e);
 
+/**
+ * @brief   Creates an empty table with the engine being benchmarked
+ *
+ * @param[in] reclaim:      The reclamation scheme to use
+ * @param[in] combine:      Whether to put a combiner in front of it
+ * @param[in] backoff:      What to do after a failed CAS
+ *
+ * @return      The table, or NULL if memory allocation failed
+ */
+static hashtable_t benchmark_create(hashtable_reclaim_t reclaim, bool combine, hashtable_backoff_t backoff);
+
 /**
  * @brief   Returns the us delta between two times
  *
@@ -68,9 +181,124 @@ double timedifference_sec(struct timeval t0, struct timeval t1);
  */
 static void* test_thread_f(void* arg);
 
+/**
+ * @brief   Times insertion across all thread counts
+ */
+static void benchmark_scaling(void);
+
+/**
+ * @brief   Compares reclamation schemes on a read-heavy mix
+ *
+ * Each scheme and thread count is run in its own process, so
+ * peak memory use isn't polluted by earlier runs
+ */
+static void benchmark_reclaim(void);
+
+/**
+ * @brief   Runs a single reclaim benchmark configuration, and reports the results
+ *
+ * @param[in] scheme:       The reclamation scheme to use
+ * @param[in] n_threads:    The number of threads to run
+ */
+static void benchmark_reclaim_run(const reclaim_scheme_t * scheme, uint32_t n_threads);
+
+/**
+ * @brief   Times random lookups in a large table, singly and in batches
+ */
+static void benchmark_lookup(void);
+
+/**
+ * @brief   Times filling a large table by insertion, batched insertion and bulk loading
+ */
+static void benchmark_load(void);
+
+/**
+ * @brief   Times insertions and removals on a few hot keys, with each way of handling contention
+ */
+static void benchmark_skewed(void);
+
+/**
+ * @brief   Walks a whole table, and prints how long it took
+ *
+ * @param[in] h:        The table to walk
+ * @param[in] method:   How the table was filled
+ */
+static void benchmark_load_scan(hashtable_t h, const char * method);
+
+/**
+ * @brief   Performs a random mix of gets, insertions and removals
+ *
+ * @param[in,out] arg:      A reclaim_thread_arg_t
+ */
+static void* reclaim_thread_f(void* arg);
+
+/**
+ * @brief   Inserts and removes keys, mostly hot ones, at random
+ *
+ * @param[in,out] arg:      A reclaim_thread_arg_t
+ */
+static void* skewed_thread_f(void* arg);
+
+/**
+ * @brief   Cheap pseudo-random number generator (xorshift32)
+ *
+ * @param[in,out] state:    Generator state. Must not be zero
+ *
+ * @return      The next pseudo-random number
+ */
+static inline uint32_t xorshift32(uint32_t * state);
+
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 
-int main(void)
+int main(int argc, char** argv)
+{
+    static const benchmark_choice_t benchmarks[] = {
+        { "scaling",    "threads,seconds",                                  benchmark_scaling },
+        { "reclaim",    "reclaim,threads,seconds,ops_per_sec,peak_rss_kb",  benchmark_reclaim },
+        { "lookup",     "method,seconds,ops_per_sec",                       benchmark_lookup },
+        { "load",       "method,seconds,ops_per_sec",                       benchmark_load },
+        { "skewed",     "mode,threads,seconds,ops_per_sec,cas_failures",    benchmark_skewed },
+    };
+    const benchmark_choice_t * benchmark = &(benchmarks[0]);
+    size_t first_engine = 0;
+    size_t n_engines = 1;
+    size_t i;
+
+    // Pick a benchmark
+    if (argc >= 2) {
+        for (i = 0; i < ARRAY_ELEMENTS(benchmarks) && strcmp(argv[1], benchmarks[i].name); i++);
+        if (i == ARRAY_ELEMENTS(benchmarks)) {
+            fprintf(stderr, "usage: %s [scaling|reclaim|lookup|load|skewed] [list|probe|cuckoo|mutex|rwlock|striped|all]\n", argv[0]);
+            return 1;
+        }
+        benchmark = &(benchmarks[i]);
+    }
+
+    // Pick an engine, or all of them
+    if (argc >= 3 && !strcmp(argv[2], "all")) {
+        n_engines = ARRAY_ELEMENTS(engines);
+    }
+    else if (argc >= 3) {
+        for (i = 0; i < ARRAY_ELEMENTS(engines) && strcmp(argv[2], engines[i].name); i++);
+        if (i == ARRAY_ELEMENTS(engines)) {
+            fprintf(stderr, "unknown engine %s\n", argv[2]);
+            return 1;
+        }
+        first_engine = i;
+    }
+
+    printf("engine,%s;\n", benchmark->header);
+    for (i = first_engine; i < first_engine + n_engines; i++) {
+        engine = &(engines[i]);
+        benchmark->run();
+    }
+
+    return 0;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static void benchmark_scaling(void)
 {
     uint32_t i;
 
@@ -88,10 +316,9 @@ int main(void)
     }
 
     // Loop over all different thread counts
-    printf("threads,seconds;\n");
     for (i = 1; i <= MAX_N_THREADS; i++) {
         // Create data structure
-        hashtable_t h = hashtable_create(hash_int, print_elem, NULL);
+        hashtable_t h = benchmark_create(HASHTABLE_RECLAIM_HAZARD, false, HASHTABLE_BACKOFF_NONE);
 
         // Create threads
         start_operation = false;
@@ -112,14 +339,291 @@ int main(void)
         gettimeofday(&stop, NULL);
 
         // Report results
-        printf("%d,%0.6lf;\n", i, timedifference_sec(start, stop));
+        printf("%s,%d,%0.6lf;\n", engine->name, i, timedifference_sec(start, stop));
 
         // Free
         hashtable_free(h);
     }
 }
 
-/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+static void benchmark_reclaim(void)
+{
+    uint32_t i;
+    uint32_t n_threads;
+
+    for (i = 0; i < ARRAY_ELEMENTS(reclaim_schemes); i++) {
+        for (n_threads = 1; n_threads <= MAX_N_THREADS; n_threads *= 2) {
+            // Don't let the child inherit unflushed output
+            fflush(stdout);
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                benchmark_reclaim_run(&(reclaim_schemes[i]), n_threads);
+                fflush(stdout);
+                _exit(0);
+            }
+            else if (pid > 0) {
+                waitpid(pid, NULL, 0);
+            }
+            else {
+                fprintf(stderr, "fork failed\n");
+                return;
+            }
+        }
+    }
+}
+
+static void benchmark_reclaim_run(const reclaim_scheme_t * scheme, uint32_t n_threads)
+{
+    reclaim_thread_arg_t args[MAX_N_THREADS];
+    uint32_t i;
+
+    // Create data structure
+    hashtable_t h = benchmark_create(scheme->reclaim, false, HASHTABLE_BACKOFF_NONE);
+    if (!h) return;
+
+    // Half full, so insertions and removals both mostly succeed
+    for (i = 0; i < N_RECLAIM_KEYS; i += 2) hashtable_insert(h, (void*)(uintptr_t) i, (void*)(uintptr_t) (i + 1));
+    hashtable_thread_offline(h);
+
+    // Create threads
+    start_operation = false;
+    for (i = 0; i < n_threads; i++) {
+        args[i].h = h;
+        args[i].seed = i + 1;
+        pthread_create(&(threads[i]), NULL, reclaim_thread_f, &(args[i]));
+    }
+
+    // Start threads and timer
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    start_operation = true;
+
+    // Wait on threads
+    for (i = 0; i < n_threads; i++) pthread_join(threads[i], NULL);
+
+    // Stop timer
+    struct timeval stop;
+    gettimeofday(&stop, NULL);
+
+    // Report results
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double seconds = timedifference_sec(start, stop);
+    printf("%s,%s,%d,%0.6lf,%0.0lf,%ld;\n",
+           engine->name,
+           scheme->name,
+           n_threads,
+           seconds,
+           (double) N_RECLAIM_OPS * n_threads / seconds,
+           usage.ru_maxrss);
+
+    // Free
+    hashtable_free(h);
+}
+
+static void benchmark_lookup(void)
+{
+    hashtable_key_t * lookup_keys;
+    hashtable_elem_t * lookup_elems;
+    uint32_t seed = 1;
+    size_t found;
+    size_t i;
+
+    lookup_keys = malloc(sizeof(hashtable_key_t) * N_LOOKUP_KEYS);
+    lookup_elems = malloc(sizeof(hashtable_elem_t) * N_LOOKUP_KEYS);
+    if (!lookup_keys || !lookup_elems) {
+        fprintf(stderr, "out of memory\n");
+        free(lookup_keys);
+        free(lookup_elems);
+        return;
+    }
+
+    // Fill the table. Elements are never dereferenced, they just have to be non-NULL
+    hashtable_t h = benchmark_create(HASHTABLE_RECLAIM_HAZARD, false, HASHTABLE_BACKOFF_NONE);
+    if (!h) {
+        free(lookup_keys);
+        free(lookup_elems);
+        return;
+    }
+    for (i = 0; i < N_LOOKUP_KEYS; i++) {
+        lookup_keys[i] = (void*)(uintptr_t) i;
+        lookup_elems[i] = (void*)(uintptr_t) (i + 1);
+    }
+    hashtable_insert_many(h, lookup_keys, lookup_elems, N_LOOKUP_KEYS);
+
+    // Random keys, so nearly every lookup misses cache
+    for (i = 0; i < N_LOOKUP_OPS; i++) lookup_keys[i] = (void*)(uintptr_t) (xorshift32(&seed) % N_LOOKUP_KEYS);
+
+    // One at a time
+    struct timeval start;
+    struct timeval stop;
+    found = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < N_LOOKUP_OPS; i++) if (hashtable_get(h, lookup_keys[i])) found++;
+    gettimeofday(&stop, NULL);
+    assert(found == N_LOOKUP_OPS);
+    double seconds = timedifference_sec(start, stop);
+    printf("%s,get,%0.6lf,%0.0lf;\n", engine->name, seconds, N_LOOKUP_OPS / seconds);
+
+    // Batched
+    found = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < N_LOOKUP_OPS; i += LOOKUP_BATCH) {
+        found += hashtable_get_many(h, &(lookup_keys[i]), &(lookup_elems[i]), LOOKUP_BATCH);
+    }
+    gettimeofday(&stop, NULL);
+    assert(found == N_LOOKUP_OPS);
+    seconds = timedifference_sec(start, stop);
+    printf("%s,get_many,%0.6lf,%0.0lf;\n", engine->name, seconds, N_LOOKUP_OPS / seconds);
+
+    // Free
+    hashtable_free(h);
+    free(lookup_keys);
+    free(lookup_elems);
+}
+
+static void benchmark_load(void)
+{
+    hashtable_key_t * load_keys;
+    hashtable_elem_t * load_elems;
+    hashtable_pair_t * pairs;
+    uint32_t seed = 1;
+    size_t i;
+
+    load_keys = malloc(sizeof(hashtable_key_t) * N_LOOKUP_KEYS);
+    load_elems = malloc(sizeof(hashtable_elem_t) * N_LOOKUP_KEYS);
+    pairs = malloc(sizeof(hashtable_pair_t) * N_LOOKUP_KEYS);
+    if (!load_keys || !load_elems || !pairs) {
+        fprintf(stderr, "out of memory\n");
+        free(load_keys);
+        free(load_elems);
+        free(pairs);
+        return;
+    }
+
+    // Every key once, in random order
+    for (i = 0; i < N_LOOKUP_KEYS; i++) load_keys[i] = (void*)(uintptr_t) i;
+    for (i = N_LOOKUP_KEYS - 1; i > 0; i--) {
+        size_t j = xorshift32(&seed) % (i + 1);
+        hashtable_key_t temp = load_keys[i];
+        load_keys[i] = load_keys[j];
+        load_keys[j] = temp;
+    }
+    for (i = 0; i < N_LOOKUP_KEYS; i++) {
+        load_elems[i] = (void*)((uintptr_t) load_keys[i] + 1);
+        pairs[i].key = load_keys[i];
+        pairs[i].elem = load_elems[i];
+    }
+
+    // One at a time
+    struct timeval start;
+    struct timeval stop;
+    gettimeofday(&start, NULL);
+    hashtable_t h = benchmark_create(HASHTABLE_RECLAIM_HAZARD, false, HASHTABLE_BACKOFF_NONE);
+    for (i = 0; h && i < N_LOOKUP_KEYS; i++) hashtable_insert(h, load_keys[i], load_elems[i]);
+    gettimeofday(&stop, NULL);
+    assert(h && hashtable_size_approx(h) == N_LOOKUP_KEYS);
+    double seconds = timedifference_sec(start, stop);
+    printf("%s,insert,%0.6lf,%0.0lf;\n", engine->name, seconds, N_LOOKUP_KEYS / seconds);
+    benchmark_load_scan(h, "insert");
+    hashtable_free(h);
+
+    // Batched
+    gettimeofday(&start, NULL);
+    h = benchmark_create(HASHTABLE_RECLAIM_HAZARD, false, HASHTABLE_BACKOFF_NONE);
+    if (h) hashtable_insert_many(h, load_keys, load_elems, N_LOOKUP_KEYS);
+    gettimeofday(&stop, NULL);
+    assert(h && hashtable_size_approx(h) == N_LOOKUP_KEYS);
+    seconds = timedifference_sec(start, stop);
+    printf("%s,insert_many,%0.6lf,%0.0lf;\n", engine->name, seconds, N_LOOKUP_KEYS / seconds);
+    benchmark_load_scan(h, "insert_many");
+    hashtable_free(h);
+
+    // Bulk loaded
+    hashtable_config_t config;
+    hashtable_config_init(&config);
+    config.engine = engine->engine;
+    gettimeofday(&start, NULL);
+    h = hashtable_create_from(pairs, N_LOOKUP_KEYS, hash_int, print_elem, NULL, &config);
+    gettimeofday(&stop, NULL);
+    assert(h && hashtable_size_approx(h) == N_LOOKUP_KEYS);
+    seconds = timedifference_sec(start, stop);
+    printf("%s,create_from,%0.6lf,%0.0lf;\n", engine->name, seconds, N_LOOKUP_KEYS / seconds);
+    benchmark_load_scan(h, "create_from");
+    hashtable_free(h);
+
+    // Free
+    free(load_keys);
+    free(load_elems);
+    free(pairs);
+}
+
+static void benchmark_skewed(void)
+{
+    reclaim_thread_arg_t args[MAX_N_THREADS];
+    uint32_t n_threads;
+    uint32_t mode;
+    uint32_t i;
+
+    for (mode = 0; mode < ARRAY_ELEMENTS(skewed_modes); mode++) {
+        for (n_threads = 1; n_threads <= MAX_N_THREADS; n_threads *= 2) {
+            // Create data structure
+            hashtable_t h = benchmark_create(HASHTABLE_RECLAIM_HAZARD, skewed_modes[mode].combine, skewed_modes[mode].backoff);
+            if (!h) return;
+
+            // Create threads
+            start_operation = false;
+            for (i = 0; i < n_threads; i++) {
+                args[i].h = h;
+                args[i].seed = i + 1;
+                pthread_create(&(threads[i]), NULL, skewed_thread_f, &(args[i]));
+            }
+
+            // Start threads and timer
+            struct timeval start;
+            gettimeofday(&start, NULL);
+            start_operation = true;
+
+            // Wait on threads
+            for (i = 0; i < n_threads; i++) pthread_join(threads[i], NULL);
+
+            // Stop timer
+            struct timeval stop;
+            gettimeofday(&stop, NULL);
+
+            // Report results
+            double seconds = timedifference_sec(start, stop);
+            printf("%s,%s,%d,%0.6lf,%0.0lf,%" PRIu64 ";\n",
+                   engine->name,
+                   skewed_modes[mode].name,
+                   n_threads,
+                   seconds,
+                   (double) N_SKEWED_OPS * n_threads / seconds,
+                   hashtable_cas_failures(h));
+
+            // Free
+            hashtable_free(h);
+        }
+    }
+}
+
+static void benchmark_load_scan(hashtable_t h, const char * method)
+{
+    struct timeval start;
+    struct timeval stop;
+    size_t visited = 0;
+
+    gettimeofday(&start, NULL);
+    hashtable_iter_t it = hashtable_iter_create(h);
+    while (hashtable_iter_next(it, NULL, NULL)) visited++;
+    hashtable_iter_free(it);
+    gettimeofday(&stop, NULL);
+
+    assert(visited == N_LOOKUP_KEYS);
+    double seconds = timedifference_sec(start, stop);
+    printf("%s,scan_after_%s,%0.6lf,%0.0lf;\n", engine->name, method, seconds, visited / seconds);
+}
 
 static uint32_t hash_int(hashtable_key_t k)
 {
@@ -132,6 +636,19 @@ static void print_elem(hashtable_elem_t e)
     (void) e;
 }
 
+static hashtable_t benchmark_create(hashtable_reclaim_t reclaim, bool combine, hashtable_backoff_t backoff)
+{
+    hashtable_config_t config;
+
+    hashtable_config_init(&config);
+    config.engine = engine->engine;
+    config.reclaim = reclaim;
+    config.combine = combine;
+    config.backoff = backoff;
+
+    return hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+}
+
 double timedifference_sec(struct timeval t0, struct timeval t1)
 {
     return (t1.tv_sec - t0.tv_sec) + ((t1.tv_usec - t0.tv_usec) / 1000000.0f);
@@ -156,3 +673,68 @@ static void* test_thread_f(void* arg)
     return NULL;
 }
 
+static void* reclaim_thread_f(void* arg)
+{
+    reclaim_thread_arg_t * thread_arg = (reclaim_thread_arg_t *) arg;
+    hashtable_t h = thread_arg->h;
+    uint32_t i;
+
+    // Wait for start signal
+    while (!start_operation);
+
+    for (i = 0; i < N_RECLAIM_OPS; i++) {
+        uint32_t key = xorshift32(&(thread_arg->seed)) % N_RECLAIM_KEYS;
+        uint32_t op = xorshift32(&(thread_arg->seed)) % 100;
+
+        // Elements are never dereferenced, they just have to be non-NULL
+        if (op < GET_PERCENT)                           hashtable_get(h, (void*)(uintptr_t) key);
+        else if (op < GET_PERCENT + (100-GET_PERCENT)/2) hashtable_insert(h, (void*)(uintptr_t) key, (void*)(uintptr_t) (key + 1));
+        else                                            hashtable_remove(h, (void*)(uintptr_t) key);
+
+        // Let QSBR make progress. A no-op for other schemes
+        if (i % QUIESCENT_PERIOD == 0) hashtable_quiescent(h);
+    }
+    hashtable_thread_offline(h);
+
+    // All done
+    return NULL;
+}
+
+static void* skewed_thread_f(void* arg)
+{
+    reclaim_thread_arg_t * thread_arg = (reclaim_thread_arg_t *) arg;
+    hashtable_t h = thread_arg->h;
+    uint32_t i;
+
+    // Wait for start signal
+    while (!start_operation);
+
+    for (i = 0; i < N_SKEWED_OPS; i++) {
+        uint32_t key = xorshift32(&(thread_arg->seed));
+        uint32_t op = xorshift32(&(thread_arg->seed)) % 100;
+
+        // Hot keys come first, so they share a few buckets
+        if (op < HOT_PERCENT)   key %= N_HOT_KEYS;
+        else                    key = N_HOT_KEYS + key % N_COLD_KEYS;
+
+        // Elements are never dereferenced, they just have to be non-NULL
+        if (op & 1) hashtable_insert(h, (void*)(uintptr_t) key, (void*)(uintptr_t) (key + 1));
+        else        hashtable_remove(h, (void*)(uintptr_t) key);
+    }
+
+    // All done
+    return NULL;
+}
+
+static inline uint32_t xorshift32(uint32_t * state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    *state = x;
+    return x;
+}
+
@@ -0,0 +1,1289 @@
+/**
+ * @file    hashtable_cuckoo.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implements the bucketized cuckoo hashtable engine
+ *
+ * Every key has two buckets, picked by two different mixes of its hash, and
+ * sits in one of the CUCKOO_WAYS slots of one of them. A bucket is a single
+ * cache line, holding a version, a 32 bit fingerprint per slot, and the slots'
+ * elements. Each slot's tag (its key's hash with TAG_KEY set) and key sit in a
+ * parallel array of entries, a line per bucket, which is only read when a
+ * fingerprint matches. So a miss reads two lines, and a hit usually two.
+ *
+ * Lookups take no locks. They read both buckets' versions, search the
+ * buckets, and check neither version has changed since. A writer holds a
+ * bucket by making its version odd (readers wait that out), and holds both of
+ * a key's buckets, lower one first, so nothing can move the key while it
+ * looks. A slot is free when its fingerprint is 0; removal just clears it.
+ *
+ * When both of a key's buckets are full, an insertion searches breadth first,
+ * without locks, for a short path of keys each of which can move to its other
+ * bucket, ending at a free slot. Then it makes the moves from the free end
+ * back, holding each moved key's two buckets and checking the path still holds.
+ * If it went stale, the insertion starts over. If there's no path at all, the
+ * table is nearly full, and grows.
+ *
+ * Resizing holds every bucket, in order, copies the live entries to a new
+ * array, sets the old one's frozen flag and publishes the new one. The old
+ * buckets are never let go, so anything waiting on one sees the flag and
+ * starts over in the new array. Unlike the probing engine's migration, one
+ * thread does all of it while everyone else waits. But a cuckoo table runs
+ * far fuller before it has to grow, so it grows less often. Old arrays are
+ * retired through the table's reclamation scheme. Under hazard pointers they
+ * are protected in HAZARD_ARRAY.
+ *
+ * A walk could miss a key that moved, or see it twice, so nothing is moved
+ * in an array while a walk is open on it. An insertion that would have to
+ * move something copies the array instead, to a fresh one of the same size
+ * which the walk doesn't see. Nor can a key the walk saw come back after its
+ * removal in a slot the walk is yet to read. So a removal leaves the key's tag
+ * in the slot, and the key goes back there. While a walk is open, no other key
+ * takes it. A walk reads one bucket at a time. In an array frozen since the
+ * walk began, each key is looked up wherever it is now, as in the probing
+ * engine.
+ *
+ * Tables shrink once fewer than 1/CUCKOO_SHRINK_LOAD_INV of the slots are in
+ * use, counted in stripes as in the other engines.
+ *
+ * @addtogroup HASHTABLE
+ * @{
+ * @addtogroup HASHTABLE_ENGINE
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Modules
+#include "hashtable.h"
+#include "hashtable_engine.h"
+#include "hazard_pointer.h"
+#include "thread_index.h"
+
+// Standard
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sched.h>
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CUCKOO_WAYS             (4)             /**< Slots per bucket */
+#define CUCKOO_SIZE_MIN         (16)            /**< The fewest buckets an array has. Must be a power of two */
+#define CUCKOO_HEADROOM_INV     (4)             /**< Arrays sized for a capacity get 1/this more slots than that */
+#define CUCKOO_TARGET_LOAD_INV  (2)             /**< A resize sizes the new array for this many slots per element */
+#define CUCKOO_SHRINK_LOAD_INV  (8)             /**< An array is resized smaller once it has this many slots per element */
+#define CUCKOO_SEARCH_MAX       (512)           /**< Most buckets a search for a free slot looks at. Keeps paths to 4 moves */
+#define CUCKOO_PATH_MAX         (16)            /**< Longer than any path the search can find */
+#define CUCKOO_KICKS_MAX        (512)           /**< Most keys moved placing one key while resizing, before going bigger */
+#define CUCKOO_CHECK_PERIOD     (64)            /**< Most removals on a stripe between load checks. Must be a power of two */
+#define CUCKOO_SEED             (UINT64_C(0x9e3779b97f4a7c15))  /**< Mixed into the tag by the second hash */
+
+#define CACHE_LINE              (64)            /**< Buckets, entries and counter stripes are aligned to this many bytes */
+#define COUNTER_STRIPES         (16)            /**< The number of stripes per count. Must be a power of two */
+
+#define TAG_KEY                 (UINT64_C(1) << 63)         /**< Set in every key's tag */
+
+#define STEP_ROOT               (UINT32_MAX)    /**< Parent of the steps a search starts from */
+
+#define HAZARD_ARRAY            (0)             /**< Hazard slot protecting the array an operation works in */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   One stripe of a count, alone on its cache line
+ */
+typedef struct cuckoo_counter_t_ {
+    _Alignas(CACHE_LINE)
+    atomic_int_fast64_t         count;                      /**< This stripe's share of the count */
+} cuckoo_counter_t;
+
+/**
+ * @brief   A bucket: everything a lookup reads before it finds a candidate
+ */
+typedef struct cuckoo_bucket_t_ {
+    _Alignas(CACHE_LINE)
+    atomic_uint_least32_t       version;                    /**< Odd while a writer holds the bucket */
+    atomic_uint_least32_t       fp[CUCKOO_WAYS];            /**< Each slot's fingerprint, or 0 if it's free */
+    _Atomic(hashtable_elem_t)   elem[CUCKOO_WAYS];          /**< Each slot's element */
+} cuckoo_bucket_t;
+
+/**
+ * @brief   The rest of a slot
+ */
+typedef struct cuckoo_entry_t_ {
+    atomic_uint_fast64_t        tag;                        /**< The key's hash, with TAG_KEY set */
+    _Atomic(hashtable_key_t)    key;                        /**< The key */
+} cuckoo_entry_t;
+
+/**
+ * @brief   An array of buckets, and their entries
+ */
+typedef struct cuckoo_array_t_ {
+    size_t                      n_buckets;                  /**< The number of buckets. A power of two */
+    atomic_size_t               walks;                      /**< Iterators and scans open on the array. Nothing moves while there are any */
+    atomic_bool                 frozen;                     /**< Set once the array has been copied to a new one */
+    struct cuckoo_array_t_ *    retired;                    /**< The next array kept until the table is freed, under HASHTABLE_RECLAIM_NONE */
+    cuckoo_entry_t *            entries;                    /**< CUCKOO_WAYS per bucket, in the same block, after the buckets */
+    cuckoo_bucket_t             buckets[];                  /**< The buckets */
+} cuckoo_array_t;
+
+/**
+ * @brief   The table
+ */
+typedef struct cuckoo_table_t_ {
+    cuckoo_counter_t            live[COUNTER_STRIPES];      /**< The number of elements, striped by thread */
+    _Atomic(cuckoo_array_t *)   array;                      /**< The current array */
+    _Atomic(cuckoo_array_t *)   retired;                    /**< Arrays resized away from, under HASHTABLE_RECLAIM_NONE */
+    size_t                      min_buckets;                /**< Arrays never have fewer buckets than this */
+    eq_f_t                      eq_f;                       /**< The function used to compare keys with the same tag, or NULL */
+    hashtable_reclaim_t         reclaim;                    /**< How old arrays are reclaimed */
+} cuckoo_table_t;
+
+/**
+ * @brief   The live slots of a bucket, as read at one moment
+ */
+typedef struct cuckoo_snapshot_t_ {
+    bool                        frozen;                     /**< Whether the bucket's array had been frozen */
+    uint32_t                    n;                          /**< The number of slots read */
+    uint64_t                    tags[CUCKOO_WAYS];          /**< Their tags */
+    hashtable_key_t             keys[CUCKOO_WAYS];          /**< Their keys */
+    hashtable_elem_t            elems[CUCKOO_WAYS];         /**< Their elements */
+} cuckoo_snapshot_t;
+
+/**
+ * @brief   A position in a walk over a table
+ */
+typedef struct cuckoo_iter_t_ {
+    cuckoo_table_t *            t;                          /**< The table being walked */
+    cuckoo_array_t *            a;                          /**< The array being walked, protected in HASHTABLE_ENGINE_HAZARD_ITER */
+    size_t                      bucket;                     /**< The next bucket to read */
+    uint32_t                    way;                        /**< The next slot of snap to report */
+    cuckoo_snapshot_t           snap;                       /**< The last bucket read */
+} cuckoo_iter_t;
+
+/**
+ * @brief   A bucket reached by a search for a free slot
+ */
+typedef struct cuckoo_step_t_ {
+    size_t                      bucket;                     /**< The bucket */
+    uint32_t                    parent;                     /**< The step whose key moves here, or STEP_ROOT */
+    uint32_t                    way;                        /**< The slot of the parent's bucket that key is in */
+} cuckoo_step_t;
+
+/**
+ * @brief   Outcomes of looking for a key
+ */
+typedef enum {
+    CUCKOO_FOUND,       /**< The key is present */
+    CUCKOO_ABSENT,      /**< The key is absent. If it was being written, it has been inserted */
+    CUCKOO_MOVED,       /**< The array has been frozen. Try again in the next one */
+    CUCKOO_FULL,        /**< There was no room for the key, and memory to make some couldn't be allocated */
+} cuckoo_result_t;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @see hashtable_engine_ops_t
+ */
+static void * cuckoo_create(const hashtable_config_t * config);
+static void cuckoo_free(void * table, free_f_t free_f);
+static hashtable_elem_t cuckoo_get(void * table, hashtable_key_t key, uint64_t hash);
+static bool cuckoo_insert(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present);
+static hashtable_elem_t cuckoo_put(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem);
+static bool cuckoo_replace_if(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem);
+static hashtable_elem_t cuckoo_remove(void * table, hashtable_key_t key, uint64_t hash);
+static size_t cuckoo_size(void * table);
+static void * cuckoo_iter_create(void * table);
+static bool cuckoo_iter_next(void * p_it, hashtable_key_t * key, hashtable_elem_t * elem);
+static void cuckoo_iter_free(void * p_it);
+static void * cuckoo_scan_begin(void * table);
+static void cuckoo_scan_end(void * table, void * snapshot);
+static size_t cuckoo_scan_range(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg);
+
+/**
+ * @brief   Inserts or replaces a key's element
+ *
+ * @param[in] t:            The table
+ * @param[in] key:          The key
+ * @param[in] tag:          The key's tag
+ * @param[in] elem:         The element to store
+ * @param[in] replace:      Whether to replace the element of a key that's present
+ * @param[out] old:         Gets the element found, if the key was present
+ *
+ * @return      CUCKOO_FOUND, CUCKOO_ABSENT if elem was inserted, or CUCKOO_FULL
+ */
+static cuckoo_result_t cuckoo_write(cuckoo_table_t * t, hashtable_key_t key, uint64_t tag, hashtable_elem_t elem, bool replace, hashtable_elem_t * old);
+
+/**
+ * @brief   Looks a key up without locking anything
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array to search. Must be protected
+ * @param[in] key:          The key
+ * @param[in] tag:          The key's tag
+ * @param[out] elem:        Gets the key's element, if it's present
+ *
+ * @return      CUCKOO_FOUND, CUCKOO_ABSENT or CUCKOO_MOVED
+ */
+static cuckoo_result_t cuckoo_lookup(cuckoo_table_t * t, cuckoo_array_t * a, hashtable_key_t key, uint64_t tag, hashtable_elem_t * elem);
+
+/**
+ * @brief   Holds both of a key's buckets in the current array
+ *
+ * @param[in] t:            The table
+ * @param[in] tag:          The key's tag
+ * @param[out] b1:          Gets the key's first bucket
+ * @param[out] b2:          Gets the key's second bucket
+ *
+ * @return      The array, protected
+ */
+static cuckoo_array_t * cuckoo_lock_key(cuckoo_table_t * t, uint64_t tag, size_t * b1, size_t * b2);
+
+/**
+ * @brief   Finds a key's slot in buckets the caller holds
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array
+ * @param[in] key:          The key
+ * @param[in] tag:          The key's tag
+ * @param[in] b1:           The key's first bucket
+ * @param[in] b2:           The key's second bucket
+ * @param[out] bucket:      Gets the bucket the key is in
+ * @param[out] way:         Gets the slot of that bucket
+ *
+ * @return      true if the key is present
+ */
+static bool cuckoo_locate(cuckoo_table_t * t, cuckoo_array_t * a, hashtable_key_t key, uint64_t tag, size_t b1, size_t b2, size_t * bucket, uint32_t * way);
+
+/**
+ * @brief   Finds a free slot for a key in either of its buckets
+ *
+ * Prefers the slot the key was last removed from. While a walk is open, slots
+ * other keys were removed from are left to them
+ *
+ * @param[in] a:            The array
+ * @param[in] tag:          The key's tag
+ * @param[in] b1:           The key's first bucket
+ * @param[in] b2:           The key's second bucket
+ * @param[out] bucket:      Gets the bucket with a free slot
+ * @param[out] way:         Gets the slot
+ *
+ * @return      true if there was one
+ */
+static bool cuckoo_free_slot(cuckoo_array_t * a, uint64_t tag, size_t b1, size_t b2, size_t * bucket, uint32_t * way);
+
+/**
+ * @brief   Fills in a free slot, in a bucket the caller holds (or an array nobody else can see)
+ */
+static void cuckoo_fill(cuckoo_array_t * a, size_t bucket, uint32_t way, uint64_t tag, hashtable_key_t key, hashtable_elem_t elem);
+
+/**
+ * @brief   Tries to free up a slot in one of a key's buckets, by moving other keys along
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array. Must be protected
+ * @param[in] b1:           The key's first bucket
+ * @param[in] b2:           The key's second bucket
+ * @param[out] resize:      If no room can be made, gets the number of buckets to resize to
+ *
+ * @return      true if there might be room now, false if the array has to be resized
+ */
+static bool cuckoo_make_room(cuckoo_table_t * t, cuckoo_array_t * a, size_t b1, size_t b2, size_t * resize);
+
+/**
+ * @brief   Moves a key to its other bucket, if it's still where a search saw it, and there's room
+ *
+ * @param[in] a:            The array. Must be protected
+ * @param[in] src:          The bucket the key was seen in
+ * @param[in] way:          The slot it was seen in
+ * @param[in] dst:          Its other bucket
+ *
+ * @return      true if it was moved
+ */
+static bool cuckoo_move(cuckoo_array_t * a, size_t src, uint32_t way, size_t dst);
+
+/**
+ * @brief   Copies an array into a new one, and makes that current
+ *
+ * Holds every bucket of the old array, so nothing else can change it meanwhile
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The current array. Must be protected
+ * @param[in] at_least:     The fewest buckets the new array can have
+ *
+ * @return      false if memory allocation failed
+ */
+static bool cuckoo_resize(cuckoo_table_t * t, cuckoo_array_t * a, size_t at_least);
+
+/**
+ * @brief   Places a key in an array nobody else can see, moving others as needed
+ *
+ * @return      false if there wasn't room. The array's contents are then garbage
+ */
+static bool cuckoo_place(cuckoo_array_t * a, uint64_t tag, hashtable_key_t key, hashtable_elem_t elem);
+
+/**
+ * @brief   Reads the live slots of a bucket consistently
+ *
+ * @param[in] a:            The array. Must be protected
+ * @param[in] bucket:       The bucket
+ * @param[out] snap:        Gets the slots
+ */
+static void cuckoo_snapshot(cuckoo_array_t * a, size_t bucket, cuckoo_snapshot_t * snap);
+
+/**
+ * @brief   Reports a slot visited by a walk, if its key is still present
+ *
+ * @param[in] t:            The table
+ * @param[in] snap:         The slot's bucket, as read by the walk
+ * @param[in] way:          The slot
+ * @param[out] key:         Gets the key
+ * @param[out] elem:        Gets the element
+ *
+ * @return      true if the key is present
+ */
+static bool cuckoo_visit(cuckoo_table_t * t, const cuckoo_snapshot_t * snap, uint32_t way, hashtable_key_t * key, hashtable_elem_t * elem);
+
+/**
+ * @brief   Takes hold of a bucket, waiting for whoever holds it
+ *
+ * @return      false if the array has been frozen
+ */
+static inline bool cuckoo_lock(cuckoo_array_t * a, size_t bucket);
+
+/**
+ * @brief   Lets go of a bucket
+ */
+static inline void cuckoo_unlock(cuckoo_array_t * a, size_t bucket);
+
+/**
+ * @brief   Takes hold of two buckets (or one, if they're the same), lower one first
+ *
+ * @return      false if the array has been frozen
+ */
+static bool cuckoo_lock_pair(cuckoo_array_t * a, size_t b1, size_t b2);
+
+/**
+ * @brief   Lets go of buckets taken with cuckoo_lock_pair
+ */
+static void cuckoo_unlock_pair(cuckoo_array_t * a, size_t b1, size_t b2);
+
+/**
+ * @brief   Starts an optimistic read of a bucket, waiting out any writer
+ *
+ * @param[out] version:     Gets the version to validate the read against
+ *
+ * @return      false if the array has been frozen, in which case the bucket
+ *              won't change again, and can be read without validating
+ */
+static inline bool cuckoo_read_begin(cuckoo_array_t * a, size_t bucket, uint32_t * version);
+
+/**
+ * @brief   Checks nobody has written to a bucket since cuckoo_read_begin
+ */
+static inline bool cuckoo_read_valid(cuckoo_array_t * a, size_t bucket, uint32_t version);
+
+/**
+ * @brief   Finds a key's two buckets. They may be the same
+ */
+static inline void cuckoo_buckets(const cuckoo_array_t * a, uint64_t tag, size_t * b1, size_t * b2);
+
+/**
+ * @brief   Finds the bucket a key isn't in
+ */
+static inline size_t cuckoo_alt(const cuckoo_array_t * a, uint64_t tag, size_t bucket);
+
+/**
+ * @brief   Gets a key's fingerprint. Never 0
+ */
+static inline uint32_t cuckoo_fingerprint(uint64_t tag);
+
+/**
+ * @brief   Mixes the bits of a tag, so every bit of the result depends on all of them
+ */
+static inline uint64_t cuckoo_mix(uint64_t x);
+
+/**
+ * @brief   Counts a removal, resizing to a smaller array if it's too empty
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array removed from. Must be protected
+ */
+static void cuckoo_count_remove(cuckoo_table_t * t, cuckoo_array_t * a);
+
+/**
+ * @brief   Adds up a count's stripes
+ *
+ * @return      The count, or 0 if it's negative
+ */
+static size_t cuckoo_sum(cuckoo_counter_t * counters);
+
+/**
+ * @brief   Finds the number of buckets to resize to
+ *
+ * @param[in] t:            The table
+ * @param[in] live:         The number of elements
+ * @param[in] at_least:     The fewest buckets it can have
+ */
+static size_t cuckoo_target_size(cuckoo_table_t * t, size_t live, size_t at_least);
+
+/**
+ * @brief   Allocates an array of empty buckets
+ *
+ * @param[in] n_buckets:    The number of buckets. A power of two
+ *
+ * @return      The array, or NULL if memory allocation failed
+ */
+static cuckoo_array_t * cuckoo_array_create(size_t n_buckets);
+
+/**
+ * @brief   Gets the table's current array, protected
+ *
+ * @param[in] t:            The table
+ * @param[in] hazard:       The hazard slot to protect it in, under hazard pointers
+ */
+static inline cuckoo_array_t * cuckoo_array_load(cuckoo_table_t * t, uint32_t hazard);
+
+/**
+ * @brief   Waits for a frozen array to stop being current
+ */
+static void cuckoo_array_wait(cuckoo_table_t * t, cuckoo_array_t * a);
+
+/**
+ * @brief   Hands an array resized away from over to be freed
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array, which nobody can newly reach
+ */
+static void cuckoo_array_retire(cuckoo_table_t * t, cuckoo_array_t * a);
+
+/**
+ * @brief   Gives way to the thread holding a bucket
+ */
+static inline void cuckoo_pause(void);
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+const hashtable_engine_ops_t hashtable_cuckoo_ops = {
+    .create         = cuckoo_create,
+    .free           = cuckoo_free,
+    .get            = cuckoo_get,
+    .insert         = cuckoo_insert,
+    .put            = cuckoo_put,
+    .replace_if     = cuckoo_replace_if,
+    .remove         = cuckoo_remove,
+    .size           = cuckoo_size,
+    .iter_create    = cuckoo_iter_create,
+    .iter_next      = cuckoo_iter_next,
+    .iter_free      = cuckoo_iter_free,
+    .scan_begin     = cuckoo_scan_begin,
+    .scan_end       = cuckoo_scan_end,
+    .scan_range     = cuckoo_scan_range,
+};
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static void * cuckoo_create(const hashtable_config_t * config)
+{
+    uint32_t i;
+
+    // Big enough for the capacity asked for, with some room to spare
+    size_t min_buckets = CUCKOO_SIZE_MIN;
+    while (min_buckets * CUCKOO_WAYS < config->capacity + config->capacity / CUCKOO_HEADROOM_INV) {
+        if (min_buckets > SIZE_MAX / (2 * CUCKOO_WAYS * sizeof(cuckoo_bucket_t))) return NULL;
+        min_buckets <<= 1;
+    }
+
+    cuckoo_table_t * t = (cuckoo_table_t *) aligned_alloc(CACHE_LINE, sizeof(cuckoo_table_t));
+    if (!t) return NULL;
+
+    cuckoo_array_t * a = cuckoo_array_create(min_buckets);
+    if (!a) {
+        free(t);
+        return NULL;
+    }
+
+    for (i = 0; i < COUNTER_STRIPES; i++) atomic_init(&(t->live[i].count), 0);
+    atomic_init(&(t->array), a);
+    atomic_init(&(t->retired), NULL);
+    t->min_buckets = min_buckets;
+    t->eq_f = config->eq_f;
+    t->reclaim = config->reclaim;
+
+    return t;
+}
+
+static void cuckoo_free(void * table, free_f_t free_f)
+{
+    cuckoo_table_t * t = (cuckoo_table_t *) table;
+    cuckoo_array_t * a = atomic_load(&(t->array));
+    size_t i;
+    uint32_t w;
+
+    // Free the elements still in the current array
+    for (i = 0; free_f && i < a->n_buckets; i++) {
+        for (w = 0; w < CUCKOO_WAYS; w++) {
+            if (atomic_load(&(a->buckets[i].fp[w]))) free_f(atomic_load(&(a->buckets[i].elem[w])));
+        }
+    }
+    free(a);
+
+    // Along with any arrays kept around
+    a = atomic_load(&(t->retired));
+    while (a) {
+        cuckoo_array_t * next = a->retired;
+        free(a);
+        a = next;
+    }
+
+    free(t);
+}
+
+static hashtable_elem_t cuckoo_get(void * table, hashtable_key_t key, uint64_t hash)
+{
+    cuckoo_table_t * t = (cuckoo_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    hashtable_elem_t elem;
+
+    while (true) {
+        cuckoo_array_t * a = cuckoo_array_load(t, HAZARD_ARRAY);
+
+        switch (cuckoo_lookup(t, a, key, tag, &elem)) {
+        case CUCKOO_FOUND:  return elem;
+        case CUCKOO_ABSENT: return NULL;
+        default:            break;
+        }
+
+        cuckoo_array_wait(t, a);
+    }
+}
+
+static bool cuckoo_insert(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present)
+{
+    hashtable_elem_t old;
+
+    switch (cuckoo_write((cuckoo_table_t *) table, key, hash | TAG_KEY, elem, false, &old)) {
+    case CUCKOO_ABSENT: if (present) *present = elem;   return true;
+    case CUCKOO_FOUND:  if (present) *present = old;    return false;
+    default:            if (present) *present = NULL;   return false;
+    }
+}
+
+static hashtable_elem_t cuckoo_put(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem)
+{
+    hashtable_elem_t old;
+
+    if (cuckoo_write((cuckoo_table_t *) table, key, hash | TAG_KEY, elem, true, &old) == CUCKOO_FOUND) return old;
+    return NULL;
+}
+
+static bool cuckoo_replace_if(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem)
+{
+    cuckoo_table_t * t = (cuckoo_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    bool replaced = false;
+    size_t b1, b2, bucket;
+    uint32_t way;
+
+    cuckoo_array_t * a = cuckoo_lock_key(t, tag, &b1, &b2);
+    if (cuckoo_locate(t, a, key, tag, b1, b2, &bucket, &way)) {
+        _Atomic(hashtable_elem_t) * elem = &(a->buckets[bucket].elem[way]);
+        if (atomic_load_explicit(elem, memory_order_relaxed) == expected) {
+            atomic_store_explicit(elem, new_elem, memory_order_relaxed);
+            replaced = true;
+        }
+    }
+    cuckoo_unlock_pair(a, b1, b2);
+
+    return replaced;
+}
+
+static hashtable_elem_t cuckoo_remove(void * table, hashtable_key_t key, uint64_t hash)
+{
+    cuckoo_table_t * t = (cuckoo_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    hashtable_elem_t elem = NULL;
+    size_t b1, b2, bucket;
+    uint32_t way;
+
+    cuckoo_array_t * a = cuckoo_lock_key(t, tag, &b1, &b2);
+    if (cuckoo_locate(t, a, key, tag, b1, b2, &bucket, &way)) {
+        elem = atomic_load_explicit(&(a->buckets[bucket].elem[way]), memory_order_relaxed);
+        atomic_store_explicit(&(a->buckets[bucket].fp[way]), 0, memory_order_relaxed);
+    }
+    cuckoo_unlock_pair(a, b1, b2);
+
+    if (elem) cuckoo_count_remove(t, a);
+    return elem;
+}
+
+static size_t cuckoo_size(void * table)
+{
+    return cuckoo_sum(((cuckoo_table_t *) table)->live);
+}
+
+static void * cuckoo_iter_create(void * table)
+{
+    cuckoo_table_t * t = (cuckoo_table_t *) table;
+
+    cuckoo_iter_t * it = (cuckoo_iter_t *) malloc(sizeof(cuckoo_iter_t));
+    if (!it) return NULL;
+
+    it->t = t;
+    it->a = cuckoo_scan_begin(t);
+    it->bucket = 0;
+    it->way = 0;
+    it->snap.n = 0;
+
+    return it;
+}
+
+static bool cuckoo_iter_next(void * p_it, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    cuckoo_iter_t * it = (cuckoo_iter_t *) p_it;
+
+    while (true) {
+        while (it->way < it->snap.n) {
+            if (cuckoo_visit(it->t, &(it->snap), it->way++, key, elem)) return true;
+        }
+
+        if (it->bucket == it->a->n_buckets) return false;
+        cuckoo_snapshot(it->a, it->bucket++, &(it->snap));
+        it->way = 0;
+    }
+}
+
+static void cuckoo_iter_free(void * p_it)
+{
+    cuckoo_iter_t * it = (cuckoo_iter_t *) p_it;
+
+    cuckoo_scan_end(it->t, it->a);
+    free(it);
+}
+
+static void * cuckoo_scan_begin(void * table)
+{
+    cuckoo_array_t * a = cuckoo_array_load((cuckoo_table_t *) table, HASHTABLE_ENGINE_HAZARD_ITER);
+
+    // Sequentially consistent, as is a move's check, so either the move sees
+    // the walk, or the walk sees the move (or the bucket held for it)
+    atomic_fetch_add(&(a->walks), 1);
+
+    return a;
+}
+
+static void cuckoo_scan_end(void * table, void * snapshot)
+{
+    (void) table;
+
+    atomic_fetch_sub(&(((cuckoo_array_t *) snapshot)->walks), 1);
+}
+
+static size_t cuckoo_scan_range(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg)
+{
+    cuckoo_table_t * t = (cuckoo_table_t *) table;
+    cuckoo_array_t * a = (cuckoo_array_t *) snapshot;
+    cuckoo_snapshot_t snap;
+    hashtable_key_t key;
+    hashtable_elem_t elem;
+    size_t visited = 0;
+    size_t i;
+    uint32_t w;
+
+    size_t first = (size_t) (((uint64_t) a->n_buckets * range) / n_ranges);
+    size_t last = (size_t) (((uint64_t) a->n_buckets * (range + 1)) / n_ranges);
+
+    for (i = first; i < last; i++) {
+        cuckoo_snapshot(a, i, &snap);
+        for (w = 0; w < snap.n; w++) {
+            if (cuckoo_visit(t, &snap, w, &key, &elem)) {
+                fn(key, elem, arg);
+                visited++;
+            }
+        }
+    }
+
+    return visited;
+}
+
+static cuckoo_result_t cuckoo_write(cuckoo_table_t * t, hashtable_key_t key, uint64_t tag, hashtable_elem_t elem, bool replace, hashtable_elem_t * old)
+{
+    size_t b1, b2, bucket, resize;
+    uint32_t way;
+
+    while (true) {
+        cuckoo_array_t * a = cuckoo_lock_key(t, tag, &b1, &b2);
+
+        if (cuckoo_locate(t, a, key, tag, b1, b2, &bucket, &way)) {
+            _Atomic(hashtable_elem_t) * slot = &(a->buckets[bucket].elem[way]);
+            *old = atomic_load_explicit(slot, memory_order_relaxed);
+            if (replace) atomic_store_explicit(slot, elem, memory_order_relaxed);
+            cuckoo_unlock_pair(a, b1, b2);
+            return CUCKOO_FOUND;
+        }
+
+        if (cuckoo_free_slot(a, tag, b1, b2, &bucket, &way)) {
+            cuckoo_fill(a, bucket, way, tag, key, elem);
+            cuckoo_unlock_pair(a, b1, b2);
+            atomic_fetch_add_explicit(&(t->live[thread_index_stripe(COUNTER_STRIPES)].count), 1, memory_order_relaxed);
+            return CUCKOO_ABSENT;
+        }
+
+        // Both full. Move other keys out of the way, or make a bigger array
+        cuckoo_unlock_pair(a, b1, b2);
+        if (!cuckoo_make_room(t, a, b1, b2, &resize) && !cuckoo_resize(t, a, resize)) return CUCKOO_FULL;
+    }
+}
+
+static cuckoo_result_t cuckoo_lookup(cuckoo_table_t * t, cuckoo_array_t * a, hashtable_key_t key, uint64_t tag, hashtable_elem_t * elem)
+{
+    uint32_t fp = cuckoo_fingerprint(tag);
+    uint32_t version[2];
+    size_t b[2];
+    uint32_t i;
+    uint32_t w;
+
+    cuckoo_buckets(a, tag, &(b[0]), &(b[1]));
+
+    while (true) {
+        hashtable_elem_t found = NULL;
+
+        if (!cuckoo_read_begin(a, b[0], &(version[0])) || !cuckoo_read_begin(a, b[1], &(version[1]))) return CUCKOO_MOVED;
+
+        for (i = 0; !found && i < 2; i++) {
+            cuckoo_bucket_t * bucket = &(a->buckets[b[i]]);
+            cuckoo_entry_t * entries = &(a->entries[b[i] * CUCKOO_WAYS]);
+
+            for (w = 0; !found && w < CUCKOO_WAYS; w++) {
+                if (atomic_load_explicit(&(bucket->fp[w]), memory_order_relaxed) != fp) continue;
+                if (atomic_load_explicit(&(entries[w].tag), memory_order_relaxed) != tag) continue;
+
+                // Only hand eq_f a key that was really there. If the read is
+                // already stale, it's retried below anyway
+                if (t->eq_f) {
+                    hashtable_key_t k = atomic_load_explicit(&(entries[w].key), memory_order_relaxed);
+                    if (!cuckoo_read_valid(a, b[0], version[0]) || !cuckoo_read_valid(a, b[1], version[1])) continue;
+                    if (!t->eq_f(k, key)) continue;
+                }
+
+                found = atomic_load_explicit(&(bucket->elem[w]), memory_order_relaxed);
+            }
+        }
+
+        // Nothing moved between the buckets while we looked, so this is the answer
+        if (cuckoo_read_valid(a, b[0], version[0]) && cuckoo_read_valid(a, b[1], version[1])) {
+            *elem = found;
+            return found ? CUCKOO_FOUND : CUCKOO_ABSENT;
+        }
+    }
+}
+
+static cuckoo_array_t * cuckoo_lock_key(cuckoo_table_t * t, uint64_t tag, size_t * b1, size_t * b2)
+{
+    while (true) {
+        cuckoo_array_t * a = cuckoo_array_load(t, HAZARD_ARRAY);
+
+        cuckoo_buckets(a, tag, b1, b2);
+        if (cuckoo_lock_pair(a, *b1, *b2)) return a;
+
+        cuckoo_array_wait(t, a);
+    }
+}
+
+static bool cuckoo_locate(cuckoo_table_t * t, cuckoo_array_t * a, hashtable_key_t key, uint64_t tag, size_t b1, size_t b2, size_t * bucket, uint32_t * way)
+{
+    uint32_t fp = cuckoo_fingerprint(tag);
+    size_t b[2] = { b1, b2 };
+    uint32_t i;
+    uint32_t w;
+
+    for (i = 0; i < (b1 == b2 ? 1 : 2); i++) {
+        cuckoo_entry_t * entries = &(a->entries[b[i] * CUCKOO_WAYS]);
+
+        for (w = 0; w < CUCKOO_WAYS; w++) {
+            if (atomic_load_explicit(&(a->buckets[b[i]].fp[w]), memory_order_relaxed) != fp) continue;
+            if (atomic_load_explicit(&(entries[w].tag), memory_order_relaxed) != tag) continue;
+            if (t->eq_f && !t->eq_f(atomic_load_explicit(&(entries[w].key), memory_order_relaxed), key)) continue;
+
+            *bucket = b[i];
+            *way = w;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool cuckoo_free_slot(cuckoo_array_t * a, uint64_t tag, size_t b1, size_t b2, size_t * bucket, uint32_t * way)
+{
+    size_t b[2] = { b1, b2 };
+    uint64_t best = UINT64_MAX;
+    uint32_t i;
+    uint32_t w;
+
+    // Ranked: the key's own slot, then one nobody's been removed from, then
+    // any other. Lower is better
+    for (i = 0; i < 2 && best; i++) {
+        cuckoo_entry_t * entries = &(a->entries[b[i] * CUCKOO_WAYS]);
+
+        for (w = 0; w < CUCKOO_WAYS && best; w++) {
+            if (atomic_load_explicit(&(a->buckets[b[i]].fp[w]), memory_order_relaxed)) continue;
+
+            uint64_t last = atomic_load_explicit(&(entries[w].tag), memory_order_relaxed);
+            uint64_t rank = (last == tag) ? 0 : (last == 0) ? 1 : 2;
+            if (rank < best) {
+                best = rank;
+                *bucket = b[i];
+                *way = w;
+            }
+        }
+    }
+
+    // A walk may have seen the key that left that last sort of slot. If it
+    // came back anywhere else, the walk could see it twice
+    if (best == 2 && atomic_load(&(a->walks))) return false;
+
+    return best != UINT64_MAX;
+}
+
+static void cuckoo_fill(cuckoo_array_t * a, size_t bucket, uint32_t way, uint64_t tag, hashtable_key_t key, hashtable_elem_t elem)
+{
+    cuckoo_entry_t * entry = &(a->entries[bucket * CUCKOO_WAYS + way]);
+
+    atomic_store_explicit(&(entry->tag), tag, memory_order_relaxed);
+    atomic_store_explicit(&(entry->key), key, memory_order_relaxed);
+    atomic_store_explicit(&(a->buckets[bucket].elem[way]), elem, memory_order_relaxed);
+    atomic_store_explicit(&(a->buckets[bucket].fp[way]), cuckoo_fingerprint(tag), memory_order_relaxed);
+}
+
+static bool cuckoo_make_room(cuckoo_table_t * t, cuckoo_array_t * a, size_t b1, size_t b2, size_t * resize)
+{
+    cuckoo_step_t steps[CUCKOO_SEARCH_MAX];
+    uint32_t path[CUCKOO_PATH_MAX];
+    uint32_t n_steps = 0;
+    uint32_t head;
+    uint32_t w;
+
+    (void) t;
+
+    // Nothing can move under an open walk. A copy it won't see is the next best thing
+    *resize = a->n_buckets;
+    if (atomic_load(&(a->walks))) return false;
+
+    // Breadth first, without locks, so the path is as short as can be. Each
+    // step's bucket is where its parent's key would move to
+    steps[n_steps++] = (cuckoo_step_t) { b1, STEP_ROOT, 0 };
+    if (b2 != b1) steps[n_steps++] = (cuckoo_step_t) { b2, STEP_ROOT, 0 };
+
+    for (head = 0; head < n_steps; head++) {
+        cuckoo_bucket_t * bucket = &(a->buckets[steps[head].bucket]);
+        uint32_t free_way = CUCKOO_WAYS;
+
+        for (w = 0; w < CUCKOO_WAYS && free_way == CUCKOO_WAYS; w++) {
+            if (!atomic_load_explicit(&(bucket->fp[w]), memory_order_relaxed)) free_way = w;
+        }
+
+        // Found one. Make the moves from the free end back, so every key
+        // always has a slot. If any goes stale, just start over
+        if (free_way < CUCKOO_WAYS) {
+            uint32_t n_path = 0;
+            uint32_t s;
+
+            for (s = head; steps[s].parent != STEP_ROOT; s = steps[s].parent) path[n_path++] = s;
+            for (s = 0; s < n_path; s++) {
+                cuckoo_step_t * step = &(steps[path[s]]);
+                if (!cuckoo_move(a, steps[step->parent].bucket, step->way, step->bucket)) break;
+            }
+
+            // Stopped for a walk that opened since
+            return !(s < n_path && atomic_load(&(a->walks)));
+        }
+
+        for (w = 0; w < CUCKOO_WAYS && n_steps < CUCKOO_SEARCH_MAX; w++) {
+            uint64_t tag = atomic_load_explicit(&(a->entries[steps[head].bucket * CUCKOO_WAYS + w].tag), memory_order_relaxed);
+            size_t alt = cuckoo_alt(a, tag, steps[head].bucket);
+            if (alt != steps[head].bucket) steps[n_steps++] = (cuckoo_step_t) { alt, head, w };
+        }
+    }
+
+    // The neighbourhood is full, so the table nearly is
+    *resize = 2 * a->n_buckets;
+    return false;
+}
+
+static bool cuckoo_move(cuckoo_array_t * a, size_t src, uint32_t way, size_t dst)
+{
+    cuckoo_entry_t * entry = &(a->entries[src * CUCKOO_WAYS + way]);
+    bool moved = false;
+    uint32_t w;
+
+    if (!cuckoo_lock_pair(a, src, dst)) return false;
+
+    // The key's two buckets are held, so readers looking for it wait, and
+    // retry if they'd already started
+    uint64_t tag = atomic_load_explicit(&(entry->tag), memory_order_relaxed);
+    if (!atomic_load(&(a->walks)) &&
+        atomic_load_explicit(&(a->buckets[src].fp[way]), memory_order_relaxed) &&
+        cuckoo_alt(a, tag, src) == dst) {
+        for (w = 0; w < CUCKOO_WAYS && atomic_load_explicit(&(a->buckets[dst].fp[w]), memory_order_relaxed); w++);
+        if (w < CUCKOO_WAYS) {
+            cuckoo_fill(a, dst, w, tag,
+                        atomic_load_explicit(&(entry->key), memory_order_relaxed),
+                        atomic_load_explicit(&(a->buckets[src].elem[way]), memory_order_relaxed));
+            atomic_store_explicit(&(a->buckets[src].fp[way]), 0, memory_order_relaxed);
+            atomic_store_explicit(&(entry->tag), 0, memory_order_relaxed);
+            moved = true;
+        }
+    }
+
+    cuckoo_unlock_pair(a, src, dst);
+    return moved;
+}
+
+static bool cuckoo_resize(cuckoo_table_t * t, cuckoo_array_t * a, size_t at_least)
+{
+    size_t live = 0;
+    size_t i;
+    uint32_t w;
+
+    // Hold every bucket, in order, like any other writer. If somebody else
+    // got there first, their array will do
+    for (i = 0; i < a->n_buckets; i++) {
+        if (!cuckoo_lock(a, i)) {
+            while (i--) cuckoo_unlock(a, i);
+            return true;
+        }
+    }
+
+    // Nothing can change now, so this is exact
+    for (i = 0; i < a->n_buckets; i++) {
+        for (w = 0; w < CUCKOO_WAYS; w++) {
+            if (atomic_load_explicit(&(a->buckets[i].fp[w]), memory_order_relaxed)) live++;
+        }
+    }
+
+    // Keys that won't fit send us up to the next size
+    cuckoo_array_t * b = NULL;
+    size_t n_buckets = cuckoo_target_size(t, live, at_least);
+    while (!b) {
+        b = cuckoo_array_create(n_buckets);
+        if (!b) {
+            for (i = 0; i < a->n_buckets; i++) cuckoo_unlock(a, i);
+            return false;
+        }
+
+        for (i = 0; b && i < a->n_buckets; i++) {
+            cuckoo_entry_t * entries = &(a->entries[i * CUCKOO_WAYS]);
+
+            for (w = 0; b && w < CUCKOO_WAYS; w++) {
+                if (!atomic_load_explicit(&(a->buckets[i].fp[w]), memory_order_relaxed)) continue;
+
+                if (!cuckoo_place(b,
+                                  atomic_load_explicit(&(entries[w].tag), memory_order_relaxed),
+                                  atomic_load_explicit(&(entries[w].key), memory_order_relaxed),
+                                  atomic_load_explicit(&(a->buckets[i].elem[w]), memory_order_relaxed))) {
+                    free(b);
+                    b = NULL;
+                    n_buckets <<= 1;
+                }
+            }
+        }
+    }
+
+    // The old buckets stay held for good. Anybody waiting on one sees the
+    // array's frozen, and starts over in the new one
+    atomic_store(&(a->frozen), true);
+    atomic_store(&(t->array), b);
+    cuckoo_array_retire(t, a);
+
+    return true;
+}
+
+static bool cuckoo_place(cuckoo_array_t * a, uint64_t tag, hashtable_key_t key, hashtable_elem_t elem)
+{
+    size_t b1, b2, bucket;
+    uint32_t kick;
+    uint32_t way;
+
+    // A random walk: take a slot from the key in hand, and go place its key
+    // in its other bucket
+    cuckoo_buckets(a, tag, &b1, &b2);
+    size_t victim = b1;
+    for (kick = 0; kick < CUCKOO_KICKS_MAX; kick++) {
+        if (cuckoo_free_slot(a, tag, b1, b2, &bucket, &way)) {
+            cuckoo_fill(a, bucket, way, tag, key, elem);
+            return true;
+        }
+
+        way = (uint32_t) (cuckoo_mix(tag + kick) % CUCKOO_WAYS);
+        cuckoo_entry_t * entry = &(a->entries[victim * CUCKOO_WAYS + way]);
+        uint64_t next_tag = atomic_load_explicit(&(entry->tag), memory_order_relaxed);
+        hashtable_key_t next_key = atomic_load_explicit(&(entry->key), memory_order_relaxed);
+        hashtable_elem_t next_elem = atomic_load_explicit(&(a->buckets[victim].elem[way]), memory_order_relaxed);
+        cuckoo_fill(a, victim, way, tag, key, elem);
+
+        tag = next_tag;
+        key = next_key;
+        elem = next_elem;
+        victim = cuckoo_alt(a, tag, victim);
+        cuckoo_buckets(a, tag, &b1, &b2);
+    }
+
+    return false;
+}
+
+static void cuckoo_snapshot(cuckoo_array_t * a, size_t bucket, cuckoo_snapshot_t * snap)
+{
+    cuckoo_bucket_t * b = &(a->buckets[bucket]);
+    cuckoo_entry_t * entries = &(a->entries[bucket * CUCKOO_WAYS]);
+    uint32_t version = 0;
+    uint32_t w;
+
+    while (true) {
+        snap->frozen = !cuckoo_read_begin(a, bucket, &version);
+        snap->n = 0;
+
+        for (w = 0; w < CUCKOO_WAYS; w++) {
+            if (!atomic_load_explicit(&(b->fp[w]), memory_order_relaxed)) continue;
+
+            snap->tags[snap->n] = atomic_load_explicit(&(entries[w].tag), memory_order_relaxed);
+            snap->keys[snap->n] = atomic_load_explicit(&(entries[w].key), memory_order_relaxed);
+            snap->elems[snap->n] = atomic_load_explicit(&(b->elem[w]), memory_order_relaxed);
+            snap->n++;
+        }
+
+        if (snap->frozen || cuckoo_read_valid(a, bucket, version)) return;
+    }
+}
+
+static bool cuckoo_visit(cuckoo_table_t * t, const cuckoo_snapshot_t * snap, uint32_t way, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    *key = snap->keys[way];
+
+    // Copied since the walk started. The key is in this slot and no other, so
+    // seeing it wherever it is now can't see it twice
+    if (snap->frozen) {
+        *elem = cuckoo_get(t, *key, snap->tags[way]);
+        return *elem != NULL;
+    }
+
+    *elem = snap->elems[way];
+    return true;
+}
+
+static inline bool cuckoo_lock(cuckoo_array_t * a, size_t bucket)
+{
+    atomic_uint_least32_t * version = &(a->buckets[bucket].version);
+
+    while (true) {
+        uint32_t v = atomic_load_explicit(version, memory_order_relaxed);
+
+        if (!(v & 1)) {
+            // Readers that see anything written after this see the bucket held
+            if (atomic_compare_exchange_weak(version, &v, v + 1)) {
+                atomic_thread_fence(memory_order_release);
+                return true;
+            }
+            continue;
+        }
+
+        if (atomic_load_explicit(&(a->frozen), memory_order_acquire)) return false;
+        cuckoo_pause();
+    }
+}
+
+static inline void cuckoo_unlock(cuckoo_array_t * a, size_t bucket)
+{
+    atomic_uint_least32_t * version = &(a->buckets[bucket].version);
+
+    atomic_store_explicit(version, atomic_load_explicit(version, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static bool cuckoo_lock_pair(cuckoo_array_t * a, size_t b1, size_t b2)
+{
+    size_t lo = (b1 < b2) ? b1 : b2;
+    size_t hi = (b1 < b2) ? b2 : b1;
+
+    if (!cuckoo_lock(a, lo)) return false;
+    if (hi != lo && !cuckoo_lock(a, hi)) {
+        cuckoo_unlock(a, lo);
+        return false;
+    }
+
+    return true;
+}
+
+static void cuckoo_unlock_pair(cuckoo_array_t * a, size_t b1, size_t b2)
+{
+    cuckoo_unlock(a, b1);
+    if (b2 != b1) cuckoo_unlock(a, b2);
+}
+
+static inline bool cuckoo_read_begin(cuckoo_array_t * a, size_t bucket, uint32_t * version)
+{
+    while (true) {
+        // Sequentially consistent, for the sake of walks just opened
+        uint32_t v = atomic_load(&(a->buckets[bucket].version));
+
+        if (!(v & 1)) {
+            *version = v;
+            return true;
+        }
+
+        if (atomic_load_explicit(&(a->frozen), memory_order_acquire)) return false;
+        cuckoo_pause();
+    }
+}
+
+static inline bool cuckoo_read_valid(cuckoo_array_t * a, size_t bucket, uint32_t version)
+{
+    atomic_thread_fence(memory_order_acquire);
+
+    return atomic_load_explicit(&(a->buckets[bucket].version), memory_order_relaxed) == version;
+}
+
+static inline void cuckoo_buckets(const cuckoo_array_t * a, uint64_t tag, size_t * b1, size_t * b2)
+{
+    size_t mask = a->n_buckets - 1;
+
+    *b1 = (size_t) cuckoo_mix(tag) & mask;
+    *b2 = (size_t) cuckoo_mix(tag ^ CUCKOO_SEED) & mask;
+}
+
+static inline size_t cuckoo_alt(const cuckoo_array_t * a, uint64_t tag, size_t bucket)
+{
+    size_t b1, b2;
+
+    cuckoo_buckets(a, tag, &b1, &b2);
+    return (bucket == b1) ? b2 : b1;
+}
+
+static inline uint32_t cuckoo_fingerprint(uint64_t tag)
+{
+    // The high half, which doesn't pick the bucket
+    return (uint32_t) (cuckoo_mix(tag) >> 32) | 1;
+}
+
+static inline uint64_t cuckoo_mix(uint64_t x)
+{
+    // MurmurHash3's finalizer
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+
+    return x;
+}
+
+static void cuckoo_count_remove(cuckoo_table_t * t, cuckoo_array_t * a)
+{
+    atomic_int_fast64_t * count = &(t->live[thread_index_stripe(COUNTER_STRIPES)].count);
+
+    // Every stripe can be a period short of a check, and between them they
+    // mustn't hide more than a quarter of the array
+    int_fast64_t period = (int_fast64_t) (a->n_buckets * CUCKOO_WAYS / (4 * COUNTER_STRIPES));
+    if (period < 1)                     period = 1;
+    if (period > CUCKOO_CHECK_PERIOD)   period = CUCKOO_CHECK_PERIOD;
+
+    int_fast64_t old = atomic_fetch_sub_explicit(count, 1, memory_order_relaxed);
+    if ((old & ~(period - 1)) == ((old - 1) & ~(period - 1))) return;
+
+    if (a->n_buckets > t->min_buckets && cuckoo_sum(t->live) * CUCKOO_SHRINK_LOAD_INV < a->n_buckets * CUCKOO_WAYS) {
+        cuckoo_resize(t, a, 0);
+    }
+}
+
+static size_t cuckoo_sum(cuckoo_counter_t * counters)
+{
+    int_fast64_t total = 0;
+    uint32_t i;
+
+    for (i = 0; i < COUNTER_STRIPES; i++) total += atomic_load_explicit(&(counters[i].count), memory_order_relaxed);
+
+    return total > 0 ? (size_t) total : 0;
+}
+
+static size_t cuckoo_target_size(cuckoo_table_t * t, size_t live, size_t at_least)
+{
+    size_t n_buckets = t->min_buckets;
+
+    while ((n_buckets * CUCKOO_WAYS / CUCKOO_TARGET_LOAD_INV < live || n_buckets < at_least) &&
+           n_buckets <= SIZE_MAX / (2 * CUCKOO_WAYS * sizeof(cuckoo_bucket_t))) {
+        n_buckets <<= 1;
+    }
+
+    return n_buckets;
+}
+
+static cuckoo_array_t * cuckoo_array_create(size_t n_buckets)
+{
+    size_t i;
+
+    // Entries right after the buckets. Both are whole cache lines
+    size_t bytes = sizeof(cuckoo_array_t) + n_buckets * (sizeof(cuckoo_bucket_t) + CUCKOO_WAYS * sizeof(cuckoo_entry_t));
+    bytes = (bytes + CACHE_LINE - 1) & ~((size_t) CACHE_LINE - 1);
+
+    cuckoo_array_t * a = (cuckoo_array_t *) aligned_alloc(CACHE_LINE, bytes);
+    if (!a) return NULL;
+
+    // Zeroed buckets are free, and not held
+    a->n_buckets = n_buckets;
+    atomic_init(&(a->walks), 0);
+    atomic_init(&(a->frozen), false);
+    a->retired = NULL;
+    a->entries = (cuckoo_entry_t *) &(a->buckets[n_buckets]);
+    memset(a->buckets, 0, n_buckets * sizeof(cuckoo_bucket_t));
+    for (i = 0; i < n_buckets * CUCKOO_WAYS; i++) {
+        atomic_init(&(a->entries[i].tag), 0);
+        atomic_init(&(a->entries[i].key), NULL);
+    }
+
+    return a;
+}
+
+static inline cuckoo_array_t * cuckoo_array_load(cuckoo_table_t * t, uint32_t hazard)
+{
+    cuckoo_array_t * a = atomic_load_explicit(&(t->array), memory_order_acquire);
+
+    // Protect it, then make sure it's still current, so it hasn't been retired
+    if (t->reclaim == HASHTABLE_RECLAIM_HAZARD) {
+        cuckoo_array_t * check;
+        do {
+            check = a;
+            hazard_pointer_set(hazard, a);
+            a = atomic_load(&(t->array));
+        } while (a != check);
+    }
+
+    return a;
+}
+
+static void cuckoo_array_wait(cuckoo_table_t * t, cuckoo_array_t * a)
+{
+    // It's frozen just before the new array is published
+    while (atomic_load(&(t->array)) == a) cuckoo_pause();
+}
+
+static void cuckoo_array_retire(cuckoo_table_t * t, cuckoo_array_t * a)
+{
+    if (t->reclaim != HASHTABLE_RECLAIM_NONE) {
+        hashtable_engine_retire(t->reclaim, a, free);
+        return;
+    }
+
+    // Kept until the table is freed
+    a->retired = atomic_load(&(t->retired));
+    while (!atomic_compare_exchange_weak(&(t->retired), &(a->retired), a));
+}
+
+static inline void cuckoo_pause(void)
+{
+    sched_yield();
+}
+
+/** @} addtogroup HASHTABLE_ENGINE */
+/** @} addtogroup HASHTABLE */
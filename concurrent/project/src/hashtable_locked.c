@@ -0,0 +1,789 @@
+/**
+ * @file    hashtable_locked.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implements the lock-based baseline engines
+ *
+ * Three engines share one chained table, and differ only in how it's locked.
+ * HASHTABLE_ENGINE_MUTEX puts the whole table behind one mutex.
+ * HASHTABLE_ENGINE_RWLOCK puts it behind a reader-writer lock, which lookups
+ * share. HASHTABLE_ENGINE_STRIPED guards it with LOCKED_STRIPES MCS locks
+ * (see spinlock.h), bucket i with lock i mod LOCKED_STRIPES, so holders don't
+ * pay for a system call, and waiters each spin on their own line. There are
+ * always at least that many buckets, and a power of two of each, so a key's
+ * stripe never changes. They're here to measure the lock-free engines against.
+ *
+ * Each bucket is a singly linked chain of nodes, sorted by tag (the key's hash
+ * with its top bit set), and with keys of equal tags in the order they were
+ * inserted. Nodes are freed as soon as they're unlinked, under the lock, so
+ * these tables need no reclamation scheme, and run as HASHTABLE_RECLAIM_NONE
+ * whatever they're created with.
+ *
+ * Element counts are kept per stripe, under its lock. Once a stripe's buckets
+ * average more than LOCKED_MAX_LOAD elements, the table is resized to one per
+ * bucket. It shrinks the same way once fewer than 1/LOCKED_SHRINK_LOAD_INV of
+ * its buckets would be used. Resizing takes every lock (in order, for the
+ * striped engine), and rehashes every node into a new array of buckets.
+ *
+ * A walk goes bucket by bucket, locking each while it steps, and remembers
+ * the last tag it saw, and how many keys with that tag. Because chains are
+ * sorted, that's enough to pick up where it left off. Resizing would scatter
+ * the buckets, so it waits until no walks are open, and the table just gets
+ * fuller meanwhile. If a key with the same tag as the walk's last is removed,
+ * the walk may miss another with that tag.
+ *
+ * @addtogroup HASHTABLE
+ * @{
+ * @addtogroup HASHTABLE_ENGINE
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Reader-writer locks are POSIX, not C11
+#define _POSIX_C_SOURCE 200809L
+
+// Modules
+#include "hashtable.h"
+#include "hashtable_engine.h"
+#include "spinlock.h"
+
+// Standard
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define LOCKED_STRIPES          (64)            /**< MCS locks in a striped table. Must be a power of two */
+#define LOCKED_SIZE_MIN         (LOCKED_STRIPES)    /**< The fewest buckets a table has. A power of two, no fewer than LOCKED_STRIPES */
+#define LOCKED_MAX_LOAD         (2)             /**< A table grows once its buckets average more elements than this */
+#define LOCKED_SHRINK_LOAD_INV  (8)             /**< A table shrinks once it has this many buckets per element */
+
+#define CACHE_LINE              (64)            /**< Stripes are aligned to this many bytes */
+
+#define TAG_KEY                 (UINT64_C(1) << 63)         /**< Set in every key's tag */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   How a table is locked
+ */
+typedef enum {
+    LOCKED_MUTEX,       /**< One mutex */
+    LOCKED_RWLOCK,      /**< One reader-writer lock */
+    LOCKED_STRIPED,     /**< An MCS lock per stripe */
+} locked_kind_t;
+
+/**
+ * @brief   An element, and its place in a chain
+ */
+typedef struct locked_node_t_ {
+    struct locked_node_t_ *     next;                       /**< The next node in the bucket, or NULL */
+    uint64_t                    tag;                        /**< The key's hash, with TAG_KEY set */
+    hashtable_key_t             key;                        /**< The key */
+    hashtable_elem_t            elem;                       /**< The element */
+} locked_node_t;
+
+/**
+ * @brief   A lock, and the count of elements in the buckets it guards
+ */
+typedef struct locked_stripe_t_ {
+    _Alignas(CACHE_LINE)
+    spinlock_mcs_t              lock;                       /**< Guards the stripe's buckets, under LOCKED_STRIPED */
+    atomic_size_t               count;                      /**< Elements in the stripe's buckets. Only changed under the lock */
+} locked_stripe_t;
+
+/**
+ * @brief   The table
+ */
+typedef struct locked_table_t_ {
+    locked_stripe_t             stripes[LOCKED_STRIPES];    /**< The stripes. Only the first n_stripes are used */
+    pthread_mutex_t             mutex;                      /**< Guards everything, under LOCKED_MUTEX */
+    pthread_rwlock_t            rwlock;                     /**< Guards everything, under LOCKED_RWLOCK */
+    locked_kind_t               kind;                       /**< How the table is locked */
+    uint32_t                    n_stripes;                  /**< The number of stripes in use. A power of two */
+    atomic_size_t               walks;                      /**< Iterators and scans open on the table. It isn't resized while there are any */
+    locked_node_t **            buckets;                    /**< Each bucket's first node. Only changed under every lock */
+    size_t                      n_buckets;                  /**< The number of buckets. A power of two */
+    size_t                      min_buckets;                /**< The table never has fewer buckets than this */
+    eq_f_t                      eq_f;                       /**< The function used to compare keys with the same tag, or NULL */
+} locked_table_t;
+
+/**
+ * @brief   A position in a walk over a table
+ */
+typedef struct locked_iter_t_ {
+    locked_table_t *            t;                          /**< The table being walked */
+    size_t                      bucket;                     /**< The bucket being walked */
+    size_t                      last;                       /**< The bucket to stop at */
+    uint64_t                    tag;                        /**< The tag of the last node visited in the bucket */
+    size_t                      run;                        /**< Nodes with that tag visited so far, or 0 if none have been in this bucket */
+} locked_iter_t;
+
+/**
+ * @brief   Outcomes of writing a key
+ */
+typedef enum {
+    LOCKED_FOUND,       /**< The key was present */
+    LOCKED_ABSENT,      /**< The key was absent, and has been inserted */
+    LOCKED_FULL,        /**< The key was absent, and memory for it couldn't be allocated */
+} locked_result_t;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @see hashtable_engine_ops_t
+ */
+static void * locked_mutex_create(const hashtable_config_t * config);
+static void * locked_rwlock_create(const hashtable_config_t * config);
+static void * locked_striped_create(const hashtable_config_t * config);
+static void locked_free(void * table, free_f_t free_f);
+static hashtable_elem_t locked_get(void * table, hashtable_key_t key, uint64_t hash);
+static bool locked_insert(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present);
+static hashtable_elem_t locked_put(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem);
+static bool locked_replace_if(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem);
+static hashtable_elem_t locked_remove(void * table, hashtable_key_t key, uint64_t hash);
+static size_t locked_size(void * table);
+static void * locked_iter_create(void * table);
+static bool locked_iter_next(void * p_it, hashtable_key_t * key, hashtable_elem_t * elem);
+static void locked_iter_free(void * p_it);
+static void * locked_scan_begin(void * table);
+static void locked_scan_end(void * table, void * snapshot);
+static size_t locked_scan_range(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg);
+
+/**
+ * @brief   Allocates an empty table
+ *
+ * @param[in] config:       The table's configuration
+ * @param[in] kind:         How to lock it
+ *
+ * @return      The table, or NULL if memory allocation failed
+ */
+static locked_table_t * locked_create(const hashtable_config_t * config, locked_kind_t kind);
+
+/**
+ * @brief   Inserts or replaces a key's element
+ *
+ * @param[in] t:            The table
+ * @param[in] key:          The key
+ * @param[in] tag:          The key's tag
+ * @param[in] elem:         The element to store
+ * @param[in] replace:      Whether to replace the element of a key that's present
+ * @param[out] old:         Gets the element found, if the key was present
+ *
+ * @return      LOCKED_FOUND, LOCKED_ABSENT if elem was inserted, or LOCKED_FULL
+ */
+static locked_result_t locked_write(locked_table_t * t, hashtable_key_t key, uint64_t tag, hashtable_elem_t elem, bool replace, hashtable_elem_t * old);
+
+/**
+ * @brief   Finds where a key is, or would go, in its bucket. Its stripe must be held
+ *
+ * @param[in] t:            The table
+ * @param[in] key:          The key
+ * @param[in] tag:          The key's tag
+ * @param[out] link:        Gets the link to the key's node, if it's present,
+ *                          and otherwise the link a new node for it would replace
+ *
+ * @return      true if the key is present
+ */
+static bool locked_find(locked_table_t * t, hashtable_key_t key, uint64_t tag, locked_node_t *** link);
+
+/**
+ * @brief   Steps a walk to its next element
+ *
+ * @param[in,out] it:       The walk
+ * @param[out] key:         Gets the element's key
+ * @param[out] elem:        Gets the element
+ *
+ * @return      false if the walk has reached it->last
+ */
+static bool locked_step(locked_iter_t * it, hashtable_key_t * key, hashtable_elem_t * elem);
+
+/**
+ * @brief   Resizes the table, if a stripe is still too full, or the table too empty, and no walks are open
+ *
+ * Takes every lock, so the caller must hold none
+ *
+ * @param[in] t:            The table
+ * @param[in] stripe:       The stripe that looked too full or too empty
+ */
+static void locked_resize(locked_table_t * t, uint32_t stripe);
+
+/**
+ * @brief   Checks whether a stripe's buckets are too full. The stripe must be held
+ */
+static inline bool locked_too_full(locked_table_t * t, uint32_t stripe);
+
+/**
+ * @brief   Checks whether the table is too empty. The stripe must be held
+ *
+ * The whole table is only added up once the stripe looks too empty
+ */
+static inline bool locked_too_empty(locked_table_t * t, uint32_t stripe);
+
+/**
+ * @brief   Finds the number of buckets to resize to, for one element per bucket
+ *
+ * @param[in] t:            The table
+ * @param[in] live:         The number of elements
+ */
+static size_t locked_target_size(locked_table_t * t, size_t live);
+
+/**
+ * @brief   Adds up the stripes' counts. Doesn't need any locks
+ */
+static size_t locked_sum(locked_table_t * t);
+
+/**
+ * @brief   Finds the stripe guarding a key, or a bucket, by its low bits
+ */
+static inline uint32_t locked_stripe(locked_table_t * t, uint64_t bits);
+
+/**
+ * @brief   Takes the lock guarding a stripe, for reading
+ *
+ * @param[in] t:            The table
+ * @param[in] stripe:       The stripe
+ * @param[in] waiter:       The caller's place in line, under LOCKED_STRIPED.
+ *                          Must be passed to the matching locked_unlock
+ */
+static inline void locked_read_lock(locked_table_t * t, uint32_t stripe, spinlock_mcs_node_t * waiter);
+
+/**
+ * @brief   Takes the lock guarding a stripe, for writing. As for locked_read_lock
+ */
+static inline void locked_write_lock(locked_table_t * t, uint32_t stripe, spinlock_mcs_node_t * waiter);
+
+/**
+ * @brief   Lets go of a lock taken with locked_read_lock or locked_write_lock
+ */
+static inline void locked_unlock(locked_table_t * t, uint32_t stripe, spinlock_mcs_node_t * waiter);
+
+/**
+ * @brief   Takes every lock, for writing, in order
+ *
+ * @param[in] t:            The table
+ * @param[in] waiters:      A place in line for each stripe, under LOCKED_STRIPED
+ */
+static void locked_lock_all(locked_table_t * t, spinlock_mcs_node_t * waiters);
+
+/**
+ * @brief   Lets go of the locks taken with locked_lock_all
+ */
+static void locked_unlock_all(locked_table_t * t, spinlock_mcs_node_t * waiters);
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+const hashtable_engine_ops_t hashtable_mutex_ops = {
+    .create         = locked_mutex_create,
+    .free           = locked_free,
+    .get            = locked_get,
+    .insert         = locked_insert,
+    .put            = locked_put,
+    .replace_if     = locked_replace_if,
+    .remove         = locked_remove,
+    .size           = locked_size,
+    .iter_create    = locked_iter_create,
+    .iter_next      = locked_iter_next,
+    .iter_free      = locked_iter_free,
+    .scan_begin     = locked_scan_begin,
+    .scan_end       = locked_scan_end,
+    .scan_range     = locked_scan_range,
+    .locked         = true,
+};
+
+const hashtable_engine_ops_t hashtable_rwlock_ops = {
+    .create         = locked_rwlock_create,
+    .free           = locked_free,
+    .get            = locked_get,
+    .insert         = locked_insert,
+    .put            = locked_put,
+    .replace_if     = locked_replace_if,
+    .remove         = locked_remove,
+    .size           = locked_size,
+    .iter_create    = locked_iter_create,
+    .iter_next      = locked_iter_next,
+    .iter_free      = locked_iter_free,
+    .scan_begin     = locked_scan_begin,
+    .scan_end       = locked_scan_end,
+    .scan_range     = locked_scan_range,
+    .locked         = true,
+};
+
+const hashtable_engine_ops_t hashtable_striped_ops = {
+    .create         = locked_striped_create,
+    .free           = locked_free,
+    .get            = locked_get,
+    .insert         = locked_insert,
+    .put            = locked_put,
+    .replace_if     = locked_replace_if,
+    .remove         = locked_remove,
+    .size           = locked_size,
+    .iter_create    = locked_iter_create,
+    .iter_next      = locked_iter_next,
+    .iter_free      = locked_iter_free,
+    .scan_begin     = locked_scan_begin,
+    .scan_end       = locked_scan_end,
+    .scan_range     = locked_scan_range,
+    .locked         = true,
+};
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static void * locked_mutex_create(const hashtable_config_t * config)
+{
+    return locked_create(config, LOCKED_MUTEX);
+}
+
+static void * locked_rwlock_create(const hashtable_config_t * config)
+{
+    return locked_create(config, LOCKED_RWLOCK);
+}
+
+static void * locked_striped_create(const hashtable_config_t * config)
+{
+    return locked_create(config, LOCKED_STRIPED);
+}
+
+static void locked_free(void * table, free_f_t free_f)
+{
+    locked_table_t * t = (locked_table_t *) table;
+    size_t i;
+
+    // Free every node, and its element
+    for (i = 0; i < t->n_buckets; i++) {
+        locked_node_t * node = t->buckets[i];
+        while (node) {
+            locked_node_t * next = node->next;
+            if (free_f) free_f(node->elem);
+            free(node);
+            node = next;
+        }
+    }
+
+    // Then the locks, and the rest
+    pthread_mutex_destroy(&(t->mutex));
+    pthread_rwlock_destroy(&(t->rwlock));
+    free(t->buckets);
+    free(t);
+}
+
+static hashtable_elem_t locked_get(void * table, hashtable_key_t key, uint64_t hash)
+{
+    locked_table_t * t = (locked_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    uint32_t stripe = locked_stripe(t, tag);
+    hashtable_elem_t elem = NULL;
+    spinlock_mcs_node_t waiter;
+    locked_node_t ** link;
+
+    locked_read_lock(t, stripe, &waiter);
+    if (locked_find(t, key, tag, &link)) elem = (*link)->elem;
+    locked_unlock(t, stripe, &waiter);
+
+    return elem;
+}
+
+static bool locked_insert(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present)
+{
+    hashtable_elem_t old;
+
+    switch (locked_write((locked_table_t *) table, key, hash | TAG_KEY, elem, false, &old)) {
+    case LOCKED_ABSENT: if (present) *present = elem;   return true;
+    case LOCKED_FOUND:  if (present) *present = old;    return false;
+    default:            if (present) *present = NULL;   return false;
+    }
+}
+
+static hashtable_elem_t locked_put(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem)
+{
+    hashtable_elem_t old;
+
+    if (locked_write((locked_table_t *) table, key, hash | TAG_KEY, elem, true, &old) == LOCKED_FOUND) return old;
+    return NULL;
+}
+
+static bool locked_replace_if(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem)
+{
+    locked_table_t * t = (locked_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    uint32_t stripe = locked_stripe(t, tag);
+    bool replaced = false;
+    spinlock_mcs_node_t waiter;
+    locked_node_t ** link;
+
+    locked_write_lock(t, stripe, &waiter);
+    if (locked_find(t, key, tag, &link) && (*link)->elem == expected) {
+        (*link)->elem = new_elem;
+        replaced = true;
+    }
+    locked_unlock(t, stripe, &waiter);
+
+    return replaced;
+}
+
+static hashtable_elem_t locked_remove(void * table, hashtable_key_t key, uint64_t hash)
+{
+    locked_table_t * t = (locked_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    uint32_t stripe = locked_stripe(t, tag);
+    hashtable_elem_t elem = NULL;
+    bool shrink = false;
+    spinlock_mcs_node_t waiter;
+    locked_node_t ** link;
+
+    locked_write_lock(t, stripe, &waiter);
+    if (locked_find(t, key, tag, &link)) {
+        locked_node_t * node = *link;
+        *link = node->next;
+        elem = node->elem;
+        free(node);
+
+        atomic_store_explicit(&(t->stripes[stripe].count), atomic_load_explicit(&(t->stripes[stripe].count), memory_order_relaxed) - 1, memory_order_relaxed);
+        shrink = !atomic_load_explicit(&(t->walks), memory_order_relaxed) && locked_too_empty(t, stripe);
+    }
+    locked_unlock(t, stripe, &waiter);
+
+    if (shrink) locked_resize(t, stripe);
+    return elem;
+}
+
+static size_t locked_size(void * table)
+{
+    return locked_sum((locked_table_t *) table);
+}
+
+static void * locked_iter_create(void * table)
+{
+    locked_iter_t * it = (locked_iter_t *) malloc(sizeof(locked_iter_t));
+    if (!it) return NULL;
+
+    // Once the walk is open, the buckets stay put
+    locked_scan_begin(table);
+    it->t = (locked_table_t *) table;
+    it->bucket = 0;
+    it->last = it->t->n_buckets;
+    it->run = 0;
+
+    return it;
+}
+
+static bool locked_iter_next(void * p_it, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    return locked_step((locked_iter_t *) p_it, key, elem);
+}
+
+static void locked_iter_free(void * p_it)
+{
+    locked_iter_t * it = (locked_iter_t *) p_it;
+
+    locked_scan_end(it->t, NULL);
+    free(it);
+}
+
+static void * locked_scan_begin(void * table)
+{
+    locked_table_t * t = (locked_table_t *) table;
+    spinlock_mcs_node_t waiter;
+
+    // Resizing holds stripe 0, so this can't slip in halfway through one
+    locked_read_lock(t, 0, &waiter);
+    atomic_fetch_add_explicit(&(t->walks), 1, memory_order_relaxed);
+    locked_unlock(t, 0, &waiter);
+
+    return NULL;
+}
+
+static void locked_scan_end(void * table, void * snapshot)
+{
+    (void) snapshot;
+
+    atomic_fetch_sub_explicit(&(((locked_table_t *) table)->walks), 1, memory_order_relaxed);
+}
+
+static size_t locked_scan_range(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg)
+{
+    locked_table_t * t = (locked_table_t *) table;
+    locked_iter_t it;
+    hashtable_key_t key;
+    hashtable_elem_t elem;
+    size_t visited = 0;
+
+    (void) snapshot;
+
+    // Buckets don't change while the scan is open
+    it.t = t;
+    it.bucket = (size_t) (((uint64_t) t->n_buckets * range) / n_ranges);
+    it.last = (size_t) (((uint64_t) t->n_buckets * (range + 1)) / n_ranges);
+    it.run = 0;
+
+    while (locked_step(&it, &key, &elem)) {
+        fn(key, elem, arg);
+        visited++;
+    }
+
+    return visited;
+}
+
+static locked_table_t * locked_create(const hashtable_config_t * config, locked_kind_t kind)
+{
+    uint32_t i;
+
+    locked_table_t * t = (locked_table_t *) aligned_alloc(CACHE_LINE, sizeof(locked_table_t));
+    if (!t) return NULL;
+
+    t->kind = kind;
+    t->n_stripes = (kind == LOCKED_STRIPED) ? LOCKED_STRIPES : 1;
+    t->eq_f = config->eq_f;
+    atomic_init(&(t->walks), 0);
+
+    // Big enough for the capacity asked for, without growing
+    t->min_buckets = LOCKED_SIZE_MIN;
+    while (t->min_buckets * LOCKED_MAX_LOAD < config->capacity) {
+        if (t->min_buckets > SIZE_MAX / (2 * sizeof(locked_node_t *))) {
+            free(t);
+            return NULL;
+        }
+        t->min_buckets <<= 1;
+    }
+    t->n_buckets = t->min_buckets;
+    t->buckets = (locked_node_t **) calloc(t->n_buckets, sizeof(locked_node_t *));
+    if (!t->buckets) {
+        free(t);
+        return NULL;
+    }
+
+    for (i = 0; i < t->n_stripes; i++) {
+        spinlock_mcs_init(&(t->stripes[i].lock));
+        atomic_init(&(t->stripes[i].count), 0);
+    }
+    pthread_mutex_init(&(t->mutex), NULL);
+    pthread_rwlock_init(&(t->rwlock), NULL);
+
+    return t;
+}
+
+static locked_result_t locked_write(locked_table_t * t, hashtable_key_t key, uint64_t tag, hashtable_elem_t elem, bool replace, hashtable_elem_t * old)
+{
+    uint32_t stripe = locked_stripe(t, tag);
+    locked_result_t result = LOCKED_FOUND;
+    bool grow = false;
+    spinlock_mcs_node_t waiter;
+    locked_node_t ** link;
+
+    // Allocated up front, so the lock isn't held across malloc
+    locked_node_t * node = (locked_node_t *) malloc(sizeof(locked_node_t));
+
+    locked_write_lock(t, stripe, &waiter);
+    if (locked_find(t, key, tag, &link)) {
+        *old = (*link)->elem;
+        if (replace) (*link)->elem = elem;
+    }
+    else if (!node) {
+        result = LOCKED_FULL;
+    }
+    else {
+        node->tag = tag;
+        node->key = key;
+        node->elem = elem;
+        node->next = *link;
+        *link = node;
+        node = NULL;
+        result = LOCKED_ABSENT;
+
+        atomic_store_explicit(&(t->stripes[stripe].count), atomic_load_explicit(&(t->stripes[stripe].count), memory_order_relaxed) + 1, memory_order_relaxed);
+        grow = !atomic_load_explicit(&(t->walks), memory_order_relaxed) && locked_too_full(t, stripe);
+    }
+    locked_unlock(t, stripe, &waiter);
+
+    free(node);
+    if (grow) locked_resize(t, stripe);
+    return result;
+}
+
+static bool locked_find(locked_table_t * t, hashtable_key_t key, uint64_t tag, locked_node_t *** link)
+{
+    locked_node_t ** prev = &(t->buckets[tag & (t->n_buckets - 1)]);
+
+    // Past the smaller tags, then through the run of this one
+    while (*prev && (*prev)->tag < tag) prev = &((*prev)->next);
+    while (*prev && (*prev)->tag == tag) {
+        if (!t->eq_f || t->eq_f((*prev)->key, key)) {
+            *link = prev;
+            return true;
+        }
+        prev = &((*prev)->next);
+    }
+
+    // New keys go at the end of the run, so walks' counts through it stay good
+    *link = prev;
+    return false;
+}
+
+static bool locked_step(locked_iter_t * it, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    locked_table_t * t = it->t;
+
+    for (; it->bucket < it->last; it->bucket++, it->run = 0) {
+        uint32_t stripe = locked_stripe(t, it->bucket);
+        spinlock_mcs_node_t waiter;
+        size_t skipped = 0;
+
+        locked_read_lock(t, stripe, &waiter);
+
+        // Past the tags already visited, then past as many of the last as were
+        locked_node_t * node = t->buckets[it->bucket];
+        if (it->run) {
+            while (node && node->tag < it->tag) node = node->next;
+            while (node && node->tag == it->tag && skipped < it->run) {
+                node = node->next;
+                skipped++;
+            }
+        }
+
+        if (node) {
+            *key = node->key;
+            *elem = node->elem;
+            it->run = (it->run && node->tag == it->tag) ? it->run + 1 : 1;
+            it->tag = node->tag;
+            locked_unlock(t, stripe, &waiter);
+            return true;
+        }
+
+        locked_unlock(t, stripe, &waiter);
+    }
+
+    return false;
+}
+
+static void locked_resize(locked_table_t * t, uint32_t stripe)
+{
+    spinlock_mcs_node_t waiters[LOCKED_STRIPES];
+    size_t i;
+
+    locked_lock_all(t, waiters);
+    size_t n_buckets = t->n_buckets;
+
+    // Somebody else may have got here first
+    if (!atomic_load_explicit(&(t->walks), memory_order_relaxed)) {
+        if (locked_too_full(t, stripe)) {
+            n_buckets = locked_target_size(t, locked_sum(t));
+            if (n_buckets <= t->n_buckets) n_buckets = 2 * t->n_buckets;
+        }
+        else if (locked_too_empty(t, stripe)) {
+            n_buckets = locked_target_size(t, locked_sum(t));
+        }
+    }
+
+    // If that failed, the table just stays as it is
+    locked_node_t ** buckets = (n_buckets != t->n_buckets) ? (locked_node_t **) calloc(n_buckets, sizeof(locked_node_t *)) : NULL;
+    if (buckets) {
+        for (i = 0; i < t->n_buckets; i++) {
+            locked_node_t * node = t->buckets[i];
+            while (node) {
+                locked_node_t * next = node->next;
+
+                // Ties stay in order, since they're reinserted in order
+                locked_node_t ** link = &(buckets[node->tag & (n_buckets - 1)]);
+                while (*link && (*link)->tag <= node->tag) link = &((*link)->next);
+                node->next = *link;
+                *link = node;
+
+                node = next;
+            }
+        }
+
+        free(t->buckets);
+        t->buckets = buckets;
+        t->n_buckets = n_buckets;
+    }
+
+    locked_unlock_all(t, waiters);
+}
+
+static inline bool locked_too_full(locked_table_t * t, uint32_t stripe)
+{
+    size_t count = atomic_load_explicit(&(t->stripes[stripe].count), memory_order_relaxed);
+
+    return count > LOCKED_MAX_LOAD * (t->n_buckets / t->n_stripes);
+}
+
+static inline bool locked_too_empty(locked_table_t * t, uint32_t stripe)
+{
+    size_t count = atomic_load_explicit(&(t->stripes[stripe].count), memory_order_relaxed);
+
+    return t->n_buckets > t->min_buckets &&
+           count * LOCKED_SHRINK_LOAD_INV * t->n_stripes < t->n_buckets &&
+           locked_sum(t) * LOCKED_SHRINK_LOAD_INV < t->n_buckets;
+}
+
+static size_t locked_target_size(locked_table_t * t, size_t live)
+{
+    size_t n_buckets = t->min_buckets;
+
+    while (n_buckets < live && n_buckets <= SIZE_MAX / (4 * sizeof(locked_node_t *))) n_buckets <<= 1;
+
+    return n_buckets;
+}
+
+static size_t locked_sum(locked_table_t * t)
+{
+    size_t total = 0;
+    uint32_t i;
+
+    for (i = 0; i < t->n_stripes; i++) total += atomic_load_explicit(&(t->stripes[i].count), memory_order_relaxed);
+
+    return total;
+}
+
+static inline uint32_t locked_stripe(locked_table_t * t, uint64_t bits)
+{
+    return (uint32_t) (bits & (t->n_stripes - 1));
+}
+
+static inline void locked_read_lock(locked_table_t * t, uint32_t stripe, spinlock_mcs_node_t * waiter)
+{
+    switch (t->kind) {
+    case LOCKED_MUTEX:      pthread_mutex_lock(&(t->mutex));                        break;
+    case LOCKED_RWLOCK:     pthread_rwlock_rdlock(&(t->rwlock));                    break;
+    case LOCKED_STRIPED:    spinlock_mcs_lock(&(t->stripes[stripe].lock), waiter);  break;
+    }
+}
+
+static inline void locked_write_lock(locked_table_t * t, uint32_t stripe, spinlock_mcs_node_t * waiter)
+{
+    switch (t->kind) {
+    case LOCKED_MUTEX:      pthread_mutex_lock(&(t->mutex));                        break;
+    case LOCKED_RWLOCK:     pthread_rwlock_wrlock(&(t->rwlock));                    break;
+    case LOCKED_STRIPED:    spinlock_mcs_lock(&(t->stripes[stripe].lock), waiter);  break;
+    }
+}
+
+static inline void locked_unlock(locked_table_t * t, uint32_t stripe, spinlock_mcs_node_t * waiter)
+{
+    switch (t->kind) {
+    case LOCKED_MUTEX:      pthread_mutex_unlock(&(t->mutex));                      break;
+    case LOCKED_RWLOCK:     pthread_rwlock_unlock(&(t->rwlock));                    break;
+    case LOCKED_STRIPED:    spinlock_mcs_unlock(&(t->stripes[stripe].lock), waiter); break;
+    }
+}
+
+static void locked_lock_all(locked_table_t * t, spinlock_mcs_node_t * waiters)
+{
+    uint32_t i;
+
+    for (i = 0; i < t->n_stripes; i++) locked_write_lock(t, i, &(waiters[i]));
+}
+
+static void locked_unlock_all(locked_table_t * t, spinlock_mcs_node_t * waiters)
+{
+    uint32_t i;
+
+    for (i = t->n_stripes; i-- > 0;) locked_unlock(t, i, &(waiters[i]));
+}
+
+/** @} addtogroup HASHTABLE_ENGINE */
+/** @} addtogroup HASHTABLE */
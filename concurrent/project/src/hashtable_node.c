@@ -17,119 +17,510 @@
 #include "hashtable_node.h"
 
 // Standard
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdatomic.h>
+#include <pthread.h>
 
 /* --- PRIVATE MACROS ------------------------------------------------------- */
 
+#define HASHTABLE_NODE_CACHE_LINE       (64)    /**< Slabs are aligned to this many bytes */
+#define HASHTABLE_NODE_SLAB_NODES       (512)   /**< Nodes carved out of a single slab allocation */
+#define HASHTABLE_NODE_MAGAZINE_NODES   (64)    /**< Nodes moved between a thread and the depot at once */
+#define HASHTABLE_NODE_DEPOT_INIT       (16)    /**< Initial number of magazine slots in the depot */
+#define HASHTABLE_NODE_COMPACT_MIN      (4*HASHTABLE_NODE_SLAB_NODES)   /**< Nodes the depot holds before it's first searched for wholly free slabs */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
 /**
- * @brief   Value used to denote a sentinel node
+ * @brief   A chain of free nodes, linked through their next fields
  */
-#define HASHTABLE_NODE_SENTINEL_ELEM    (UINTPTR_MAX)
+typedef struct hashtable_node_magazine_t_ {
+    hashtable_node_t    head;           /**< The first free node */
+    uint32_t            count;          /**< The number of nodes in the chain */
+} hashtable_node_magazine_t;
 
-/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+/**
+ * @brief   A slab, or a block from hashtable_node_create_block
+ */
+typedef struct hashtable_node_slab_t_ {
+    hashtable_node_t    base;           /**< The first node */
+    size_t              n_nodes;        /**< The number of nodes it holds */
+    size_t              free_nodes;     /**< How many of them are in the depot. Only counted while compacting */
+} hashtable_node_slab_t;
+
+/**
+ * @brief   Per-thread node cache
+ *
+ * Nodes are handed out of the magazine first, then out of the thread's
+ * current slab. Only refilling from (or spilling to) the depot, and
+ * allocating a fresh slab, touch shared state.
+ */
+typedef struct hashtable_node_cache_t_ {
+    hashtable_node_magazine_t   magazine;       /**< Free nodes owned by this thread */
+    hashtable_node_t            slab_next;      /**< The next never-used node in the current slab */
+    hashtable_node_t            slab_end;       /**< One past the last node in the current slab */
+    bool                        registered;     /**< Whether the thread exit hook is armed */
+} hashtable_node_cache_t;
 
 /**
- * @brief   Internal node structure
+ * @brief   State shared by every thread's cache
  */
-struct hashtable_node_t_ {
-    uint32_t            hash;           /**< The node's hash */
-    atomic_uintptr_t    elem;           /**< The element the node references */
-    atomic_uintptr_t    next;           /**< The next element in the sequence */
+typedef struct hashtable_node_pool_t_ {
+    pthread_mutex_t             lock;           /**< Guards every other field */
+    hashtable_node_magazine_t * depot;          /**< Full magazines released by threads */
+    size_t                      depot_count;    /**< The number of magazines in the depot */
+    size_t                      depot_size;     /**< The number of slots allocated for the depot */
+    size_t                      depot_nodes;    /**< The number of nodes in the depot's magazines */
+    size_t                      compact_at;     /**< The depot is next searched for wholly free slabs once it holds this many nodes */
+    hashtable_node_slab_t *     slabs;          /**< Every slab still allocated, so they stay reachable */
+    size_t                      slab_count;     /**< The number of slabs allocated */
+    size_t                      slab_size;      /**< The number of slots allocated for slab records */
+    size_t                      bytes;          /**< The memory held by slabs */
+} hashtable_node_pool_t;
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static hashtable_node_pool_t hashtable_node_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .compact_at = HASHTABLE_NODE_COMPACT_MIN,
 };
 
+static pthread_once_t hashtable_node_pool_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t hashtable_node_pool_key;
+
+static _Thread_local hashtable_node_cache_t hashtable_node_cache;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Returns the calling thread's node cache, arming its exit hook on first use
+ */
+static inline hashtable_node_cache_t * hashtable_node_cache_get(void);
+
+/**
+ * @brief   Takes an uninitialized node from the calling thread's cache
+ *
+ * @return      A node, or NULL if memory allocation failed
+ */
+static inline hashtable_node_t hashtable_node_alloc(void);
+
+/**
+ * @brief   Creates the key used to flush caches on thread exit
+ */
+static void hashtable_node_pool_key_create(void);
+
+/**
+ * @brief   Thread exit hook. Returns everything the thread still holds to the depot
+ *
+ * @param[in] p_cache:  The exiting thread's cache
+ */
+static void hashtable_node_cache_flush(void * p_cache);
+
+/**
+ * @brief   Gets a node the calling thread has never handed out
+ *
+ * Tries the depot first, then the current slab, then a new slab
+ *
+ * @param[in,out] cache:    The calling thread's cache
+ *
+ * @return      An uninitialized node, or NULL if memory allocation failed
+ */
+static hashtable_node_t hashtable_node_cache_refill(hashtable_node_cache_t * cache);
+
+/**
+ * @brief   Moves a magazine into the depot
+ *
+ * @param[in] magazine:     The chain of nodes to release
+ *
+ * @return      true if successful, false if memory allocation failed
+ */
+static bool hashtable_node_depot_push(hashtable_node_magazine_t magazine);
+
+/**
+ * @brief   Gives every slab whose nodes are all in the depot back to the system
+ *
+ * Takes time linear in the depot's size, so it only runs once the depot has
+ * doubled since the last time. Must be called with the pool locked
+ *
+ * @param[in,out] pool:     The pool
+ */
+static void hashtable_node_depot_compact(hashtable_node_pool_t * pool);
+
+/**
+ * @brief   Records a slab, so it stays reachable
+ *
+ * @param[in] slab:         The slab's memory
+ * @param[in] n_nodes:      The number of nodes it holds
+ *
+ * @return      true if successful, false if memory allocation failed
+ */
+static bool hashtable_node_slab_add(hashtable_node_t slab, size_t n_nodes);
+
+/**
+ * @brief   Finds the slab a node was carved from
+ *
+ * The slabs must be sorted by address, and the pool locked
+ *
+ * @param[in] pool:         The pool
+ * @param[in] node:         The node
+ *
+ * @return      The node's slab
+ */
+static hashtable_node_slab_t * hashtable_node_slab_find(hashtable_node_pool_t * pool, hashtable_node_t node);
+
+/**
+ * @brief   Orders slab records by address, for qsort
+ */
+static int hashtable_node_slab_compare(const void * a, const void * b);
+
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 
-hashtable_node_t hashtable_node_create(hashtable_elem_t elem, uint32_t hash)
+hashtable_node_t hashtable_node_create(hashtable_key_t key, hashtable_elem_t elem, uint64_t hash)
 {
-    // Allocate memory
-    hashtable_node_t node = (hashtable_node_t) malloc(sizeof(struct hashtable_node_t_));
+    hashtable_node_t node = hashtable_node_alloc();
     if (!node) return NULL;
 
-    // Initialize fields
-    node->hash = hash;
-    atomic_init(&(node->elem), (uintptr_t) elem);
-    atomic_init(&(node->next), NULL);
+    hashtable_node_init(node, key, elem, hash);
 
     // Success
     return node;
 }
 
+hashtable_node_t hashtable_node_create_sentinel(uint32_t bucket)
+{
+    hashtable_node_t node = hashtable_node_alloc();
+    if (!node) return NULL;
+
+    hashtable_node_init_sentinel(node, bucket);
+
+    // Success
+    return node;
+}
+
+hashtable_node_t hashtable_node_create_block(size_t n)
+{
+    // aligned_alloc wants a multiple of the alignment
+    size_t size = n * sizeof(struct hashtable_node_t_);
+    size = (size + HASHTABLE_NODE_CACHE_LINE - 1) & ~((size_t) HASHTABLE_NODE_CACHE_LINE - 1);
+
+    hashtable_node_t block = (hashtable_node_t) aligned_alloc(HASHTABLE_NODE_CACHE_LINE, size);
+    if (!block) return NULL;
+
+    // Its nodes are freed one by one into the pool, so it's kept like any other slab
+    if (!hashtable_node_slab_add(block, n)) {
+        free(block);
+        return NULL;
+    }
+
+    return block;
+}
+
+void hashtable_node_init(hashtable_node_t node, hashtable_key_t key, hashtable_elem_t elem, uint64_t hash)
+{
+    // Initialize fields
+    node->so_key = hashtable_node_split_order_key(hash, false);
+    node->key = key;
+    atomic_init(&(node->elem), (uintptr_t) elem);
+    atomic_init(&(node->next), (uintptr_t) NULL);
+}
+
+void hashtable_node_init_sentinel(hashtable_node_t node, uint32_t bucket)
+{
+    // Initialize fields. The flag rides along in next from here on
+    node->so_key = hashtable_node_split_order_key(bucket, true);
+    node->key = NULL;
+    atomic_init(&(node->elem), (uintptr_t) NULL);
+    atomic_init(&(node->next), HASHTABLE_NODE_SENTINEL);
+}
+
 void hashtable_node_free(hashtable_node_t node)
 {
-    // Free memory
-    if (node) free(node);
+    hashtable_node_cache_t * cache;
+
+    if (!node) return;
+
+    // Put it back in the magazine
+    cache = hashtable_node_cache_get();
+    atomic_store_explicit(&(node->next), (uintptr_t) cache->magazine.head, memory_order_relaxed);
+    cache->magazine.head = node;
+    (cache->magazine.count)++;
+
+    // Spill a full magazine once we're holding two
+    if (cache->magazine.count >= 2*HASHTABLE_NODE_MAGAZINE_NODES) {
+        hashtable_node_magazine_t spill;
+        hashtable_node_t last;
+        uint32_t i;
+
+        // Split off the first magazine's worth
+        spill.head = cache->magazine.head;
+        spill.count = HASHTABLE_NODE_MAGAZINE_NODES;
+        last = spill.head;
+        for (i = 1; i < HASHTABLE_NODE_MAGAZINE_NODES; i++) {
+            last = (hashtable_node_t) atomic_load_explicit(&(last->next), memory_order_relaxed);
+        }
+
+        // Keep the remainder if the depot can't take it
+        hashtable_node_t rest = (hashtable_node_t) atomic_load_explicit(&(last->next), memory_order_relaxed);
+        atomic_store_explicit(&(last->next), (uintptr_t) NULL, memory_order_relaxed);
+        if (hashtable_node_depot_push(spill)) {
+            cache->magazine.head = rest;
+            cache->magazine.count -= HASHTABLE_NODE_MAGAZINE_NODES;
+        }
+        else {
+            atomic_store_explicit(&(last->next), (uintptr_t) rest, memory_order_relaxed);
+        }
+    }
 }
 
-uint32_t hashtable_node_get_hash(hashtable_node_t node)
+size_t hashtable_node_pool_bytes(void)
 {
-    // Verify that the node is non-NULL
-    if (node)   return node->hash;
-    else        return UINT32_C(0);
+    hashtable_node_pool_t * pool = &hashtable_node_pool;
+
+    pthread_mutex_lock(&(pool->lock));
+    size_t bytes = pool->bytes;
+    pthread_mutex_unlock(&(pool->lock));
+
+    return bytes;
 }
 
-hashtable_elem_t hashtable_node_get_elem(hashtable_node_t node)
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static inline hashtable_node_cache_t * hashtable_node_cache_get(void)
 {
-    // Load the elem pointer
-    if (node)   return (hashtable_elem_t) atomic_load(&(node->elem));
-    else        return NULL;
+    hashtable_node_cache_t * cache = &hashtable_node_cache;
+
+    // Make sure this thread's nodes find their way back when it exits
+    if (!cache->registered) {
+        pthread_once(&hashtable_node_pool_key_once, hashtable_node_pool_key_create);
+        pthread_setspecific(hashtable_node_pool_key, cache);
+        cache->registered = true;
+    }
+
+    return cache;
 }
 
-hashtable_node_t hashtable_node_get_next(hashtable_node_t node)
+static inline hashtable_node_t hashtable_node_alloc(void)
 {
-    // Load the next node pointer
-    if (node)   return (hashtable_node_t) atomic_load(&(node->next));
-    else        return NULL;
+    hashtable_node_cache_t * cache = hashtable_node_cache_get();
+    hashtable_node_t node;
+
+    // Take from the magazine if possible
+    node = cache->magazine.head;
+    if (node) {
+        cache->magazine.head = (hashtable_node_t) atomic_load_explicit(&(node->next), memory_order_relaxed);
+        (cache->magazine.count)--;
+        return node;
+    }
+
+    return hashtable_node_cache_refill(cache);
 }
 
-bool hashtable_node_is_sentinel(hashtable_node_t node)
+static void hashtable_node_pool_key_create(void)
 {
-    // Retrieve the implicit node->sentinel field
-    if (node)   return (atomic_load(&(node->elem)) == HASHTABLE_NODE_SENTINEL_ELEM);
-    else        return false;
+    pthread_key_create(&hashtable_node_pool_key, hashtable_node_cache_flush);
 }
 
-void hashtable_node_set_elem(hashtable_node_t node, hashtable_elem_t elem)
+static void hashtable_node_cache_flush(void * p_cache)
 {
-    // Atomically set the elem field
-    if (node) atomic_store(&(node->elem), (uintptr_t) elem);
+    hashtable_node_cache_t * cache = (hashtable_node_cache_t *) p_cache;
+
+    // Chain the untouched remainder of the slab onto the magazine
+    while (cache->slab_next != cache->slab_end) {
+        hashtable_node_t node = cache->slab_next++;
+        atomic_init(&(node->next), (uintptr_t) cache->magazine.head);
+        cache->magazine.head = node;
+        (cache->magazine.count)++;
+    }
+
+    // Hand everything to the depot. If that fails the nodes stay
+    // reachable through their slab, so nothing leaks
+    if (cache->magazine.head) hashtable_node_depot_push(cache->magazine);
+
+    cache->magazine.head = NULL;
+    cache->magazine.count = 0;
+    cache->registered = false;
 }
 
-void hashtable_node_set_next(hashtable_node_t node, hashtable_node_t next)
+static hashtable_node_t hashtable_node_cache_refill(hashtable_node_cache_t * cache)
 {
-    // Atomically set the next field
-    if (node) atomic_store(&(node->next), (uintptr_t) next);
+    hashtable_node_pool_t * pool = &hashtable_node_pool;
+    hashtable_node_t node;
+
+    // Take a whole magazine from the depot, if there is one
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->depot_count) {
+        cache->magazine = pool->depot[--(pool->depot_count)];
+        pool->depot_nodes -= cache->magazine.count;
+        pthread_mutex_unlock(&(pool->lock));
+
+        node = cache->magazine.head;
+        cache->magazine.head = (hashtable_node_t) atomic_load_explicit(&(node->next), memory_order_relaxed);
+        (cache->magazine.count)--;
+        return node;
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    // Otherwise carve it out of this thread's slab
+    if (cache->slab_next == cache->slab_end) {
+        hashtable_node_t slab = (hashtable_node_t) aligned_alloc(HASHTABLE_NODE_CACHE_LINE,
+                                                                 HASHTABLE_NODE_SLAB_NODES * sizeof(struct hashtable_node_t_));
+        if (!slab) return NULL;
+
+        // Remember it so it is never lost
+        if (!hashtable_node_slab_add(slab, HASHTABLE_NODE_SLAB_NODES)) {
+            free(slab);
+            return NULL;
+        }
+
+        cache->slab_next = slab;
+        cache->slab_end = slab + HASHTABLE_NODE_SLAB_NODES;
+    }
+
+    return cache->slab_next++;
 }
 
-void hashtable_node_set_sentinel(hashtable_node_t node)
+static bool hashtable_node_depot_push(hashtable_node_magazine_t magazine)
 {
-    // Atomically set the elem field to be a sentinel
-    if (node) atomic_store(&(node->elem), HASHTABLE_NODE_SENTINEL_ELEM);
+    hashtable_node_pool_t * pool = &hashtable_node_pool;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    // Grow if necessary
+    if (pool->depot_count == pool->depot_size) {
+        size_t new_size = pool->depot_size ? pool->depot_size*2 : HASHTABLE_NODE_DEPOT_INIT;
+        hashtable_node_magazine_t * new_depot = (hashtable_node_magazine_t *) realloc(pool->depot, new_size * sizeof(hashtable_node_magazine_t));
+        if (!new_depot) {
+            pthread_mutex_unlock(&(pool->lock));
+            return false;
+        }
+        pool->depot = new_depot;
+        pool->depot_size = new_size;
+    }
+
+    pool->depot[(pool->depot_count)++] = magazine;
+    pool->depot_nodes += magazine.count;
+    if (pool->depot_nodes >= pool->compact_at) hashtable_node_depot_compact(pool);
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return true;
 }
 
-bool hashtable_node_set_sentinel_if_elem(hashtable_node_t node, hashtable_elem_t expected_elem)
+static void hashtable_node_depot_compact(hashtable_node_pool_t * pool)
 {
-    return hashtable_node_cas_elem(node, expected_elem, (hashtable_elem_t) HASHTABLE_NODE_SENTINEL_ELEM);
+    hashtable_node_t node;
+    size_t n_free = 0;
+    size_t i, j;
+
+    // Count how many of each slab's nodes are in the depot. Nodes still held
+    // by a thread, whether in its magazine, its current slab, or a table,
+    // keep their slab from filling up
+    qsort(pool->slabs, pool->slab_count, sizeof(hashtable_node_slab_t), hashtable_node_slab_compare);
+    for (i = 0; i < pool->slab_count; i++) pool->slabs[i].free_nodes = 0;
+    for (i = 0; i < pool->depot_count; i++) {
+        for (node = pool->depot[i].head; node; node = (hashtable_node_t) atomic_load_explicit(&(node->next), memory_order_relaxed)) {
+            hashtable_node_slab_t * slab = hashtable_node_slab_find(pool, node);
+            if (++(slab->free_nodes) == slab->n_nodes) n_free++;
+        }
+    }
+
+    // Take the free slabs' nodes out of their magazines, dropping any left
+    // empty. Magazines only ever shrink, so they're rewritten in place
+    if (n_free) {
+        size_t kept = 0;
+        for (i = 0; i < pool->depot_count; i++) {
+            hashtable_node_magazine_t magazine = { .head = NULL, .count = 0 };
+            hashtable_node_t next;
+
+            for (node = pool->depot[i].head; node; node = next) {
+                next = (hashtable_node_t) atomic_load_explicit(&(node->next), memory_order_relaxed);
+                hashtable_node_slab_t * slab = hashtable_node_slab_find(pool, node);
+                if (slab->free_nodes == slab->n_nodes) continue;
+
+                atomic_store_explicit(&(node->next), (uintptr_t) magazine.head, memory_order_relaxed);
+                magazine.head = node;
+                (magazine.count)++;
+            }
+            if (magazine.count) pool->depot[kept++] = magazine;
+        }
+        pool->depot_count = kept;
+
+        // Then free them
+        for (i = 0, j = 0; i < pool->slab_count; i++) {
+            hashtable_node_slab_t * slab = &(pool->slabs[i]);
+            if (slab->free_nodes == slab->n_nodes) {
+                pool->depot_nodes -= slab->n_nodes;
+                pool->bytes -= slab->n_nodes * sizeof(struct hashtable_node_t_);
+                free(slab->base);
+            }
+            else {
+                pool->slabs[j++] = *slab;
+            }
+        }
+        pool->slab_count = j;
+    }
+
+    // Whatever is left has to be matched by as many pushes before the next
+    // look, which keeps the cost per node constant
+    pool->compact_at = 2*pool->depot_nodes;
+    if (pool->compact_at < HASHTABLE_NODE_COMPACT_MIN) pool->compact_at = HASHTABLE_NODE_COMPACT_MIN;
 }
 
-bool hashtable_node_if_sentinel_set_elem(hashtable_node_t node, hashtable_elem_t new_elem)
+static bool hashtable_node_slab_add(hashtable_node_t slab, size_t n_nodes)
 {
-    return hashtable_node_cas_elem(node, (hashtable_elem_t) HASHTABLE_NODE_SENTINEL_ELEM, new_elem);
+    hashtable_node_pool_t * pool = &hashtable_node_pool;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    // Grow if necessary
+    if (pool->slab_count == pool->slab_size) {
+        size_t new_size = pool->slab_size ? pool->slab_size*2 : HASHTABLE_NODE_DEPOT_INIT;
+        hashtable_node_slab_t * new_slabs = (hashtable_node_slab_t *) realloc(pool->slabs, new_size * sizeof(hashtable_node_slab_t));
+        if (!new_slabs) {
+            pthread_mutex_unlock(&(pool->lock));
+            return false;
+        }
+        pool->slabs = new_slabs;
+        pool->slab_size = new_size;
+    }
+
+    pool->slabs[pool->slab_count].base = slab;
+    pool->slabs[pool->slab_count].n_nodes = n_nodes;
+    (pool->slab_count)++;
+    pool->bytes += n_nodes * sizeof(struct hashtable_node_t_);
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return true;
 }
 
-bool hashtable_node_cas_elem(hashtable_node_t node, hashtable_elem_t expected_elem, hashtable_elem_t new_elem)
+static hashtable_node_slab_t * hashtable_node_slab_find(hashtable_node_pool_t * pool, hashtable_node_t node)
 {
-    // CAS the elem field, checking whether it's a sentinel or not
-    if (node)   return atomic_compare_exchange_strong(&(node->elem), (uintptr_t *) &expected_elem, (uintptr_t) new_elem);
-    else        return false;
+    size_t lo = 0;
+    size_t hi = pool->slab_count;
+
+    // The last slab starting at or before the node. Every pooled node came
+    // out of one, so that's the one holding it
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo)/2;
+        if ((uintptr_t) pool->slabs[mid].base <= (uintptr_t) node)  lo = mid;
+        else                                                        hi = mid;
+    }
+
+    return &(pool->slabs[lo]);
 }
 
-bool hashtable_node_cas_next(hashtable_node_t node, hashtable_node_t expected_next, hashtable_node_t new_next)
+static int hashtable_node_slab_compare(const void * a, const void * b)
 {
-    // CAS the next field, checking whether it's still expected_next
-    if (node)   return atomic_compare_exchange_strong(&(node->next), (uintptr_t *) &expected_next, (uintptr_t) new_next);
-    else        return false;
+    uintptr_t a_val = (uintptr_t) ((const hashtable_node_slab_t *) a)->base;
+    uintptr_t b_val = (uintptr_t) ((const hashtable_node_slab_t *) b)->base;
+
+    if (a_val < b_val)      return -1;
+    else if (a_val > b_val) return 1;
+    else                    return 0;
 }
 
 /**
@@ -16,11 +16,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
 
 // Modules
 #include "hashtable.h"
 #include "unit_test.h"
 
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define N_POOL_NODES        (5000)          // Spans several slabs and magazines
+#define N_BLOCK_NODES       (33)            // Odd, so the block's size needs rounding up
+#define N_RELEASE_NODES     (64 * 512)      // Many slabs' worth
+
+#define N_THREADS           (8)
+
 /* --- PRIVATE DATA TYPES --------------------------------------------------- */
 
 typedef struct hashtable_node_test_context_t_ {
@@ -47,9 +56,9 @@ static void test_hashtable_node_standard_post(void * p_context);
 static bool test_hashtable_node_create(void * p_context, char ** err_str);
 
 /**
- * @brief   Tests retrieving a hash
+ * @brief   Tests retrieving a key
  */
-static bool test_hashtable_node_get_hash(void * p_context, char ** err_str);
+static bool test_hashtable_node_get_key(void * p_context, char ** err_str);
 
 /**
  * @brief   Tests setting and retrieving an element
@@ -62,10 +71,15 @@ static bool test_hashtable_node_get_set_elem(void * p_context, char ** err_str);
 static bool test_hashtable_node_get_set_next(void * p_context, char ** err_str);
 
 /**
- * @brief   Tests setting a node as a sentinel
+ * @brief   Tests creating sentinel nodes
  */
 static bool test_hashtable_node_get_set_sentinel(void * p_context, char ** err_str);
 
+/**
+ * @brief   Tests that split-order keys are precomputed, and sort correctly
+ */
+static bool test_hashtable_node_so_key(void * p_context, char ** err_str);
+
 /**
  * @brief   Tests CAS with elem field
  */
@@ -77,14 +91,41 @@ static bool test_hashtable_node_cas_elem(void * p_context, char ** err_str);
 static bool test_hashtable_node_cas_next(void * p_context, char ** err_str);
 
 /**
- * @brief   Tests first CAS function using the sentinel
+ * @brief   Tests that freed nodes are handed back out by the pool
+ */
+static bool test_hashtable_node_pool_reuse(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests that pooled nodes never straddle a cache line
+ */
+static bool test_hashtable_node_pool_layout(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests the pool with many threads allocating and freeing at once
  */
-static bool test_hashtable_node_cas_sentinel_1(void * p_context, char ** err_str);
+static bool test_hashtable_node_pool_threading(void * p_context, char ** err_str);
 
 /**
- * @brief   Tests second CAS function using the sentinel
+ * @brief   Tests allocating nodes in one contiguous block
  */
-static bool test_hashtable_node_cas_sentinel_2(void * p_context, char ** err_str);
+static bool test_hashtable_node_pool_block(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests that slabs are given back once their nodes are all free
+ */
+static bool test_hashtable_node_pool_release(void * p_context, char ** err_str);
+
+/**
+ * @brief   Allocates, checks, and frees many nodes
+ */
+static void * test_hashtable_node_pool_thread_f(void * p_context);
+
+/**
+ * @brief   Allocates many nodes, notes the pool's size, then frees them all and exits
+ *
+ * @param[out] p_peak:  Where to put the pool's size with every node allocated
+ */
+static void * test_hashtable_node_pool_release_thread_f(void * p_peak);
 
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 
@@ -108,9 +149,9 @@ int main(void)
                        test_hashtable_node_create,
                        test_hashtable_node_standard_post);
     unit_test_register(hashtable_node_tests,
-                       "hash retrieval",
+                       "key retrieval",
                        test_hashtable_node_standard_pre,
-                       test_hashtable_node_get_hash,
+                       test_hashtable_node_get_key,
                        test_hashtable_node_standard_post);
     unit_test_register(hashtable_node_tests,
                        "elem storing",
@@ -127,6 +168,11 @@ int main(void)
                        test_hashtable_node_standard_pre,
                        test_hashtable_node_get_set_sentinel,
                        test_hashtable_node_standard_post);
+    unit_test_register(hashtable_node_tests,
+                       "split-order key",
+                       test_hashtable_node_standard_pre,
+                       test_hashtable_node_so_key,
+                       test_hashtable_node_standard_post);
     unit_test_register(hashtable_node_tests,
                        "elem cas",
                        test_hashtable_node_standard_pre,
@@ -138,14 +184,29 @@ int main(void)
                        test_hashtable_node_cas_next,
                        test_hashtable_node_standard_post);
     unit_test_register(hashtable_node_tests,
-                       "sentinel cas 1",
+                       "pool reuse",
+                       test_hashtable_node_standard_pre,
+                       test_hashtable_node_pool_reuse,
+                       test_hashtable_node_standard_post);
+    unit_test_register(hashtable_node_tests,
+                       "pool layout",
+                       test_hashtable_node_standard_pre,
+                       test_hashtable_node_pool_layout,
+                       test_hashtable_node_standard_post);
+    unit_test_register(hashtable_node_tests,
+                       "pool threading",
+                       test_hashtable_node_standard_pre,
+                       test_hashtable_node_pool_threading,
+                       test_hashtable_node_standard_post);
+    unit_test_register(hashtable_node_tests,
+                       "pool blocks",
                        test_hashtable_node_standard_pre,
-                       test_hashtable_node_cas_sentinel_1,
+                       test_hashtable_node_pool_block,
                        test_hashtable_node_standard_post);
     unit_test_register(hashtable_node_tests,
-                       "sentinel cas 2",
+                       "pool release",
                        test_hashtable_node_standard_pre,
-                       test_hashtable_node_cas_sentinel_2,
+                       test_hashtable_node_pool_release,
                        test_hashtable_node_standard_post);
 
     // Run tests
@@ -182,9 +243,9 @@ static bool test_hashtable_node_standard_pre(void ** p_context, char ** err_str)
     *p_context = context;
 
     // allocate nodes
-    context->zero = hashtable_node_create(NULL, 0);
-    context->five = hashtable_node_create(NULL, 5);
-    context->max = hashtable_node_create(NULL, UINT32_MAX);
+    context->zero = hashtable_node_create((void *) 10, NULL, 0);
+    context->five = hashtable_node_create((void *) 15, NULL, 5);
+    context->max = hashtable_node_create((void *) 20, NULL, UINT64_MAX);
     if (!context->zero || !context->five || !context->max) {
         *err_str = "memory allocation failed";
         return false;
@@ -217,25 +278,25 @@ static bool test_hashtable_node_create(void * p_context, char ** err_str)
     return true;
 }
 
-static bool test_hashtable_node_get_hash(void * p_context, char ** err_str)
+static bool test_hashtable_node_get_key(void * p_context, char ** err_str)
 {
     hashtable_node_test_context_t context = (hashtable_node_test_context_t) p_context;
 
-    // Test 0 hash
-    if (hashtable_node_get_hash(context->zero) != 0) {
-        *err_str = "0 hash retrieval failed";
+    // Test 0 key
+    if (hashtable_node_get_key(context->zero) != (void *) 10) {
+        *err_str = "0 key retrieval failed";
         return false;
     }
 
-    // Test 5 hash
-    if (hashtable_node_get_hash(context->five) != 5) {
-        *err_str = "5 hash retrieval failed";
+    // Test 5 key
+    if (hashtable_node_get_key(context->five) != (void *) 15) {
+        *err_str = "5 key retrieval failed";
         return false;
     }
 
-    // Test max hash
-    if (hashtable_node_get_hash(context->max) != UINT32_MAX) {
-        *err_str = "max hash retrieval failed";
+    // Test max key
+    if (hashtable_node_get_key(context->max) != (void *) 20) {
+        *err_str = "max key retrieval failed";
         return false;
     }
 
@@ -366,49 +427,96 @@ static bool test_hashtable_node_get_set_sentinel(void * p_context, char ** err_s
         return false;
     }
 
-    // Set sentinels
-    hashtable_node_set_sentinel(context->zero);
-    hashtable_node_set_sentinel(context->five);
-    hashtable_node_set_sentinel(context->max);
-
-    // Test 0 set sentinel
-    if (!hashtable_node_is_sentinel(context->zero)) {
-        *err_str = "0 set sentinel retrieval failed";
+    // Create a sentinel
+    hashtable_node_t sentinel = hashtable_node_create_sentinel(5);
+    if (!sentinel) {
+        *err_str = "memory allocation failed";
         return false;
     }
 
-    // Test 5 set sentinel
-    if (!hashtable_node_is_sentinel(context->five)) {
-        *err_str = "5 set sentinel retrieval failed";
-        return false;
+    // Test it's a sentinel, with no element
+    bool success = false;
+    if (!hashtable_node_is_sentinel(sentinel)) {
+        *err_str = "sentinel not created";
+    }
+    else if (hashtable_node_get_key(sentinel) != NULL || hashtable_node_get_elem(sentinel) != NULL) {
+        *err_str = "sentinel fields not initialized";
+    }
+
+    // The flag doesn't leak into next, and survives changing it
+    else if (!hashtable_node_cas_next(sentinel, NULL, context->five) ||
+             hashtable_node_get_next(sentinel) != context->five) {
+        *err_str = "sentinel set next retrieval failed";
+    }
+    else if (!hashtable_node_cas_next(sentinel, context->five, context->max) ||
+             hashtable_node_get_next(sentinel) != context->max) {
+        *err_str = "sentinel next cas failed";
+    }
+    else if (!hashtable_node_is_sentinel(sentinel)) {
+        *err_str = "sentinel flag lost";
     }
 
-    // Test max set sentinel
-    if (!hashtable_node_is_sentinel(context->max)) {
-        *err_str = "max set sentinel retrieval failed";
+    // Marking doesn't affect it either
+    else if (!hashtable_node_mark(sentinel) || !hashtable_node_is_marked(sentinel) || !hashtable_node_is_sentinel(sentinel)) {
+        *err_str = "sentinel mark failed";
+    }
+    else if (hashtable_node_get_next(sentinel) != context->max) {
+        *err_str = "marked sentinel next retrieval failed";
+    }
+    else {
+        success = true;
+    }
+
+    hashtable_node_free(sentinel);
+
+    if (success) *err_str = NULL;
+    return success;
+}
+
+static bool test_hashtable_node_so_key(void * p_context, char ** err_str)
+{
+    hashtable_node_test_context_t context = (hashtable_node_test_context_t) p_context;
+
+    // Regular nodes get the reversed hash, with the low bit set
+    if (hashtable_node_get_so_key(context->zero) != UINT64_C(0x000000001)) {
+        *err_str = "0 key incorrect";
+        return false;
+    }
+    if (hashtable_node_get_so_key(context->five) != UINT64_C(0xA000000000000001)) {
+        *err_str = "5 key incorrect";
+        return false;
+    }
+    if (hashtable_node_get_so_key(context->max) != UINT64_MAX) {
+        *err_str = "max key incorrect";
         return false;
     }
 
-    // Set elems. Should clear sentinel
-    hashtable_node_set_elem(context->zero, (void *) 0);
+    // The key doesn't change with the rest of the node
     hashtable_node_set_elem(context->five, (void *) 2);
-    hashtable_node_set_elem(context->max, (void *) UINTPTR_MAX - 1);
-
-    // Test 0 set sentinel
-    if (hashtable_node_is_sentinel(context->zero)) {
-        *err_str = "0 clear sentinel failed";
+    hashtable_node_set_next(context->five, context->max);
+    hashtable_node_mark(context->five);
+    if (hashtable_node_get_so_key(context->five) != hashtable_node_split_order_key(5, false)) {
+        *err_str = "5 key changed";
         return false;
     }
 
-    // Test 5 set sentinel
-    if (hashtable_node_is_sentinel(context->five)) {
-        *err_str = "5 clear sentinel failed";
+    // A sentinel sorts immediately before regular nodes with the same hash
+    hashtable_node_t sentinel = hashtable_node_create_sentinel(5);
+    if (!sentinel) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    uint64_t sentinel_key = hashtable_node_get_so_key(sentinel);
+    hashtable_node_free(sentinel);
+    if (sentinel_key != UINT64_C(0xA000000000000000)) {
+        *err_str = "sentinel key incorrect";
         return false;
     }
 
-    // Test max set sentinel
-    if (hashtable_node_is_sentinel(context->max)) {
-        *err_str = "max clear sentinel failed";
+    // Reversal puts a bucket's children after it
+    if (hashtable_node_split_order_key(1, true) >= hashtable_node_split_order_key(3, false) ||
+        hashtable_node_split_order_key(2, true) >= hashtable_node_split_order_key(3, true)) {
+        *err_str = "keys misordered";
         return false;
     }
 
@@ -623,219 +731,249 @@ static bool test_hashtable_node_cas_next(void * p_context, char ** err_str)
     return true;
 }
 
-static bool test_hashtable_node_cas_sentinel_1(void * p_context, char ** err_str)
+static bool test_hashtable_node_pool_reuse(void * p_context, char ** err_str)
 {
     hashtable_node_test_context_t context = (hashtable_node_test_context_t) p_context;
-
-    // First attempted set. Should fail
-    // first 0 cas
-    if (hashtable_node_if_sentinel_set_elem(context->zero, (void *) 1)) {
-        *err_str = "first 0 cas succeeded when it shouldn't have";
+    hashtable_node_t node;
+
+    // Give one back, and ask for one
+    hashtable_node_free(context->five);
+    context->five = NULL;
+    node = hashtable_node_create((void *) 8, (void *) 7, 7);
+    context->five = node;
+    if (!node) {
+        *err_str = "memory allocation failed";
         return false;
     }
 
-    // first 5 cas
-    if (hashtable_node_if_sentinel_set_elem(context->five, (void *) 2)) {
-        *err_str = "first 5 cas succeeded when it shouldn't have";
+    // A recycled node must look brand new
+    if (hashtable_node_get_key(node) != (void *) 8 ||
+        hashtable_node_get_so_key(node) != hashtable_node_split_order_key(7, false) ||
+        hashtable_node_get_elem(node) != (void *) 7 ||
+        hashtable_node_get_next(node) != NULL ||
+        hashtable_node_is_sentinel(node)) {
+        *err_str = "recycled node not reinitialized";
         return false;
     }
 
-    // first max cas
-    if (hashtable_node_if_sentinel_set_elem(context->max, (void *) UINTPTR_MAX - 1)) {
-        *err_str = "first max cas succeeded when it shouldn't have";
+    // The most recently freed node comes back first
+    hashtable_node_t first = hashtable_node_create(NULL, NULL, 1);
+    hashtable_node_free(first);
+    hashtable_node_t second = hashtable_node_create(NULL, NULL, 2);
+    hashtable_node_free(second);
+    if (first != second) {
+        *err_str = "freed node not reused";
         return false;
     }
 
-    // Make sentinels
-    hashtable_node_set_sentinel(context->zero);
-    hashtable_node_set_sentinel(context->five);
-    hashtable_node_set_sentinel(context->max);
+    // Success
+    *err_str = NULL;
+    return true;
+}
 
-    // Second attempted set. Should succeed
-    // second 0 cas
-    if (!hashtable_node_if_sentinel_set_elem(context->zero, (void *) 1)) {
-        *err_str = "second 0 cas failed";
-        return false;
-    }
+static bool test_hashtable_node_pool_layout(void * p_context, char ** err_str)
+{
+    (void) p_context;
+    uint32_t i;
 
-    // second 5 cas
-    if (!hashtable_node_if_sentinel_set_elem(context->five, (void *) 2)) {
-        *err_str = "second 5 cas failed";
+    hashtable_node_t * nodes = (hashtable_node_t *) malloc(N_POOL_NODES * sizeof(hashtable_node_t));
+    if (!nodes) {
+        *err_str = "test allocation failed";
         return false;
     }
 
-    // second max cas
-    if (!hashtable_node_if_sentinel_set_elem(context->max, (void *) UINTPTR_MAX - 1)) {
-        *err_str = "second max cas failed";
-        return false;
-    }
+    // Pull enough to go through several slabs
+    bool success = true;
+    for (i = 0; i < N_POOL_NODES; i++) {
+        nodes[i] = hashtable_node_create(NULL, NULL, i);
+        if (!nodes[i]) {
+            *err_str = "memory allocation failed";
+            success = false;
+            break;
+        }
 
-    // Check value is as expected
-    // Retrieve 0 set elem
-    if (hashtable_node_is_sentinel(context->zero) ||
-        hashtable_node_get_elem(context->zero) != (void *) 1) {
-        *err_str = "0 set elem retrieval failed";
-        return false;
+        // Nodes are 32 byte aligned, so none crosses a 64 byte line
+        if (((uintptr_t) nodes[i]) % 32 != 0) {
+            *err_str = "node not aligned";
+            success = false;
+            i++;
+            break;
+        }
     }
 
-    // Retrieve 5 set elem
-    if (hashtable_node_is_sentinel(context->zero) ||
-        hashtable_node_get_elem(context->five) != (void *) 2) {
-        *err_str = "5 set elem retrieval failed";
-        return false;
+    // Check nothing was handed out twice
+    uint32_t j;
+    for (j = 1; success && j < i; j++) {
+        if (nodes[j] == nodes[j - 1]) {
+            *err_str = "node handed out twice";
+            success = false;
+        }
     }
 
-    // Retrieve max set elem
-    if (hashtable_node_is_sentinel(context->zero) ||
-        hashtable_node_get_elem(context->max) != (void *) UINTPTR_MAX - 1) {
-        *err_str = "max set elem retrieval failed";
-        return false;
-    }
+    // Give them all back
+    for (j = 0; j < i; j++) hashtable_node_free(nodes[j]);
+    free(nodes);
 
-    // Third attempted set. Should fail
-    // third 0 cas
-    if (hashtable_node_if_sentinel_set_elem(context->zero, (void *) 5)) {
-        *err_str = "third 0 cas succeeded";
-        return false;
-    }
+    if (success) *err_str = NULL;
+    return success;
+}
 
-    // third 5 cas
-    if (hashtable_node_if_sentinel_set_elem(context->five, (void *) 8)) {
-        *err_str = "third 5 cas succeeded";
-        return false;
-    }
+static bool test_hashtable_node_pool_threading(void * p_context, char ** err_str)
+{
+    uint32_t i;
 
-    // third max cas
-    if (hashtable_node_if_sentinel_set_elem(context->max, (void *) UINTPTR_MAX - 2)) {
-        *err_str = "third max cas succeeded";
-        return false;
+    // Start the threads
+    pthread_t threads[N_THREADS];
+    for (i = 0; i < N_THREADS; i++) {
+        pthread_create(&(threads[i]), NULL, test_hashtable_node_pool_thread_f, p_context);
     }
 
-    // Check value is as expected
-    // Retrieve 0 set elem
-    if (hashtable_node_is_sentinel(context->zero) ||
-        hashtable_node_get_elem(context->zero) != (void *) 1) {
-        *err_str = "0 set elem retrieval failed";
-        return false;
-    }
-
-    // Retrieve 5 set elem
-    if (hashtable_node_is_sentinel(context->zero) ||
-        hashtable_node_get_elem(context->five) != (void *) 2) {
-        *err_str = "5 set elem retrieval failed";
-        return false;
+    // Wait on and check the threads
+    bool success = true;
+    for (i = 0; i < N_THREADS; i++) {
+        void * err_val;
+        pthread_join(threads[i], &err_val);
+        if (err_val) success = false;
     }
-
-    // Retrieve max set elem
-    if (hashtable_node_is_sentinel(context->zero) ||
-        hashtable_node_get_elem(context->max) != (void *) UINTPTR_MAX - 1) {
-        *err_str = "max set elem retrieval failed";
+    if (!success) {
+        *err_str = "node corrupted by another thread";
         return false;
     }
 
+    // Success
     *err_str = NULL;
     return true;
 }
 
-static bool test_hashtable_node_cas_sentinel_2(void * p_context, char ** err_str)
+static bool test_hashtable_node_pool_block(void * p_context, char ** err_str)
 {
-    hashtable_node_test_context_t context = (hashtable_node_test_context_t) p_context;
+    (void) p_context;
+    uint32_t i;
 
-    // First attempted set. Should fail
-    // first 0 cas
-    if (hashtable_node_set_sentinel_if_elem(context->zero, (void *) 1)) {
-        *err_str = "first 0 cas succeeded when it shouldn't have";
+    hashtable_node_t block = hashtable_node_create_block(N_BLOCK_NODES);
+    if (!block) {
+        *err_str = "memory allocation failed";
         return false;
     }
 
-    // first 5 cas
-    if (hashtable_node_set_sentinel_if_elem(context->five, (void *) 2)) {
-        *err_str = "first 5 cas succeeded when it shouldn't have";
+    // Contiguous, and aligned like any other node
+    if (((uintptr_t) block) % 32 != 0) {
+        *err_str = "block not aligned";
         return false;
     }
-
-    // first max cas
-    if (hashtable_node_set_sentinel_if_elem(context->max, (void *) UINTPTR_MAX - 1)) {
-        *err_str = "first max cas succeeded when it shouldn't have";
-        return false;
+    for (i = 0; i < N_BLOCK_NODES; i++) {
+        if (i % 2)  hashtable_node_init(block + i, NULL, (void *)(uintptr_t) i, i);
+        else        hashtable_node_init_sentinel(block + i, i);
     }
-
-    // Second attempted set. Should succeed
-    // second 0 cas
-    if (!hashtable_node_set_sentinel_if_elem(context->zero, NULL)) {
-        *err_str = "second 0 cas failed";
-        return false;
+    for (i = 0; i < N_BLOCK_NODES; i++) {
+        if (hashtable_node_is_sentinel(block + i) != !(i % 2) ||
+            hashtable_node_get_so_key(block + i) != hashtable_node_split_order_key(i, !(i % 2))) {
+            *err_str = "block node initialized incorrectly";
+            return false;
+        }
     }
 
-    // second 5 cas
-    if (!hashtable_node_set_sentinel_if_elem(context->five, NULL)) {
-        *err_str = "second 5 cas failed";
+    // Freed one at a time, into the pool
+    for (i = 0; i < N_BLOCK_NODES; i++) hashtable_node_free(block + i);
+    hashtable_node_t node = hashtable_node_create(NULL, NULL, 0);
+    if (node != block + N_BLOCK_NODES - 1) {
+        *err_str = "block node not reused";
         return false;
     }
+    hashtable_node_free(node);
 
-    // second max cas
-    if (!hashtable_node_set_sentinel_if_elem(context->max, NULL)) {
-        *err_str = "second max cas failed";
-        return false;
-    }
+    // Success
+    *err_str = NULL;
+    return true;
+}
 
-    // Check value is as expected
-    // check 0 sentinel
-    if (!hashtable_node_is_sentinel(context->zero)) {
-        *err_str = "0 set sentinel failed";
+static bool test_hashtable_node_pool_release(void * p_context, char ** err_str)
+{
+    (void) p_context;
+    size_t before = hashtable_node_pool_bytes();
+    size_t peak = 0;
+    pthread_t thread;
+    void * err_val;
+
+    // Everything a thread had goes back to the depot when it exits
+    pthread_create(&thread, NULL, test_hashtable_node_pool_release_thread_f, &peak);
+    pthread_join(thread, &err_val);
+    if (err_val) {
+        *err_str = "memory allocation failed";
         return false;
     }
-
-    // check 0 sentinel
-    if (!hashtable_node_is_sentinel(context->five)) {
-        *err_str = "5 set sentinel failed";
+    if (peak < before + N_RELEASE_NODES * sizeof(struct hashtable_node_t_) / 2) {
+        *err_str = "pool didn't grow";
         return false;
     }
 
-    // check 0 sentinel
-    if (!hashtable_node_is_sentinel(context->max)) {
-        *err_str = "max set sentinel failed";
+    // Most of what it grew by is given back. The depot is only searched for
+    // free slabs as it doubles, so some may be left over
+    if (hashtable_node_pool_bytes() > before + (peak - before) / 4) {
+        *err_str = "free slabs not given back";
         return false;
     }
 
-    // Third attempted set. Should fail
-    // third 0 cas
-    if (hashtable_node_set_sentinel_if_elem(context->zero, NULL)) {
-        *err_str = "third 0 cas succeeded";
-        return false;
-    }
+    // Success
+    *err_str = NULL;
+    return true;
+}
 
-    // third 5 cas
-    if (hashtable_node_set_sentinel_if_elem(context->five, NULL)) {
-        *err_str = "third 5 cas succeeded";
-        return false;
-    }
+static void * test_hashtable_node_pool_thread_f(void * p_context)
+{
+    (void) p_context;
+    uint32_t round;
+    uint32_t i;
+
+    hashtable_node_t * nodes = (hashtable_node_t *) malloc(N_POOL_NODES * sizeof(hashtable_node_t));
+    if (!nodes) return (void *) 1;
+
+    for (round = 0; round < 4; round++) {
+        // Allocate, tagging each node with its index
+        for (i = 0; i < N_POOL_NODES; i++) {
+            nodes[i] = hashtable_node_create((hashtable_key_t)(uintptr_t) i, (hashtable_elem_t)(uintptr_t) i, i);
+            if (!nodes[i]) {
+                free(nodes);
+                return (void *) 1;
+            }
+        }
+
+        // If another thread was handed one of ours, the tags won't match
+        for (i = 0; i < N_POOL_NODES; i++) {
+            if (hashtable_node_get_key(nodes[i]) != (hashtable_key_t)(uintptr_t) i ||
+                hashtable_node_get_elem(nodes[i]) != (hashtable_elem_t)(uintptr_t) i) {
+                free(nodes);
+                return (void *) 1;
+            }
+        }
+
+        // Give them back
+        for (i = 0; i < N_POOL_NODES; i++) hashtable_node_free(nodes[i]);
+    }
+
+    free(nodes);
+    return (void *) 0;
+}
 
-    // third max cas
-    if (hashtable_node_set_sentinel_if_elem(context->max, NULL)) {
-        *err_str = "third max cas succeeded";
-        return false;
-    }
+static void * test_hashtable_node_pool_release_thread_f(void * p_peak)
+{
+    uint32_t i;
 
-    // Check value is as expected
-    // check 0 sentinel
-    if (!hashtable_node_is_sentinel(context->zero)) {
-        *err_str = "0 set sentinel failed";
-        return false;
-    }
+    hashtable_node_t * nodes = (hashtable_node_t *) malloc(N_RELEASE_NODES * sizeof(hashtable_node_t));
+    if (!nodes) return (void *) 1;
 
-    // check 0 sentinel
-    if (!hashtable_node_is_sentinel(context->five)) {
-        *err_str = "5 set sentinel failed";
-        return false;
+    for (i = 0; i < N_RELEASE_NODES; i++) {
+        nodes[i] = hashtable_node_create(NULL, NULL, i);
+        if (!nodes[i]) {
+            while (i--) hashtable_node_free(nodes[i]);
+            free(nodes);
+            return (void *) 1;
+        }
     }
+    *((size_t *) p_peak) = hashtable_node_pool_bytes();
 
-    // check 0 sentinel
-    if (!hashtable_node_is_sentinel(context->max)) {
-        *err_str = "max set sentinel failed";
-        return false;
-    }
+    for (i = 0; i < N_RELEASE_NODES; i++) hashtable_node_free(nodes[i]);
 
-    *err_str = NULL;
-    return true;
+    free(nodes);
+    return (void *) 0;
 }
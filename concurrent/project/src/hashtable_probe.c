@@ -0,0 +1,1019 @@
+/**
+ * @file    hashtable_probe.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implements the open-addressing hashtable engine
+ *
+ * Every key lives inline in a power-of-two array of slots, alongside its tag
+ * (its hash with the top bit set) and its element, and is found by linear
+ * probing from the slot its hash picks. Nothing is allocated per element, and
+ * a lookup usually touches one cache line.
+ *
+ * A slot's tag goes from EMPTY to a key's tag exactly once, so a key never
+ * moves within an array. To claim a slot, a writer swaps its tag to BUSY,
+ * fills in the key and element, then publishes the real tag. Readers never
+ * wait on a write in progress: they step past BUSY slots, and take a tombstone
+ * being revived for absent. Writers, and migration, wait them out, since the
+ * key being written might be theirs.
+ *
+ * Removing a key swaps its element for ELEM_REMOVED, leaving a tombstone which
+ * still holds its tag. Without an eq_f the tag identifies the key, so
+ * inserting it again revives the same slot (through ELEM_PENDING while the
+ * key is rewritten). With an eq_f, the removed key may have been freed and
+ * can't be compared, so tombstones are never looked at again; the key goes in
+ * a fresh slot, and the tombstone is dropped at the next migration.
+ *
+ * Resizing, and clearing out tombstones, migrate the whole array into a new
+ * one. The old one's next field is set to ARRAY_SIZING first, which stops any
+ * more slots being claimed, so the new array can be sized for the elements
+ * actually left. The new array is then published there, after which any
+ * thread that runs into the migration helps: it claims chunks of slots,
+ * freezes each one (EMPTY to MOVED, a live element to ELEM_MOVED, a tombstone to
+ * ELEM_FROZEN), and copies the live ones across. Frozen slots can't change, so
+ * an operation which finds one helps finish the migration, then starts over
+ * in the new array. Writers that claimed a slot just as migration started
+ * give it back and do the same, so the new array only has to make room for
+ * a few stragglers. Whoever finishes the last chunk swings the table over to
+ * the new array, and retires the old one through the table's reclamation
+ * scheme. Under hazard pointers, an operation's array is protected in
+ * HAZARD_ARRAY, and the array being migrated to in HAZARD_NEXT.
+ *
+ * A migration starts once more than 1/PROBE_MAX_LOAD_INV of an array's slots
+ * have been claimed (counting tombstones), or once fewer than
+ * 1/PROBE_SHRINK_LOAD_INV hold live elements, and sizes the new array for a
+ * load of 1/PROBE_TARGET_LOAD_INV. Both counts are striped by thread, and only
+ * added up when a stripe crosses a multiple of the check period, as in the
+ * list engine.
+ *
+ * An iterator pins the array current when it starts and walks it slot by
+ * slot. A slot frozen since holds its key and nothing else, so the key's
+ * element is looked up wherever it is now, and every key present for the
+ * whole walk is seen exactly once.
+ *
+ * @addtogroup HASHTABLE
+ * @{
+ * @addtogroup HASHTABLE_ENGINE
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Modules
+#include "hashtable.h"
+#include "hashtable_engine.h"
+#include "hazard_pointer.h"
+#include "thread_index.h"
+
+// Standard
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define PROBE_SIZE_MIN          (64)            /**< The fewest slots an array has. Must be a power of two */
+#define PROBE_MAX_LOAD_INV      (2)             /**< An array is migrated once more than 1/this of its slots are claimed */
+#define PROBE_TARGET_LOAD_INV   (4)             /**< A migration sizes the new array for this many slots per element */
+#define PROBE_SHRINK_LOAD_INV   (16)            /**< An array is migrated to a smaller one once it has this many slots per element */
+#define PROBE_CHUNK             (1024)          /**< Slots claimed at once by a thread helping with a migration */
+#define PROBE_CHECK_PERIOD      (64)            /**< Most claims (or removals) on a stripe between load checks. Must be a power of two */
+
+#define CACHE_LINE              (64)            /**< Counter stripes are aligned to this many bytes */
+#define COUNTER_STRIPES         (16)            /**< The number of stripes per count. Must be a power of two */
+#define SLOT_ALIGN              (32)            /**< Slot stride. Two slots per line, none straddling */
+
+#define TAG_EMPTY               (UINT64_C(0))               /**< Tag of a slot no key has claimed */
+#define TAG_BUSY                (UINT64_C(1))               /**< Tag of a slot being claimed */
+#define TAG_MOVED               (UINT64_C(2))               /**< Tag of an empty slot frozen by migration */
+#define TAG_KEY                 (UINT64_C(1) << 63)         /**< Set in every key's tag, and in no other */
+
+#define ELEM_REMOVED            ((hashtable_elem_t) &probe_removed)     /**< Element of a tombstone */
+#define ELEM_PENDING            ((hashtable_elem_t) &probe_pending)     /**< Element of a tombstone being revived */
+#define ELEM_MOVED              ((hashtable_elem_t) &probe_moved)       /**< Element of a slot whose element has been copied to the next array */
+#define ELEM_FROZEN             ((hashtable_elem_t) &probe_frozen)      /**< Element of a tombstone frozen by migration */
+
+#define ARRAY_SIZING            ((probe_array_t *) &probe_sizing)       /**< Next array of one whose migration is being sized */
+
+#define HAZARD_ARRAY            (0)             /**< Hazard slot protecting the array an operation works in */
+#define HAZARD_NEXT             (1)             /**< Hazard slot protecting the array it's being migrated to */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   One stripe of a count, alone on its cache line
+ */
+typedef struct probe_counter_t_ {
+    _Alignas(CACHE_LINE)
+    atomic_int_fast64_t         count;                      /**< This stripe's share of the count */
+} probe_counter_t;
+
+/**
+ * @brief   A key, and the element stored under it
+ */
+typedef struct probe_slot_t_ {
+    _Alignas(SLOT_ALIGN)
+    atomic_uint_fast64_t        tag;                        /**< The key's hash with TAG_KEY set, or one of the other TAG_ values */
+    _Atomic(hashtable_key_t)    key;                        /**< The key */
+    _Atomic(hashtable_elem_t)   elem;                       /**< The element, or one of the ELEM_ values */
+} probe_slot_t;
+
+/**
+ * @brief   An array of slots, and the state of its migration
+ */
+typedef struct probe_array_t_ {
+    probe_counter_t             claimed[COUNTER_STRIPES];   /**< Slots claimed by a key, tombstones included, striped by thread */
+    size_t                      size;                       /**< The number of slots. A power of two */
+    _Atomic(struct probe_array_t_ *) next;                  /**< The array being migrated to, once migration has started */
+    atomic_size_t               next_chunk;                 /**< The next chunk of slots to be migrated */
+    atomic_size_t               chunks_done;                /**< The number of chunks migrated */
+    struct probe_array_t_ *     retired;                    /**< The next array kept until the table is freed, under HASHTABLE_RECLAIM_NONE */
+    probe_slot_t                slots[];                    /**< The slots */
+} probe_array_t;
+
+/**
+ * @brief   The table
+ */
+typedef struct probe_table_t_ {
+    probe_counter_t             live[COUNTER_STRIPES];      /**< The number of elements, striped by thread */
+    _Atomic(probe_array_t *)    array;                      /**< The current array */
+    _Atomic(probe_array_t *)    retired;                    /**< Arrays migrated away from, under HASHTABLE_RECLAIM_NONE */
+    size_t                      min_size;                   /**< Arrays never have fewer slots than this */
+    eq_f_t                      eq_f;                       /**< The function used to compare keys with the same tag, or NULL */
+    hashtable_reclaim_t         reclaim;                    /**< How old arrays are reclaimed */
+} probe_table_t;
+
+/**
+ * @brief   A position in a walk over a table
+ */
+typedef struct probe_iter_t_ {
+    probe_table_t *             t;                          /**< The table being walked */
+    probe_array_t *             a;                          /**< The array being walked, protected in HASHTABLE_ENGINE_HAZARD_ITER */
+    size_t                      i;                          /**< The next slot to look at */
+} probe_iter_t;
+
+/**
+ * @brief   Outcomes of looking for a key in an array
+ */
+typedef enum {
+    PROBE_FOUND,        /**< The key's slot was found */
+    PROBE_ABSENT,       /**< The key isn't in the array. If a slot was asked for, it has been claimed */
+    PROBE_MOVED,        /**< The array is being migrated. Help, then try again in the next one */
+    PROBE_FULL,         /**< Every slot on the way has been claimed */
+} probe_result_t;
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static char probe_removed;      /**< Only its address is used, as ELEM_REMOVED */
+static char probe_pending;      /**< Only its address is used, as ELEM_PENDING */
+static char probe_moved;        /**< Only its address is used, as ELEM_MOVED */
+static char probe_frozen;       /**< Only its address is used, as ELEM_FROZEN */
+static char probe_sizing;       /**< Only its address is used, as ARRAY_SIZING */
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @see hashtable_engine_ops_t
+ */
+static void * probe_create(const hashtable_config_t * config);
+static void probe_free(void * table, free_f_t free_f);
+static hashtable_elem_t probe_get(void * table, hashtable_key_t key, uint64_t hash);
+static bool probe_insert(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present);
+static hashtable_elem_t probe_put(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem);
+static bool probe_replace_if(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem);
+static hashtable_elem_t probe_remove(void * table, hashtable_key_t key, uint64_t hash);
+static size_t probe_size(void * table);
+static void * probe_iter_create(void * table);
+static bool probe_iter_next(void * p_it, hashtable_key_t * key, hashtable_elem_t * elem);
+static void probe_iter_free(void * p_it);
+static void * probe_scan_begin(void * table);
+static size_t probe_scan_range(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg);
+
+/**
+ * @brief   Looks for a key's slot in an array
+ *
+ * Slots being claimed are stepped past, unless claim is set, in which case
+ * they're waited on
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array to search. Must be protected
+ * @param[in] key:          The key to look for
+ * @param[in] tag:          The key's tag
+ * @param[in] claim:        Whether to claim the first empty slot, if the key is absent
+ * @param[out] slot:        Gets the key's slot, or the claimed one
+ *
+ * @return      The outcome. The key's slot may hold a tombstone, but only if the table has no eq_f
+ */
+static probe_result_t probe_find(probe_table_t * t, probe_array_t * a, hashtable_key_t key, uint64_t tag, bool claim, probe_slot_t ** slot);
+
+/**
+ * @brief   Fills in a slot claimed by probe_find, and publishes it
+ *
+ * If the array has started migrating, the slot is given back instead
+ *
+ * @return      true if published, false if the slot was given back
+ */
+static bool probe_publish(probe_array_t * a, probe_slot_t * slot, hashtable_key_t key, uint64_t tag, hashtable_elem_t elem);
+
+/**
+ * @brief   Stores an element in a key's slot, reviving it if it's a tombstone
+ *
+ * @param[in] a:            The slot's array
+ * @param[in] slot:         The key's slot, as found by probe_find
+ * @param[in] key:          The key
+ * @param[in] elem:         The element to store
+ * @param[in] replace:      Whether to replace a live element
+ * @param[out] old:         Gets the live element found, if any
+ *
+ * @return      PROBE_FOUND if the key was live (and its element replaced, if asked),
+ *              PROBE_ABSENT if it was a tombstone and elem was stored, or PROBE_MOVED
+ */
+static probe_result_t probe_store(probe_array_t * a, probe_slot_t * slot, hashtable_key_t key, hashtable_elem_t elem, bool replace, hashtable_elem_t * old);
+
+/**
+ * @brief   Reports a slot visited by a walk, if it holds a live element
+ *
+ * @param[in] t:            The table
+ * @param[in] slot:         The slot
+ * @param[out] key:         Gets the key
+ * @param[out] elem:        Gets the element
+ *
+ * @return      true if the slot's key was live
+ */
+static bool probe_visit(probe_table_t * t, probe_slot_t * slot, hashtable_key_t * key, hashtable_elem_t * elem);
+
+/**
+ * @brief   Counts an insertion, migrating the array if it has gotten too full
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array inserted into. Must be protected
+ * @param[in] claimed:      Whether a new slot was claimed, rather than a tombstone revived
+ */
+static void probe_count_insert(probe_table_t * t, probe_array_t * a, bool claimed);
+
+/**
+ * @brief   Counts a removal, migrating to a smaller array if it's too empty
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array removed from. Must be protected
+ */
+static void probe_count_remove(probe_table_t * t, probe_array_t * a);
+
+/**
+ * @brief   Adds to the calling thread's stripe of a count
+ *
+ * @param[in,out] counters: The count's stripes
+ * @param[in] delta:        The amount to add
+ * @param[in] period:       The check period. A power of two
+ *
+ * @return      true if the stripe crossed a multiple of period
+ */
+static inline bool probe_count(probe_counter_t * counters, int_fast64_t delta, int_fast64_t period);
+
+/**
+ * @brief   Adds up a count's stripes
+ *
+ * @return      The count, or 0 if it's negative
+ */
+static size_t probe_sum(probe_counter_t * counters);
+
+/**
+ * @brief   Gets the check period for an array
+ *
+ * Small arrays are checked more often, so they can't fill up between checks
+ *
+ * @return      The most claims or removals on a stripe between checks
+ */
+static inline int_fast64_t probe_check_period(probe_array_t * a);
+
+/**
+ * @brief   Starts migrating an array, unless it already has been, and helps finish
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The current array. Must be protected
+ * @param[in] at_least:     The fewest slots the new array can have
+ *
+ * @return      false if memory allocation failed
+ */
+static bool probe_migrate(probe_table_t * t, probe_array_t * a, size_t at_least);
+
+/**
+ * @brief   Helps migrate an array, if migration has started, and waits for it to finish
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array being migrated. Must be protected
+ */
+static void probe_help(probe_table_t * t, probe_array_t * a);
+
+/**
+ * @brief   Freezes a chunk of slots, and copies their live elements to the next array
+ *
+ * @param[in] a:            The array being migrated
+ * @param[in] b:            The array being migrated to
+ * @param[in] chunk:        The chunk
+ */
+static void probe_migrate_chunk(probe_array_t * a, probe_array_t * b, size_t chunk);
+
+/**
+ * @brief   Finds the size of array to migrate to
+ *
+ * @param[in] t:            The table
+ * @param[in] at_least:     The fewest slots it can have
+ *
+ * @return      The number of slots
+ */
+static size_t probe_target_size(probe_table_t * t, size_t at_least);
+
+/**
+ * @brief   Allocates an array of empty slots
+ *
+ * @param[in] size:         The number of slots. A power of two
+ *
+ * @return      The array, or NULL if memory allocation failed
+ */
+static probe_array_t * probe_array_create(size_t size);
+
+/**
+ * @brief   Gets the table's current array, protected
+ *
+ * @param[in] t:            The table
+ * @param[in] hazard:       The hazard slot to protect it in, under hazard pointers
+ *
+ * @return      The current array
+ */
+static inline probe_array_t * probe_array_load(probe_table_t * t, uint32_t hazard);
+
+/**
+ * @brief   Hands an array migrated away from over to be freed
+ *
+ * @param[in] t:            The table
+ * @param[in] a:            The array, which nobody can newly reach
+ */
+static void probe_array_retire(probe_table_t * t, probe_array_t * a);
+
+/**
+ * @brief   Checks whether an element is a real one, rather than one of the ELEM_ values
+ */
+static inline bool probe_is_live(hashtable_elem_t elem);
+
+/**
+ * @brief   Gives way to the thread a slot is waiting on
+ */
+static inline void probe_pause(void);
+
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+const hashtable_engine_ops_t hashtable_probe_ops = {
+    .create         = probe_create,
+    .free           = probe_free,
+    .get            = probe_get,
+    .insert         = probe_insert,
+    .put            = probe_put,
+    .replace_if     = probe_replace_if,
+    .remove         = probe_remove,
+    .size           = probe_size,
+    .iter_create    = probe_iter_create,
+    .iter_next      = probe_iter_next,
+    .iter_free      = probe_iter_free,
+    .scan_begin     = probe_scan_begin,
+    .scan_range     = probe_scan_range,
+};
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static void * probe_create(const hashtable_config_t * config)
+{
+    uint32_t i;
+
+    // Big enough for the capacity asked for without migrating
+    size_t min_size = PROBE_SIZE_MIN;
+    while (min_size / PROBE_MAX_LOAD_INV < config->capacity) {
+        if (min_size > SIZE_MAX / 2) return NULL;
+        min_size <<= 1;
+    }
+
+    probe_table_t * t = (probe_table_t *) aligned_alloc(CACHE_LINE, sizeof(probe_table_t));
+    if (!t) return NULL;
+
+    probe_array_t * a = probe_array_create(min_size);
+    if (!a) {
+        free(t);
+        return NULL;
+    }
+
+    for (i = 0; i < COUNTER_STRIPES; i++) atomic_init(&(t->live[i].count), 0);
+    atomic_init(&(t->array), a);
+    atomic_init(&(t->retired), NULL);
+    t->min_size = min_size;
+    t->eq_f = config->eq_f;
+    t->reclaim = config->reclaim;
+
+    return t;
+}
+
+static void probe_free(void * table, free_f_t free_f)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    probe_array_t * a = atomic_load(&(t->array));
+    size_t i;
+
+    // Free the elements still in the current array
+    for (i = 0; free_f && i < a->size; i++) {
+        hashtable_elem_t elem = atomic_load(&(a->slots[i].elem));
+        if ((atomic_load(&(a->slots[i].tag)) & TAG_KEY) && probe_is_live(elem)) free_f(elem);
+    }
+    free(a);
+
+    // Along with any arrays kept around
+    a = atomic_load(&(t->retired));
+    while (a) {
+        probe_array_t * next = a->retired;
+        free(a);
+        a = next;
+    }
+
+    free(t);
+}
+
+static hashtable_elem_t probe_get(void * table, hashtable_key_t key, uint64_t hash)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    probe_slot_t * slot;
+
+    while (true) {
+        probe_array_t * a = probe_array_load(t, HAZARD_ARRAY);
+
+        switch (probe_find(t, a, key, tag, false, &slot)) {
+        case PROBE_FOUND: {
+            hashtable_elem_t elem = atomic_load_explicit(&(slot->elem), memory_order_acquire);
+            if (elem != ELEM_MOVED && elem != ELEM_FROZEN) return probe_is_live(elem) ? elem : NULL;
+            break;
+        }
+        case PROBE_ABSENT:
+            return NULL;
+        case PROBE_FULL:
+            if (!atomic_load(&(a->next))) return NULL;
+            break;
+        case PROBE_MOVED:
+            break;
+        }
+
+        probe_help(t, a);
+    }
+}
+
+static bool probe_insert(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem, hashtable_elem_t * present)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    hashtable_elem_t dummy;
+    probe_slot_t * slot;
+
+    if (!present) present = &dummy;
+
+    while (true) {
+        probe_array_t * a = probe_array_load(t, HAZARD_ARRAY);
+
+        switch (probe_find(t, a, key, tag, true, &slot)) {
+        case PROBE_ABSENT:
+            if (probe_publish(a, slot, key, tag, elem)) {
+                probe_count_insert(t, a, true);
+                *present = elem;
+                return true;
+            }
+            break;
+        case PROBE_FOUND:
+            switch (probe_store(a, slot, key, elem, false, present)) {
+            case PROBE_FOUND:   return false;
+            case PROBE_ABSENT:  probe_count_insert(t, a, false); *present = elem; return true;
+            default:            break;
+            }
+            break;
+        case PROBE_FULL:
+            if (!probe_migrate(t, a, a->size)) {
+                *present = NULL;
+                return false;
+            }
+            continue;
+        case PROBE_MOVED:
+            break;
+        }
+
+        probe_help(t, a);
+    }
+}
+
+static hashtable_elem_t probe_put(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t elem)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    hashtable_elem_t old;
+    probe_slot_t * slot;
+
+    while (true) {
+        probe_array_t * a = probe_array_load(t, HAZARD_ARRAY);
+
+        switch (probe_find(t, a, key, tag, true, &slot)) {
+        case PROBE_ABSENT:
+            if (probe_publish(a, slot, key, tag, elem)) {
+                probe_count_insert(t, a, true);
+                return NULL;
+            }
+            break;
+        case PROBE_FOUND:
+            switch (probe_store(a, slot, key, elem, true, &old)) {
+            case PROBE_FOUND:   return old;
+            case PROBE_ABSENT:  probe_count_insert(t, a, false); return NULL;
+            default:            break;
+            }
+            break;
+        case PROBE_FULL:
+            if (!probe_migrate(t, a, a->size)) return NULL;
+            continue;
+        case PROBE_MOVED:
+            break;
+        }
+
+        probe_help(t, a);
+    }
+}
+
+static bool probe_replace_if(void * table, hashtable_key_t key, uint64_t hash, hashtable_elem_t expected, hashtable_elem_t new_elem)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    probe_slot_t * slot;
+
+    while (true) {
+        probe_array_t * a = probe_array_load(t, HAZARD_ARRAY);
+
+        switch (probe_find(t, a, key, tag, false, &slot)) {
+        case PROBE_FOUND: {
+            hashtable_elem_t elem = atomic_load(&(slot->elem));
+            while (elem == expected && probe_is_live(elem)) {
+                if (atomic_compare_exchange_weak(&(slot->elem), &elem, new_elem)) return true;
+            }
+            if (elem != ELEM_MOVED && elem != ELEM_FROZEN) return false;
+            break;
+        }
+        case PROBE_ABSENT:
+            return false;
+        case PROBE_FULL:
+            if (!atomic_load(&(a->next))) return false;
+            break;
+        case PROBE_MOVED:
+            break;
+        }
+
+        probe_help(t, a);
+    }
+}
+
+static hashtable_elem_t probe_remove(void * table, hashtable_key_t key, uint64_t hash)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    uint64_t tag = hash | TAG_KEY;
+    probe_slot_t * slot;
+
+    while (true) {
+        probe_array_t * a = probe_array_load(t, HAZARD_ARRAY);
+
+        switch (probe_find(t, a, key, tag, false, &slot)) {
+        case PROBE_FOUND: {
+            // A tombstone being revived isn't back yet, so the key is absent
+            hashtable_elem_t elem = atomic_load(&(slot->elem));
+            while (probe_is_live(elem)) {
+                if (atomic_compare_exchange_weak(&(slot->elem), &elem, ELEM_REMOVED)) {
+                    probe_count_remove(t, a);
+                    return elem;
+                }
+            }
+            if (elem != ELEM_MOVED && elem != ELEM_FROZEN) return NULL;
+            break;
+        }
+        case PROBE_ABSENT:
+            return NULL;
+        case PROBE_FULL:
+            if (!atomic_load(&(a->next))) return NULL;
+            break;
+        case PROBE_MOVED:
+            break;
+        }
+
+        probe_help(t, a);
+    }
+}
+
+static size_t probe_size(void * table)
+{
+    return probe_sum(((probe_table_t *) table)->live);
+}
+
+static void * probe_iter_create(void * table)
+{
+    probe_table_t * t = (probe_table_t *) table;
+
+    probe_iter_t * it = (probe_iter_t *) malloc(sizeof(probe_iter_t));
+    if (!it) return NULL;
+
+    it->t = t;
+    it->a = probe_array_load(t, HASHTABLE_ENGINE_HAZARD_ITER);
+    it->i = 0;
+
+    return it;
+}
+
+static bool probe_iter_next(void * p_it, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    probe_iter_t * it = (probe_iter_t *) p_it;
+
+    while (it->i < it->a->size) {
+        if (probe_visit(it->t, &(it->a->slots[it->i++]), key, elem)) return true;
+    }
+
+    return false;
+}
+
+static void probe_iter_free(void * p_it)
+{
+    free(p_it);
+}
+
+static void * probe_scan_begin(void * table)
+{
+    return probe_array_load((probe_table_t *) table, HASHTABLE_ENGINE_HAZARD_ITER);
+}
+
+static size_t probe_scan_range(void * table, void * snapshot, uint32_t range, uint32_t n_ranges, for_each_f_t fn, void * arg)
+{
+    probe_table_t * t = (probe_table_t *) table;
+    probe_array_t * a = (probe_array_t *) snapshot;
+    hashtable_key_t key;
+    hashtable_elem_t elem;
+    size_t visited = 0;
+    size_t i;
+
+    size_t first = (size_t) (((uint64_t) a->size * range) / n_ranges);
+    size_t last = (size_t) (((uint64_t) a->size * (range + 1)) / n_ranges);
+
+    for (i = first; i < last; i++) {
+        if (probe_visit(t, &(a->slots[i]), &key, &elem)) {
+            fn(key, elem, arg);
+            visited++;
+        }
+    }
+
+    return visited;
+}
+
+static probe_result_t probe_find(probe_table_t * t, probe_array_t * a, hashtable_key_t key, uint64_t tag, bool claim, probe_slot_t ** slot)
+{
+    size_t mask = a->size - 1;
+    size_t i = (size_t) tag & mask;
+    size_t n = 0;
+
+    while (n < a->size) {
+        probe_slot_t * s = &(a->slots[i]);
+        uint64_t s_tag = atomic_load_explicit(&(s->tag), memory_order_acquire);
+
+        if (s_tag == TAG_EMPTY) {
+            if (!claim) return PROBE_ABSENT;
+
+            // Lost the race for it. Look again, in case it was our key
+            if (!atomic_compare_exchange_strong(&(s->tag), &s_tag, TAG_BUSY)) continue;
+
+            *slot = s;
+            return PROBE_ABSENT;
+        }
+
+        if (s_tag == TAG_BUSY && claim) {
+            probe_pause();
+            continue;
+        }
+
+        if (s_tag == TAG_MOVED) return PROBE_MOVED;
+
+        // Another key, or (with an eq_f) the tag's only half the story
+        if (s_tag == tag) {
+            if (!t->eq_f) {
+                *slot = s;
+                return PROBE_FOUND;
+            }
+
+            // Only compare against live keys, since removed ones may have been freed
+            hashtable_elem_t elem = atomic_load_explicit(&(s->elem), memory_order_acquire);
+            if (elem == ELEM_MOVED || elem == ELEM_FROZEN) return PROBE_MOVED;
+            if (probe_is_live(elem) && t->eq_f(atomic_load_explicit(&(s->key), memory_order_relaxed), key)) {
+                *slot = s;
+                return PROBE_FOUND;
+            }
+        }
+
+        i = (i + 1) & mask;
+        n++;
+    }
+
+    // Every slot is taken, which migration should have prevented, unless it's underway
+    return atomic_load(&(a->next)) ? PROBE_MOVED : PROBE_FULL;
+}
+
+static bool probe_publish(probe_array_t * a, probe_slot_t * slot, hashtable_key_t key, uint64_t tag, hashtable_elem_t elem)
+{
+    // Both this and starting a migration are sequentially consistent, so
+    // either we see it's started, or the migration sees our claim and waits
+    if (atomic_load(&(a->next))) {
+        atomic_store(&(slot->tag), TAG_EMPTY);
+        return false;
+    }
+
+    atomic_store_explicit(&(slot->key), key, memory_order_relaxed);
+    atomic_store_explicit(&(slot->elem), elem, memory_order_relaxed);
+    atomic_store_explicit(&(slot->tag), tag, memory_order_release);
+
+    return true;
+}
+
+static probe_result_t probe_store(probe_array_t * a, probe_slot_t * slot, hashtable_key_t key, hashtable_elem_t elem, bool replace, hashtable_elem_t * old)
+{
+    hashtable_elem_t curr = atomic_load_explicit(&(slot->elem), memory_order_acquire);
+
+    while (true) {
+        if (curr == ELEM_MOVED || curr == ELEM_FROZEN) return PROBE_MOVED;
+
+        // Someone else is reviving it. Wait to see what they put there
+        if (curr == ELEM_PENDING) {
+            probe_pause();
+            curr = atomic_load_explicit(&(slot->elem), memory_order_acquire);
+            continue;
+        }
+
+        // Live: maybe swap the element in place
+        if (curr != ELEM_REMOVED) {
+            *old = curr;
+            if (!replace || atomic_compare_exchange_weak(&(slot->elem), &curr, elem)) return PROBE_FOUND;
+            continue;
+        }
+
+        // A tombstone. Revive it, unless migration got to the array first. The
+        // key isn't compared, so it's a different pointer to an equal key, at most
+        if (atomic_compare_exchange_weak(&(slot->elem), &curr, ELEM_PENDING)) {
+            if (atomic_load(&(a->next))) {
+                atomic_store(&(slot->elem), ELEM_REMOVED);
+                return PROBE_MOVED;
+            }
+
+            atomic_store_explicit(&(slot->key), key, memory_order_relaxed);
+            atomic_store_explicit(&(slot->elem), elem, memory_order_release);
+            return PROBE_ABSENT;
+        }
+    }
+}
+
+static bool probe_visit(probe_table_t * t, probe_slot_t * slot, hashtable_key_t * key, hashtable_elem_t * elem)
+{
+    uint64_t tag = atomic_load_explicit(&(slot->tag), memory_order_acquire);
+    if (!(tag & TAG_KEY)) return false;
+
+    hashtable_elem_t curr = atomic_load_explicit(&(slot->elem), memory_order_acquire);
+    *key = atomic_load_explicit(&(slot->key), memory_order_relaxed);
+
+    // Copied since the walk started. The key is in this slot and no other, so
+    // seeing it wherever it is now can't see it twice
+    if (curr == ELEM_MOVED) curr = probe_get(t, *key, tag);
+
+    if (!curr || !probe_is_live(curr)) return false;
+
+    *elem = curr;
+    return true;
+}
+
+static void probe_count_insert(probe_table_t * t, probe_array_t * a, bool claimed)
+{
+    atomic_fetch_add_explicit(&(t->live[thread_index_stripe(COUNTER_STRIPES)].count), 1, memory_order_relaxed);
+
+    // Only claims fill the array up
+    if (claimed && probe_count(a->claimed, 1, probe_check_period(a))) {
+        if (probe_sum(a->claimed) * PROBE_MAX_LOAD_INV > a->size) probe_migrate(t, a, 0);
+    }
+}
+
+static void probe_count_remove(probe_table_t * t, probe_array_t * a)
+{
+    if (probe_count(t->live, -1, probe_check_period(a))) {
+        if (a->size > t->min_size && probe_sum(t->live) * PROBE_SHRINK_LOAD_INV < a->size) probe_migrate(t, a, 0);
+    }
+}
+
+static inline bool probe_count(probe_counter_t * counters, int_fast64_t delta, int_fast64_t period)
+{
+    atomic_int_fast64_t * count = &(counters[thread_index_stripe(COUNTER_STRIPES)].count);
+    int_fast64_t old = atomic_fetch_add_explicit(count, delta, memory_order_relaxed);
+
+    return (old & ~(period - 1)) != ((old + delta) & ~(period - 1));
+}
+
+static size_t probe_sum(probe_counter_t * counters)
+{
+    int_fast64_t total = 0;
+    uint32_t i;
+
+    for (i = 0; i < COUNTER_STRIPES; i++) total += atomic_load_explicit(&(counters[i].count), memory_order_relaxed);
+
+    return total > 0 ? (size_t) total : 0;
+}
+
+static inline int_fast64_t probe_check_period(probe_array_t * a)
+{
+    // Every stripe can be a period short of a check, and between them they
+    // mustn't hide more than a quarter of the array
+    size_t period = a->size / (4 * COUNTER_STRIPES);
+
+    if (period < 1)                     return 1;
+    if (period > PROBE_CHECK_PERIOD)    return PROBE_CHECK_PERIOD;
+    return (int_fast64_t) period;
+}
+
+static bool probe_migrate(probe_table_t * t, probe_array_t * a, size_t at_least)
+{
+    probe_array_t * expected = NULL;
+
+    // Whoever stops the claims first sizes the new array. Once they're
+    // stopped, the number of elements can only grow by what's being revived
+    // or counted right now, one per thread at most
+    if (atomic_compare_exchange_strong(&(a->next), &expected, ARRAY_SIZING)) {
+        probe_array_t * b = probe_array_create(probe_target_size(t, at_least));
+        atomic_store(&(a->next), b);
+        if (!b) return false;
+    }
+
+    probe_help(t, a);
+    return true;
+}
+
+static void probe_help(probe_table_t * t, probe_array_t * a)
+{
+    size_t n_chunks = (a->size + PROBE_CHUNK - 1) / PROBE_CHUNK;
+    size_t chunk;
+
+    probe_array_t * b;
+
+    // Wait for the new array, which doesn't come if it couldn't be allocated
+    while ((b = atomic_load(&(a->next))) == ARRAY_SIZING) probe_pause();
+    if (!b) return;
+
+    // b can't have been retired while a is still current, since it only gets
+    // retired once it has been migrated away from in turn
+    if (t->reclaim == HASHTABLE_RECLAIM_HAZARD) hazard_pointer_set(HAZARD_NEXT, b);
+    if (atomic_load(&(t->array)) != a) return;
+
+    // Take chunks until they're all spoken for. Whoever finishes the last one
+    // moves the table over
+    while ((chunk = atomic_fetch_add(&(a->next_chunk), 1)) < n_chunks) {
+        probe_migrate_chunk(a, b, chunk);
+
+        if (atomic_fetch_add(&(a->chunks_done), 1) + 1 == n_chunks) {
+            probe_array_t * expected = a;
+            if (atomic_compare_exchange_strong(&(t->array), &expected, b)) probe_array_retire(t, a);
+        }
+    }
+
+    // Then wait for the stragglers
+    while (atomic_load(&(t->array)) == a) probe_pause();
+}
+
+static void probe_migrate_chunk(probe_array_t * a, probe_array_t * b, size_t chunk)
+{
+    size_t first = chunk * PROBE_CHUNK;
+    size_t last = (first + PROBE_CHUNK < a->size) ? first + PROBE_CHUNK : a->size;
+    size_t mask = b->size - 1;
+    int_fast64_t copied = 0;
+    size_t i;
+
+    for (i = first; i < last; i++) {
+        probe_slot_t * s = &(a->slots[i]);
+
+        while (true) {
+            uint64_t tag = atomic_load(&(s->tag));
+
+            // Empty slots are frozen outright. Claims in progress are waited out
+            if (tag == TAG_EMPTY) {
+                if (atomic_compare_exchange_strong(&(s->tag), &tag, TAG_MOVED)) break;
+                continue;
+            }
+            if (tag == TAG_BUSY) {
+                probe_pause();
+                continue;
+            }
+
+            hashtable_elem_t elem = atomic_load(&(s->elem));
+            if (elem == ELEM_PENDING) {
+                probe_pause();
+                continue;
+            }
+
+            // Freeze the element, then copy it if it's live. Nobody else
+            // touches the new array until migration is done, so no key there
+            // can be a duplicate
+            hashtable_elem_t frozen = (elem == ELEM_REMOVED) ? ELEM_FROZEN : ELEM_MOVED;
+            if (!atomic_compare_exchange_strong(&(s->elem), &elem, frozen)) continue;
+            if (frozen == ELEM_FROZEN) break;
+
+            size_t j = (size_t) tag & mask;
+            size_t n;
+            for (n = 0; n < b->size; n++, j = (j + 1) & mask) {
+                probe_slot_t * d = &(b->slots[j]);
+                uint64_t empty = TAG_EMPTY;
+                if (atomic_compare_exchange_strong(&(d->tag), &empty, tag)) {
+                    atomic_store_explicit(&(d->key), atomic_load(&(s->key)), memory_order_relaxed);
+                    atomic_store_explicit(&(d->elem), elem, memory_order_relaxed);
+                    copied++;
+                    break;
+                }
+            }
+            assert(n < b->size);
+            break;
+        }
+    }
+
+    // Published to the other threads along with chunks_done
+    if (copied) atomic_fetch_add_explicit(&(b->claimed[thread_index_stripe(COUNTER_STRIPES)].count), copied, memory_order_relaxed);
+}
+
+static size_t probe_target_size(probe_table_t * t, size_t at_least)
+{
+    size_t live = probe_sum(t->live);
+    size_t size = t->min_size;
+
+    while ((size / PROBE_TARGET_LOAD_INV < live || size < at_least) && size <= SIZE_MAX / 2) size <<= 1;
+
+    return size;
+}
+
+static probe_array_t * probe_array_create(size_t size)
+{
+    uint32_t i;
+
+    // Rounded up to a whole number of cache lines, as aligned_alloc wants
+    size_t bytes = sizeof(probe_array_t) + size * sizeof(probe_slot_t);
+    bytes = (bytes + CACHE_LINE - 1) & ~((size_t) CACHE_LINE - 1);
+
+    probe_array_t * a = (probe_array_t *) aligned_alloc(CACHE_LINE, bytes);
+    if (!a) return NULL;
+
+    // Zeroed slots are empty
+    memset(a->slots, 0, size * sizeof(probe_slot_t));
+    for (i = 0; i < COUNTER_STRIPES; i++) atomic_init(&(a->claimed[i].count), 0);
+    a->size = size;
+    atomic_init(&(a->next), NULL);
+    atomic_init(&(a->next_chunk), 0);
+    atomic_init(&(a->chunks_done), 0);
+    a->retired = NULL;
+
+    return a;
+}
+
+static inline probe_array_t * probe_array_load(probe_table_t * t, uint32_t hazard)
+{
+    probe_array_t * a = atomic_load_explicit(&(t->array), memory_order_acquire);
+
+    // Protect it, then make sure it's still current, so it hasn't been retired
+    if (t->reclaim == HASHTABLE_RECLAIM_HAZARD) {
+        probe_array_t * check;
+        do {
+            check = a;
+            hazard_pointer_set(hazard, a);
+            a = atomic_load(&(t->array));
+        } while (a != check);
+    }
+
+    return a;
+}
+
+static void probe_array_retire(probe_table_t * t, probe_array_t * a)
+{
+    if (t->reclaim != HASHTABLE_RECLAIM_NONE) {
+        hashtable_engine_retire(t->reclaim, a, free);
+        return;
+    }
+
+    // Kept until the table is freed
+    a->retired = atomic_load(&(t->retired));
+    while (!atomic_compare_exchange_weak(&(t->retired), &(a->retired), a));
+}
+
+static inline bool probe_is_live(hashtable_elem_t elem)
+{
+    return elem != ELEM_REMOVED && elem != ELEM_PENDING && elem != ELEM_MOVED && elem != ELEM_FROZEN;
+}
+
+static inline void probe_pause(void)
+{
+    sched_yield();
+}
+
+/** @} addtogroup HASHTABLE_ENGINE */
+/** @} addtogroup HASHTABLE */
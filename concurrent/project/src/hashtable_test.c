@@ -18,10 +18,14 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 // Modules
 #include "unit_test.h"
+#include "hazard_pointer.h"
+#include "hashtable_node.h"
+#include "epoch.h"
 
 /* --- PRIVATE MACROS ------------------------------------------------------- */
 
@@ -31,6 +35,24 @@
 
 #define N_THREADS           (200)             
 
+#define N_CHURN_ROUNDS      (50)
+
+#define MAX_RETIRED         (4 * HAZARD_POINTER_SLOTS * N_THREADS) // Twice the scan threshold, once every thread has had a record
+
+#define N_RECLAIM_THREADS   (8)
+
+#define N_SIZE_INSERTIONS   (1000)
+
+#define NEIGHBOUR_BIT       (0x80000000)    // Sorts a key immediately after the same key without it
+
+#define N_UPDATE_KEYS       (16)            // Few, so updates collide
+#define N_UPDATE_ROUNDS     (20000)
+
+#define N_ITER_PASSES       (20)
+
+#define N_SHRINK_KEYS       (1 << 16)
+#define SHRINK_KEEP_PERIOD  (64)            // One key in this many stays in while the rest come and go
+
 //#define VERBOSE
 
 /* --- PRIVATE DATA TYPES --------------------------------------------------- */
@@ -52,8 +74,44 @@ typedef struct hashtable_stress_context_t_ {
     char ** elems;                  /**< Some elements to insert with them */
 } * hashtable_stress_context_t;
 
+/**
+ * @brief   Per-thread state for the update threading test
+ *
+ * Every element is a unique token. Each thread adds up the tokens it puts into
+ * the table and the ones it gets back out, so a lost update shows up as a
+ * mismatch between the totals
+ */
+typedef struct hashtable_update_thread_arg_t_ {
+    hashtable_t table;              /**< The table to work on */
+    uint32_t id;                    /**< Makes this thread's tokens unique */
+    uint64_t sum_in;                /**< Total of the tokens stored */
+    uint64_t sum_out;               /**< Total of the tokens replaced or removed */
+} hashtable_update_thread_arg_t;
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint32_t compute_calls;      /**< Number of times compute_elem has run */
+static atomic_uint n_freed;         /**< Number of times counting_free has run */
+static hashtable_engine_t test_engine;  /**< Engine the suite currently running creates tables with */
+static bool test_combine;           /**< Whether the suite currently running creates tables with a combiner */
+
 /* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
 
+/**
+ * @brief   Registers every test in a suite
+ */
+static void test_hashtable_register(unit_test_t tests);
+
+/**
+ * @brief   hashtable_config_init, but with the engine under test
+ */
+static void test_config_init(hashtable_config_t * config);
+
+/**
+ * @brief   hashtable_create, but with the engine under test
+ */
+static hashtable_t test_create(hash_f_t hash_f, print_f_t print_f, free_f_t free_f);
+
 /**
  * @brief   Test hash function for an int
  */
@@ -66,6 +124,26 @@ static uint32_t hash_int(hashtable_key_t k);
  */
 static uint32_t hash_string(hashtable_key_t k);
 
+/**
+ * @brief   Deliberately poor string hash. Only looks at the first character
+ */
+static uint32_t hash_string_first(hashtable_key_t k);
+
+/**
+ * @brief   Test equality function for strings
+ */
+static bool eq_string(hashtable_key_t a, hashtable_key_t b);
+
+/**
+ * @brief   Test 64 bit hash function for an int
+ */
+static uint64_t hash64_int(hashtable_key_t k);
+
+/**
+ * @brief   Makes an element for an int key, counting calls. Refuses key 0
+ */
+static hashtable_elem_t compute_elem(hashtable_key_t k);
+
 /**
  * @brief   Prints a single table element
  */
@@ -136,6 +214,111 @@ static bool test_hashtable_remove(void * p_context, char ** err_str);
  */
 static bool test_hashtable_threading(void * p_context, char ** err_str);
 
+/**
+ * @brief   Tests that removed nodes are actually freed
+ */
+static bool test_hashtable_churn(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests the approximate size, which is exact with only one thread
+ */
+static bool test_hashtable_size(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests threaded insertion and removal under every reclamation scheme
+ */
+static bool test_hashtable_reclaim(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests removals racing with insertions right after the nodes being removed
+ */
+static bool test_hashtable_remove_insert_race(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests batched insertion and removal
+ */
+static bool test_hashtable_batch(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests batched lookup
+ */
+static bool test_hashtable_get_many(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests batched insertion and removal racing each other, under every reclamation scheme
+ */
+static bool test_hashtable_batch_threading(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests telling keys with the same hash apart
+ */
+static bool test_hashtable_collisions(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests keys which only differ above the low 32 bits of their hash
+ */
+static bool test_hashtable_hash64(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests replacing elements in place
+ */
+static bool test_hashtable_update(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests inserting computed elements
+ */
+static bool test_hashtable_compute_if_absent(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests puts, conditional replacements and removals racing, under every reclamation scheme
+ */
+static bool test_hashtable_update_threading(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests walking the table with an iterator, including removing what it's on
+ */
+static bool test_hashtable_iteration(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests iterators racing insertions and removals, under every reclamation scheme
+ */
+static bool test_hashtable_iteration_threading(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests visiting every element from several threads
+ */
+static bool test_hashtable_parallel_for_each(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests that emptying a grown table out leaves it working
+ */
+static bool test_hashtable_shrink(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests growing and shrinking under concurrent operations, under every reclamation scheme
+ */
+static bool test_hashtable_shrink_threading(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests tables created with a capacity
+ */
+static bool test_hashtable_capacity(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests building a table from an array of pairs
+ */
+static bool test_hashtable_create_from(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests each CAS backoff policy, and the failure count
+ */
+static bool test_hashtable_backoff(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests hashtable_get_stats
+ */
+static bool test_hashtable_stats(void * p_context, char ** err_str);
+
 /**
  * @brief   Function which tries to insert many values into the hashtable
  */
@@ -146,6 +329,75 @@ static void * test_hashtable_insert_thread_f(void * p_context);
  */
 static void * test_hashtable_remove_thread_f(void * p_context);
 
+/**
+ * @brief   Function which inserts each key's neighbour, so it lands right after the key
+ */
+static void * test_hashtable_insert_neighbour_thread_f(void * p_context);
+
+/**
+ * @brief   Function which inserts every key in one batch
+ */
+static void * test_hashtable_insert_many_thread_f(void * p_context);
+
+/**
+ * @brief   Function which removes every key in one batch. Returns the number it removed
+ */
+static void * test_hashtable_remove_many_thread_f(void * p_context);
+
+/**
+ * @brief   Function which randomly puts, replaces and removes a few keys
+ *
+ * @param[in,out] p_arg:    A hashtable_update_thread_arg_t
+ */
+static void * test_hashtable_update_thread_f(void * p_arg);
+
+/**
+ * @brief   Function which repeatedly walks a table of ints. Even keys must be seen exactly once
+ *
+ * @param[in] p_table:      The hashtable_t to walk
+ */
+static void * test_hashtable_iterate_thread_f(void * p_table);
+
+/**
+ * @brief   Function which repeatedly inserts and removes every odd key
+ *
+ * @param[in,out] p_table:  The hashtable_t to modify
+ */
+static void * test_hashtable_churn_odd_thread_f(void * p_table);
+
+/**
+ * @brief   Function which repeatedly inserts and removes every key but the kept ones
+ *
+ * @param[in,out] p_table:  The hashtable_t to modify
+ */
+static void * test_hashtable_grow_shrink_thread_f(void * p_table);
+
+/**
+ * @brief   Function which repeatedly walks a table, and checks the kept keys are all there
+ *
+ * @param[in] p_table:      The hashtable_t to walk
+ */
+static void * test_hashtable_iterate_kept_thread_f(void * p_table);
+
+/**
+ * @brief   Counts a visit to an int key, in an array of atomic counters
+ */
+static void test_hashtable_count_visit(hashtable_key_t key, hashtable_elem_t elem, void * p_visits);
+
+/**
+ * @brief   Frees a pointer, and counts it in n_freed
+ */
+static void counting_free(void * ptr);
+
+/**
+ * @brief   Function which retires a pointer under QSBR, and tries hard to have it freed
+ *
+ * @param[in] p_ptr:        The pointer to retire
+ *
+ * @return      NULL
+ */
+static void * test_hashtable_qsbr_retire_thread_f(void * p_ptr);
+
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 
 /**
@@ -155,71 +407,213 @@ static void * test_hashtable_remove_thread_f(void * p_context);
  */
 int main(void)
 {
-    uint32_t err;
-    unit_test_t hashtable_tests;
+    static const struct {
+        hashtable_engine_t engine;
+        bool combine;
+        char * name;
+    } suites[] = {
+        { HASHTABLE_ENGINE_LIST,    false,  "hashtable" },
+        { HASHTABLE_ENGINE_PROBE,   false,  "hashtable (probing)" },
+        { HASHTABLE_ENGINE_CUCKOO,  false,  "hashtable (cuckoo)" },
+        { HASHTABLE_ENGINE_MUTEX,   false,  "hashtable (mutex)" },
+        { HASHTABLE_ENGINE_RWLOCK,  false,  "hashtable (rwlock)" },
+        { HASHTABLE_ENGINE_STRIPED, false,  "hashtable (striped)" },
+        { HASHTABLE_ENGINE_LIST,    true,   "hashtable (combining)" },
+        { HASHTABLE_ENGINE_PROBE,   true,   "hashtable (probing, combining)" },
+    };
+    uint32_t err = 0;
+    uint32_t i;
+
+    // Run every test against every engine, and through a combiner
+    for (i = 0; i < ARRAY_ELEMENTS(suites); i++) {
+        test_engine = suites[i].engine;
+        test_combine = suites[i].combine;
+
+        // Allocate test structure
+        unit_test_t hashtable_tests = unit_test_create(suites[i].name);
+
+        // Register and run tests
+        test_hashtable_register(hashtable_tests);
+        if (unit_test_run(hashtable_tests)) err = 1;
+
+        // Free test structure
+        unit_test_free(hashtable_tests);
+    }
 
-    // Allocate test structure
-    hashtable_tests = unit_test_create("hashtable");
+    return err;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
 
-    // Register tests
-    unit_test_register(hashtable_tests,
+static void test_hashtable_register(unit_test_t tests)
+{
+    unit_test_register(tests,
                        "creation",
                        test_hashtable_standard_pre,
                        test_hashtable_create,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "insertion and membership",
                        test_hashtable_standard_pre,
                        test_hashtable_insert_contains,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "insertion edge cases",
                        test_hashtable_standard_pre,
                        test_hashtable_insert_edge_cases,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "contains on non-present member",
                        test_hashtable_standard_pre,
                        test_hashtable_contains_not_present,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "duplicate insertion",
                        test_hashtable_standard_pre,
                        test_hashtable_duplicate_insertion,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "getting",
                        test_hashtable_standard_pre,
                        test_hashtable_get,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "removing",
                        test_hashtable_standard_pre,
                        test_hashtable_remove,
                        test_hashtable_standard_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
+                       "approximate size",
+                       test_hashtable_standard_pre,
+                       test_hashtable_size,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
                        "stress",
                        test_hashtable_stress_pre,
                        test_hashtable_stress,
                        test_hashtable_stress_post);
-    unit_test_register(hashtable_tests,
+    unit_test_register(tests,
                        "threading",
                        test_hashtable_stress_pre,
                        test_hashtable_threading,
                        test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "churn",
+                       test_hashtable_stress_pre,
+                       test_hashtable_churn,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "reclamation schemes",
+                       test_hashtable_stress_pre,
+                       test_hashtable_reclaim,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "removal and insertion race",
+                       test_hashtable_stress_pre,
+                       test_hashtable_remove_insert_race,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "batches",
+                       test_hashtable_stress_pre,
+                       test_hashtable_batch,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "batched lookup",
+                       test_hashtable_stress_pre,
+                       test_hashtable_get_many,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "batch threading",
+                       test_hashtable_stress_pre,
+                       test_hashtable_batch_threading,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "colliding keys",
+                       test_hashtable_standard_pre,
+                       test_hashtable_collisions,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "64 bit hashes",
+                       test_hashtable_standard_pre,
+                       test_hashtable_hash64,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "updates",
+                       test_hashtable_standard_pre,
+                       test_hashtable_update,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "compute if absent",
+                       test_hashtable_standard_pre,
+                       test_hashtable_compute_if_absent,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "update threading",
+                       test_hashtable_stress_pre,
+                       test_hashtable_update_threading,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "iteration",
+                       test_hashtable_stress_pre,
+                       test_hashtable_iteration,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "iteration threading",
+                       test_hashtable_stress_pre,
+                       test_hashtable_iteration_threading,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "parallel scan",
+                       test_hashtable_stress_pre,
+                       test_hashtable_parallel_for_each,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "shrinking",
+                       test_hashtable_standard_pre,
+                       test_hashtable_shrink,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "shrink threading",
+                       test_hashtable_stress_pre,
+                       test_hashtable_shrink_threading,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "pre-sizing",
+                       test_hashtable_standard_pre,
+                       test_hashtable_capacity,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "bulk loading",
+                       test_hashtable_standard_pre,
+                       test_hashtable_create_from,
+                       test_hashtable_standard_post);
+    unit_test_register(tests,
+                       "backoff",
+                       test_hashtable_stress_pre,
+                       test_hashtable_backoff,
+                       test_hashtable_stress_post);
+    unit_test_register(tests,
+                       "statistics",
+                       test_hashtable_stress_pre,
+                       test_hashtable_stats,
+                       test_hashtable_stress_post);
+}
 
-    // Run tests
-    if (unit_test_run(hashtable_tests)) err = 1;
-    else                                err = 0;
+static void test_config_init(hashtable_config_t * config)
+{
+    hashtable_config_init(config);
+    config->engine = test_engine;
+    config->combine = test_combine;
+}
 
-    // Free test structure
-    unit_test_free(hashtable_tests);
+static hashtable_t test_create(hash_f_t hash_f, print_f_t print_f, free_f_t free_f)
+{
+    hashtable_config_t config;
 
-    return err;
+    test_config_init(&config);
+    return hashtable_create_with_config(hash_f, print_f, free_f, &config);
 }
 
-/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
-
 static uint32_t hash_int(hashtable_key_t k)
 {
     // Double cast to avoid compiler warning
@@ -237,6 +631,58 @@ static uint32_t hash_string(hashtable_key_t k)
     return hash;
 }
 
+static uint32_t hash_string_first(hashtable_key_t k)
+{
+    return (uint32_t) ((char *) k)[0];
+}
+
+static bool eq_string(hashtable_key_t a, hashtable_key_t b)
+{
+    return strcmp((char *) a, (char *) b) == 0;
+}
+
+static uint64_t hash64_int(hashtable_key_t k)
+{
+    return (uint64_t)(uintptr_t) k;
+}
+
+static hashtable_elem_t compute_elem(hashtable_key_t k)
+{
+    compute_calls++;
+
+    if (k == NULL)  return NULL;
+    else            return (hashtable_elem_t)((uintptr_t) k + 1);
+}
+
+static void test_hashtable_count_visit(hashtable_key_t key, hashtable_elem_t elem, void * p_visits)
+{
+    (void) elem;
+    atomic_uint_fast32_t * visits = (atomic_uint_fast32_t *) p_visits;
+
+    atomic_fetch_add(&(visits[(uintptr_t) key]), 1);
+}
+
+static void counting_free(void * ptr)
+{
+    free(ptr);
+    atomic_fetch_add(&n_freed, 1);
+}
+
+static void * test_hashtable_qsbr_retire_thread_f(void * p_ptr)
+{
+    uint32_t i;
+
+    epoch_qsbr_online();
+    if (epoch_qsbr_retire(p_ptr, counting_free)) counting_free(p_ptr);
+    for (i = 0; i < N_CHURN_ROUNDS; i++) {
+        epoch_qsbr_quiescent();
+        epoch_qsbr_collect();
+    }
+    epoch_qsbr_offline();
+
+    return NULL;
+}
+
 static void print_elem(hashtable_elem_t e)
 {
     // It's actually a string
@@ -268,8 +714,8 @@ static bool test_hashtable_standard_pre(void ** p_context, char ** err_str)
     *p_context = context;
 
     // Allocate tables
-    context->int_table = hashtable_create(hash_int, print_elem, NULL);
-    context->string_table = hashtable_create(hash_string, print_elem, NULL);
+    context->int_table = test_create(hash_int, print_elem, NULL);
+    context->string_table = test_create(hash_string, print_elem, NULL);
     if (!context->int_table || !context->string_table) {
         *err_str = "memory allocation failed";
         return false;
@@ -329,7 +775,7 @@ static bool test_hashtable_stress_pre(void ** p_context, char ** err_str)
     }
 
     // Allocate table
-    context->int_table = hashtable_create(hash_int, print_elem, NULL);
+    context->int_table = test_create(hash_int, print_elem, NULL);
     if (!context->int_table) {
         *err_str = "memory allocation failed";
         free(context);
@@ -423,7 +869,21 @@ static bool test_hashtable_create(void * p_context, char ** err_str)
 {
     (void) p_context;
 
-    // Success; actual test happens in preamble
+    // The preamble creates tables with the engine under test. The shorthands
+    // always give the default, which had better work too
+    hashtable_t plain = hashtable_create(hash_int, print_elem, NULL);
+    hashtable_t sized = hashtable_create_with_capacity(hash_int, print_elem, NULL, N_SIZE_INSERTIONS);
+    bool success = plain && sized &&
+                   hashtable_insert(plain, (void *) 1, "1") && hashtable_get(plain, (void *) 1) &&
+                   hashtable_insert(sized, (void *) 1, "1") && hashtable_get(sized, (void *) 1);
+    hashtable_free(plain);
+    hashtable_free(sized);
+    if (!success) {
+        *err_str = "default table creation failed";
+        return false;
+    }
+
+    // Success
     *err_str = NULL;
     return true;
 }
@@ -843,33 +1303,83 @@ static bool test_hashtable_remove(void * p_context, char ** err_str)
     return true;
 }
 
-static bool test_hashtable_stress(void * p_context, char ** err_str)
+static bool test_hashtable_size(void * p_context, char ** err_str)
 {
-    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
-    uint32_t i;
-    bool success;
+    hashtable_test_context_t context = (hashtable_test_context_t) p_context;
+    uintptr_t i;
 
-    // Insert everything
-    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
-        success = hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i]);
-        if (!success) {
+    // Empty to start
+    if (hashtable_size_approx(context->int_table) != 0) {
+        *err_str = "new table not empty";
+        return false;
+    }
+
+    // Fill it. Duplicates don't count
+    for (i = 0; i < N_SIZE_INSERTIONS; i++) {
+        if (!hashtable_insert(context->int_table, (void *) i, "elem")) {
             *err_str = "int insertion failed";
             return false;
         }
     }
+    hashtable_insert(context->int_table, (void *) 0, "elem");
+    if (hashtable_size_approx(context->int_table) != N_SIZE_INSERTIONS) {
+        *err_str = "wrong size after insertion";
+        return false;
+    }
 
-    #ifdef VERBOSE
-    printf("all in:\n");
-    hashtable_print(context->int_table);
-    printf("\n");
-    #endif
-
-    // Check that it's all there
-    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
-        hashtable_elem_t elem = hashtable_get(context->int_table, (void *)(uintptr_t) context->keys[i]);
-        if (!elem || strcmp((char *) elem, context->elems[i]) != 0) {
-            printf("failed at %d\n", i);
-            *err_str = "int retrieval failed";
+    // Remove half. Missing keys don't count
+    for (i = 0; i < N_SIZE_INSERTIONS; i += 2) {
+        if (!hashtable_remove(context->int_table, (void *) i)) {
+            *err_str = "int removal failed";
+            return false;
+        }
+    }
+    hashtable_remove(context->int_table, (void *) 0);
+    if (hashtable_size_approx(context->int_table) != N_SIZE_INSERTIONS/2) {
+        *err_str = "wrong size after removal";
+        return false;
+    }
+
+    // Everything left is still there after all that growth
+    for (i = 1; i < N_SIZE_INSERTIONS; i += 2) {
+        if (!hashtable_contains(context->int_table, (void *) i)) {
+            *err_str = "element lost";
+            return false;
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_stress(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+    bool success;
+
+    // Insert everything
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        success = hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+        if (!success) {
+            *err_str = "int insertion failed";
+            return false;
+        }
+    }
+
+    #ifdef VERBOSE
+    printf("all in:\n");
+    hashtable_print(context->int_table);
+    printf("\n");
+    #endif
+
+    // Check that it's all there
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        hashtable_elem_t elem = hashtable_get(context->int_table, (void *)(uintptr_t) context->keys[i]);
+        if (!elem || strcmp((char *) elem, context->elems[i]) != 0) {
+            printf("failed at %d\n", i);
+            *err_str = "int retrieval failed";
             return false;
         }
     }
@@ -971,43 +1481,1477 @@ static bool test_hashtable_threading(void * p_context, char ** err_str)
     return true;
 }
 
-static void * test_hashtable_insert_thread_f(void * p_context)
+static bool test_hashtable_churn(void * p_context, char ** err_str)
 {
     hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t round;
     uint32_t i;
-    bool success;
 
-    // Insert everything. Intentionally races with copies of itself
+    // Fill and empty the table over and over
+    for (round = 0; round < N_CHURN_ROUNDS; round++) {
+        for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+            if (!hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i])) {
+                *err_str = "int insertion failed";
+                return false;
+            }
+        }
+
+        for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+            hashtable_elem_t elem = hashtable_remove(context->int_table, (void *)(uintptr_t) context->keys[i]);
+            if (!elem || strcmp((char *) elem, context->elems[i]) != 0) {
+                *err_str = "int removal failed";
+                return false;
+            }
+
+            // Removed nodes must not pile up
+            if (hazard_pointer_retired() > MAX_RETIRED) {
+                *err_str = "removed nodes not reclaimed";
+                return false;
+            }
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_reclaim(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_reclaim_t schemes[] = {
+        HASHTABLE_RECLAIM_HAZARD,
+        HASHTABLE_RECLAIM_EPOCH,
+        HASHTABLE_RECLAIM_QSBR,
+        HASHTABLE_RECLAIM_NONE,
+    };
+    hashtable_t default_table = context->int_table;
+    uint32_t i, j;
+
+    for (i = 0; i < ARRAY_ELEMENTS(schemes); i++) {
+        hashtable_config_t config;
+        pthread_t threads[N_RECLAIM_THREADS];
+        bool success = true;
+
+        // Swap in a table using this scheme
+        test_config_init(&config);
+        config.reclaim = schemes[i];
+        context->int_table = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!context->int_table) {
+            context->int_table = default_table;
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // Fill it, then empty it, racing all the way
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_create(&(threads[j]), NULL, test_hashtable_insert_thread_f, p_context);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_create(&(threads[j]), NULL, test_hashtable_remove_thread_f, p_context);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+
+        // Check that nothing's there
+        for (j = 0; j < N_STRESS_INSERTIONS; j++) {
+            if (hashtable_contains(context->int_table, (void *)(uintptr_t) context->keys[j])) success = false;
+        }
+
+        // Don't hold up reclamation for anyone else
+        hashtable_thread_offline(context->int_table);
+        hashtable_free(context->int_table);
+        context->int_table = default_table;
+
+        if (!success) {
+            *err_str = "threaded insertion or removal failed";
+            return false;
+        }
+    }
+
+    // A bad scheme is rejected
+    hashtable_config_t config;
+    test_config_init(&config);
+    config.reclaim = (hashtable_reclaim_t) (HASHTABLE_RECLAIM_NONE + 1);
+    if (hashtable_create_with_config(hash_int, print_elem, NULL, &config)) {
+        *err_str = "invalid config accepted";
+        return false;
+    }
+
+    // So is a bad engine
+    test_config_init(&config);
+    config.engine = (hashtable_engine_t) (HASHTABLE_ENGINE_STRIPED + 1);
+    if (hashtable_create_with_config(hash_int, print_elem, NULL, &config)) {
+        *err_str = "invalid engine accepted";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_remove_insert_race(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    pthread_t threads[2*N_RECLAIM_THREADS];
+    uint32_t i;
+
+    // Fill the table
     for (i = 0; i < N_STRESS_INSERTIONS; i++) {
-        success = hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+        if (!hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i])) {
+            *err_str = "int insertion failed";
+            return false;
+        }
+    }
 
-        // Make sure that either we put it there, or some other thread did
-        if (!success && !hashtable_contains(context->int_table, (void*)(uintptr_t) context->keys[i])) {
-            // Failure
-            return (void *) 1;
+    // Empty it, while linking new nodes onto the ones being removed
+    for (i = 0; i < N_RECLAIM_THREADS; i++) {
+        pthread_create(&(threads[2*i]), NULL, test_hashtable_remove_thread_f, p_context);
+        pthread_create(&(threads[2*i + 1]), NULL, test_hashtable_insert_neighbour_thread_f, p_context);
+    }
+    bool success = true;
+    for (i = 0; i < 2*N_RECLAIM_THREADS; i++) {
+        void * err_val;
+        pthread_join(threads[i], &err_val);
+        if (err_val) success = false;
+    }
+    if (!success) {
+        *err_str = "threaded insertion or removal failed";
+        return false;
+    }
+
+    // None of the insertions may have been lost along with the node before them
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        if (hashtable_contains(context->int_table, (void *)(uintptr_t) context->keys[i])) {
+            *err_str = "removed key still present";
+            return false;
+        }
+        if (hashtable_get(context->int_table, (void *)(uintptr_t) (context->keys[i] | NEIGHBOUR_BIT)) != context->elems[i]) {
+            *err_str = "insertion lost";
+            return false;
         }
     }
 
     // Success
-    return (void *) 0;
+    *err_str = NULL;
+    return true;
 }
 
-static void * test_hashtable_remove_thread_f(void * p_context)
+static bool test_hashtable_batch(void * p_context, char ** err_str)
 {
     hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
     uint32_t i;
 
-    // Remove everything. Intentionally races with copies of itself
+    hashtable_key_t * keys = (hashtable_key_t *) malloc(N_STRESS_INSERTIONS * sizeof(hashtable_key_t));
+    hashtable_elem_t * elems = (hashtable_elem_t *) malloc(N_STRESS_INSERTIONS * sizeof(hashtable_elem_t));
+    if (!keys || !elems) {
+        free(keys);
+        free(elems);
+        *err_str = "test allocation failed";
+        return false;
+    }
     for (i = 0; i < N_STRESS_INSERTIONS; i++) {
-        hashtable_elem_t elem = hashtable_remove(context->int_table, (void *)(uintptr_t) context->keys[i]);
-        // Check that we did remove it, and that we got the right one back
-        if (hashtable_contains(context->int_table, (void*)(uintptr_t) context->keys[i]) ||
-            (elem && strcmp((char *) elem, context->elems[i]) != 0)) {
-            // Failure
-            return (void *) 1;
+        keys[i] = (hashtable_key_t)(uintptr_t) context->keys[i];
+        elems[i] = context->elems[i];
+    }
+
+    bool success = false;
+
+    // Insert the first half on its own, then everything. Only the new half goes in
+    if (hashtable_insert_many(context->int_table, keys, elems, N_STRESS_INSERTIONS/2) != N_STRESS_INSERTIONS/2) {
+        *err_str = "first batch insertion failed";
+    }
+    else if (hashtable_insert_many(context->int_table, keys, elems, N_STRESS_INSERTIONS) != N_STRESS_INSERTIONS - N_STRESS_INSERTIONS/2) {
+        *err_str = "second batch insertion failed";
+    }
+    else if (hashtable_size_approx(context->int_table) != N_STRESS_INSERTIONS) {
+        *err_str = "size incorrect after batch insertion";
+    }
+    else {
+        success = true;
+    }
+
+    // Everything is where it should be
+    for (i = 0; success && i < N_STRESS_INSERTIONS; i++) {
+        if (hashtable_get(context->int_table, keys[i]) != elems[i]) {
+            *err_str = "batch inserted element not found";
+            success = false;
+        }
+    }
+
+    // Take out every other key, each listed twice. The second copy finds nothing
+    for (i = 0; i < N_STRESS_INSERTIONS/2; i++) {
+        keys[i] = keys[i + N_STRESS_INSERTIONS/2] = (hashtable_key_t)(uintptr_t) context->keys[2*i + 1];
+    }
+    if (success && hashtable_remove_many(context->int_table, keys, elems, N_STRESS_INSERTIONS) != N_STRESS_INSERTIONS/2) {
+        *err_str = "batch removal count incorrect";
+        success = false;
+    }
+    for (i = 0; success && i < N_STRESS_INSERTIONS/2; i++) {
+        hashtable_elem_t first = elems[i];
+        hashtable_elem_t second = elems[i + N_STRESS_INSERTIONS/2];
+        if ((first == NULL) == (second == NULL) ||
+            (first ? first : second) != context->elems[2*i + 1]) {
+            *err_str = "batch removed elements incorrect";
+            success = false;
+        }
+    }
+
+    // And the rest are still there
+    for (i = 0; success && i < N_STRESS_INSERTIONS; i++) {
+        bool present = hashtable_contains(context->int_table, (hashtable_key_t)(uintptr_t) context->keys[i]);
+        if (present != (i % 2 == 0)) {
+            *err_str = "batch removal touched the wrong keys";
+            success = false;
+        }
+    }
+
+    free(keys);
+    free(elems);
+
+    if (success) *err_str = NULL;
+    return success;
+}
+
+static bool test_hashtable_get_many(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+
+    hashtable_key_t * keys = (hashtable_key_t *) malloc(N_STRESS_INSERTIONS * sizeof(hashtable_key_t));
+    hashtable_elem_t * elems = (hashtable_elem_t *) malloc(N_STRESS_INSERTIONS * sizeof(hashtable_elem_t));
+    if (!keys || !elems) {
+        free(keys);
+        free(elems);
+        *err_str = "test allocation failed";
+        return false;
+    }
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) keys[i] = (hashtable_key_t)(uintptr_t) context->keys[i];
+
+    bool success = true;
+
+    // Nothing to find yet
+    if (hashtable_get_many(context->int_table, keys, elems, N_STRESS_INSERTIONS) != 0) {
+        *err_str = "found keys in an empty table";
+        success = false;
+    }
+    for (i = 0; success && i < N_STRESS_INSERTIONS; i++) {
+        if (elems[i] != NULL) {
+            *err_str = "missing key gave an element";
+            success = false;
+        }
+    }
+
+    // Every other key in, then look them all up, including a ragged last group
+    for (i = 0; i < N_STRESS_INSERTIONS; i += 2) hashtable_insert(context->int_table, keys[i], context->elems[i]);
+    if (success && hashtable_get_many(context->int_table, keys, elems, N_STRESS_INSERTIONS - 1) != N_STRESS_INSERTIONS/2) {
+        *err_str = "batched lookup count incorrect";
+        success = false;
+    }
+    for (i = 0; success && i < N_STRESS_INSERTIONS - 1; i++) {
+        hashtable_elem_t expected = (i % 2 == 0) ? context->elems[i] : NULL;
+        if (elems[i] != expected) {
+            *err_str = "batched lookup gave the wrong element";
+            success = false;
+        }
+    }
+
+    free(keys);
+    free(elems);
+
+    if (success) *err_str = NULL;
+    return success;
+}
+
+static bool test_hashtable_batch_threading(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_reclaim_t schemes[] = {
+        HASHTABLE_RECLAIM_HAZARD,
+        HASHTABLE_RECLAIM_EPOCH,
+        HASHTABLE_RECLAIM_QSBR,
+        HASHTABLE_RECLAIM_NONE,
+    };
+    hashtable_t default_table = context->int_table;
+    uint32_t i, j;
+
+    for (i = 0; i < ARRAY_ELEMENTS(schemes); i++) {
+        hashtable_config_t config;
+        pthread_t threads[N_RECLAIM_THREADS];
+        bool success = true;
+
+        // Swap in a table using this scheme
+        test_config_init(&config);
+        config.reclaim = schemes[i];
+        context->int_table = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!context->int_table) {
+            context->int_table = default_table;
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // Everyone inserts everything
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_create(&(threads[j]), NULL, test_hashtable_insert_many_thread_f, p_context);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+        if (hashtable_size_approx(context->int_table) != N_STRESS_INSERTIONS) success = false;
+        for (j = 0; j < N_STRESS_INSERTIONS; j++) {
+            if (hashtable_get(context->int_table, (void *)(uintptr_t) context->keys[j]) != context->elems[j]) success = false;
+        }
+
+        // Everyone removes everything. Each key is removed exactly once
+        uintptr_t removed = 0;
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_create(&(threads[j]), NULL, test_hashtable_remove_many_thread_f, p_context);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * n_removed;
+            pthread_join(threads[j], &n_removed);
+            removed += (uintptr_t) n_removed;
+        }
+        if (removed != N_STRESS_INSERTIONS || hashtable_size_approx(context->int_table) != 0) success = false;
+
+        // Don't hold up reclamation for anyone else
+        hashtable_thread_offline(context->int_table);
+        hashtable_free(context->int_table);
+        context->int_table = default_table;
+
+        if (!success) {
+            *err_str = "threaded batch insertion or removal failed";
+            return false;
         }
     }
 
     // Success
-    return (void *) 0;
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_collisions(void * p_context, char ** err_str)
+{
+    (void) p_context;
+    static char * const keys[] = { "apple", "avocado", "apricot", "banana", "almond", "acerola" };
+    hashtable_config_t config;
+    uint32_t i;
+
+    // Every key starting with the same letter collides
+    test_config_init(&config);
+    config.eq_f = eq_string;
+    hashtable_t h = hashtable_create_with_config(hash_string_first, print_elem, NULL, &config);
+    if (!h) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+
+    // Insert everything. The keys are their own elements
+    bool success = true;
+    for (i = 0; i < ARRAY_ELEMENTS(keys); i++) {
+        if (!hashtable_insert(h, keys[i], keys[i])) success = false;
+    }
+    if (!success) {
+        *err_str = "colliding insertion failed";
+        hashtable_free(h);
+        return false;
+    }
+
+    // A different pointer to an equal key is still the same key
+    char copy[] = "avocado";
+    if (hashtable_insert(h, copy, copy) || hashtable_get(h, copy) != keys[1]) {
+        *err_str = "equal key not recognized";
+        hashtable_free(h);
+        return false;
+    }
+
+    // Each gets its own element back
+    for (i = 0; i < ARRAY_ELEMENTS(keys); i++) {
+        if (hashtable_get(h, keys[i]) != keys[i]) success = false;
+    }
+    if (!success || hashtable_contains(h, "anchovy")) {
+        *err_str = "colliding get failed";
+        hashtable_free(h);
+        return false;
+    }
+
+    // Removing one leaves the others alone
+    if (hashtable_remove(h, "apricot") != keys[2] ||
+        hashtable_contains(h, "apricot") ||
+        hashtable_get(h, "apple") != keys[0] ||
+        hashtable_get(h, "almond") != keys[4]) {
+        *err_str = "colliding removal failed";
+        hashtable_free(h);
+        return false;
+    }
+
+    // Without an eq_f, a collision is the same key
+    hashtable_free(h);
+    h = test_create(hash_string_first, print_elem, NULL);
+    if (!h) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    if (!hashtable_insert(h, "apple", "apple") || hashtable_insert(h, "avocado", "avocado")) {
+        *err_str = "collision without eq_f not treated as duplicate";
+        hashtable_free(h);
+        return false;
+    }
+    hashtable_free(h);
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_hash64(void * p_context, char ** err_str)
+{
+    (void) p_context;
+    hashtable_config_t config;
+    uint64_t i;
+
+    // Only a 64 bit hash is needed
+    test_config_init(&config);
+    config.hash64_f = hash64_int;
+    hashtable_t h = hashtable_create_with_config(NULL, print_elem, NULL, &config);
+    if (!h) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+
+    // Keys which would all hash to the same 32 bits
+    bool success = true;
+    for (i = 1; i <= N_SIZE_INSERTIONS; i++) {
+        if (!hashtable_insert(h, (hashtable_key_t)(uintptr_t) (i << 32), (hashtable_elem_t)(uintptr_t) i)) success = false;
+    }
+    for (i = 1; i <= N_SIZE_INSERTIONS; i++) {
+        if (hashtable_get(h, (hashtable_key_t)(uintptr_t) (i << 32)) != (hashtable_elem_t)(uintptr_t) i) success = false;
+    }
+    if (!success || hashtable_contains(h, (hashtable_key_t) 0)) {
+        *err_str = "64 bit keys not distinguished";
+        hashtable_free(h);
+        return false;
+    }
+    hashtable_free(h);
+
+    // No hash function at all is rejected
+    if (hashtable_create(NULL, print_elem, NULL)) {
+        *err_str = "missing hash function accepted";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_update(void * p_context, char ** err_str)
+{
+    hashtable_test_context_t context = (hashtable_test_context_t) p_context;
+    hashtable_t h = context->int_table;
+    uint32_t i;
+
+    // Putting a new key inserts it
+    for (i = 0; i < N_SIZE_INSERTIONS; i++) {
+        if (hashtable_put(h, (void *)(uintptr_t) i, (void *)(uintptr_t) (i + 1)) != NULL) {
+            *err_str = "put of a new key replaced something";
+            return false;
+        }
+    }
+
+    // Putting again replaces it, without changing the size
+    for (i = 0; i < N_SIZE_INSERTIONS; i++) {
+        if (hashtable_put(h, (void *)(uintptr_t) i, (void *)(uintptr_t) (i + 2)) != (void *)(uintptr_t) (i + 1)) {
+            *err_str = "put didn't hand back the old element";
+            return false;
+        }
+    }
+    if (hashtable_size_approx(h) != N_SIZE_INSERTIONS) {
+        *err_str = "size incorrect after replacement";
+        return false;
+    }
+    for (i = 0; i < N_SIZE_INSERTIONS; i++) {
+        if (hashtable_get(h, (void *)(uintptr_t) i) != (void *)(uintptr_t) (i + 2)) {
+            *err_str = "put didn't replace the element";
+            return false;
+        }
+    }
+
+    // Conditional replacement only happens on a match
+    if (hashtable_replace_if(h, (void *) 5, (void *) 6, (void *) 100)) {
+        *err_str = "replaced a mismatched element";
+        return false;
+    }
+    if (!hashtable_replace_if(h, (void *) 5, (void *) 7, (void *) 100) ||
+        hashtable_get(h, (void *) 5) != (void *) 100) {
+        *err_str = "didn't replace a matching element";
+        return false;
+    }
+    if (hashtable_replace_if(h, (void *)(uintptr_t) N_SIZE_INSERTIONS, NULL, (void *) 100) ||
+        hashtable_contains(h, (void *)(uintptr_t) N_SIZE_INSERTIONS)) {
+        *err_str = "replaced a missing key";
+        return false;
+    }
+
+    // Removed keys can be put back
+    if (hashtable_remove(h, (void *) 5) != (void *) 100 ||
+        hashtable_put(h, (void *) 5, (void *) 7) != NULL ||
+        hashtable_get(h, (void *) 5) != (void *) 7) {
+        *err_str = "put after removal failed";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_compute_if_absent(void * p_context, char ** err_str)
+{
+    hashtable_test_context_t context = (hashtable_test_context_t) p_context;
+    hashtable_t h = context->int_table;
+    uint32_t i;
+
+    compute_calls = 0;
+
+    // Absent keys get computed
+    for (i = 1; i <= N_SIZE_INSERTIONS; i++) {
+        if (hashtable_compute_if_absent(h, (void *)(uintptr_t) i, compute_elem) != (void *)(uintptr_t) (i + 1)) {
+            *err_str = "computed element not returned";
+            return false;
+        }
+    }
+
+    // Present ones don't
+    for (i = 1; i <= N_SIZE_INSERTIONS; i++) {
+        if (hashtable_compute_if_absent(h, (void *)(uintptr_t) i, compute_elem) != (void *)(uintptr_t) (i + 1)) {
+            *err_str = "present element not returned";
+            return false;
+        }
+    }
+    if (compute_calls != N_SIZE_INSERTIONS || hashtable_size_approx(h) != N_SIZE_INSERTIONS) {
+        *err_str = "computed more than once";
+        return false;
+    }
+
+    // Nothing goes in if computing fails
+    if (hashtable_compute_if_absent(h, (void *) 0, compute_elem) != NULL || hashtable_size_approx(h) != N_SIZE_INSERTIONS) {
+        *err_str = "failed computation inserted something";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_update_threading(void * p_context, char ** err_str)
+{
+    (void) p_context;
+    hashtable_reclaim_t schemes[] = {
+        HASHTABLE_RECLAIM_HAZARD,
+        HASHTABLE_RECLAIM_EPOCH,
+        HASHTABLE_RECLAIM_QSBR,
+        HASHTABLE_RECLAIM_NONE,
+    };
+    uint32_t i, j;
+
+    for (i = 0; i < ARRAY_ELEMENTS(schemes); i++) {
+        hashtable_config_t config;
+        pthread_t threads[N_RECLAIM_THREADS];
+        hashtable_update_thread_arg_t args[N_RECLAIM_THREADS];
+
+        test_config_init(&config);
+        config.reclaim = schemes[i];
+        hashtable_t h = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!h) {
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // Everyone updates the same few keys
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            args[j].table = h;
+            args[j].id = j;
+            args[j].sum_in = 0;
+            args[j].sum_out = 0;
+            pthread_create(&(threads[j]), NULL, test_hashtable_update_thread_f, &(args[j]));
+        }
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_join(threads[j], NULL);
+
+        // Every token that went in came back out, or is still there
+        uint64_t sum_in = 0;
+        uint64_t sum_out = 0;
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            sum_in += args[j].sum_in;
+            sum_out += args[j].sum_out;
+        }
+        for (j = 0; j < N_UPDATE_KEYS; j++) sum_out += (uintptr_t) hashtable_get(h, (void *)(uintptr_t) j);
+
+        hashtable_thread_offline(h);
+        hashtable_free(h);
+
+        if (sum_in != sum_out) {
+            *err_str = "an update was lost";
+            return false;
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_iteration(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_t h = context->int_table;
+    hashtable_key_t key;
+    hashtable_elem_t elem;
+    uint32_t i;
+
+    uint32_t * seen = (uint32_t *) calloc(N_STRESS_INSERTIONS, sizeof(uint32_t));
+    if (!seen) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+
+    bool success = true;
+
+    // Nothing to see in an empty table
+    hashtable_iter_t it = hashtable_iter_create(h);
+    if (!it || hashtable_iter_next(it, &key, &elem)) {
+        *err_str = "empty table iteration failed";
+        success = false;
+    }
+    hashtable_iter_free(it);
+
+    // See everything once, removing every third key from under the iterator as we go
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_insert(h, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+    it = hashtable_iter_create(h);
+    while (success && hashtable_iter_next(it, &key, &elem)) {
+        uint32_t k = (uint32_t)(uintptr_t) key;
+        if (k >= N_STRESS_INSERTIONS || (uint32_t) atoi((char *) elem) != k) {
+            *err_str = "iterator gave a bad element";
+            success = false;
+        }
+        else {
+            seen[k]++;
+            if (k % 3 == 0) hashtable_remove(h, key);
+        }
+    }
+    hashtable_iter_free(it);
+    for (i = 0; success && i < N_STRESS_INSERTIONS; i++) {
+        if (seen[i] != 1) {
+            *err_str = "element not seen exactly once";
+            success = false;
+        }
+    }
+
+    // The removals stuck
+    memset(seen, 0, N_STRESS_INSERTIONS * sizeof(uint32_t));
+    it = hashtable_iter_create(h);
+    while (success && hashtable_iter_next(it, &key, NULL)) seen[(uintptr_t) key]++;
+    hashtable_iter_free(it);
+    for (i = 0; success && i < N_STRESS_INSERTIONS; i++) {
+        if (seen[i] != (i % 3 == 0 ? 0 : 1)) {
+            *err_str = "removed element seen, or remaining element missed";
+            success = false;
+        }
+    }
+
+    free(seen);
+
+    if (success) *err_str = NULL;
+    return success;
+}
+
+static bool test_hashtable_iteration_threading(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_reclaim_t schemes[] = {
+        HASHTABLE_RECLAIM_HAZARD,
+        HASHTABLE_RECLAIM_EPOCH,
+        HASHTABLE_RECLAIM_QSBR,
+        HASHTABLE_RECLAIM_NONE,
+    };
+    uint32_t i, j;
+
+    for (i = 0; i < ARRAY_ELEMENTS(schemes); i++) {
+        hashtable_config_t config;
+        pthread_t threads[N_RECLAIM_THREADS];
+        bool success = true;
+
+        test_config_init(&config);
+        config.reclaim = schemes[i];
+        hashtable_t h = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!h) {
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // Even keys stay put. Odd ones come and go while half the threads walk the table
+        for (j = 0; j < N_STRESS_INSERTIONS; j++) {
+            if (context->keys[j] % 2 == 0) hashtable_insert(h, (void *)(uintptr_t) context->keys[j], context->elems[j]);
+        }
+        hashtable_thread_offline(h);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * (*thread_f)(void *) = (j % 2) ? test_hashtable_churn_odd_thread_f : test_hashtable_iterate_thread_f;
+            pthread_create(&(threads[j]), NULL, thread_f, h);
+        }
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+
+        hashtable_free(h);
+
+        if (!success) {
+            *err_str = "concurrent iteration missed or repeated an element";
+            return false;
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_parallel_for_each(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t thread_counts[] = { 0, 1, 3, 8 };
+    uint32_t i, j;
+
+    atomic_uint_fast32_t * visits = (atomic_uint_fast32_t *) malloc(N_STRESS_INSERTIONS * sizeof(atomic_uint_fast32_t));
+    if (!visits) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+
+    bool success = true;
+
+    // A small table can't be split much. Make sure its few buckets still cover everything
+    for (i = 0; i < 3; i++) hashtable_insert(context->int_table, (void *)(uintptr_t) i, context->elems[i]);
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) atomic_init(&(visits[i]), 0);
+    if (hashtable_parallel_for_each(context->int_table, 8, test_hashtable_count_visit, visits) != 3) {
+        *err_str = "small table scan count incorrect";
+        success = false;
+    }
+    for (i = 0; success && i < 3; i++) {
+        if (atomic_load(&(visits[i])) != 1) {
+            *err_str = "small table element not visited exactly once";
+            success = false;
+        }
+    }
+
+    // Everything in, then scan with different numbers of threads
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_insert(context->int_table, (void *)(uintptr_t) i, context->elems[i]);
+    for (i = 0; success && i < ARRAY_ELEMENTS(thread_counts); i++) {
+        for (j = 0; j < N_STRESS_INSERTIONS; j++) atomic_init(&(visits[j]), 0);
+        if (hashtable_parallel_for_each(context->int_table, thread_counts[i], test_hashtable_count_visit, visits) != N_STRESS_INSERTIONS) {
+            *err_str = "scan count incorrect";
+            success = false;
+        }
+        for (j = 0; success && j < N_STRESS_INSERTIONS; j++) {
+            if (atomic_load(&(visits[j])) != 1) {
+                *err_str = "element not visited exactly once";
+                success = false;
+            }
+        }
+    }
+
+    free(visits);
+    if (!success) return false;
+
+    // Pitching in mustn't take this thread offline while it has an iterator
+    // open, or whatever another thread retires goes straight away. The
+    // lock-based engines don't use QSBR at all
+    if (test_engine >= HASHTABLE_ENGINE_MUTEX) {
+        *err_str = NULL;
+        return true;
+    }
+    hashtable_config_t config;
+    test_config_init(&config);
+    config.reclaim = HASHTABLE_RECLAIM_QSBR;
+    hashtable_t h = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+    uint32_t * canary = (uint32_t *) malloc(sizeof(uint32_t));
+    hashtable_iter_t it = h ? hashtable_iter_create(h) : NULL;
+    if (!canary || !it) {
+        hashtable_iter_free(it);
+        hashtable_free(h);
+        free(canary);
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    hashtable_parallel_for_each(h, 1, test_hashtable_count_visit, NULL);
+
+    pthread_t retirer;
+    atomic_store(&n_freed, 0);
+    pthread_create(&retirer, NULL, test_hashtable_qsbr_retire_thread_f, canary);
+    pthread_join(retirer, NULL);
+    if (atomic_load(&n_freed) != 0) {
+        *err_str = "scan took the calling thread offline";
+        success = false;
+    }
+
+    hashtable_iter_free(it);
+    hashtable_thread_offline(h);
+    hashtable_free(h);
+
+    if (success) *err_str = NULL;
+    return success;
+}
+
+static bool test_hashtable_shrink(void * p_context, char ** err_str)
+{
+    hashtable_test_context_t context = (hashtable_test_context_t) p_context;
+    hashtable_t h = context->int_table;
+    uint32_t round;
+    uint32_t i;
+
+    // Grow it big, then empty it out but for a few, twice over
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < N_SHRINK_KEYS; i++) hashtable_insert(h, (void *)(uintptr_t) i, (void *)(uintptr_t) (i + 1));
+        for (i = 0; i < N_SHRINK_KEYS; i++) {
+            if (i % SHRINK_KEEP_PERIOD) hashtable_remove(h, (void *)(uintptr_t) i);
+        }
+
+        // Only the ones we kept are left
+        if (hashtable_size_approx(h) != N_SHRINK_KEYS / SHRINK_KEEP_PERIOD) {
+            *err_str = "size incorrect after shrinking";
+            return false;
+        }
+        for (i = 0; i < N_SHRINK_KEYS; i++) {
+            hashtable_elem_t expected = (i % SHRINK_KEEP_PERIOD) ? NULL : (void *)(uintptr_t) (i + 1);
+            if (hashtable_get(h, (void *)(uintptr_t) i) != expected) {
+                *err_str = "shrinking lost or kept the wrong elements";
+                return false;
+            }
+        }
+    }
+
+    // Empty it completely, and it still works
+    for (i = 0; i < N_SHRINK_KEYS; i += SHRINK_KEEP_PERIOD) hashtable_remove(h, (void *)(uintptr_t) i);
+    if (hashtable_size_approx(h) != 0 || !hashtable_insert(h, (void *) 5, (void *) 6) || hashtable_get(h, (void *) 5) != (void *) 6) {
+        *err_str = "empty table unusable after shrinking";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_shrink_threading(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_reclaim_t schemes[] = {
+        HASHTABLE_RECLAIM_HAZARD,
+        HASHTABLE_RECLAIM_EPOCH,
+        HASHTABLE_RECLAIM_QSBR,
+        HASHTABLE_RECLAIM_NONE,
+    };
+    uint32_t i, j;
+
+    for (i = 0; i < ARRAY_ELEMENTS(schemes); i++) {
+        hashtable_config_t config;
+        pthread_t threads[N_RECLAIM_THREADS];
+        bool success = true;
+
+        test_config_init(&config);
+        config.reclaim = schemes[i];
+        hashtable_t h = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!h) {
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // A few keys stay throughout, while the table grows and shrinks around
+        // them and half the threads walk it
+        for (j = 0; j < N_STRESS_INSERTIONS; j++) {
+            if (context->keys[j] % SHRINK_KEEP_PERIOD == 0) hashtable_insert(h, (void *)(uintptr_t) context->keys[j], context->elems[j]);
+        }
+        hashtable_thread_offline(h);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * (*thread_f)(void *) = (j % 2) ? test_hashtable_grow_shrink_thread_f : test_hashtable_iterate_kept_thread_f;
+            pthread_create(&(threads[j]), NULL, thread_f, h);
+        }
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+
+        // Only the kept keys are left
+        if (hashtable_size_approx(h) != N_STRESS_INSERTIONS / SHRINK_KEEP_PERIOD + (N_STRESS_INSERTIONS % SHRINK_KEEP_PERIOD ? 1 : 0)) success = false;
+        for (j = 0; success && j < N_STRESS_INSERTIONS; j++) {
+            if (hashtable_contains(h, (void *)(uintptr_t) j) != (j % SHRINK_KEEP_PERIOD == 0)) success = false;
+        }
+        hashtable_thread_offline(h);
+        hashtable_free(h);
+
+        if (!success) {
+            *err_str = "element lost while growing and shrinking";
+            return false;
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_capacity(void * p_context, char ** err_str)
+{
+    size_t capacities[] = {0, 1, 100, 12345, N_SHRINK_KEYS};
+    uint32_t i;
+    uintptr_t k;
+
+    (void) p_context;
+
+    for (i = 0; i < ARRAY_ELEMENTS(capacities); i++) {
+        hashtable_config_t config;
+
+        test_config_init(&config);
+        config.capacity = capacities[i];
+        hashtable_t h = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!h) {
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // Fill it to capacity and past it, empty it, then fill it again
+        bool success = true;
+        uint32_t round;
+        for (round = 0; success && round < 2; round++) {
+            for (k = 0; k < 2*capacities[i] + 1; k++) hashtable_insert(h, (void *) k, (void *) (k + 1));
+            if (hashtable_size_approx(h) != 2*capacities[i] + 1) success = false;
+            for (k = 0; success && k < 2*capacities[i] + 1; k++) {
+                if (hashtable_get(h, (void *) k) != (void *) (k + 1)) success = false;
+            }
+            for (k = 0; k < 2*capacities[i] + 1; k++) hashtable_remove(h, (void *) k);
+            if (hashtable_size_approx(h) != 0 || hashtable_contains(h, (void *) 0)) success = false;
+        }
+        hashtable_free(h);
+
+        if (!success) {
+            *err_str = "pre-sized table lost or kept the wrong elements";
+            return false;
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_create_from(void * p_context, char ** err_str)
+{
+    (void) p_context;
+    hashtable_config_t config;
+    hashtable_key_t key;
+    uint32_t i;
+
+    hashtable_pair_t * pairs = (hashtable_pair_t *) malloc(2*N_SHRINK_KEYS * sizeof(hashtable_pair_t));
+    if (!pairs) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+
+    // Every key in a scrambled order, then every key again. The first copy wins
+    for (i = 0; i < N_SHRINK_KEYS; i++) {
+        uintptr_t k = (i * UINT32_C(40503)) % N_SHRINK_KEYS;
+        pairs[i].key = (void *) k;
+        pairs[i].elem = (void *) (k + 1);
+        pairs[N_SHRINK_KEYS + i].key = (void *) k;
+        pairs[N_SHRINK_KEYS + i].elem = (void *) (k + 2);
+    }
+    test_config_init(&config);
+    hashtable_t h = hashtable_create_from(pairs, 2*N_SHRINK_KEYS, hash_int, print_elem, NULL, &config);
+    free(pairs);
+    if (!h) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+
+    bool success = (hashtable_size_approx(h) == N_SHRINK_KEYS);
+    for (i = 0; success && i < N_SHRINK_KEYS; i++) {
+        if (hashtable_get(h, (void *)(uintptr_t) i) != (void *)(uintptr_t) (i + 1)) success = false;
+    }
+
+    // A walk sees each key once
+    uint32_t visited = 0;
+    hashtable_iter_t it = hashtable_iter_create(h);
+    while (success && hashtable_iter_next(it, &key, NULL)) {
+        if ((uintptr_t) key >= N_SHRINK_KEYS) success = false;
+        visited++;
+    }
+    hashtable_iter_free(it);
+    if (visited != N_SHRINK_KEYS) success = false;
+
+    // And it's an ordinary table from then on
+    for (i = 0; success && i < N_SHRINK_KEYS; i += 2) {
+        if (hashtable_remove(h, (void *)(uintptr_t) i) != (void *)(uintptr_t) (i + 1)) success = false;
+    }
+    if (!hashtable_insert(h, (void *)(uintptr_t) N_SHRINK_KEYS, (void *) 1) || hashtable_size_approx(h) != N_SHRINK_KEYS/2 + 1) success = false;
+    hashtable_free(h);
+    if (!success) {
+        *err_str = "bulk-loaded table has the wrong contents";
+        return false;
+    }
+
+    // Colliding keys, with an eq_f and a different reclamation scheme
+    hashtable_pair_t fruit[] = {
+        { "apple", "apple" }, { "banana", "banana" }, { "avocado", "avocado" },
+        { "apple", "second apple" }, { "blueberry", "blueberry" },
+    };
+    test_config_init(&config);
+    config.eq_f = eq_string;
+    config.reclaim = HASHTABLE_RECLAIM_EPOCH;
+    h = hashtable_create_from(fruit, ARRAY_ELEMENTS(fruit), hash_string_first, print_elem, NULL, &config);
+    if (!h) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    success = hashtable_size_approx(h) == 4 &&
+              hashtable_get(h, "apple") == fruit[0].elem &&
+              hashtable_get(h, "avocado") == fruit[2].elem &&
+              hashtable_get(h, "blueberry") == fruit[4].elem &&
+              !hashtable_contains(h, "almond");
+    hashtable_free(h);
+    if (!success) {
+        *err_str = "bulk-loaded collisions not told apart";
+        return false;
+    }
+
+    // Nothing at all is fine too
+    test_config_init(&config);
+    h = hashtable_create_from(NULL, 0, hash_int, print_elem, NULL, &config);
+    if (!h || hashtable_size_approx(h) != 0 || !hashtable_insert(h, (void *) 1, (void *) 1)) {
+        *err_str = "empty bulk load failed";
+        hashtable_free(h);
+        return false;
+    }
+    hashtable_free(h);
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_backoff(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_backoff_t policies[] = {
+        HASHTABLE_BACKOFF_NONE,
+        HASHTABLE_BACKOFF_EXPONENTIAL,
+        HASHTABLE_BACKOFF_ADAPTIVE,
+    };
+    hashtable_t default_table = context->int_table;
+    uint32_t i, j;
+
+    for (i = 0; i < ARRAY_ELEMENTS(policies); i++) {
+        hashtable_config_t config;
+        pthread_t threads[N_RECLAIM_THREADS];
+        bool success = true;
+
+        // Swap in a table using this policy
+        test_config_init(&config);
+        config.backoff = policies[i];
+        context->int_table = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+        if (!context->int_table) {
+            context->int_table = default_table;
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        // Nothing to fail against yet
+        if (hashtable_cas_failures(context->int_table) != 0) success = false;
+
+        // Fill it, then empty it, racing all the way
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_create(&(threads[j]), NULL, test_hashtable_insert_thread_f, p_context);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+        for (j = 0; j < N_RECLAIM_THREADS; j++) pthread_create(&(threads[j]), NULL, test_hashtable_remove_thread_f, p_context);
+        for (j = 0; j < N_RECLAIM_THREADS; j++) {
+            void * err_val;
+            pthread_join(threads[j], &err_val);
+            if (err_val) success = false;
+        }
+
+        // Check that nothing's there
+        for (j = 0; j < N_STRESS_INSERTIONS; j++) {
+            if (hashtable_contains(context->int_table, (void *)(uintptr_t) context->keys[j])) success = false;
+        }
+
+        hashtable_free(context->int_table);
+        context->int_table = default_table;
+
+        if (!success) {
+            *err_str = "threaded insertion or removal failed";
+            return false;
+        }
+    }
+
+    // One thread on its own never fails a CAS
+    uint64_t failures = hashtable_cas_failures(context->int_table);
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_remove(context->int_table, (void *)(uintptr_t) context->keys[i]);
+    if (hashtable_cas_failures(context->int_table) != failures) {
+        *err_str = "uncontended CAS failures counted";
+        return false;
+    }
+
+    // A bad policy is rejected
+    hashtable_config_t config;
+    test_config_init(&config);
+    config.backoff = (hashtable_backoff_t) (HASHTABLE_BACKOFF_ADAPTIVE + 1);
+    if (hashtable_create_with_config(hash_int, print_elem, NULL, &config)) {
+        *err_str = "invalid backoff accepted";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hashtable_stats(void * p_context, char ** err_str)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    hashtable_config_t config;
+    hashtable_stats_t stats;
+    uint32_t i;
+
+    // Nothing done yet
+    hashtable_get_stats(context->int_table, &stats);
+    if (stats.inserts || stats.gets || stats.removes || stats.searches || stats.resizes) {
+        *err_str = "fresh table has statistics";
+        return false;
+    }
+
+    // Fill it, look everything up, and empty it
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_get(context->int_table, (void *)(uintptr_t) context->keys[i]);
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_remove(context->int_table, (void *)(uintptr_t) context->keys[i]);
+
+    hashtable_get_stats(context->int_table, &stats);
+#if HASHTABLE_STATS
+    if (stats.inserts != N_STRESS_INSERTIONS || stats.gets != N_STRESS_INSERTIONS || stats.removes != N_STRESS_INSERTIONS) {
+        *err_str = "operations miscounted";
+        return false;
+    }
+#endif
+
+    // The rest only describe the list
+    if (test_engine != HASHTABLE_ENGINE_LIST) {
+        if (stats.searches || stats.sentinels || stats.resizes || stats.cas_failures) {
+            *err_str = "engine reports list statistics";
+            return false;
+        }
+
+        *err_str = NULL;
+        return true;
+    }
+
+    // Bucket 0 always has a sentinel, and one thread never fails a CAS
+    if (stats.sentinels == 0 || stats.cas_failures != 0) {
+        *err_str = "list statistics wrong";
+        return false;
+    }
+#if HASHTABLE_STATS
+    // It grew to hold everything, and shrank again. Every operation searched
+    if (stats.resizes < 2 || stats.searches < 3 * N_STRESS_INSERTIONS || stats.search_avg > (double) stats.search_max) {
+        *err_str = "list statistics wrong";
+        return false;
+    }
+#endif
+
+    // Removed nodes stay until the table is freed, without reclamation
+    test_config_init(&config);
+    config.reclaim = HASHTABLE_RECLAIM_NONE;
+    hashtable_t h = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+    test_config_init(&config);
+    hashtable_t other = hashtable_create_with_config(hash_int, print_elem, NULL, &config);
+    if (!h || !other) {
+        hashtable_free(h);
+        hashtable_free(other);
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_insert(h, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) hashtable_remove(h, (void *)(uintptr_t) context->keys[i]);
+    hashtable_get_stats(h, &stats);
+    hashtable_free(h);
+#if HASHTABLE_STATS
+    if (stats.retired_bytes < N_STRESS_INSERTIONS * sizeof(struct hashtable_node_t_)) {
+        *err_str = "saved nodes not counted";
+        return false;
+    }
+#endif
+
+    // Nodes removed from other tables, and not yet freed, aren't this one's
+    hashtable_get_stats(other, &stats);
+    hashtable_free(other);
+    if (stats.retired_bytes != 0) {
+        *err_str = "other tables' nodes counted";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static void * test_hashtable_insert_thread_f(void * p_context)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+    bool success;
+
+    // Insert everything. Intentionally races with copies of itself
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        success = hashtable_insert(context->int_table, (void *)(uintptr_t) context->keys[i], context->elems[i]);
+
+        // Make sure that either we put it there, or some other thread did
+        if (!success && !hashtable_contains(context->int_table, (void*)(uintptr_t) context->keys[i])) {
+            // Failure
+            return (void *) 1;
+        }
+    }
+
+    // Success
+    return (void *) 0;
+}
+
+static void * test_hashtable_remove_thread_f(void * p_context)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+
+    // Remove everything. Intentionally races with copies of itself
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        hashtable_elem_t elem = hashtable_remove(context->int_table, (void *)(uintptr_t) context->keys[i]);
+        // Check that we did remove it, and that we got the right one back
+        if (hashtable_contains(context->int_table, (void*)(uintptr_t) context->keys[i]) ||
+            (elem && strcmp((char *) elem, context->elems[i]) != 0)) {
+            // Failure
+            return (void *) 1;
+        }
+    }
+
+    // Success
+    return (void *) 0;
+}
+
+static void * test_hashtable_insert_neighbour_thread_f(void * p_context)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+
+    // Insert everything. Intentionally races with copies of itself
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        hashtable_key_t key = (void *)(uintptr_t) (context->keys[i] | NEIGHBOUR_BIT);
+        if (!hashtable_insert(context->int_table, key, context->elems[i]) && !hashtable_contains(context->int_table, key)) {
+            // Failure
+            return (void *) 1;
+        }
+    }
+
+    // Success
+    return (void *) 0;
+}
+
+static void * test_hashtable_insert_many_thread_f(void * p_context)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+
+    hashtable_key_t * keys = (hashtable_key_t *) malloc(N_STRESS_INSERTIONS * sizeof(hashtable_key_t));
+    if (!keys) return (void *) 1;
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) keys[i] = (hashtable_key_t)(uintptr_t) context->keys[i];
+
+    // Insert everything. Intentionally races with copies of itself
+    hashtable_insert_many(context->int_table, keys, (const hashtable_elem_t *) context->elems, N_STRESS_INSERTIONS);
+    hashtable_thread_offline(context->int_table);
+
+    // Whoever inserted them, they'd better all be there
+    void * err_val = (void *) 0;
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+        if (!hashtable_contains(context->int_table, keys[i])) err_val = (void *) 1;
+    }
+    hashtable_thread_offline(context->int_table);
+
+    free(keys);
+    return err_val;
+}
+
+static void * test_hashtable_remove_many_thread_f(void * p_context)
+{
+    hashtable_stress_context_t context = (hashtable_stress_context_t) p_context;
+    uint32_t i;
+
+    hashtable_key_t * keys = (hashtable_key_t *) malloc(N_STRESS_INSERTIONS * sizeof(hashtable_key_t));
+    if (!keys) return (void *) 0;
+    for (i = 0; i < N_STRESS_INSERTIONS; i++) keys[i] = (hashtable_key_t)(uintptr_t) context->keys[i];
+
+    // Remove everything. Intentionally races with copies of itself
+    size_t removed = hashtable_remove_many(context->int_table, keys, NULL, N_STRESS_INSERTIONS);
+    hashtable_thread_offline(context->int_table);
+
+    free(keys);
+    return (void *) (uintptr_t) removed;
+}
+
+static void * test_hashtable_update_thread_f(void * p_arg)
+{
+    hashtable_update_thread_arg_t * arg = (hashtable_update_thread_arg_t *) p_arg;
+    uint32_t seed = arg->id + 1;
+    uint32_t i;
+
+    for (i = 0; i < N_UPDATE_ROUNDS; i++) {
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        hashtable_key_t key = (void *)(uintptr_t) (seed % N_UPDATE_KEYS);
+        uintptr_t token = ((uintptr_t) arg->id << 24) | (i + 1);
+        hashtable_elem_t old;
+
+        switch ((seed >> 8) % 3) {
+        case 0:
+            arg->sum_in += token;
+            arg->sum_out += (uintptr_t) hashtable_put(arg->table, key, (void *) token);
+            break;
+        case 1:
+            old = hashtable_get(arg->table, key);
+            if (old && hashtable_replace_if(arg->table, key, old, (void *) token)) {
+                arg->sum_in += token;
+                arg->sum_out += (uintptr_t) old;
+            }
+            break;
+        default:
+            arg->sum_out += (uintptr_t) hashtable_remove(arg->table, key);
+            break;
+        }
+        hashtable_quiescent(arg->table);
+    }
+    hashtable_thread_offline(arg->table);
+
+    return NULL;
+}
+
+static void * test_hashtable_iterate_thread_f(void * p_table)
+{
+    hashtable_t h = (hashtable_t) p_table;
+    hashtable_key_t key;
+    uint32_t pass;
+    uint32_t i;
+
+    uint32_t * seen = (uint32_t *) malloc(N_STRESS_INSERTIONS * sizeof(uint32_t));
+    if (!seen) return (void *) 1;
+
+    void * err_val = (void *) 0;
+    for (pass = 0; !err_val && pass < N_ITER_PASSES; pass++) {
+        memset(seen, 0, N_STRESS_INSERTIONS * sizeof(uint32_t));
+
+        hashtable_iter_t it = hashtable_iter_create(h);
+        if (!it) err_val = (void *) 1;
+        while (!err_val && hashtable_iter_next(it, &key, NULL)) {
+            uintptr_t k = (uintptr_t) key;
+            if (k >= N_STRESS_INSERTIONS || ++seen[k] > 1) err_val = (void *) 1;
+        }
+        hashtable_iter_free(it);
+
+        // Keys present throughout are seen exactly once
+        for (i = 0; !err_val && i < N_STRESS_INSERTIONS; i += 2) {
+            if (seen[i] != 1) err_val = (void *) 1;
+        }
+        hashtable_quiescent(h);
+    }
+    hashtable_thread_offline(h);
+
+    free(seen);
+    return err_val;
+}
+
+static void * test_hashtable_churn_odd_thread_f(void * p_table)
+{
+    hashtable_t h = (hashtable_t) p_table;
+    uint32_t round;
+    uint32_t i;
+
+    for (round = 0; round < N_CHURN_ROUNDS; round++) {
+        for (i = 1; i < N_STRESS_INSERTIONS; i += 2) hashtable_insert(h, (void *)(uintptr_t) i, (void *)(uintptr_t) i);
+        for (i = 1; i < N_STRESS_INSERTIONS; i += 2) hashtable_remove(h, (void *)(uintptr_t) i);
+        hashtable_quiescent(h);
+    }
+    hashtable_thread_offline(h);
+
+    return (void *) 0;
+}
+
+static void * test_hashtable_grow_shrink_thread_f(void * p_table)
+{
+    hashtable_t h = (hashtable_t) p_table;
+    uint32_t round;
+    uint32_t i;
+
+    // Everything but the kept keys, so the table swings between too full and too empty
+    for (round = 0; round < N_CHURN_ROUNDS; round++) {
+        for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+            if (i % SHRINK_KEEP_PERIOD) hashtable_insert(h, (void *)(uintptr_t) i, (void *)(uintptr_t) i);
+        }
+        for (i = 0; i < N_STRESS_INSERTIONS; i++) {
+            if (i % SHRINK_KEEP_PERIOD) hashtable_remove(h, (void *)(uintptr_t) i);
+        }
+        hashtable_quiescent(h);
+    }
+    hashtable_thread_offline(h);
+
+    return (void *) 0;
+}
+
+static void * test_hashtable_iterate_kept_thread_f(void * p_table)
+{
+    hashtable_t h = (hashtable_t) p_table;
+    hashtable_key_t key;
+    uint32_t pass;
+    uint32_t i;
+
+    uint32_t * seen = (uint32_t *) malloc(N_STRESS_INSERTIONS * sizeof(uint32_t));
+    if (!seen) return (void *) 1;
+
+    void * err_val = (void *) 0;
+    for (pass = 0; !err_val && pass < N_ITER_PASSES; pass++) {
+        memset(seen, 0, N_STRESS_INSERTIONS * sizeof(uint32_t));
+
+        // Walk it, with sentinels coming and going under the iterator
+        hashtable_iter_t it = hashtable_iter_create(h);
+        if (!it) err_val = (void *) 1;
+        while (!err_val && hashtable_iter_next(it, &key, NULL)) {
+            uintptr_t k = (uintptr_t) key;
+            if (k >= N_STRESS_INSERTIONS || ++seen[k] > 1) err_val = (void *) 1;
+        }
+        hashtable_iter_free(it);
+
+        // The kept keys are always there, whether walked or looked up
+        for (i = 0; !err_val && i < N_STRESS_INSERTIONS; i += SHRINK_KEEP_PERIOD) {
+            if (seen[i] != 1 || !hashtable_contains(h, (void *)(uintptr_t) i)) err_val = (void *) 1;
+        }
+        hashtable_quiescent(h);
+    }
+    hashtable_thread_offline(h);
+
+    free(seen);
+    return err_val;
 }
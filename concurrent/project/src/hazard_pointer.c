@@ -0,0 +1,318 @@
+/**
+ * @file    hazard_pointer.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implementation of hazard pointer based memory reclamation
+ *
+ * Every thread which touches the module is given a record, holding its
+ * hazard slots and its list of retired pointers. Records are kept in a
+ * global list which only ever grows; a thread which exits gives its record
+ * up for reuse, along with anything it still had retired.
+ *
+ * @addtogroup HAZARD_POINTER
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// This module
+#include "hazard_pointer.h"
+
+// Standard
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define HAZARD_POINTER_CACHE_LINE       (64)    /**< Records are aligned to this many bytes */
+#define HAZARD_POINTER_SCAN_MIN         (64)    /**< Never scan with fewer than this many pointers retired */
+#define HAZARD_POINTER_RETIRED_INIT     (64)    /**< The initial size of a retired list */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   A pointer waiting to be freed
+ */
+typedef struct hazard_pointer_retired_t_ {
+    void *              ptr;            /**< The retired pointer */
+    free_f_t            free_f;         /**< The function which frees it */
+} hazard_pointer_retired_t;
+
+/**
+ * @brief   Per-thread reclamation state
+ */
+typedef struct hazard_pointer_record_t_ {
+    _Alignas(HAZARD_POINTER_CACHE_LINE)
+    atomic_uintptr_t                    hazards[HAZARD_POINTER_SLOTS];  /**< Published pointers */
+    atomic_bool                         active;         /**< Whether a live thread owns this record */
+    struct hazard_pointer_record_t_ *   next;           /**< The next record. Never changes once published */
+    hazard_pointer_retired_t *          retired;        /**< Pointers retired by the owner */
+    size_t                              retired_count;  /**< The number of retired pointers */
+    size_t                              retired_size;   /**< The number of slots allocated for retired pointers */
+    uintptr_t *                         snapshot;       /**< Scratch space for a scan */
+    size_t                              snapshot_size;  /**< The number of slots allocated for the snapshot */
+} hazard_pointer_record_t;
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static _Atomic(hazard_pointer_record_t *) hazard_pointer_records = NULL;
+
+static atomic_uint_fast32_t hazard_pointer_record_count = 0;
+
+static pthread_once_t hazard_pointer_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t hazard_pointer_key;
+
+static _Thread_local hazard_pointer_record_t * hazard_pointer_record = NULL;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Gets the calling thread's record, acquiring one if necessary
+ *
+ * @return      The record, or NULL if memory allocation failed
+ */
+static inline hazard_pointer_record_t * hazard_pointer_record_get(void);
+
+/**
+ * @brief   Takes an inactive record, or allocates and publishes a new one
+ *
+ * @return      The record, or NULL if memory allocation failed
+ */
+static hazard_pointer_record_t * hazard_pointer_record_acquire(void);
+
+/**
+ * @brief   Creates the key used to release records on thread exit
+ */
+static void hazard_pointer_key_create(void);
+
+/**
+ * @brief   Thread exit hook. Clears the record's slots and gives it up
+ *
+ * @param[in] p_record:     The exiting thread's record
+ */
+static void hazard_pointer_record_release(void * p_record);
+
+/**
+ * @brief   Frees every pointer in record's retired list which isn't published
+ *
+ * @param[in,out] record:   The record to scan for
+ */
+static void hazard_pointer_record_scan(hazard_pointer_record_t * record);
+
+/**
+ * @brief   Ordering function for qsort and bsearch
+ */
+static int hazard_pointer_compare(const void * a, const void * b);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+void hazard_pointer_set(uint32_t slot, void * ptr)
+{
+    hazard_pointer_record_t * record = hazard_pointer_record_get();
+
+    // Check input
+    if (!record || slot >= HAZARD_POINTER_SLOTS) return;
+
+    // Sequentially consistent, so the caller's validating load can't be
+    // reordered before this store
+    atomic_store(&(record->hazards[slot]), (uintptr_t) ptr);
+}
+
+void hazard_pointer_clear(void)
+{
+    hazard_pointer_clear_range(0, HAZARD_POINTER_SLOTS);
+}
+
+void hazard_pointer_clear_range(uint32_t first, uint32_t n)
+{
+    hazard_pointer_record_t * record = hazard_pointer_record;
+    uint32_t i;
+
+    // Nothing published if we haven't got a record
+    if (!record) return;
+
+    for (i = first; i < HAZARD_POINTER_SLOTS && i - first < n; i++) {
+        atomic_store_explicit(&(record->hazards[i]), (uintptr_t) NULL, memory_order_release);
+    }
+}
+
+uint32_t hazard_pointer_retire(void * ptr, free_f_t free_f)
+{
+    hazard_pointer_record_t * record = hazard_pointer_record_get();
+
+    // Check input
+    if (!record || !free_f) return 1;
+
+    // Grow if necessary
+    if (record->retired_count == record->retired_size) {
+        size_t new_size = record->retired_size ? record->retired_size*2 : HAZARD_POINTER_RETIRED_INIT;
+        hazard_pointer_retired_t * new_retired = (hazard_pointer_retired_t *) realloc(record->retired, new_size * sizeof(hazard_pointer_retired_t));
+        if (!new_retired) return 1;
+
+        record->retired = new_retired;
+        record->retired_size = new_size;
+    }
+
+    // Save it
+    record->retired[record->retired_count].ptr = ptr;
+    record->retired[record->retired_count].free_f = free_f;
+    (record->retired_count)++;
+
+    // Scan once there are enough retired pointers that at least half
+    // must be unprotected, keeping each scan's cost amortized O(1)
+    size_t threshold = 2 * HAZARD_POINTER_SLOTS * atomic_load_explicit(&hazard_pointer_record_count, memory_order_relaxed);
+    if (threshold < HAZARD_POINTER_SCAN_MIN) threshold = HAZARD_POINTER_SCAN_MIN;
+    if (record->retired_count >= threshold) hazard_pointer_record_scan(record);
+
+    // Success
+    return 0;
+}
+
+void hazard_pointer_scan(void)
+{
+    hazard_pointer_record_t * record = hazard_pointer_record;
+
+    if (record) hazard_pointer_record_scan(record);
+}
+
+size_t hazard_pointer_retired(void)
+{
+    hazard_pointer_record_t * record = hazard_pointer_record;
+
+    return record ? record->retired_count : 0;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static inline hazard_pointer_record_t * hazard_pointer_record_get(void)
+{
+    if (!hazard_pointer_record) hazard_pointer_record = hazard_pointer_record_acquire();
+
+    return hazard_pointer_record;
+}
+
+static hazard_pointer_record_t * hazard_pointer_record_acquire(void)
+{
+    hazard_pointer_record_t * record;
+
+    // Make sure we give the record back when this thread exits
+    pthread_once(&hazard_pointer_key_once, hazard_pointer_key_create);
+
+    // Try to reuse a record from a thread which has exited
+    for (record = atomic_load(&hazard_pointer_records); record; record = record->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&(record->active), &expected, true)) {
+            pthread_setspecific(hazard_pointer_key, record);
+            return record;
+        }
+    }
+
+    // Allocate a new one
+    record = (hazard_pointer_record_t *) aligned_alloc(HAZARD_POINTER_CACHE_LINE, sizeof(hazard_pointer_record_t));
+    if (!record) return NULL;
+
+    // Initialize fields
+    uint32_t i;
+    for (i = 0; i < HAZARD_POINTER_SLOTS; i++) atomic_init(&(record->hazards[i]), (uintptr_t) NULL);
+    atomic_init(&(record->active), true);
+    record->retired = NULL;
+    record->retired_count = 0;
+    record->retired_size = 0;
+    record->snapshot = NULL;
+    record->snapshot_size = 0;
+
+    // Count it, then push it onto the list, so the count never falls behind
+    // the records a scan can see. Records are never removed, so there is no ABA
+    atomic_fetch_add(&hazard_pointer_record_count, 1);
+    record->next = atomic_load(&hazard_pointer_records);
+    while (!atomic_compare_exchange_weak(&hazard_pointer_records, &(record->next), record));
+
+    pthread_setspecific(hazard_pointer_key, record);
+
+    return record;
+}
+
+static void hazard_pointer_key_create(void)
+{
+    pthread_key_create(&hazard_pointer_key, hazard_pointer_record_release);
+}
+
+static void hazard_pointer_record_release(void * p_record)
+{
+    hazard_pointer_record_t * record = (hazard_pointer_record_t *) p_record;
+
+    // Publish nothing, and free what we can. The rest is inherited
+    // by the next thread to take this record
+    hazard_pointer_record = record;
+    hazard_pointer_clear();
+    hazard_pointer_record_scan(record);
+    hazard_pointer_record = NULL;
+
+    atomic_store(&(record->active), false);
+}
+
+static void hazard_pointer_record_scan(hazard_pointer_record_t * record)
+{
+    hazard_pointer_record_t * curr;
+    size_t n_hazards;
+    size_t needed;
+    size_t i;
+
+    // Records are counted before they're published, so this is normally enough
+    // room to copy every slot. A missed hazard would free a protected
+    // pointer, so rather than ever cut the copy short, grow it and start over
+    needed = HAZARD_POINTER_SLOTS * atomic_load(&hazard_pointer_record_count);
+    do {
+        if (needed > record->snapshot_size) {
+            uintptr_t * new_snapshot = (uintptr_t *) realloc(record->snapshot, needed * sizeof(uintptr_t));
+
+            // Can't scan without it. We'll try again next time
+            if (!new_snapshot) return;
+
+            record->snapshot = new_snapshot;
+            record->snapshot_size = needed;
+        }
+
+        // Collect every published pointer
+        n_hazards = 0;
+        needed = 0;
+        for (curr = atomic_load(&hazard_pointer_records); curr; curr = curr->next) {
+            uint32_t j;
+            needed += HAZARD_POINTER_SLOTS;
+            for (j = 0; j < HAZARD_POINTER_SLOTS; j++) {
+                uintptr_t hazard = atomic_load(&(curr->hazards[j]));
+                if (hazard && n_hazards < record->snapshot_size) record->snapshot[n_hazards++] = hazard;
+            }
+        }
+    } while (needed > record->snapshot_size);
+    qsort(record->snapshot, n_hazards, sizeof(uintptr_t), hazard_pointer_compare);
+
+    // Free everything nobody is looking at, compacting what's left
+    size_t kept = 0;
+    for (i = 0; i < record->retired_count; i++) {
+        uintptr_t ptr = (uintptr_t) record->retired[i].ptr;
+        if (bsearch(&ptr, record->snapshot, n_hazards, sizeof(uintptr_t), hazard_pointer_compare)) {
+            record->retired[kept++] = record->retired[i];
+        }
+        else {
+            record->retired[i].free_f(record->retired[i].ptr);
+        }
+    }
+    record->retired_count = kept;
+}
+
+static int hazard_pointer_compare(const void * a, const void * b)
+{
+    uintptr_t a_val = *((const uintptr_t *) a);
+    uintptr_t b_val = *((const uintptr_t *) b);
+
+    if (a_val < b_val)      return -1;
+    else if (a_val > b_val) return 1;
+    else                    return 0;
+}
+
+/** @} addtogroup HAZARD_POINTER */
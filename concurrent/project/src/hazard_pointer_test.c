@@ -0,0 +1,377 @@
+/**
+ * @file    hazard_pointer_test.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Unit test for hazard pointer reclamation
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Module under test
+#include "hazard_pointer.h"
+
+// Standard Libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Modules
+#include "unit_test.h"
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define N_STRESS_RETIRES        (10000)
+#define N_THREADS               (8)
+#define N_SWAPS                 (20000)
+
+#define MAX_RETIRED             (1024)      // Far more than 2 * slots * threads in this test
+#define CANARY                  (0xC0FFEE)
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static atomic_uint_fast32_t n_freed;
+
+static atomic_uintptr_t shared;
+
+static atomic_bool writers_done;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Resets the counters
+ */
+static bool test_hazard_pointer_standard_pre(void** p_context, char** err_str);
+
+/**
+ * @brief   Frees anything left behind by the test
+ */
+static void test_hazard_pointer_standard_post(void* p_context);
+
+/**
+ * @brief   Free function which counts calls, and poisons the memory first
+ */
+static void counting_free(void* ptr);
+
+/**
+ * @brief   Tests that a published pointer isn't freed, and that it is once cleared
+ */
+static bool test_hazard_pointer_protection(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that clearing some slots leaves the others published
+ */
+static bool test_hazard_pointer_partial_clear(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that the number of retired pointers stays bounded
+ */
+static bool test_hazard_pointer_bounded(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests readers against writers retiring what the readers are looking at
+ */
+static bool test_hazard_pointer_threading(void* p_context, char** err_str);
+
+/**
+ * @brief   Repeatedly replaces the shared object, retiring the old one
+ */
+static void* test_hazard_pointer_writer_thread_f(void* p_context);
+
+/**
+ * @brief   Repeatedly protects and checks the shared object
+ */
+static void* test_hazard_pointer_reader_thread_f(void* p_context);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+/**
+ * @brief   Test entry point
+ *
+ * @return  1 if one or more tests failed, 0 otherwise
+ */
+int main(void)
+{
+    uint32_t err;
+    unit_test_t hazard_pointer_tests;
+
+    // Allocate test structure
+    hazard_pointer_tests = unit_test_create("hazard pointer");
+
+    // Register tests
+    unit_test_register(hazard_pointer_tests,
+                       "protection",
+                       test_hazard_pointer_standard_pre,
+                       test_hazard_pointer_protection,
+                       test_hazard_pointer_standard_post);
+    unit_test_register(hazard_pointer_tests,
+                       "partial clear",
+                       test_hazard_pointer_standard_pre,
+                       test_hazard_pointer_partial_clear,
+                       test_hazard_pointer_standard_post);
+    unit_test_register(hazard_pointer_tests,
+                       "bounded",
+                       test_hazard_pointer_standard_pre,
+                       test_hazard_pointer_bounded,
+                       test_hazard_pointer_standard_post);
+    unit_test_register(hazard_pointer_tests,
+                       "threading",
+                       test_hazard_pointer_standard_pre,
+                       test_hazard_pointer_threading,
+                       test_hazard_pointer_standard_post);
+
+    // Run tests
+    if (unit_test_run(hazard_pointer_tests)) err = 1;
+    else                                     err = 0;
+
+    // Free test structure
+    unit_test_free(hazard_pointer_tests);
+
+    return err;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static bool test_hazard_pointer_standard_pre(void** p_context, char** err_str)
+{
+    // Ensure params are good
+    if (!err_str) {
+        return false;
+    }
+    if (!p_context) {
+        *err_str = "!!! bad params !!!";
+        return false;
+    }
+
+    // No context needed
+    *p_context = NULL;
+    atomic_store(&n_freed, 0);
+    atomic_store(&shared, (uintptr_t) NULL);
+    atomic_store(&writers_done, false);
+
+    *err_str = NULL;
+    return true;
+}
+
+static void test_hazard_pointer_standard_post(void* p_context)
+{
+    (void) p_context;
+
+    // Nothing published by this thread, so everything it retired goes
+    hazard_pointer_clear();
+    hazard_pointer_scan();
+
+    // Free the shared object, if there is one
+    void* last = (void*) atomic_exchange(&shared, (uintptr_t) NULL);
+    if (last) free(last);
+}
+
+static void counting_free(void* ptr)
+{
+    *((uint32_t*) ptr) = 0;
+    free(ptr);
+    atomic_fetch_add(&n_freed, 1);
+}
+
+static bool test_hazard_pointer_protection(void* p_context, char** err_str)
+{
+    (void) p_context;
+
+    uint32_t* reference = (uint32_t*) malloc(sizeof(uint32_t));
+    if (!reference) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+    *reference = CANARY;
+
+    // Protect it, then retire it
+    hazard_pointer_set(0, reference);
+    if (hazard_pointer_retire(reference, counting_free)) {
+        free(reference);
+        *err_str = "retire failed";
+        return false;
+    }
+
+    // Scanning must leave it alone
+    hazard_pointer_scan();
+    if (atomic_load(&n_freed) != 0 || hazard_pointer_retired() != 1 || *reference != CANARY) {
+        *err_str = "protected pointer freed";
+        return false;
+    }
+
+    // Once it's not protected, it goes
+    hazard_pointer_clear();
+    hazard_pointer_scan();
+    if (atomic_load(&n_freed) != 1 || hazard_pointer_retired() != 0) {
+        *err_str = "unprotected pointer not freed";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hazard_pointer_partial_clear(void* p_context, char** err_str)
+{
+    (void) p_context;
+
+    uint32_t* reference = (uint32_t*) malloc(sizeof(uint32_t));
+    if (!reference) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+    *reference = CANARY;
+
+    // Protect it in the last slot, then retire it
+    hazard_pointer_set(HAZARD_POINTER_SLOTS - 1, reference);
+    if (hazard_pointer_retire(reference, counting_free)) {
+        free(reference);
+        *err_str = "retire failed";
+        return false;
+    }
+
+    // Clearing the other slots must leave it alone
+    hazard_pointer_clear_range(0, HAZARD_POINTER_SLOTS - 1);
+    hazard_pointer_scan();
+    if (atomic_load(&n_freed) != 0 || *reference != CANARY) {
+        *err_str = "pointer freed after clearing other slots";
+        return false;
+    }
+
+    // Clearing its own slot frees it, even with a count running off the end
+    hazard_pointer_clear_range(HAZARD_POINTER_SLOTS - 1, HAZARD_POINTER_SLOTS);
+    hazard_pointer_scan();
+    if (atomic_load(&n_freed) != 1 || hazard_pointer_retired() != 0) {
+        *err_str = "pointer not freed after clearing its slot";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hazard_pointer_bounded(void* p_context, char** err_str)
+{
+    (void) p_context;
+    uint32_t i;
+
+    // Retire a lot of things, without ever scanning explicitly
+    for (i = 0; i < N_STRESS_RETIRES; i++) {
+        uint32_t* reference = (uint32_t*) malloc(sizeof(uint32_t));
+        if (!reference || hazard_pointer_retire(reference, counting_free)) {
+            free(reference);
+            *err_str = "retire failed";
+            return false;
+        }
+
+        if (hazard_pointer_retired() > MAX_RETIRED) {
+            *err_str = "retired list grew without bound";
+            return false;
+        }
+    }
+
+    // Everything that's gone was freed exactly once
+    if (atomic_load(&n_freed) + hazard_pointer_retired() != N_STRESS_RETIRES) {
+        *err_str = "retired pointer lost";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_hazard_pointer_threading(void* p_context, char** err_str)
+{
+    uint32_t i;
+
+    // Start with something to look at
+    uint32_t* first = (uint32_t*) malloc(sizeof(uint32_t));
+    if (!first) {
+        *err_str = "test allocation failed";
+        return false;
+    }
+    *first = CANARY;
+    atomic_store(&shared, (uintptr_t) first);
+
+    // Start readers and writers
+    pthread_t readers[N_THREADS];
+    pthread_t writers[N_THREADS];
+    for (i = 0; i < N_THREADS; i++) {
+        pthread_create(&(readers[i]), NULL, test_hazard_pointer_reader_thread_f, p_context);
+        pthread_create(&(writers[i]), NULL, test_hazard_pointer_writer_thread_f, p_context);
+    }
+
+    // Wait on writers, then tell readers to stop
+    bool success = true;
+    for (i = 0; i < N_THREADS; i++) {
+        void* err_val;
+        pthread_join(writers[i], &err_val);
+        if (err_val) success = false;
+    }
+    atomic_store(&writers_done, true);
+    for (i = 0; i < N_THREADS; i++) {
+        void* err_val;
+        pthread_join(readers[i], &err_val);
+        if (err_val) success = false;
+    }
+
+    if (!success) {
+        *err_str = "reader saw freed memory";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static void* test_hazard_pointer_writer_thread_f(void* p_context)
+{
+    (void) p_context;
+    uint32_t i;
+
+    for (i = 0; i < N_SWAPS; i++) {
+        uint32_t* reference = (uint32_t*) malloc(sizeof(uint32_t));
+        if (!reference) return (void*) 1;
+        *reference = CANARY;
+
+        // Swap it in. The old one is now unreachable, so retire it
+        void* old = (void*) atomic_exchange(&shared, (uintptr_t) reference);
+        if (hazard_pointer_retire(old, counting_free)) {
+            free(old);
+            return (void*) 1;
+        }
+    }
+
+    return (void*) 0;
+}
+
+static void* test_hazard_pointer_reader_thread_f(void* p_context)
+{
+    (void) p_context;
+
+    while (!atomic_load(&writers_done)) {
+        uint32_t* reference;
+
+        // Standard protect-and-validate loop
+        do {
+            reference = (uint32_t*) atomic_load(&shared);
+            hazard_pointer_set(0, reference);
+        } while (reference != (uint32_t*) atomic_load(&shared));
+
+        // Poisoned means it was freed while we held it
+        if (*reference != CANARY) {
+            hazard_pointer_clear();
+            return (void*) 1;
+        }
+
+        hazard_pointer_clear();
+    }
+
+    return (void*) 0;
+}
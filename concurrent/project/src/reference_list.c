@@ -5,6 +5,14 @@
  * @brief   Implementation of a concurrent reference list, to store pointers
  *          for later deallocation
  *
+ * References are stored in blocks of REFERENCE_LIST_NODE_REFS. Each list keeps
+ * a few partially filled blocks, striped by thread so that threads rarely
+ * contend for one. A thread takes a stripe's block with an exchange, fills in
+ * a reference, and puts it back; full blocks are published with a single
+ * lock-free push onto the front of the list. Saving a reference is therefore
+ * allocation-free except once per block, and costs the same no matter how
+ * many references have already been saved
+ *
  * @addtogroup REFERENCE_LIST
  * @{
  */
@@ -22,6 +30,11 @@
 
 // Modules
 #include "reference_list_node.h"
+#include "thread_index.h"
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define REFERENCE_LIST_STRIPES      (16)    /**< The number of fill blocks per list. Must be a power of two */
 
 /* --- PRIVATE DATA TYPES --------------------------------------------------- */
 
@@ -29,10 +42,29 @@
  * @brief   The reference list structure
  */
 struct reference_list_t_ {
-    reference_list_node_t   head;       /**< The beginning of the actual list */
-    free_f_t                free_f;     /**< A function to free individual elements */
+    reference_list_node_t               head;                           /**< The beginning of the actual list */
+    free_f_t                            free_f;                         /**< A function to free individual elements */
+    _Atomic(reference_list_node_t)      fill[REFERENCE_LIST_STRIPES];   /**< Partially filled blocks, not yet in the list */
 };
 
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Publishes a block by pushing it onto the front of the list
+ *
+ * @param[in,out] r:    The list to push onto
+ * @param[in] node:     The block to push. Must not be in the list already
+ */
+static void reference_list_push(reference_list_t r, reference_list_node_t node);
+
+/**
+ * @brief   Frees every reference in a block, and the block itself
+ *
+ * @param[in] r:        The list the block belongs to
+ * @param[in] node:     The block to free
+ */
+static void reference_list_node_free_refs(reference_list_t r, reference_list_node_t node);
+
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 
 reference_list_t reference_list_create(free_f_t free_f)
@@ -49,6 +81,13 @@ reference_list_t reference_list_create(free_f_t free_f)
     // Set fields
     r->free_f = free_f;
     r->head = reference_list_node_create(NULL); // The list is headed by a dummy node
+    if (!r->head) {
+        free(r);
+        return NULL;
+    }
+
+    uint32_t i;
+    for (i = 0; i < REFERENCE_LIST_STRIPES; i++) atomic_init(&(r->fill[i]), NULL);
 
     // Pass it back
     return r;
@@ -64,13 +103,19 @@ void reference_list_free(reference_list_t r)
             // Get next
             next = reference_list_node_get_next(curr);
 
-            // Free reference and node
-            r->free_f(reference_list_node_get_ref(curr));
-            reference_list_node_free(curr);
+            // Free references and node
+            reference_list_node_free_refs(r, curr);
 
             // Keep walking
             curr = next;
         }
+
+        // Free the blocks that never filled up
+        uint32_t i;
+        for (i = 0; i < REFERENCE_LIST_STRIPES; i++) {
+            reference_list_node_t fill = atomic_load(&(r->fill[i]));
+            if (fill) reference_list_node_free_refs(r, fill);
+        }
         
         // Free the head node. No reference freeing necessary
         // because it is a dummy
@@ -85,28 +130,54 @@ uint32_t reference_list_insert(reference_list_t r, void * elem)
 {
     if (!r) return 1;
 
-    // Create a node for this element
-    reference_list_node_t node = reference_list_node_create(elem);
-    if (!node) return 1;
+    // Take our stripe's block, so nobody else can touch it
+    _Atomic(reference_list_node_t) * fill = &(r->fill[thread_index_stripe(REFERENCE_LIST_STRIPES)]);
+    reference_list_node_t node = atomic_exchange(fill, NULL);
 
-    // Loop till we successfuly put it in
-    bool insert_success = false;
-    do {
-        // Find the end
-        reference_list_node_t curr = r->head;
-        reference_list_node_t next = reference_list_node_get_next(curr);
-        while (next) {
-            curr = next;
-            next = reference_list_node_get_next(curr);
-        }
+    // Add to it, or start a new one
+    if (node) {
+        reference_list_node_add_ref(node, elem);
+    }
+    else {
+        node = reference_list_node_create(elem);
+        if (!node) return 1;
+    }
 
-        // Try to insert
-        insert_success = reference_list_node_set_next(curr, node);
-    } while (!insert_success);
+    // Publish it if it's full. Otherwise put it back, publishing
+    // whatever another thread left there in the meantime
+    if (reference_list_node_is_full(node)) {
+        reference_list_push(r, node);
+    }
+    else {
+        reference_list_node_t displaced = atomic_exchange(fill, node);
+        if (displaced) reference_list_push(r, displaced);
+    }
 
     // Success
     return 0;
 }
 
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static void reference_list_push(reference_list_t r, reference_list_node_t node)
+{
+    // Push it on the front, right after the dummy head. Nodes are never
+    // removed while the list is live, so there is no ABA to worry about
+    reference_list_node_t first;
+    do {
+        first = reference_list_node_get_next(r->head);
+        reference_list_node_init_next(node, first);
+    } while (!reference_list_node_cas_next(r->head, first, node));
+}
+
+static void reference_list_node_free_refs(reference_list_t r, reference_list_node_t node)
+{
+    uint32_t i;
+    uint32_t count = reference_list_node_count(node);
+
+    for (i = 0; i < count; i++) r->free_f(reference_list_node_get_ref_at(node, i));
+    reference_list_node_free(node);
+}
+
 /** @} addgtogroup REFERENCE_LIST */
 
@@ -29,8 +29,9 @@
  * @brief   Internal data type for a reference list node
  */
 struct reference_list_node_t_ {
-    void*               ref;    /**< The stored reference */
-    atomic_uintptr_t    next;   /**< The next node in the list */
+    atomic_uintptr_t    next;                               /**< The next node in the list */
+    uint32_t            count;                              /**< The number of stored references */
+    void*               refs[REFERENCE_LIST_NODE_REFS];     /**< The stored references */
 };
 
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
@@ -44,7 +45,8 @@ reference_list_node_t reference_list_node_create(void* ref)
     if (!node) return NULL;
 
     // Initialize fields
-    node->ref = ref;
+    node->refs[0] = ref;
+    node->count = 1;
     atomic_init(&(node->next), ATOMIC_NULL);
 
     // Pass it back
@@ -62,7 +64,37 @@ void* reference_list_node_get_ref(reference_list_node_t node)
     if (!node) return NULL;
 
     // Return reference
-    return node->ref;
+    return node->refs[0];
+}
+
+void* reference_list_node_get_ref_at(reference_list_node_t node, uint32_t i)
+{
+    // Check input
+    if (!node || i >= node->count) return NULL;
+
+    // Return reference
+    return node->refs[i];
+}
+
+uint32_t reference_list_node_count(reference_list_node_t node)
+{
+    return node ? node->count : 0;
+}
+
+bool reference_list_node_add_ref(reference_list_node_t node, void* ref)
+{
+    // Check input
+    if (!node || node->count >= REFERENCE_LIST_NODE_REFS) return false;
+
+    // Save it
+    node->refs[(node->count)++] = ref;
+
+    return true;
+}
+
+bool reference_list_node_is_full(reference_list_node_t node)
+{
+    return !node || node->count >= REFERENCE_LIST_NODE_REFS;
 }
 
 reference_list_node_t reference_list_node_get_next(reference_list_node_t node)
@@ -81,4 +113,24 @@ bool reference_list_node_set_next(reference_list_node_t node, reference_list_nod
     return atomic_compare_exchange_strong(&(node->next), &expected, (atomic_uintptr_t) next);
 }
 
+void reference_list_node_init_next(reference_list_node_t node, reference_list_node_t next)
+{
+    // Check input
+    if (!node) return;
+
+    // Nobody else can see it yet, so no ordering needed
+    atomic_store_explicit(&(node->next), (uintptr_t) next, memory_order_relaxed);
+}
+
+bool reference_list_node_cas_next(reference_list_node_t node, reference_list_node_t expected, reference_list_node_t next)
+{
+    // Check input
+    if (!node) return false;
+    if (!next) return false;
+
+    // Attempt to swap next
+    uintptr_t expected_val = (uintptr_t) expected;
+    return atomic_compare_exchange_strong(&(node->next), &expected_val, (uintptr_t) next);
+}
+
 /** @} addtogroup REFERENCE_LIST_NODE */
@@ -53,6 +53,16 @@ static bool test_reference_list_node_ref(void * p_context, char ** err_str);
  */
 static bool test_reference_list_node_next(void * p_context, char ** err_str);
 
+/**
+ * @brief   Tests initializing and compare-and-swapping the next field
+ */
+static bool test_reference_list_node_cas_next(void * p_context, char ** err_str);
+
+/**
+ * @brief   Tests storing many references in one node
+ */
+static bool test_reference_list_node_block(void * p_context, char ** err_str);
+
 /* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 
 /**
@@ -85,6 +95,18 @@ int main(void)
                        test_reference_list_node_next,
                        test_reference_list_node_standard_post);
 
+    unit_test_register(reference_list_node_tests,
+                       "next compare and swap",
+                       test_reference_list_node_standard_pre,
+                       test_reference_list_node_cas_next,
+                       test_reference_list_node_standard_post);
+
+    unit_test_register(reference_list_node_tests,
+                       "reference blocks",
+                       test_reference_list_node_standard_pre,
+                       test_reference_list_node_block,
+                       test_reference_list_node_standard_post);
+
     // Run tests
     if (unit_test_run(reference_list_node_tests)) err = 1;
     else                                          err = 0;
@@ -270,3 +292,89 @@ static bool test_reference_list_node_next(void * p_context, char ** err_str)
     *err_str = NULL;
     return true;
 }
+
+static bool test_reference_list_node_cas_next(void * p_context, char ** err_str)
+{
+    reference_list_node_test_context_t context = (reference_list_node_test_context_t) p_context;
+    bool success;
+
+    // Initializing works even when next is already set
+    reference_list_node_init_next(context->node_null, context->node_five);
+    reference_list_node_init_next(context->node_null, context->node_null);
+    if (reference_list_node_get_next(context->node_null) != context->node_null) {
+        *err_str = "init should always set next";
+        return false;
+    }
+    reference_list_node_init_next(context->node_null, NULL);
+
+    // Try to operate on NULL, or swap in NULL
+    success =            reference_list_node_cas_next(NULL, NULL, context->node_five);
+    success = success || reference_list_node_cas_next(context->node_null, NULL, NULL);
+    if (success) {
+        *err_str = "invalid compare and swap should not succeed";
+        return false;
+    }
+
+    // Wrong expected value
+    success = reference_list_node_cas_next(context->node_null, context->node_five, context->node_five);
+    if (success || reference_list_node_get_next(context->node_null)) {
+        *err_str = "compare and swap with the wrong expected value should fail";
+        return false;
+    }
+
+    // Right expected value, repeatedly
+    success =            reference_list_node_cas_next(context->node_null, NULL, context->node_five);
+    success = success && reference_list_node_cas_next(context->node_null, context->node_five, context->node_null);
+    if (!success || reference_list_node_get_next(context->node_null) != context->node_null) {
+        *err_str = "compare and swap with the right expected value should succeed";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_reference_list_node_block(void * p_context, char ** err_str)
+{
+    reference_list_node_test_context_t context = (reference_list_node_test_context_t) p_context;
+    uintptr_t i;
+
+    // Created holding one
+    if (reference_list_node_count(context->node_null) != 1 || reference_list_node_is_full(context->node_null)) {
+        *err_str = "new node should hold exactly one reference";
+        return false;
+    }
+
+    // Fill it up. The first slot is NULL already
+    for (i = 1; i < REFERENCE_LIST_NODE_REFS; i++) {
+        if (!reference_list_node_add_ref(context->node_null, (void*) i)) {
+            *err_str = "add should succeed until the node is full";
+            return false;
+        }
+    }
+    if (!reference_list_node_is_full(context->node_null) || reference_list_node_add_ref(context->node_null, (void*) i)) {
+        *err_str = "add should fail once the node is full";
+        return false;
+    }
+
+    // Everything comes back in order
+    if (reference_list_node_count(context->node_null) != REFERENCE_LIST_NODE_REFS) {
+        *err_str = "full node has the wrong count";
+        return false;
+    }
+    for (i = 0; i < REFERENCE_LIST_NODE_REFS; i++) {
+        if (reference_list_node_get_ref_at(context->node_null, i) != (void*) i) {
+            *err_str = "get_ref_at should return references in the order they were added";
+            return false;
+        }
+    }
+    if (reference_list_node_get_ref_at(context->node_null, i) || reference_list_node_get_ref_at(NULL, 0)) {
+        *err_str = "get_ref_at out of range should fail";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
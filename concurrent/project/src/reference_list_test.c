@@ -18,6 +18,7 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 // Modules
@@ -28,6 +29,10 @@
 #define N_STRESS_INSERTIONS     (4096)
 #define N_THREADS               (2)
 
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static atomic_uint_fast32_t n_freed;
+
 /* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
 
 /**
@@ -63,6 +68,16 @@ static bool test_reference_list_stress(void* p_context, char** err_str);
  */
 static bool test_reference_list_threading(void* p_context, char** err_str);
 
+/**
+ * @brief   Ensures every reference is freed exactly once, whether or not its block filled up
+ */
+static bool test_reference_list_free_all(void* p_context, char** err_str);
+
+/**
+ * @brief   Free function which counts calls
+ */
+static void counting_free(void* ptr);
+
 /**
  * @brief   Inserts a bunch of values into the reference list
  */
@@ -104,6 +119,11 @@ int main(void)
                        test_reference_list_standard_pre,
                        test_reference_list_threading,
                        test_reference_list_standard_post);
+    unit_test_register(reference_list_tests,
+                       "freeing",
+                       test_reference_list_standard_pre,
+                       test_reference_list_free_all,
+                       test_reference_list_standard_post);
 
     // Run tests
     if (unit_test_run(reference_list_tests)) err = 1;
@@ -217,6 +237,53 @@ static bool test_reference_list_threading(void* p_context, char** err_str)
     return true;
 }
 
+static bool test_reference_list_free_all(void* p_context, char** err_str)
+{
+    (void) p_context;
+    uint32_t i;
+
+    // Use our own list, so we can count what's freed
+    reference_list_t r = reference_list_create(counting_free);
+    if (!r) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    atomic_store(&n_freed, 0);
+
+    // Not a multiple of the block size, so some blocks are left partially filled
+    pthread_t insert_threads[N_THREADS];
+    for (i = 0; i < N_THREADS; i++) {
+        pthread_create(&(insert_threads[i]), NULL, test_reference_list_insert_thread_f, r);
+    }
+    bool insert_success = true;
+    for (i = 0; i < N_THREADS; i++) {
+        void * err_val;
+        pthread_join(insert_threads[i], &err_val);
+        if (err_val) insert_success = false;
+    }
+
+    reference_list_free(r);
+
+    if (!insert_success) {
+        *err_str = "insertion failed";
+        return false;
+    }
+    if (atomic_load(&n_freed) != N_THREADS*N_STRESS_INSERTIONS) {
+        *err_str = "wrong number of references freed";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static void counting_free(void* ptr)
+{
+    free(ptr);
+    atomic_fetch_add(&n_freed, 1);
+}
+
 static void* test_reference_list_insert_thread_f(void* p_context)
 {
     reference_list_t r = (reference_list_t) p_context;
@@ -0,0 +1,246 @@
+/**
+ * @file    spinlock.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implementation of spinning mutual exclusion locks
+ *
+ * Every lock is taken with acquire ordering and released with release
+ * ordering, so everything done while holding it is seen by the next holder.
+ * Queue locks hand over by storing to the next waiter's own flag.
+ *
+ * @addtogroup SPINLOCK
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// This module
+#include "spinlock.h"
+
+// Standard
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+// Architecture
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+void spinlock_relax(uint32_t * spins)
+{
+    if (*spins < SPINLOCK_SPINS_MAX) {
+        (*spins)++;
+        spinlock_pause();
+    }
+    else {
+        sched_yield();
+    }
+}
+
+void spinlock_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+void spinlock_tas_init(spinlock_tas_t * lock)
+{
+    atomic_init(&(lock->held), false);
+}
+
+void spinlock_tas_lock(spinlock_tas_t * lock)
+{
+    uint32_t spins = 0;
+
+    while (atomic_exchange_explicit(&(lock->held), true, memory_order_acquire)) spinlock_relax(&spins);
+}
+
+bool spinlock_tas_trylock(spinlock_tas_t * lock)
+{
+    return !atomic_exchange_explicit(&(lock->held), true, memory_order_acquire);
+}
+
+void spinlock_tas_unlock(spinlock_tas_t * lock)
+{
+    atomic_store_explicit(&(lock->held), false, memory_order_release);
+}
+
+void spinlock_ttas_init(spinlock_ttas_t * lock)
+{
+    atomic_init(&(lock->held), false);
+}
+
+void spinlock_ttas_lock(spinlock_ttas_t * lock)
+{
+    uint32_t backoff = SPINLOCK_BACKOFF_MIN;
+    uint32_t spins = 0;
+    uint32_t i;
+
+    while (true) {
+        // Wait in cache until it looks free
+        while (atomic_load_explicit(&(lock->held), memory_order_relaxed)) spinlock_relax(&spins);
+        if (!atomic_exchange_explicit(&(lock->held), true, memory_order_acquire)) return;
+
+        // Somebody beat us to it, so others probably will too. Let them
+        for (i = 0; i < backoff; i++) spinlock_pause();
+        if (backoff < SPINLOCK_BACKOFF_MAX) backoff <<= 1;
+    }
+}
+
+bool spinlock_ttas_trylock(spinlock_ttas_t * lock)
+{
+    if (atomic_load_explicit(&(lock->held), memory_order_relaxed)) return false;
+    return !atomic_exchange_explicit(&(lock->held), true, memory_order_acquire);
+}
+
+void spinlock_ttas_unlock(spinlock_ttas_t * lock)
+{
+    atomic_store_explicit(&(lock->held), false, memory_order_release);
+}
+
+void spinlock_ticket_init(spinlock_ticket_t * lock)
+{
+    atomic_init(&(lock->next), 0);
+    atomic_init(&(lock->serving), 0);
+}
+
+void spinlock_ticket_lock(spinlock_ticket_t * lock)
+{
+    uint_fast32_t ticket = atomic_fetch_add_explicit(&(lock->next), 1, memory_order_relaxed);
+    uint32_t spins = 0;
+
+    while (atomic_load_explicit(&(lock->serving), memory_order_acquire) != ticket) spinlock_relax(&spins);
+}
+
+bool spinlock_ticket_trylock(spinlock_ticket_t * lock)
+{
+    // Only if the next ticket would be served straight away. next is only ever
+    // bumped relaxed, so it's acquiring serving that orders us after the last unlock
+    uint_fast32_t ticket = atomic_load_explicit(&(lock->serving), memory_order_acquire);
+    uint_fast32_t expected = ticket;
+
+    return atomic_compare_exchange_strong_explicit(&(lock->next), &expected, ticket + 1, memory_order_acquire, memory_order_relaxed);
+}
+
+void spinlock_ticket_unlock(spinlock_ticket_t * lock)
+{
+    // Only the holder changes it, so nobody else can have
+    uint_fast32_t serving = atomic_load_explicit(&(lock->serving), memory_order_relaxed);
+
+    atomic_store_explicit(&(lock->serving), serving + 1, memory_order_release);
+}
+
+void spinlock_mcs_init(spinlock_mcs_t * lock)
+{
+    atomic_init(&(lock->tail), NULL);
+}
+
+void spinlock_mcs_lock(spinlock_mcs_t * lock, spinlock_mcs_node_t * node)
+{
+    uint32_t spins = 0;
+
+    atomic_store_explicit(&(node->next), NULL, memory_order_relaxed);
+    atomic_store_explicit(&(node->waiting), true, memory_order_relaxed);
+
+    // Join the back of the line. If there was nobody in it, it's ours
+    spinlock_mcs_node_t * pred = atomic_exchange_explicit(&(lock->tail), node, memory_order_acq_rel);
+    if (!pred) return;
+
+    // Otherwise tell whoever's ahead where we are, and wait for them to let us in
+    atomic_store_explicit(&(pred->next), node, memory_order_release);
+    while (atomic_load_explicit(&(node->waiting), memory_order_acquire)) spinlock_relax(&spins);
+}
+
+bool spinlock_mcs_trylock(spinlock_mcs_t * lock, spinlock_mcs_node_t * node)
+{
+    spinlock_mcs_node_t * expected = NULL;
+
+    atomic_store_explicit(&(node->next), NULL, memory_order_relaxed);
+    atomic_store_explicit(&(node->waiting), false, memory_order_relaxed);
+
+    return atomic_compare_exchange_strong_explicit(&(lock->tail), &expected, node, memory_order_acq_rel, memory_order_relaxed);
+}
+
+void spinlock_mcs_unlock(spinlock_mcs_t * lock, spinlock_mcs_node_t * node)
+{
+    uint32_t spins = 0;
+
+    spinlock_mcs_node_t * next = atomic_load_explicit(&(node->next), memory_order_acquire);
+    if (!next) {
+        // Nobody behind us, unless someone's just swapped themselves in
+        spinlock_mcs_node_t * expected = node;
+        if (atomic_compare_exchange_strong_explicit(&(lock->tail), &expected, NULL, memory_order_release, memory_order_relaxed)) return;
+
+        // They have. Wait for them to link themselves in
+        while (!(next = atomic_load_explicit(&(node->next), memory_order_acquire))) spinlock_relax(&spins);
+    }
+
+    atomic_store_explicit(&(next->waiting), false, memory_order_release);
+}
+
+uint32_t spinlock_clh_init(spinlock_clh_t * lock)
+{
+    // The line starts behind a node that's already let go
+    spinlock_clh_node_t * node = (spinlock_clh_node_t *) aligned_alloc(SPINLOCK_CACHE_LINE, sizeof(spinlock_clh_node_t));
+    if (!node) return 1;
+
+    atomic_init(&(node->waiting), false);
+    atomic_init(&(lock->tail), node);
+
+    return 0;
+}
+
+void spinlock_clh_destroy(spinlock_clh_t * lock)
+{
+    free(atomic_load(&(lock->tail)));
+}
+
+uint32_t spinlock_clh_handle_init(spinlock_clh_handle_t * handle)
+{
+    handle->mine = (spinlock_clh_node_t *) aligned_alloc(SPINLOCK_CACHE_LINE, sizeof(spinlock_clh_node_t));
+    if (!handle->mine) return 1;
+
+    atomic_init(&(handle->mine->waiting), false);
+    handle->pred = NULL;
+
+    return 0;
+}
+
+void spinlock_clh_handle_destroy(spinlock_clh_handle_t * handle)
+{
+    free(handle->mine);
+}
+
+void spinlock_clh_lock(spinlock_clh_t * lock, spinlock_clh_handle_t * handle)
+{
+    uint32_t spins = 0;
+
+    // Join the back of the line, and watch whoever's ahead
+    atomic_store_explicit(&(handle->mine->waiting), true, memory_order_relaxed);
+    spinlock_clh_node_t * pred = atomic_exchange_explicit(&(lock->tail), handle->mine, memory_order_acq_rel);
+    while (atomic_load_explicit(&(pred->waiting), memory_order_acquire)) spinlock_relax(&spins);
+
+    handle->pred = pred;
+}
+
+void spinlock_clh_unlock(spinlock_clh_t * lock, spinlock_clh_handle_t * handle)
+{
+    (void) lock;
+
+    // Our node now belongs to whoever's behind us. Nobody's watching the one
+    // ahead any more, so it's ours for next time
+    spinlock_clh_node_t * mine = handle->mine;
+    handle->mine = handle->pred;
+    handle->pred = NULL;
+    atomic_store_explicit(&(mine->waiting), false, memory_order_release);
+}
+
+/** @} addtogroup SPINLOCK */
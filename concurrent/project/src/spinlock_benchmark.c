@@ -0,0 +1,225 @@
+/**
+ * @file    spinlock_benchmark.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Benchmarking code for lock contention
+ *
+ * Every thread takes the same lock over and over, around a critical section
+ * which just bumps a counter, so nearly all the time goes into handing the
+ * lock over. Reports acquisitions per second for each lock, from one thread up
+ * to MAX_N_THREADS, with a pthread mutex alongside for reference. Name a lock
+ * ("tas", "ttas", "ticket", "mcs", "clh" or "mutex") to run only that one
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Module
+#include "spinlock.h"
+
+// Standard Libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_ELEMENTS(a)   (sizeof(a)/sizeof((a)[0]))
+
+#define MAX_N_THREADS       (16)
+
+#define N_ACQUISITIONS      (1 << 16)       /**< Acquisitions per thread */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   The locks to benchmark
+ */
+typedef enum {
+    BENCH_LOCK_TAS,
+    BENCH_LOCK_TTAS,
+    BENCH_LOCK_TICKET,
+    BENCH_LOCK_MCS,
+    BENCH_LOCK_CLH,
+    BENCH_LOCK_MUTEX,
+} bench_lock_kind_t;
+
+/**
+ * @brief   A lock to benchmark
+ */
+typedef struct lock_choice_t_ {
+    bench_lock_kind_t   kind;       /**< The lock */
+    const char *        name;       /**< What it's called on the command line, and in the output */
+} lock_choice_t;
+
+/**
+ * @brief   Room for any of them
+ */
+typedef union bench_lock_t_ {
+    spinlock_tas_t      tas;
+    spinlock_ttas_t     ttas;
+    spinlock_ticket_t   ticket;
+    spinlock_mcs_t      mcs;
+    spinlock_clh_t      clh;
+    pthread_mutex_t     mutex;
+} bench_lock_t;
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static pthread_t threads[MAX_N_THREADS];
+
+static atomic_bool start_operation;
+
+static bench_lock_kind_t kind;
+
+static bench_lock_t lock;
+
+static uint64_t counter;    /**< Only changed under the lock */
+
+static const lock_choice_t locks[] = {
+    { BENCH_LOCK_TAS,       "tas"    },
+    { BENCH_LOCK_TTAS,      "ttas"   },
+    { BENCH_LOCK_TICKET,    "ticket" },
+    { BENCH_LOCK_MCS,       "mcs"    },
+    { BENCH_LOCK_CLH,       "clh"    },
+    { BENCH_LOCK_MUTEX,     "mutex"  },
+};
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Times one lock across all thread counts
+ *
+ * @param[in] choice:       The lock
+ */
+static void benchmark_lock(const lock_choice_t * choice);
+
+/**
+ * @brief   Takes and releases the lock N_ACQUISITIONS times
+ *
+ * Waits on a signal to start running
+ *
+ * @param[in] arg:          Unused
+ */
+static void* lock_thread_f(void* arg);
+
+/**
+ * @brief   Returns the seconds between two times
+ */
+static double timedifference_sec(struct timeval t0, struct timeval t1);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+int main(int argc, char** argv)
+{
+    uint32_t i;
+
+    printf("lock,threads,seconds,acquisitions_per_sec;\n");
+    for (i = 0; i < ARRAY_ELEMENTS(locks); i++) {
+        if (argc >= 2 && strcmp(argv[1], locks[i].name)) continue;
+        benchmark_lock(&(locks[i]));
+    }
+
+    return 0;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static void benchmark_lock(const lock_choice_t * choice)
+{
+    uint32_t n_threads;
+    uint32_t i;
+
+    kind = choice->kind;
+    for (n_threads = 1; n_threads <= MAX_N_THREADS; n_threads++) {
+        // Create lock
+        switch (kind) {
+        case BENCH_LOCK_TAS:    spinlock_tas_init(&(lock.tas));             break;
+        case BENCH_LOCK_TTAS:   spinlock_ttas_init(&(lock.ttas));           break;
+        case BENCH_LOCK_TICKET: spinlock_ticket_init(&(lock.ticket));       break;
+        case BENCH_LOCK_MCS:    spinlock_mcs_init(&(lock.mcs));             break;
+        case BENCH_LOCK_CLH:
+            if (spinlock_clh_init(&(lock.clh))) {
+                fprintf(stderr, "out of memory\n");
+                return;
+            }
+            break;
+        case BENCH_LOCK_MUTEX:  pthread_mutex_init(&(lock.mutex), NULL);   break;
+        }
+        counter = 0;
+
+        // Create threads
+        atomic_store(&start_operation, false);
+        for (i = 0; i < n_threads; i++) pthread_create(&(threads[i]), NULL, lock_thread_f, NULL);
+
+        // Start threads and timer
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        atomic_store(&start_operation, true);
+
+        // Wait on threads
+        for (i = 0; i < n_threads; i++) pthread_join(threads[i], NULL);
+
+        // Stop timer
+        struct timeval stop;
+        gettimeofday(&stop, NULL);
+
+        // Report results
+        double seconds = timedifference_sec(start, stop);
+        uint64_t acquisitions = (uint64_t) N_ACQUISITIONS * n_threads;
+        if (counter != acquisitions) fprintf(stderr, "%s lost %lu increments\n", choice->name, (unsigned long) (acquisitions - counter));
+        printf("%s,%u,%0.6lf,%0.0lf;\n", choice->name, n_threads, seconds, acquisitions / seconds);
+
+        // Free
+        if (kind == BENCH_LOCK_CLH)     spinlock_clh_destroy(&(lock.clh));
+        if (kind == BENCH_LOCK_MUTEX)   pthread_mutex_destroy(&(lock.mutex));
+    }
+}
+
+static void* lock_thread_f(void* arg)
+{
+    spinlock_mcs_node_t node;
+    spinlock_clh_handle_t handle;
+    uint32_t i;
+
+    (void) arg;
+
+    if (kind == BENCH_LOCK_CLH && spinlock_clh_handle_init(&handle)) return NULL;
+
+    // Wait for start signal
+    while (!atomic_load_explicit(&start_operation, memory_order_acquire));
+
+    for (i = 0; i < N_ACQUISITIONS; i++) {
+        switch (kind) {
+        case BENCH_LOCK_TAS:    spinlock_tas_lock(&(lock.tas));             break;
+        case BENCH_LOCK_TTAS:   spinlock_ttas_lock(&(lock.ttas));           break;
+        case BENCH_LOCK_TICKET: spinlock_ticket_lock(&(lock.ticket));       break;
+        case BENCH_LOCK_MCS:    spinlock_mcs_lock(&(lock.mcs), &node);      break;
+        case BENCH_LOCK_CLH:    spinlock_clh_lock(&(lock.clh), &handle);    break;
+        case BENCH_LOCK_MUTEX:  pthread_mutex_lock(&(lock.mutex));          break;
+        }
+
+        counter++;
+
+        switch (kind) {
+        case BENCH_LOCK_TAS:    spinlock_tas_unlock(&(lock.tas));           break;
+        case BENCH_LOCK_TTAS:   spinlock_ttas_unlock(&(lock.ttas));         break;
+        case BENCH_LOCK_TICKET: spinlock_ticket_unlock(&(lock.ticket));     break;
+        case BENCH_LOCK_MCS:    spinlock_mcs_unlock(&(lock.mcs), &node);    break;
+        case BENCH_LOCK_CLH:    spinlock_clh_unlock(&(lock.clh), &handle);  break;
+        case BENCH_LOCK_MUTEX:  pthread_mutex_unlock(&(lock.mutex));        break;
+        }
+    }
+
+    if (kind == BENCH_LOCK_CLH) spinlock_clh_handle_destroy(&handle);
+    return NULL;
+}
+
+static double timedifference_sec(struct timeval t0, struct timeval t1)
+{
+    return (t1.tv_sec - t0.tv_sec) + ((t1.tv_usec - t0.tv_usec) / 1000000.0f);
+}
@@ -0,0 +1,395 @@
+/**
+ * @file    spinlock_test.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Unit test for spinning locks
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Module under test
+#include "spinlock.h"
+
+// Standard Libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Modules
+#include "unit_test.h"
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_ELEMENTS(a)       (sizeof(a)/sizeof((a)[0]))
+
+#define N_THREADS               (8)
+#define N_ACQUISITIONS          (20000)         /**< Per thread */
+
+/* --- PRIVATE DATA TYPES --------------------------------------------------- */
+
+/**
+ * @brief   The locks under test
+ */
+typedef enum {
+    TEST_LOCK_TAS,
+    TEST_LOCK_TTAS,
+    TEST_LOCK_TICKET,
+    TEST_LOCK_MCS,
+    TEST_LOCK_CLH,
+} test_lock_kind_t;
+
+/**
+ * @brief   Room for any of them
+ */
+typedef union test_lock_t_ {
+    spinlock_tas_t              tas;
+    spinlock_ttas_t             ttas;
+    spinlock_ticket_t           ticket;
+    spinlock_mcs_t              mcs;
+    spinlock_clh_t              clh;
+} test_lock_t;
+
+/**
+ * @brief   What a thread needs to take any of them
+ */
+typedef struct test_locker_t_ {
+    spinlock_mcs_node_t         node;           /**< For MCS locks */
+    spinlock_clh_handle_t       handle;         /**< For CLH locks */
+} test_locker_t;
+
+/**
+ * @brief   A lock, and what it guards
+ */
+typedef struct test_spinlock_context_t_ {
+    test_lock_kind_t            kind;           /**< The kind of lock */
+    test_lock_t                 lock;           /**< The lock */
+    uint64_t                    counter;        /**< Only changed under the lock, without atomics */
+    uint32_t                    inside;         /**< Threads inside the critical section. Should never pass 1 */
+    bool                        overlap;        /**< Set if it ever did */
+} test_spinlock_context_t;
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Doesn't need any setup
+ */
+static bool test_spinlock_standard_pre(void** p_context, char** err_str);
+
+/**
+ * @brief   Doesn't need any cleanup
+ */
+static void test_spinlock_standard_post(void* p_context);
+
+/**
+ * @brief   Tests that each lock can be taken and released, and trylock fails while held
+ */
+static bool test_spinlock_trylock(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that a CLH handle can take different locks, one after another
+ */
+static bool test_spinlock_clh_handle(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that each lock keeps threads out of each other's way
+ */
+static bool test_spinlock_exclusion(void* p_context, char** err_str);
+
+/**
+ * @brief   Takes the lock over and over, counting inside it
+ */
+static void* test_spinlock_thread_f(void* p_context);
+
+/**
+ * @brief   Initializes a lock of the context's kind
+ *
+ * @return      false if memory allocation failed
+ */
+static bool test_lock_init(test_spinlock_context_t * context);
+
+/**
+ * @brief   Frees what a lock holds
+ */
+static void test_lock_destroy(test_spinlock_context_t * context);
+
+/**
+ * @brief   Takes a lock
+ */
+static void test_lock(test_spinlock_context_t * context, test_locker_t * locker);
+
+/**
+ * @brief   Takes a lock, if it's free
+ */
+static bool test_trylock(test_spinlock_context_t * context, test_locker_t * locker);
+
+/**
+ * @brief   Releases a lock
+ */
+static void test_unlock(test_spinlock_context_t * context, test_locker_t * locker);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+/**
+ * @brief   Test entry point
+ *
+ * @return  1 if one or more tests failed, 0 otherwise
+ */
+int main(void)
+{
+    uint32_t err;
+    unit_test_t spinlock_tests;
+
+    // Allocate test structure
+    spinlock_tests = unit_test_create("spinlock");
+
+    // Register tests
+    unit_test_register(spinlock_tests,
+                       "trylock",
+                       test_spinlock_standard_pre,
+                       test_spinlock_trylock,
+                       test_spinlock_standard_post);
+    unit_test_register(spinlock_tests,
+                       "clh handles",
+                       test_spinlock_standard_pre,
+                       test_spinlock_clh_handle,
+                       test_spinlock_standard_post);
+    unit_test_register(spinlock_tests,
+                       "exclusion",
+                       test_spinlock_standard_pre,
+                       test_spinlock_exclusion,
+                       test_spinlock_standard_post);
+
+    // Run tests
+    if (unit_test_run(spinlock_tests)) err = 1;
+    else                               err = 0;
+
+    // Free test structure
+    unit_test_free(spinlock_tests);
+
+    return err;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static bool test_spinlock_standard_pre(void** p_context, char** err_str)
+{
+    // Ensure params are good
+    if (!err_str) {
+        return false;
+    }
+    if (!p_context) {
+        *err_str = "!!! bad params !!!";
+        return false;
+    }
+
+    // No context needed
+    *p_context = NULL;
+
+    *err_str = NULL;
+    return true;
+}
+
+static void test_spinlock_standard_post(void* p_context)
+{
+    (void) p_context;
+}
+
+static bool test_spinlock_trylock(void* p_context, char** err_str)
+{
+    (void) p_context;
+    test_spinlock_context_t context;
+    test_locker_t locker;
+    test_locker_t other;
+    uint32_t kind;
+
+    if (spinlock_clh_handle_init(&(locker.handle))) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+    if (spinlock_clh_handle_init(&(other.handle))) {
+        spinlock_clh_handle_destroy(&(locker.handle));
+        *err_str = "memory allocation failed";
+        return false;
+    }
+
+    bool success = true;
+    for (kind = TEST_LOCK_TAS; success && kind <= TEST_LOCK_CLH; kind++) {
+        context.kind = (test_lock_kind_t) kind;
+        if (!test_lock_init(&context)) {
+            *err_str = "memory allocation failed";
+            success = false;
+            break;
+        }
+
+        // Taken, released, and taken again. CLH has no trylock
+        test_lock(&context, &locker);
+        if (kind != TEST_LOCK_CLH && test_trylock(&context, &other)) {
+            *err_str = "lock taken twice";
+            success = false;
+        }
+        test_unlock(&context, &locker);
+        if (success && kind != TEST_LOCK_CLH) {
+            if (!test_trylock(&context, &other)) {
+                *err_str = "free lock couldn't be taken";
+                success = false;
+            }
+            else {
+                test_unlock(&context, &other);
+            }
+        }
+        test_lock(&context, &locker);
+        test_unlock(&context, &locker);
+
+        test_lock_destroy(&context);
+    }
+
+    spinlock_clh_handle_destroy(&(locker.handle));
+    spinlock_clh_handle_destroy(&(other.handle));
+
+    if (success) *err_str = NULL;
+    return success;
+}
+
+static bool test_spinlock_clh_handle(void* p_context, char** err_str)
+{
+    (void) p_context;
+    spinlock_clh_t locks[2];
+    spinlock_clh_handle_t handles[2];
+    uint32_t i;
+
+    if (spinlock_clh_init(&(locks[0])) || spinlock_clh_init(&(locks[1])) ||
+        spinlock_clh_handle_init(&(handles[0])) || spinlock_clh_handle_init(&(handles[1]))) {
+        *err_str = "memory allocation failed";
+        return false;
+    }
+
+    // Nodes trade places between handles and locks as they go
+    for (i = 0; i < 16; i++) {
+        spinlock_clh_lock(&(locks[i % 2]), &(handles[(i / 2) % 2]));
+        spinlock_clh_unlock(&(locks[i % 2]), &(handles[(i / 2) % 2]));
+    }
+
+    // Every node is freed exactly once, which valgrind checks
+    for (i = 0; i < 2; i++) {
+        spinlock_clh_destroy(&(locks[i]));
+        spinlock_clh_handle_destroy(&(handles[i]));
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_spinlock_exclusion(void* p_context, char** err_str)
+{
+    (void) p_context;
+    static const char * names[] = { "tas", "ttas", "ticket", "mcs", "clh" };
+    static char message[64];
+    test_spinlock_context_t context;
+    pthread_t threads[N_THREADS];
+    uint32_t kind;
+    uint32_t i;
+
+    for (kind = TEST_LOCK_TAS; kind <= TEST_LOCK_CLH; kind++) {
+        context.kind = (test_lock_kind_t) kind;
+        context.counter = 0;
+        context.inside = 0;
+        context.overlap = false;
+        if (!test_lock_init(&context)) {
+            *err_str = "memory allocation failed";
+            return false;
+        }
+
+        for (i = 0; i < N_THREADS; i++) pthread_create(&(threads[i]), NULL, test_spinlock_thread_f, &context);
+        for (i = 0; i < N_THREADS; i++) pthread_join(threads[i], NULL);
+
+        test_lock_destroy(&context);
+
+        // Every increment made it in, and nobody was ever inside together
+        if (context.overlap || context.counter != (uint64_t) N_THREADS * N_ACQUISITIONS) {
+            snprintf(message, sizeof(message), "%s lock let two threads in at once", names[kind]);
+            *err_str = message;
+            return false;
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static void* test_spinlock_thread_f(void* p_context)
+{
+    test_spinlock_context_t * context = (test_spinlock_context_t *) p_context;
+    test_locker_t locker;
+    uint32_t i;
+
+    if (spinlock_clh_handle_init(&(locker.handle))) {
+        context->overlap = true;
+        return NULL;
+    }
+
+    for (i = 0; i < N_ACQUISITIONS; i++) {
+        test_lock(context, &locker);
+        if (++(context->inside) != 1) context->overlap = true;
+        context->counter++;
+        context->inside--;
+        test_unlock(context, &locker);
+    }
+
+    spinlock_clh_handle_destroy(&(locker.handle));
+    return NULL;
+}
+
+static bool test_lock_init(test_spinlock_context_t * context)
+{
+    switch (context->kind) {
+    case TEST_LOCK_TAS:     spinlock_tas_init(&(context->lock.tas));        return true;
+    case TEST_LOCK_TTAS:    spinlock_ttas_init(&(context->lock.ttas));      return true;
+    case TEST_LOCK_TICKET:  spinlock_ticket_init(&(context->lock.ticket));  return true;
+    case TEST_LOCK_MCS:     spinlock_mcs_init(&(context->lock.mcs));        return true;
+    case TEST_LOCK_CLH:     return spinlock_clh_init(&(context->lock.clh)) == 0;
+    }
+
+    return false;
+}
+
+static void test_lock_destroy(test_spinlock_context_t * context)
+{
+    if (context->kind == TEST_LOCK_CLH) spinlock_clh_destroy(&(context->lock.clh));
+}
+
+static void test_lock(test_spinlock_context_t * context, test_locker_t * locker)
+{
+    switch (context->kind) {
+    case TEST_LOCK_TAS:     spinlock_tas_lock(&(context->lock.tas));                        break;
+    case TEST_LOCK_TTAS:    spinlock_ttas_lock(&(context->lock.ttas));                      break;
+    case TEST_LOCK_TICKET:  spinlock_ticket_lock(&(context->lock.ticket));                  break;
+    case TEST_LOCK_MCS:     spinlock_mcs_lock(&(context->lock.mcs), &(locker->node));       break;
+    case TEST_LOCK_CLH:     spinlock_clh_lock(&(context->lock.clh), &(locker->handle));     break;
+    }
+}
+
+static bool test_trylock(test_spinlock_context_t * context, test_locker_t * locker)
+{
+    switch (context->kind) {
+    case TEST_LOCK_TAS:     return spinlock_tas_trylock(&(context->lock.tas));
+    case TEST_LOCK_TTAS:    return spinlock_ttas_trylock(&(context->lock.ttas));
+    case TEST_LOCK_TICKET:  return spinlock_ticket_trylock(&(context->lock.ticket));
+    case TEST_LOCK_MCS:     return spinlock_mcs_trylock(&(context->lock.mcs), &(locker->node));
+    default:                return false;
+    }
+}
+
+static void test_unlock(test_spinlock_context_t * context, test_locker_t * locker)
+{
+    switch (context->kind) {
+    case TEST_LOCK_TAS:     spinlock_tas_unlock(&(context->lock.tas));                      break;
+    case TEST_LOCK_TTAS:    spinlock_ttas_unlock(&(context->lock.ttas));                    break;
+    case TEST_LOCK_TICKET:  spinlock_ticket_unlock(&(context->lock.ticket));                break;
+    case TEST_LOCK_MCS:     spinlock_mcs_unlock(&(context->lock.mcs), &(locker->node));     break;
+    case TEST_LOCK_CLH:     spinlock_clh_unlock(&(context->lock.clh), &(locker->handle));   break;
+    }
+}
@@ -0,0 +1,38 @@
+/**
+ * @file    thread_index.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Implementation of small, dense per-thread indices
+ *
+ * @addtogroup THREAD_INDEX
+ * @{
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// This module
+#include "thread_index.h"
+
+// Standard
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static atomic_uint_fast32_t thread_index_count = 0;
+
+static _Thread_local uint32_t thread_index_self = UINT32_MAX;
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+uint32_t thread_index(void)
+{
+    // Hand out indices in the order threads first show up
+    if (thread_index_self == UINT32_MAX) {
+        thread_index_self = (uint32_t) atomic_fetch_add_explicit(&thread_index_count, 1, memory_order_relaxed);
+    }
+
+    return thread_index_self;
+}
+
+/** @} addtogroup THREAD_INDEX */
@@ -0,0 +1,170 @@
+/**
+ * @file    thread_index_test.c
+ * @author  Austin Glaser <austin.glaser@colorado.edu>
+ *
+ * @brief   Unit test for per-thread indices
+ */
+
+/* --- PRIVATE DEPENDENCIES ------------------------------------------------- */
+
+// Module under test
+#include "thread_index.h"
+
+// Standard Libraries
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Modules
+#include "unit_test.h"
+
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define N_THREADS               (32)
+#define N_STRIPES               (8)
+
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint32_t indices[N_THREADS];
+
+/* --- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+
+/**
+ * @brief   Doesn't need any setup
+ */
+static bool test_thread_index_standard_pre(void** p_context, char** err_str);
+
+/**
+ * @brief   Doesn't need any cleanup
+ */
+static void test_thread_index_standard_post(void* p_context);
+
+/**
+ * @brief   Tests that a thread always gets the same index, and stripe
+ */
+static bool test_thread_index_stable(void* p_context, char** err_str);
+
+/**
+ * @brief   Tests that different threads get different indices
+ */
+static bool test_thread_index_unique(void* p_context, char** err_str);
+
+/**
+ * @brief   Records the thread's index
+ */
+static void* test_thread_index_thread_f(void* p_context);
+
+/* --- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+
+/**
+ * @brief   Test entry point
+ *
+ * @return  1 if one or more tests failed, 0 otherwise
+ */
+int main(void)
+{
+    uint32_t err;
+    unit_test_t thread_index_tests;
+
+    // Allocate test structure
+    thread_index_tests = unit_test_create("thread index");
+
+    // Register tests
+    unit_test_register(thread_index_tests,
+                       "stability",
+                       test_thread_index_standard_pre,
+                       test_thread_index_stable,
+                       test_thread_index_standard_post);
+    unit_test_register(thread_index_tests,
+                       "uniqueness",
+                       test_thread_index_standard_pre,
+                       test_thread_index_unique,
+                       test_thread_index_standard_post);
+
+    // Run tests
+    if (unit_test_run(thread_index_tests)) err = 1;
+    else                                   err = 0;
+
+    // Free test structure
+    unit_test_free(thread_index_tests);
+
+    return err;
+}
+
+/* --- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+
+static bool test_thread_index_standard_pre(void** p_context, char** err_str)
+{
+    // Ensure params are good
+    if (!err_str) {
+        return false;
+    }
+    if (!p_context) {
+        *err_str = "!!! bad params !!!";
+        return false;
+    }
+
+    // No context needed
+    *p_context = NULL;
+
+    *err_str = NULL;
+    return true;
+}
+
+static void test_thread_index_standard_post(void* p_context)
+{
+    (void) p_context;
+}
+
+static bool test_thread_index_stable(void* p_context, char** err_str)
+{
+    (void) p_context;
+
+    uint32_t first = thread_index();
+    if (thread_index() != first || thread_index_stripe(N_STRIPES) != first % N_STRIPES) {
+        *err_str = "index changed between calls";
+        return false;
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static bool test_thread_index_unique(void* p_context, char** err_str)
+{
+    (void) p_context;
+    uint32_t i, j;
+
+    // Collect an index from each of a bunch of threads
+    pthread_t threads[N_THREADS];
+    for (i = 0; i < N_THREADS; i++) pthread_create(&(threads[i]), NULL, test_thread_index_thread_f, &(indices[i]));
+    for (i = 0; i < N_THREADS; i++) pthread_join(threads[i], NULL);
+
+    // No two alike, and none the same as ours
+    for (i = 0; i < N_THREADS; i++) {
+        if (indices[i] == thread_index()) {
+            *err_str = "thread shares the main thread's index";
+            return false;
+        }
+        for (j = i + 1; j < N_THREADS; j++) {
+            if (indices[i] == indices[j]) {
+                *err_str = "two threads share an index";
+                return false;
+            }
+        }
+    }
+
+    // Success
+    *err_str = NULL;
+    return true;
+}
+
+static void* test_thread_index_thread_f(void* p_context)
+{
+    *((uint32_t*) p_context) = thread_index();
+
+    return NULL;
+}